@@ -0,0 +1,332 @@
+#include "alsa_backend.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <plog/Log.h>
+
+#include "core/globals.hpp"
+#include "util/exception.hpp"
+#include "util/sample-format.hpp"
+#include "util/timer.hpp"
+
+namespace otto::audio {
+
+  using util::SampleFormat;
+
+  namespace {
+
+    void check(int err, const char* what)
+    {
+      if (err < 0) throw util::exception("ALSA: {}: {}", what, snd_strerror(err));
+    }
+
+    /// The formats we can convert, in order of preference
+    constexpr std::pair<snd_pcm_format_t, SampleFormat> formats[] = {
+      {SND_PCM_FORMAT_FLOAT_LE, SampleFormat::Float32},
+      {SND_PCM_FORMAT_S24_3LE, SampleFormat::PCM24},
+      {SND_PCM_FORMAT_S16_LE, SampleFormat::PCM16},
+    };
+
+    /// Negotiate mmap access and the nearest configuration to the one asked
+    /// for, which is updated to what the PCM chose
+    void configure(snd_pcm_t* pcm, unsigned& channels, SampleFormat& format,
+      unsigned& rate, unsigned& period_size, unsigned& periods)
+    {
+      snd_pcm_hw_params_t* hw;
+      snd_pcm_hw_params_alloca(&hw);
+      check(snd_pcm_hw_params_any(pcm, hw), "no configurations");
+
+      snd_pcm_access_mask_t* access;
+      snd_pcm_access_mask_alloca(&access);
+      snd_pcm_access_mask_none(access);
+      snd_pcm_access_mask_set(access, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+      snd_pcm_access_mask_set(access, SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+      check(snd_pcm_hw_params_set_access_mask(pcm, hw, access), "mmap access");
+
+      auto found = std::find_if(std::begin(formats), std::end(formats),
+        [&] (auto&& f) { return snd_pcm_hw_params_set_format(pcm, hw, f.first) == 0; });
+      if (found == std::end(formats)) {
+        throw util::exception("ALSA: no supported sample format");
+      }
+      format = found->second;
+
+      snd_pcm_uframes_t period = period_size;
+      check(snd_pcm_hw_params_set_channels_near(pcm, hw, &channels), "channels");
+      check(snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, nullptr), "sample rate");
+      check(snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, nullptr), "period size");
+      check(snd_pcm_hw_params_set_periods_near(pcm, hw, &periods, nullptr), "periods");
+      check(snd_pcm_hw_params(pcm, hw), "hardware parameters");
+
+      snd_pcm_hw_params_get_channels(hw, &channels);
+      snd_pcm_hw_params_get_rate(hw, &rate, nullptr);
+      snd_pcm_hw_params_get_period_size(hw, &period, nullptr);
+      snd_pcm_hw_params_get_periods(hw, &periods, nullptr);
+      period_size = period;
+      snd_pcm_uframes_t buffer_size;
+      snd_pcm_hw_params_get_buffer_size(hw, &buffer_size);
+
+      snd_pcm_sw_params_t* sw;
+      snd_pcm_sw_params_alloca(&sw);
+      check(snd_pcm_sw_params_current(pcm, sw), "software parameters");
+      check(snd_pcm_sw_params_set_avail_min(pcm, sw, period), "wakeup size");
+      // Started explicitly, once the buffer is full
+      check(snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer_size), "start threshold");
+      check(snd_pcm_sw_params(pcm, sw), "software parameters");
+    }
+
+    std::byte* sample_at(const snd_pcm_channel_area_t& area, snd_pcm_uframes_t frame)
+    {
+      return static_cast<std::byte*>(area.addr) + (area.first + frame * area.step) / 8;
+    }
+
+    /// Whether the areas are plain interleaved frames, so they can be
+    /// converted in one go
+    bool is_interleaved(const snd_pcm_channel_area_t* areas, unsigned channels, SampleFormat f)
+    {
+      unsigned bits = util::sample_size(f) * 8;
+      for (unsigned c = 0; c < channels; c++) {
+        if (areas[c].addr != areas[0].addr
+          || areas[c].first != areas[0].first + c * bits
+          || areas[c].step != channels * bits) return false;
+      }
+      return true;
+    }
+
+    /// Write `n` interleaved frames from `src` to the mmap areas at `offset`
+    void write_areas(const snd_pcm_channel_area_t* areas, unsigned channels,
+      SampleFormat f, snd_pcm_uframes_t offset, const float* src, snd_pcm_uframes_t n)
+    {
+      if (is_interleaved(areas, channels, f)) {
+        util::encode_samples(f, src, sample_at(areas[0], offset), n * channels);
+        return;
+      }
+      for (unsigned c = 0; c < channels; c++) {
+        for (snd_pcm_uframes_t i = 0; i < n; i++) {
+          util::encode_samples(f, src + i * channels + c, sample_at(areas[c], offset + i), 1);
+        }
+      }
+    }
+
+    /// Read `n` interleaved frames from the mmap areas at `offset` to `dst`
+    void read_areas(const snd_pcm_channel_area_t* areas, unsigned channels,
+      SampleFormat f, snd_pcm_uframes_t offset, float* dst, snd_pcm_uframes_t n)
+    {
+      if (is_interleaved(areas, channels, f)) {
+        util::decode_samples(f, sample_at(areas[0], offset), dst, n * channels);
+        return;
+      }
+      for (unsigned c = 0; c < channels; c++) {
+        for (snd_pcm_uframes_t i = 0; i < n; i++) {
+          util::decode_samples(f, sample_at(areas[c], offset + i), dst + i * channels + c, 1);
+        }
+      }
+    }
+
+    /// Transfer `n` frames to or from the PCM through its mmap areas,
+    /// calling `f(areas, offset, done, frames)` for each contiguous run. It
+    /// takes two when the areas wrap around.
+    ///
+    /// \returns `0`, or a negative error code
+    template<typename F>
+    int transfer(snd_pcm_t* pcm, snd_pcm_uframes_t n, F&& f)
+    {
+      snd_pcm_uframes_t done = 0;
+      while (done < n) {
+        const snd_pcm_channel_area_t* areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t frames = n - done;
+        int err = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+        if (err < 0) return err;
+        f(areas, offset, done, frames);
+        auto committed = snd_pcm_mmap_commit(pcm, offset, frames);
+        if (committed < 0) return committed;
+        if (committed != snd_pcm_sframes_t(frames)) return -EPIPE;
+        done += frames;
+      }
+      return 0;
+    }
+  }
+
+  AlsaBackend::AlsaBackend(MainAudio& owner, Options opts)
+    : AudioBackend (owner), options (std::move(opts))
+  {
+    auto format = SampleFormat::Float32;
+    check(snd_pcm_open(&playback.pcm, options.playback.c_str(), SND_PCM_STREAM_PLAYBACK, 0),
+      options.playback.c_str());
+    playback.channels = 2;
+    try {
+      configure(playback.pcm, playback.channels, format,
+        options.samplerate, options.period_size, options.periods);
+    } catch (...) {
+      snd_pcm_close(playback.pcm);
+      throw;
+    }
+    playback.format = int(format);
+    playback.buffer.resize(options.period_size * playback.channels);
+    LOGI << "ALSA: playing to " << options.playback << " at " << options.samplerate
+         << "Hz, " << options.periods << " periods of " << options.period_size;
+
+    if (!options.capture.empty()) {
+      unsigned rate = options.samplerate;
+      unsigned period_size = options.period_size;
+      unsigned periods = options.periods;
+      try {
+        check(snd_pcm_open(&capture.pcm, options.capture.c_str(), SND_PCM_STREAM_CAPTURE, 0),
+          options.capture.c_str());
+        capture.channels = 1;
+        configure(capture.pcm, capture.channels, format, rate, period_size, periods);
+        if (rate != options.samplerate || period_size != options.period_size) {
+          throw util::exception("ALSA: capture can't run at {}Hz with periods of {}",
+            options.samplerate, options.period_size);
+        }
+        capture.format = int(format);
+        capture.buffer.resize(options.period_size * capture.channels);
+        linked = snd_pcm_link(playback.pcm, capture.pcm) == 0;
+      } catch (std::exception& e) {
+        LOGE << e.what() << ", recording silence";
+        if (capture.pcm) snd_pcm_close(capture.pcm);
+        capture.pcm = nullptr;
+      }
+    }
+    input.resize(options.period_size);
+
+    Globals::samplerate = options.samplerate;
+    Globals::events.samplerateChanged.runAll(options.samplerate);
+    Globals::events.bufferSizeChanged.runAll(options.period_size);
+  }
+
+  AlsaBackend::~AlsaBackend()
+  {
+    stop();
+    if (capture.pcm) snd_pcm_close(capture.pcm);
+    snd_pcm_close(playback.pcm);
+  }
+
+  void AlsaBackend::start()
+  {
+    if (thread.joinable()) return;
+    keep_running = true;
+    thread = std::thread([this] { main_routine(); });
+  }
+
+  void AlsaBackend::stop()
+  {
+    keep_running = false;
+    if (thread.joinable()) thread.join();
+  }
+
+  void AlsaBackend::main_routine()
+  {
+    sched_param param = {};
+    param.sched_priority = options.priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+      LOGW << "ALSA: could not run the audio thread with SCHED_FIFO";
+    }
+
+    bool ok = start_pcms();
+    while (ok && keep_running) {
+      int err = snd_pcm_wait(playback.pcm, 100);
+      if (err == 0) continue;
+      auto avail = err < 0 ? err : snd_pcm_avail_update(playback.pcm);
+      if (avail < 0) {
+        ok = recover(avail);
+      } else if (avail >= snd_pcm_sframes_t(options.period_size)) {
+        ok = cycle();
+      }
+    }
+    snd_pcm_drop(playback.pcm);
+    if (capture.pcm && !linked) snd_pcm_drop(capture.pcm);
+    if (!ok) {
+      LOGE << "ALSA: giving up on " << options.playback;
+      Globals::exit();
+    }
+  }
+
+  bool AlsaBackend::start_pcms()
+  {
+    auto silence = [&] (auto* areas, auto offset, auto, auto frames) {
+      std::fill(playback.buffer.begin(), playback.buffer.end(), 0.f);
+      for (snd_pcm_uframes_t i = 0; i < frames; i += options.period_size) {
+        auto n = std::min<snd_pcm_uframes_t>(frames - i, options.period_size);
+        write_areas(areas, playback.channels, SampleFormat(playback.format),
+          offset + i, playback.buffer.data(), n);
+      }
+    };
+    int err = transfer(playback.pcm, options.period_size * options.periods, silence);
+    if (err >= 0) err = snd_pcm_start(playback.pcm);
+    if (err >= 0 && capture.pcm && !linked) err = snd_pcm_start(capture.pcm);
+    if (err < 0) {
+      LOGE << "ALSA: could not start: " << snd_strerror(err);
+      return false;
+    }
+    return true;
+  }
+
+  bool AlsaBackend::recover(int err)
+  {
+    _xruns++;
+    LOGW << "ALSA: " << snd_strerror(err);
+    snd_pcm_drop(playback.pcm);
+    if (capture.pcm && !linked) snd_pcm_drop(capture.pcm);
+    err = snd_pcm_prepare(playback.pcm);
+    if (err >= 0 && capture.pcm && !linked) err = snd_pcm_prepare(capture.pcm);
+    if (err < 0) {
+      LOGE << "ALSA: could not recover: " << snd_strerror(err);
+      return false;
+    }
+    return start_pcms();
+  }
+
+  bool AlsaBackend::cycle()
+  {
+    static auto& timer = util::timer::dispatcher.timer("Audio Frame time");
+    if (timer.running) timer.stopTimer();
+    timer.startTimer();
+
+    long nframes = options.period_size;
+
+    std::fill(input.begin(), input.end(), 0.f);
+    if (capture.pcm) {
+      auto avail = snd_pcm_avail_update(capture.pcm);
+      if (avail < 0) return recover(avail);
+      if (avail >= nframes) {
+        int err = transfer(capture.pcm, nframes, [&] (auto* areas, auto offset, auto done, auto frames) {
+            read_areas(areas, capture.channels, SampleFormat(capture.format),
+              offset, capture.buffer.data() + done * capture.channels, frames);
+          });
+        if (err < 0) return recover(err);
+        for (int i = 0; i < nframes; i++) input[i] = capture.buffer[i * capture.channels];
+      }
+    }
+
+    const float* out = playback.buffer.data();
+    std::fill(playback.buffer.begin(), playback.buffer.end(), 0.f);
+    if (owner.is_processing()) {
+      auto out_data = owner.process({{{input.data()}, nframes}, {}, nframes});
+      LOGW_IF(out_data.nframes != nframes) << "Frames went missing!";
+      auto l = out_data.audio[0];
+      auto r = out_data.audio[1];
+      for (int i = 0; i < nframes; i++) {
+        if (playback.channels == 1) {
+          playback.buffer[i] = (l[i] + r[i]) / 2.f;
+        } else {
+          playback.buffer[i * playback.channels] = l[i];
+          playback.buffer[i * playback.channels + 1] = r[i];
+        }
+      }
+    }
+
+    int err = transfer(playback.pcm, nframes, [&] (auto* areas, auto offset, auto done, auto frames) {
+        write_areas(areas, playback.channels, SampleFormat(playback.format),
+          offset, out + done * playback.channels, frames);
+      });
+    if (err < 0) return recover(err);
+    _cycles++;
+    return true;
+  }
+
+}
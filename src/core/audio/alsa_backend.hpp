@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/audio/main_audio.hpp"
+
+typedef struct _snd_pcm snd_pcm_t;
+
+namespace otto::audio {
+
+  /// Talks to an ALSA PCM directly, without a JACK server in between
+  ///
+  /// Audio goes through the mmap areas of the PCM, on a thread of its own
+  /// running with `SCHED_FIFO`. The sample rate and period size are
+  /// negotiated from the <Options> when the backend is made, and reported
+  /// through `Globals::events` like the JACK backend does. Each period is one
+  /// call to <MainAudio::process>. There is no MIDI.
+  ///
+  /// Any PCM name works, so the `null` plugin, or the `file` plugin on top of
+  /// it, can stand in for a sound card.
+  class AlsaBackend final : public AudioBackend {
+  public:
+    struct Options {
+      /// PCM to play to
+      std::string playback = "default";
+      /// PCM to record the external input from. Empty for silence.
+      std::string capture = "";
+      unsigned samplerate = 44100;
+      /// Frames per period. Cards may choose one near it.
+      unsigned period_size = 256;
+      /// Periods in the buffer of the PCM, which sets the latency
+      unsigned periods = 2;
+      /// `SCHED_FIFO` priority of the audio thread
+      int priority = 70;
+    };
+
+    /// Open and configure the PCMs
+    ///
+    /// \throws <util::exception> if the playback PCM can't be used. A capture
+    /// PCM that doesn't agree with it is left out.
+    AlsaBackend(MainAudio&, Options);
+    ~AlsaBackend();
+
+    /// Start the audio thread
+    void start() override;
+    /// Stop the audio thread
+    void stop() override;
+
+    /// The negotiated sample rate
+    unsigned samplerate() const { return options.samplerate; }
+    /// The negotiated period size
+    unsigned period_size() const { return options.period_size; }
+
+    /// Periods processed so far
+    long cycles() const { return _cycles; }
+    /// Times the PCM ran dry or overflowed
+    long xruns() const { return _xruns; }
+
+  private:
+    /// A PCM, and how its samples are laid out
+    struct Stream {
+      snd_pcm_t* pcm = nullptr;
+      unsigned channels = 0;
+      /// An <util::SampleFormat>
+      int format = 0;
+      /// Interleaved samples of one period
+      std::vector<float> buffer;
+    };
+
+    void main_routine();
+    /// Fill the playback buffer with silence, and start both PCMs
+    bool start_pcms();
+    /// Recover from `err`, and start again
+    bool recover(int err);
+    /// Process one period
+    bool cycle();
+
+    Options options;
+    Stream playback;
+    Stream capture;
+    bool linked = false;
+    std::vector<float> input;
+
+    std::thread thread;
+    std::atomic_bool keep_running {true};
+    std::atomic<long> _cycles {0};
+    std::atomic<long> _xruns {0};
+  };
+
+}
@@ -171,14 +171,24 @@ namespace otto::audio {
   ///
   template<int Cin, int Cout>
   class FaustWrapper {
-    // Needed to convert from faust's deinterleaved data to interleaved
-    audio::RTBuffer<float, std::max(Cin, Cout)> faustbuf;
+    // Faust reads planar channels, so strided input is copied here first
+    audio::ProcessBuffer<Cin> faustbuf;
   protected:
 
     audio::ProcessBuffer<Cout> proc_buf;
 
     FaustOptions opts;
 
+    /// Process `data` into `out`, which has room for `data.nframes` frames
+    void process_into(audio::ProcessData<Cin> data, audio::AudioView<Cout> out) {
+      auto in = data.audio;
+      if (!in.is_contiguous()) {
+        for (int c = 0; c < Cin; c++) data.audio[c].copy_to(faustbuf[c].data());
+        in = faustbuf.view(data.nframes);
+      }
+      fDSP->compute(data.nframes, in.data(), out.data());
+    }
+
   public:
 
     std::unique_ptr<dsp> fDSP;
@@ -199,29 +209,10 @@ namespace otto::audio {
 
     virtual ~FaustWrapper() {}
 
+    /// Faust reads and writes the channels in place, so this only copies
+    /// input that isn't planar
     audio::ProcessData<Cout> process(audio::ProcessData<Cin> data) {
-      // Convert interleaved to deinterleaved and back
-      auto size = data.nframes;
-      auto raw_pb = reinterpret_cast<float*>(proc_buf.data());
-      auto in_bufs = util::generate_sequence<Cin>(
-        [&] (int n) {
-          return raw_pb + n * size;
-        });
-      for (int i = 0; i < Cin; i++) {
-        for (int j = 0; j < size; j++) {
-          in_bufs[i][j] = data.audio[j][i];
-        }
-      }
-      auto out_bufs = util::generate_sequence<Cout>(
-        [&] (int n) {
-          return faustbuf.data() + n * size;
-        });
-      fDSP->compute(data.nframes, in_bufs.data(), out_bufs.data());
-      for (int i = 0; i < Cin; i++) {
-        for (int j = 0; j < size; j++) {
-          proc_buf[j][i] = out_bufs[i][j];
-        }
-      }
+      process_into(data, proc_buf.view(data.nframes));
       return data.redirect(proc_buf);
     }
 
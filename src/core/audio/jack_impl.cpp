@@ -28,15 +28,13 @@ namespace otto::audio {
     LOGI << "JACK shut down, exiting";
   }
 
-  class MainAudio::Impl {
+  class JackBackend final : public AudioBackend {
   public:
 
     using AudioSample = jack_default_audio_sample_t;
     const size_t sampleSize = sizeof(AudioSample);
     const std::string clientName = "OTTO";
 
-    MainAudio& owner;
-
     struct {
       jack_port_t *outL;
       jack_port_t *outR;
@@ -50,15 +48,16 @@ namespace otto::audio {
     jack_client_t *client;
     jack_status_t jackStatus;
 
-    std::vector<midi::AnyMidiEvent> midi_buf;
+    midi::MidiBuffer midi_buf;
+    int midi_dropped = 0;
 
     enum class PortType {
       Audio,
       Midi
     };
 
-    Impl(MainAudio& owner)
-      : owner (owner)
+    JackBackend(MainAudio& owner)
+      : AudioBackend (owner)
     {
       jack_set_error_function(jackError);
       jack_set_info_function(jackLogInfo);
@@ -76,19 +75,19 @@ namespace otto::audio {
 
       jack_set_process_callback(client,
         [](jack_nframes_t nframes, void* arg) {
-          (static_cast<Impl*>(arg))->process(nframes);
+          (static_cast<JackBackend*>(arg))->process(nframes);
           return 0;
         }, this);
 
       jack_set_sample_rate_callback(client,
         [](jack_nframes_t nframes, void* arg) {
-          (static_cast<Impl*>(arg))->samplerateCallback(nframes);
+          (static_cast<JackBackend*>(arg))->samplerateCallback(nframes);
           return 0;
         }, this);
 
       jack_set_buffer_size_callback(client,
         [](jack_nframes_t nframes, void* arg) {
-          (static_cast<Impl*>(arg))->buffersizeCallback(nframes);
+          (static_cast<JackBackend*>(arg))->buffersizeCallback(nframes);
           return 0;
         }, this);
 
@@ -96,6 +95,19 @@ namespace otto::audio {
 
       bufferSize = jack_get_buffer_size(client);
 
+      LOGI << "Initialized JackAudio";
+    }
+
+    ~JackBackend()
+    {
+      LOGI << "Closing Jack client";
+      jack_client_close(client);
+      Globals::exit();
+    };
+
+    void start() override
+    {
+      if (client == nullptr) return;
       if (jack_activate(client)) {
         LOGF << "Cannot activate JACK client";
         Globals::exit();
@@ -103,16 +115,12 @@ namespace otto::audio {
       }
 
       setupPorts();
-
-      LOGI << "Initialized JackAudio";
     }
 
-    ~Impl()
+    void stop() override
     {
-      LOGI << "Closing Jack client";
-      jack_client_close(client);
-      Globals::exit();
-    };
+      if (client != nullptr) jack_deactivate(client);
+    }
 
     void setupPorts()
     {
@@ -223,9 +231,9 @@ namespace otto::audio {
 
     void process(unsigned nframes)
     {
-      if (!(owner.do_process && Globals::running())) return;
+      if (!owner.is_processing()) return;
 
-      static auto& timer = util::timer::dispatcher.timers["Audio Frame time"];
+      static auto& timer = util::timer::dispatcher.timer("Audio Frame time");
       if (timer.running) timer.stopTimer();
       timer.startTimer();
 
@@ -242,67 +250,33 @@ namespace otto::audio {
 
       jack_midi_event_t event;
       for (int i = 0; i < nevents; i++) {
-        using namespace midi;
-
         jack_midi_event_get(&event, midiBuf, i);
-        midi::MidiEvent mEvent;
-
-        mEvent.channel = event.buffer[0] & 0b00001111;
-        mEvent.data = event.buffer + 1;
-        mEvent.time = event.time;
-
-        auto type = MidiEvent::Type(event.buffer[0] >> 4);
-        switch (type) {
-        case MidiEvent::Type::NoteOff:
-          mEvent.type = MidiEvent::Type::NoteOff;
-          midi_buf.emplace_back(NoteOffEvent(mEvent));
-          break;
-        case MidiEvent::Type::NoteOn:
-          mEvent.type = MidiEvent::Type::NoteOn;
-          midi_buf.emplace_back(NoteOnEvent(mEvent));
-          break;
-        case MidiEvent::Type::ControlChange:
-          mEvent.type = MidiEvent::Type::ControlChange;
-          midi_buf.emplace_back(ControlChangeEvent(mEvent));
-          break;
+        midi::MidiEvent e;
+        if (event.size >= 3 && midi::MidiEvent::parse(event.buffer, event.time, e)) {
+          midi_buf.push(e);
         }
       }
+      LOGW_IF(midi_buf.dropped() != midi_dropped) << "MIDI events were dropped";
+      midi_dropped = midi_buf.dropped();
 
       float* outLData = (float*) jack_port_get_buffer(ports.outL, nframes);
       float* outRData = (float*) jack_port_get_buffer(ports.outR, nframes);
       float* inData = (float*) jack_port_get_buffer(ports.input, nframes);
 
-      auto out_data = owner.process({
-          {reinterpret_cast<util::audio::AudioFrame<1>*>(inData), nframes},
-          {midi_buf},
-            nframes});
+      auto out_data = owner.process({{{inData}, nframes}, {midi_buf.data(), midi_buf.size()}, nframes});
 
       LOGW_IF(out_data.nframes != nframes) << "Frames went missing!";
 
-      // Separate channels
-      for (int i = 0; i < nframes; i++)
-      {
-        outLData[i] = out_data.audio[i][0];
-        outRData[i] = out_data.audio[i][1];
-      }
+      out_data.audio[0].copy_to(outLData);
+      out_data.audio[1].copy_to(outRData);
     }
 
   };
 
 
-  /*
-   * MainAudio members
-   */
-
-  MainAudio::MainAudio() {}
-  MainAudio::~MainAudio() {}
-
-  void MainAudio::init() {
-    impl = std::make_unique<Impl>(*this);
-  }
-
-  void MainAudio::exit() {
-    impl.reset();
+  std::unique_ptr<AudioBackend> jack_backend(MainAudio& owner)
+  {
+    return std::make_unique<JackBackend>(owner);
   }
 
 
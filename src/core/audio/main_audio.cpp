@@ -1,54 +1,104 @@
 #include "main_audio.hpp"
+
+#include <thread>
+
+#include <plog/Log.h>
+
 #include "core/globals.hpp"
 #include "util/algorithm.hpp"
 
 namespace otto::audio {
 
+  MainAudio::MainAudio() {}
+  MainAudio::~MainAudio() {}
+
+  void MainAudio::init()
+  {
+    auto opts = worker_options;
+    if (std::thread::hardware_concurrency() < 2) opts.workers = 0;
+    workers = std::make_unique<util::worker_pool>(opts);
+    LOGI << "Audio graph runs on " << workers->workers() + 1 << " threads";
+    backend = backend_factory(*this);
+  }
+
+  void MainAudio::exit()
+  {
+    if (backend) backend->stop();
+    backend.reset();
+    workers.reset();
+  }
+
+  void MainAudio::start_processing()
+  {
+    do_process = true;
+    backend->start();
+  }
+
+  bool MainAudio::is_processing() const
+  {
+    return do_process && Globals::running();
+  }
+
   ProcessData<2> MainAudio::process(ProcessData<1> external_in)
   {
     using Selection = modules::InputSelector::Selection;
 
     // Main processor function
     auto midi_in = external_in.midi_only();
-    auto playback_out = Globals::tapedeck.process_playback(midi_in);
-    auto mixer_out = Globals::mixer.process_tracks(playback_out);
-
-    auto record_in = [&] () {
-      switch (Globals::selector.props.input.get()) {
-      case Selection::Internal:
-        return Globals::effect.process(Globals::synth.process(midi_in));
-      case Selection::External:
-        return Globals::effect.process(external_in);
-      case Selection::TrackFB:
-        util::transform(playback_out, audiobuf1.begin(),
-          [track = Globals::selector.props.track.get()] (auto&& a) {
-            return std::array{a[track]};
-          });
-        return external_in.redirect(audiobuf1);
-      case Selection::MasterFB:
-        break;
-      }
-      return audio::ProcessData<1>{{nullptr},{nullptr}};
-    }();
+    auto input = Globals::selector.props.input.get();
+
+    // Tape playback and the engines don't depend on each other until the
+    // mixer, so they run in parallel when the recorded input doesn't come
+    // from the tape itself
+    ProcessData<tape_buffer::tracks> playback_out;
+    ProcessData<2> mixer_out;
+    auto playback = [&] {
+      playback_out = Globals::tapedeck.process_playback(midi_in);
+      mixer_out = Globals::mixer.process_tracks(playback_out);
+    };
 
-    if (Globals::selector.props.input != Selection::MasterFB) {
+    ProcessData<1> record_in;
+    switch (input) {
+    case Selection::Internal:
+      workers->run(playback, [&] {
+        record_in = Globals::effect.process(Globals::synth.process(midi_in));
+      });
+      break;
+    case Selection::External:
+      workers->run(playback, [&] {
+        record_in = Globals::effect.process(external_in);
+      });
+      break;
+    case Selection::TrackFB:
+      playback();
+      record_in = external_in.redirect(
+        playback_out.audio.channel(Globals::selector.props.track.get()));
+      break;
+    case Selection::MasterFB:
+      playback();
+      break;
+    }
+
+    if (input != Selection::MasterFB) {
       Globals::mixer.process_engine(record_in);
     }
 
     // mixer_out = Globals::master_fx.process(mixer_out);
 
-    if (Globals::selector.props.input == Selection::MasterFB) {
-      util::transform(mixer_out, audiobuf1.begin(),
-        [] (auto&& a) { return std::array{a[0] + a[1]}; });
-      record_in = {{audiobuf1.data(), external_in.nframes}, external_in.midi};
+    if (input == Selection::MasterFB) {
+      auto sum = audiobuf1[0];
+      for (int i = 0; i < mixer_out.nframes; i++) {
+        sum[i] = mixer_out.audio[0][i] + mixer_out.audio[1][i];
+      }
+      record_in = external_in.redirect(audiobuf1);
     }
 
     Globals::tapedeck.process_record(record_in);
 
     IF_DEBUG({
         float max;
-        for (auto& frm : mixer_out) {
-          float sum = frm[0] + frm[1];
+        for (int i = 0; i < mixer_out.nframes; i++) {
+          float sum = mixer_out.audio[0][i] + mixer_out.audio[1][i];
           if (std::abs(sum - max) > 0) {
             max = sum;
           }
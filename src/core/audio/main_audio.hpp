@@ -2,19 +2,55 @@
 
 #include <memory>
 #include <atomic>
+#include <functional>
 
 #include "core/audio/processor.hpp"
 #include "debug/ui.hpp"
+#include "util/worker-pool.hpp"
 
 namespace otto::audio {
 
+  class MainAudio;
+
+  /// Connects <MainAudio> to something that takes its audio: the sound
+  /// system, or a file
+  ///
+  /// A backend is opened and configured by its constructor, and calls
+  /// <MainAudio::process> once per buffer between <start> and <stop>, from
+  /// whatever thread it likes, while <MainAudio::is_processing>. It reports
+  /// its sample rate and buffer size through `Globals::events` before the
+  /// first buffer and whenever they change.
+  class AudioBackend {
+  public:
+    AudioBackend(MainAudio& owner) : owner (owner) {}
+    virtual ~AudioBackend() = default;
+
+    /// Start calling <MainAudio::process>
+    ///
+    /// Backends with a thread of their own return right away. Others
+    /// process on the calling thread, and return when they are done.
+    virtual void start() = 0;
+
+    /// Stop calling <MainAudio::process>, and wait for the last call to
+    /// return
+    virtual void stop() = 0;
+
+  protected:
+    MainAudio& owner;
+  };
+
+  /// Makes the backend for <MainAudio::init>
+  using AudioBackendFactory = std::function<std::unique_ptr<AudioBackend>(MainAudio&)>;
+
+  /// Connect to a JACK server, see `jack_impl.cpp`
+  std::unique_ptr<AudioBackend> jack_backend(MainAudio&);
+
   /// Class that interacts with OS audio/midi framework, and delegates
   /// processing to the modules.
   class MainAudio {
 
-    // PIMPL - define in individual implementation files
-    class Impl;
-    std::unique_ptr<Impl> impl;
+    std::unique_ptr<AudioBackend> backend;
+    std::unique_ptr<util::worker_pool> workers;
     std::atomic_bool do_process {false};
 
     struct DbgInfo : debug::Info {
@@ -29,16 +65,29 @@ namespace otto::audio {
 
   public:
 
-    // A unique_ptr pimpl requires externally defined ctors and dtors
     MainAudio();
     ~MainAudio();
 
     // Input channel is external audio in. Also should hold MIDI from system
     ProcessData<2> process(ProcessData<1>);
 
+    /// Makes the backend in <init>. Replace it before then to use another.
+    AudioBackendFactory backend_factory = jack_backend;
+
+    /// Threads for <process> to render tape playback and the engines on at
+    /// the same time. Set before <init>. With no workers, or on one core,
+    /// everything runs on the backend's thread.
+    util::worker_pool::Options worker_options = {1, 70};
+
+    /// Make the backend
     void init();
+    /// Stop and close the backend
     void exit();
-    void start_processing() { do_process = true; }
+    /// Start the backend, and let it call <process>
+    void start_processing();
+
+    /// Whether the backend should call <process>
+    bool is_processing() const;
 
   private:
     ProcessBuffer<1> audiobuf1;
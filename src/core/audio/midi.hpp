@@ -1,53 +1,169 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cmath>
-#include <variant.hpp>
-
-#include "util/poly-ptr.hpp"
+#include <cstdint>
+#include <type_traits>
 
 namespace otto::midi {
 
+  /// A MIDI channel message, with the frame it happens at in the current
+  /// buffer
+  ///
+  /// Events are 8 bytes of plain data, so buffers of them can be copied and
+  /// sliced freely on the audio thread.
   struct MidiEvent {
 
     using byte = unsigned char;
 
-    enum class Type {
+    enum class Type : std::uint8_t {
       NoteOff       = 0b1000,
       NoteOn        = 0b1001,
       ControlChange = 0b1011,
     };
 
+    /// Frame of the buffer the event belongs to
+    std::uint32_t time;
     Type type;
+    std::uint8_t channel;
+    std::array<byte, 2> data;
+
+    /// Read the message in `msg`, which is at least 3 bytes
+    ///
+    /// A note on with velocity 0 is read as the note off it means.
+    ///
+    /// \returns `false` if it isn't a message we handle
+    static bool parse(const byte* msg, std::uint32_t time, MidiEvent& out)
+    {
+      auto type = Type(msg[0] >> 4);
+      switch (type) {
+      case Type::NoteOn:
+        if (msg[2] == 0) type = Type::NoteOff;
+        break;
+      case Type::NoteOff:
+      case Type::ControlChange:
+        break;
+      default:
+        return false;
+      }
+      out = make(time, type, msg[0] & 0b00001111, msg[1], msg[2]);
+      return true;
+    }
 
-    byte *data;
-    int channel;
-    int time;
+    static MidiEvent note_on(std::uint32_t time, int channel, int key, int velocity)
+    {
+      return make(time, Type::NoteOn, channel, key, velocity);
+    }
 
-  };
+    static MidiEvent note_off(std::uint32_t time, int channel, int key, int velocity = 0)
+    {
+      return make(time, Type::NoteOff, channel, key, velocity);
+    }
 
-  struct NoteOnEvent : public MidiEvent {
-    int key = data[0];
-    int velocity = data[1];
+    static MidiEvent control_change(std::uint32_t time, int channel, int controller, int value)
+    {
+      return make(time, Type::ControlChange, channel, controller, value);
+    }
 
-    NoteOnEvent(const MidiEvent& event) : MidiEvent(event) {};
-  };
+    bool is_note_on() const { return type == Type::NoteOn; }
+    bool is_note_off() const { return type == Type::NoteOff; }
+    bool is_control_change() const { return type == Type::ControlChange; }
+
+    /// Note events
+    int key() const { return data[0]; }
+    int velocity() const { return data[1]; }
 
-  struct NoteOffEvent : public MidiEvent {
-    int key = data[0];
-    int velocity = data[1];
+    /// Control change events
+    int controller() const { return data[0]; }
+    int value() const { return data[1]; }
 
-    NoteOffEvent(const MidiEvent& event) : MidiEvent(event) {};
+  private:
+    static MidiEvent make(std::uint32_t time, Type type, int channel, int d0, int d1)
+    {
+      return {time, type, std::uint8_t(channel), {byte(d0), byte(d1)}};
+    }
   };
 
-  struct ControlChangeEvent : public MidiEvent {
-    int controler = data[0];
-    int value = data[1];
+  static_assert(sizeof(MidiEvent) == 8 && std::is_trivially_copyable_v<MidiEvent>,
+    "MIDI events are copied around on the audio thread");
+
+  /// A fixed number of <MidiEvent>s, in time order
+  ///
+  /// Storage is part of the buffer, so filling it never allocates. Events
+  /// that don't fit are dropped.
+  class MidiBuffer {
+  public:
+    static constexpr int capacity = 512;
+
+    /// Add an event, keeping the buffer in time order
+    ///
+    /// \returns `false` if the buffer was full
+    bool push(const MidiEvent& e)
+    {
+      if (_size == capacity) {
+        _dropped++;
+        return false;
+      }
+      // Sources send events in order, so this rarely moves any
+      auto pos = std::upper_bound(begin(), end(), e.time,
+        [] (std::uint32_t t, const MidiEvent& o) { return t < o.time; });
+      std::copy_backward(pos, end(), end() + 1);
+      *pos = e;
+      _size++;
+      return true;
+    }
 
-    ControlChangeEvent(const MidiEvent& event) : MidiEvent(event) {};
+    void clear() { _size = 0; }
+
+    MidiEvent* begin() { return events.data(); }
+    MidiEvent* end() { return events.data() + _size; }
+    const MidiEvent* begin() const { return events.data(); }
+    const MidiEvent* end() const { return events.data() + _size; }
+    MidiEvent* data() { return events.data(); }
+    const MidiEvent* data() const { return events.data(); }
+
+    int size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    /// Events dropped since the buffer was made
+    int dropped() const { return _dropped; }
+
+  private:
+    std::array<MidiEvent, capacity> events;
+    int _size = 0;
+    int _dropped = 0;
   };
 
-  // TODO: Replace with variant AnyMidiEvent
-  using AnyMidiEvent = mpark::variant<NoteOnEvent, NoteOffEvent, ControlChangeEvent>;
+  /// Split a buffer of `nframes` frames at the time of each event
+  ///
+  /// Calls `render(from, n)` for the frames between events, and
+  /// `on_event(event)` at the frame of each, so processors can respond on
+  /// the exact frame without another pass over the events. Events must be
+  /// in time order. Events past the buffer are handled at its end.
+  template<typename Events, typename OnEvent, typename Render>
+  void split_block(const Events& events, long nframes, OnEvent&& on_event, Render&& render)
+  {
+    long pos = 0;
+    for (auto&& e : events) {
+      long time = std::min<long>(e.time, nframes);
+      if (time > pos) {
+        render(pos, time - pos);
+        pos = time;
+      }
+      on_event(e);
+    }
+    if (pos < nframes) render(pos, nframes - pos);
+  }
+
+  /// Call `f(event)` for each event of `type` in `events`
+  template<typename Events, typename F>
+  void for_each(const Events& events, MidiEvent::Type type, F&& f)
+  {
+    for (auto&& e : events) {
+      if (e.type == type) f(e);
+    }
+  }
 
   inline float freqTable[128];
 
@@ -0,0 +1,61 @@
+#include "midi_script.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "util/exception.hpp"
+
+namespace otto::midi {
+
+  MidiScript::MidiScript(std::istream& in)
+  {
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream words {line};
+      std::string type;
+      Event e;
+      auto& event = e.event;
+      if (!(words >> e.frame)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        throw util::exception("MIDI script line {}: expected a frame", number);
+      }
+      int channel, d0, d1;
+      if (!(words >> type >> channel >> d0 >> d1)) {
+        throw util::exception("MIDI script line {}: expected type, channel and data", number);
+      }
+      if (type == "on") {
+        event.type = MidiEvent::Type::NoteOn;
+      } else if (type == "off") {
+        event.type = MidiEvent::Type::NoteOff;
+      } else if (type == "cc") {
+        event.type = MidiEvent::Type::ControlChange;
+      } else {
+        throw util::exception("MIDI script line {}: unknown event type '{}'", number, type);
+      }
+      if (e.frame < 0 || channel < 0 || channel > 15
+        || d0 < 0 || d0 > 127 || d1 < 0 || d1 > 127) {
+        throw util::exception("MIDI script line {}: value out of range", number);
+      }
+      event.time = 0;
+      event.channel = channel;
+      event.data = {MidiEvent::byte(d0), MidiEvent::byte(d1)};
+      _events.push_back(e);
+    }
+    std::stable_sort(_events.begin(), _events.end(),
+      [] (auto&& a, auto&& b) { return a.frame < b.frame; });
+  }
+
+  void MidiScript::events_in(long from, long nframes, MidiBuffer& out) const
+  {
+    auto first = std::lower_bound(_events.begin(), _events.end(), from,
+      [] (auto&& e, long f) { return e.frame < f; });
+    for (auto e = first; e != _events.end() && e->frame < from + nframes; e++) {
+      auto event = e->event;
+      event.time = e->frame - from;
+      out.push(event);
+    }
+  }
+
+}
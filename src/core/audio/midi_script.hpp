@@ -0,0 +1,49 @@
+#pragma once
+
+#include <istream>
+#include <vector>
+
+#include "core/audio/midi.hpp"
+
+namespace otto::midi {
+
+  /// MIDI events at fixed frames, read from a text script
+  ///
+  /// Each line holds the frame of an event, its type, channel and data bytes:
+  ///
+  /// ```
+  /// # frame type channel data...
+  /// 0      on   0  60 100
+  /// 22050  off  0  60 0
+  /// 44100  cc   0  7  90
+  /// ```
+  ///
+  /// Types are `on`, `off` and `cc`. Everything after a `#` is a comment.
+  /// Events don't have to be in order.
+  class MidiScript {
+  public:
+    struct Event {
+      long frame;
+      /// The event, with its time left at `0`
+      MidiEvent event;
+    };
+
+    MidiScript() = default;
+
+    /// Read a script
+    ///
+    /// \throws <util::exception> naming the line of the first malformed event
+    explicit MidiScript(std::istream&);
+
+    /// Add the events in frames `[from, from + nframes)` to `out`, timed
+    /// from `from`
+    void events_in(long from, long nframes, MidiBuffer& out) const;
+
+    /// All events, by frame
+    const std::vector<Event>& events() const { return _events; }
+
+  private:
+    std::vector<Event> _events;
+  };
+
+}
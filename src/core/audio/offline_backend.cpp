@@ -0,0 +1,100 @@
+#include "offline_backend.hpp"
+
+#include <fstream>
+#include <vector>
+
+#include <plog/Log.h>
+
+#include "core/globals.hpp"
+#include "util/exception.hpp"
+
+namespace otto::audio {
+
+  using Clock = std::chrono::steady_clock;
+
+  OfflineBackend::OfflineBackend(MainAudio& owner, Options opts)
+    : AudioBackend (owner), options (std::move(opts))
+  {
+    if (!options.midi.empty()) {
+      std::ifstream in {options.midi};
+      if (!in) throw util::exception("Can't read MIDI script {}", options.midi.string());
+      script = midi::MidiScript(in);
+    }
+
+    if (!options.input.empty()) {
+      if (!filesystem::exists(options.input)) {
+        throw util::exception("No input file {}", options.input.string());
+      }
+      input.open(options.input);
+      LOGW_IF(input.info.samplerate != options.samplerate)
+        << "Input is at " << input.info.samplerate << "Hz, rendering at "
+        << options.samplerate << "Hz without resampling";
+    }
+
+    length = options.frames;
+    if (length <= 0 && input.is_open()) {
+      length = input.length() / input.info.channels;
+    } else if (length <= 0 && !script.events().empty()) {
+      length = script.events().back().frame + options.samplerate;
+    }
+
+    filesystem::remove(options.output);
+    output.info.channels = 2;
+    output.info.samplerate = options.samplerate;
+    output.open(options.output);
+
+    Globals::samplerate = options.samplerate;
+    Globals::events.samplerateChanged.runAll(options.samplerate);
+    Globals::events.bufferSizeChanged.runAll(options.buffer_size);
+  }
+
+  void OfflineBackend::start()
+  {
+    int bs = options.buffer_size;
+    int channels = input.is_open() ? input.info.channels : 1;
+    std::vector<float> interleaved(bs * channels);
+    std::vector<float> in(bs);
+    std::vector<float> out_frames(bs * 2);
+    midi::MidiBuffer midi_buf;
+    auto period = std::chrono::nanoseconds(std::chrono::seconds(bs)) / options.samplerate;
+
+    auto start = Clock::now();
+    for (long pos = 0; pos < length && owner.is_processing(); pos += bs) {
+      long nframes = std::min<long>(bs, length - pos);
+
+      std::fill(in.begin(), in.end(), 0.f);
+      if (input.is_open()) {
+        input.read_samples(interleaved.data(), nframes * channels);
+        for (int i = 0; i < nframes; i++) in[i] = interleaved[i * channels];
+      }
+      midi_buf.clear();
+      script.events_in(pos, nframes, midi_buf);
+      if (options.before_cycle) options.before_cycle();
+
+      auto cycle_start = Clock::now();
+      auto out = owner.process({{{in.data()}, nframes}, {midi_buf.data(), midi_buf.size()}, nframes});
+      auto cycle_time = Clock::now() - cycle_start;
+
+      _stats.cycle_time.record(cycle_time);
+      if (cycle_time > period) _stats.overruns++;
+      _stats.cycles++;
+      _stats.frames += nframes;
+
+      LOGW_IF(out.nframes != nframes) << "Frames went missing!";
+      for (int i = 0; i < nframes; i++) {
+        out_frames[2 * i] = out.audio[0][i];
+        out_frames[2 * i + 1] = out.audio[1][i];
+      }
+      output.write_samples(out_frames.data(), nframes * 2);
+    }
+    _stats.elapsed = Clock::now() - start;
+    output.close();
+  }
+
+  double OfflineBackend::Stats::realtime_factor(int samplerate) const
+  {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    return seconds == 0 ? 0 : frames / double(samplerate) / seconds;
+  }
+
+}
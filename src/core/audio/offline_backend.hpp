@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <filesystem.hpp>
+
+#include "core/audio/main_audio.hpp"
+#include "core/audio/midi_script.hpp"
+#include "util/histogram.hpp"
+#include "util/soundfile.hpp"
+
+namespace otto::audio {
+
+  /// Renders to a wave file instead of the sound system
+  ///
+  /// Audio comes from a wave file and MIDI from a <midi::MidiScript>, and
+  /// buffers are processed back to back on the calling thread, as fast as
+  /// they go. Since the output doesn't depend on timing, this makes renders
+  /// comparable between changes, and shows what each buffer costs.
+  class OfflineBackend final : public AudioBackend {
+  public:
+    struct Options {
+      /// Wave file with the external input. Only its first channel is used.
+      /// Empty for silence.
+      filesystem::path input;
+      /// <midi::MidiScript> to play. Empty for none.
+      filesystem::path midi;
+      /// Where to write the stereo output
+      filesystem::path output;
+      int buffer_size = 256;
+      int samplerate = 44100;
+      /// Frames to render. `0` renders the input, or one second past the
+      /// last MIDI event if there is no input.
+      long frames = 0;
+      /// Called before each buffer, to let background threads catch up, so
+      /// they don't make the output depend on timing. Not counted in
+      /// <Stats::cycle_time>.
+      std::function<void()> before_cycle;
+    };
+
+    struct Stats {
+      long frames = 0;
+      long cycles = 0;
+      /// Cycles that took longer than their audio lasts
+      long overruns = 0;
+      /// Wall time of the whole render
+      std::chrono::nanoseconds elapsed {0};
+      /// Time spent in each call to <MainAudio::process>
+      util::latency_histogram cycle_time;
+
+      /// Seconds of audio rendered per second
+      double realtime_factor(int samplerate) const;
+    };
+
+    /// Open the files, and report the buffer size and sample rate
+    ///
+    /// \throws <util::exception> if the MIDI script is malformed
+    OfflineBackend(MainAudio&, Options);
+
+    /// Render everything, on the calling thread
+    void start() override;
+    /// Rendering stops by itself, or when <MainAudio::is_processing> stops
+    void stop() override {}
+
+    const Stats& stats() const { return _stats; }
+
+  private:
+    Options options;
+    midi::MidiScript script;
+    util::SoundFile input;
+    util::SoundFile output;
+    long length = 0;
+    Stats _stats;
+  };
+
+}
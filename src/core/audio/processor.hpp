@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <gsl/span>
 #include <exception>
@@ -34,15 +36,6 @@ namespace otto {
     template<typename...>
     struct is_audio_processor {}; // TODO: Implementation
 
-    template<typename T>
-    struct audio_frame_channels;
-
-    template<std::size_t N>
-    struct audio_frame_channels<std::array<float, N>> {
-      static constexpr auto value = N;
-    };
-
-
     namespace detail {
       // No including "core/globals.hpp" in headers
       void registerAudioBufferResize(std::function<void(int)>);
@@ -73,33 +66,186 @@ namespace otto {
       }
     };
 
+    /// One channel of audio: `size` samples, `stride` floats apart
+    ///
+    /// Planar audio has a stride of `1`. A channel of interleaved frames has
+    /// the number of channels as its stride.
+    class ChannelView {
+    public:
+      ChannelView(float* data, long size, int stride = 1)
+        : _data (data), _size (size), _stride (stride)
+      {}
+
+      float& operator[](long i) const { return _data[i * _stride]; }
+
+      float* data() const { return _data; }
+      long size() const { return _size; }
+      int stride() const { return _stride; }
+      bool is_contiguous() const { return _stride == 1; }
+
+      /// The samples `[idx, idx + length)`, or to the end if `length` is
+      /// negative
+      ChannelView slice(long idx, long length = -1) const
+      {
+        return {_data + idx * _stride, length < 0 ? _size - idx : length, _stride};
+      }
+
+      /// Copy the samples to the contiguous `dst`
+      void copy_to(float* dst) const
+      {
+        if (is_contiguous()) {
+          std::copy_n(_data, _size, dst);
+        } else {
+          for (long i = 0; i < _size; i++) dst[i] = (*this)[i];
+        }
+      }
+
+    private:
+      float* _data;
+      long _size;
+      int _stride;
+    };
+
+    /// `N` channels of audio, as pointers to the first sample of each
+    ///
+    /// All channels have the same size and stride, so a view is either
+    /// planar, or a selection of channels from interleaved frames. Views
+    /// don't own their audio, and selecting or slicing channels copies none
+    /// of it.
     template<int N>
-    using ProcessBuffer = RTBuffer<std::array<float, N>, 1>;
+    class AudioView {
+    public:
+      static constexpr int channels = N;
+
+      AudioView() = default;
+
+      AudioView(std::array<float*, N> data, long size, int stride = 1)
+        : _data (data), _size (size), _stride (stride)
+      {}
+
+      /// View `size` interleaved frames
+      static AudioView interleaved(std::array<float, N>* frames, long size)
+      {
+        std::array<float*, N> data;
+        for (int c = 0; c < N; c++) data[c] = frames->data() + c;
+        return {data, size, N};
+      }
+
+      ChannelView operator[](int c) const { return {_data[c], _size, _stride}; }
+
+      /// The first sample of each channel, as for example Faust wants them.
+      /// Only makes sense for contiguous views.
+      float** data() { return _data.data(); }
+      long size() const { return _size; }
+      int stride() const { return _stride; }
+      bool is_contiguous() const { return _stride == 1; }
+
+      /// Channel `c`, on its own
+      AudioView<1> channel(int c) const { return {{_data[c]}, _size, _stride}; }
+
+      /// Channels `Cs...`, in that order
+      template<int... Cs>
+      AudioView<sizeof...(Cs)> select() const
+      {
+        static_assert(((Cs < N) && ...), "No such channel");
+        return {{_data[Cs]...}, _size, _stride};
+      }
+
+      /// The frames `[idx, idx + length)`, or to the end if `length` is
+      /// negative
+      AudioView slice(long idx, long length = -1) const
+      {
+        auto res = *this;
+        for (auto&& d : res._data) d += idx * _stride;
+        res._size = length < 0 ? _size - idx : length;
+        return res;
+      }
+
+    private:
+      std::array<float*, N> _data = {};
+      long _size = 0;
+      int _stride = 1;
+    };
+
+    /// Planar audio of `N` channels, sized to the buffer size like <RTBuffer>
+    ///
+    /// The channels lie one after the other in a single allocation.
+    template<int N>
+    class ProcessBuffer {
+    public:
+      ProcessBuffer(std::size_t initial_size = 0)
+        : buf (initial_size)
+      {}
+
+      /// Frames in each channel
+      long size() const
+      {
+        if constexpr (N == 0) {
+          return 0;
+        } else {
+          return buf.size() / N;
+        }
+      }
+
+      gsl::span<float> operator[](int c) { return {buf.data() + c * size(), size()}; }
+
+      /// View the first `nframes` frames, or all of them
+      AudioView<N> view(long nframes = -1)
+      {
+        std::array<float*, N> data;
+        for (int c = 0; c < N; c++) data[c] = buf.data() + c * size();
+        return {data, nframes < 0 ? size() : nframes};
+      }
+
+      /// Fill with silence
+      void clear() { buf.clear(); }
+
+    private:
+      RTBuffer<float, N> buf;
+    };
 
     /// Non-owning package of data passed to audio processors
     template<int N>
     struct ProcessData {
       static constexpr int channels = N;
 
-      gsl::span<std::array<float, channels>> audio;
-      gsl::span<midi::AnyMidiEvent> midi;
+      AudioView<channels> audio;
+      gsl::span<const midi::MidiEvent> midi;
 
-      long nframes;
+      long nframes = 0;
 
       template<int outN = 0>
       ProcessData<outN> midi_only() {
-        return {{nullptr, nullptr}, midi, nframes};
+        return {{}, midi, nframes};
       }
 
       ProcessData audio_only() {
         return {audio, {nullptr, nullptr}, nframes};
       }
 
-      template<typename T>
-      auto redirect(T& buf)
+      /// The same midi and frames, with the audio in `buf`
+      template<int M>
+      ProcessData<M> redirect(ProcessBuffer<M>& buf)
+      {
+        return {buf.view(nframes), midi, nframes};
+      }
+
+      /// The same midi and frames, with the audio of `view`
+      template<int M>
+      ProcessData<M> redirect(AudioView<M> view)
       {
-        return ProcessData<audio_frame_channels<std::decay_t<
-          decltype(buf[0])>>::value>{{buf.data(), nframes}, midi, nframes};
+        return {view.slice(0, nframes), midi, nframes};
+      }
+
+      /// Channel `c` on its own, without copying it
+      ProcessData<1> channel(int c) {
+        return {audio.channel(c), midi, nframes};
+      }
+
+      /// Channels `Cs...`, without copying them
+      template<int... Cs>
+      ProcessData<sizeof...(Cs)> select() {
+        return {audio.template select<Cs...>(), midi, nframes};
       }
 
       /// Get only a slice of the audio.
@@ -113,14 +259,9 @@ namespace otto {
         auto res = *this;
         length = length < 0 ? nframes - idx : length;
         res.nframes = length;
-        res.audio = {audio.data() + idx, length};
+        res.audio = audio.slice(idx, length);
         return res;
       }
-
-      decltype(auto) begin() { return audio.begin(); }
-      decltype(auto) end() { return audio.end(); }
-      decltype(auto) begin() const { return audio.begin(); }
-      decltype(auto) end() const { return audio.end(); }
     };
 
   } // audio
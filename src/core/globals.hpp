@@ -27,7 +27,9 @@ namespace otto {
     static inline std::atomic_bool isRunning {true};
   public:
 
-    static inline const filesystem::path data_dir {"data"};
+    /// Where the tape, settings and samples are kept. Only change it before
+    /// <init>.
+    static inline filesystem::path data_dir {"data"};
 
     static inline struct {
       util::EventDispatcher<> preInit;
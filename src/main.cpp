@@ -1,8 +1,12 @@
+#include <cstdlib>
 #include <mutex>
+#include <string>
+#include <fmt/format.h>
 #include <plog/Log.h>
 #include <plog/Appenders/ConsoleAppender.h>
 
 #include "core/audio/midi.hpp"
+#include "core/audio/alsa_backend.hpp"
 #include "core/ui/mainui.hpp"
 #include "modules/studio/tapedeck/tapedeck.hpp"
 #include "modules/studio/mixer/mixer.hpp"
@@ -12,9 +16,43 @@
 #include "modules/synths/nuke/nuke.hpp"
 #include "core/globals.hpp"
 
+// Runs the OTTO on JACK, or with `-a alsa`, straight on ALSA:
+//
+//     otto [-a jack|alsa] [-d playback pcm] [-c capture pcm]
+//          [-p period size] [-n periods] [-r sample rate] [-j workers]
+//
+// `-j` sets the number of extra threads the audio graph runs on.
+
+static void usage()
+{
+  fmt::print(stderr, "usage: otto [-a jack|alsa] [-d playback pcm] [-c capture pcm] "
+    "[-p period size] [-n periods] [-r sample rate] [-j workers]\n");
+  std::exit(2);
+}
+
 int main(int argc, char *argv[]) {
   using namespace otto;
 
+  bool use_alsa = false;
+  audio::AlsaBackend::Options alsa;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.size() != 2 || arg[0] != '-' || ++i == argc) usage();
+    switch (arg[1]) {
+    case 'a':
+      if (argv[i] != std::string("jack") && argv[i] != std::string("alsa")) usage();
+      use_alsa = argv[i] == std::string("alsa");
+      break;
+    case 'd': alsa.playback = argv[i]; break;
+    case 'c': alsa.capture = argv[i]; break;
+    case 'p': alsa.period_size = std::atoi(argv[i]); break;
+    case 'n': alsa.periods = std::atoi(argv[i]); break;
+    case 'r': alsa.samplerate = std::atoi(argv[i]); break;
+    case 'j': Globals::audio.worker_options.workers = std::atoi(argv[i]); break;
+    default: usage();
+    }
+  }
+
   auto cleanup = [] {
     Globals::events.preExit.runAll();
     Globals::ui.exit();
@@ -41,6 +79,12 @@ int main(int argc, char *argv[]) {
     Globals::synth.registerModule<NukeSynth>("Nuke");
     Globals::synth.registerModule<SynthSampler>("Sampler");
 
+    if (use_alsa) {
+      Globals::audio.backend_factory = [alsa] (audio::MainAudio& owner) {
+        return std::make_unique<audio::AlsaBackend>(owner, alsa);
+      };
+    }
+
     Globals::events.preInit.runAll();
     Globals::init();
     Globals::events.postInit.runAll();
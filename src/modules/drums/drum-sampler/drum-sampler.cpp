@@ -60,76 +60,70 @@ namespace otto::modules {
   }
 
   audio::ProcessData<1> DrumSampler::process(audio::ProcessData<0> data) {
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent, [&] (midi::NoteOnEvent& e) {
-          if (e.channel == 1) {
-            currentVoiceIdx = e.key % nVoices;
-            auto &&voice = props.voiceData[currentVoiceIdx];
-            voice.playProgress = (voice.fwd()) ? 0 : voice.length() - 1;
-            voice.trigger = true;
-          }
-        }, [] (auto&&) {});
-    }
-
     proc_buf.clear();
-
-    for (auto &&voice : props.voiceData) {
-
-      float playSpeed = voice.speed * sampleSpeed;
-
-      // Process audio
-      if (voice.playProgress >= 0 && playSpeed > 0) {
-        if (voice.fwd()) {
-          if (voice.loop() && voice.trigger) {
-            for(int i = 0; i < data.nframes; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
-              voice.playProgress += playSpeed;
+    auto out = proc_buf[0];
+
+    // Voices start and stop on the frame of their event
+    midi::split_block(data.midi, data.nframes, [&] (const midi::MidiEvent& e) {
+      if (e.channel != 1) return;
+      if (e.is_note_on()) {
+        currentVoiceIdx = e.key() % nVoices;
+        auto &&voice = props.voiceData[currentVoiceIdx];
+        voice.playProgress = (voice.fwd()) ? 0 : voice.length() - 1;
+        voice.trigger = true;
+      } else if (e.is_note_off()) {
+        auto &&voice = props.voiceData[e.key() % nVoices];
+        voice.trigger = false;
+        if (voice.stop()) {
+          voice.playProgress = -1;
+        }
+      }
+    }, [&] (long from, long n) {
+      for (auto &&voice : props.voiceData) {
+
+        float playSpeed = voice.speed * sampleSpeed;
+
+        // Process audio
+        if (voice.playProgress >= 0 && playSpeed > 0) {
+          if (voice.fwd()) {
+            if (voice.loop() && voice.trigger) {
+              for(int i = from; i < from + n; ++i) {
+                out[i] += sampleData[voice.in + voice.playProgress];
+                voice.playProgress += playSpeed;
+                if (voice.playProgress >= voice.length()) {
+                  voice.playProgress = 0;
+                }
+              }
+            } else {
+              int frms = std::min<int>(n, voice.length() - voice.playProgress);
+              for(int i = from; i < from + frms; ++i) {
+                out[i] += sampleData[voice.in + voice.playProgress];
+                voice.playProgress += playSpeed;
+              }
               if (voice.playProgress >= voice.length()) {
-                voice.playProgress = 0;
+                voice.playProgress = -1;
               }
             }
           } else {
-            int frms = std::min<int>(data.nframes, voice.length() - voice.playProgress);
-            for(int i = 0; i < frms; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
-              voice.playProgress += playSpeed;
-            }
-            if (voice.playProgress >= voice.length()) {
-              voice.playProgress = -1;
-            }
-          }
-        } else {
-          if (voice.loop() && voice.trigger) {
-            for(int i = 0; i < data.nframes; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
-              voice.playProgress -= playSpeed;
-              if (voice.playProgress < 0) {
-                voice.playProgress = voice.length() -1;
+            if (voice.loop() && voice.trigger) {
+              for(int i = from; i < from + n; ++i) {
+                out[i] += sampleData[voice.in + voice.playProgress];
+                voice.playProgress -= playSpeed;
+                if (voice.playProgress < 0) {
+                  voice.playProgress = voice.length() -1;
+                }
+              }
+            } else {
+              int frms = std::min<int>(n, voice.playProgress);
+              for(int i = from; i < from + frms; ++i) {
+                out[i] += sampleData[voice.in + voice.playProgress];
+                voice.playProgress -= playSpeed;
               }
-            }
-          } else {
-            int frms = std::min<int>(data.nframes, voice.playProgress);
-            for(int i = 0; i < frms; ++i) {
-              proc_buf[i][0] += sampleData[voice.in + voice.playProgress];
-              voice.playProgress -= playSpeed;
             }
           }
         }
       }
-    }
-
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent,
-        [&] (midi::NoteOffEvent& e) {
-          if (e.channel == 1) {
-            auto &&voice = props.voiceData[e.key % nVoices];
-            voice.trigger = false;
-            if (voice.stop()) {
-              voice.playProgress = -1;
-            }
-          }
-        }, [] (auto&&) {});
-    };
+    });
 
     return data.redirect(proc_buf);
   }
@@ -19,26 +19,27 @@ namespace otto::modules {
   }
 
   audio::ProcessData<1> SimpleDrumsModule::process(audio::ProcessData<0> data) {
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent, [&] (midi::NoteOnEvent& e) {
-          currentVoiceIdx = e.key % 24;
-          voices[currentVoiceIdx].props.trigger = true;
-          voices[currentVoiceIdx].props.envelope.sustain = float(e.velocity)/128.f;
-        }, [] (auto&&) {});
-    }
     proc_buf.clear();
     voice_buf.clear();
-    for (auto &&voice : voices) {
-      auto voice_data = voice.process(data.midi_only());
-      for (auto [vb, pb] : util::zip(voice_data, proc_buf)) {
-        util::audio::add_all(pb, vb);
+    auto out = proc_buf[0];
+    // Render up to each event, so hits land on their own frame
+    midi::split_block(data.midi, data.nframes, [&] (const midi::MidiEvent& e) {
+      if (e.is_note_on()) {
+        currentVoiceIdx = e.key() % 24;
+        voices[currentVoiceIdx].props.trigger = true;
+        voices[currentVoiceIdx].props.envelope.sustain = float(e.velocity())/128.f;
+      } else if (e.is_note_off()) {
+        voices[e.key() % 24].props.trigger = false;
       }
-    }
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent, [&] (midi::NoteOffEvent& e) {
-          voices[e.key % 24].props.trigger = false;
-        }, [] (auto&&) {});
-    };
+    }, [&] (long from, long n) {
+      for (auto &&voice : voices) {
+        auto voice_data = voice.process(data.midi_only().slice(from, n));
+        auto in = voice_data.audio[0];
+        for (int i = 0; i < n; i++) {
+          out[from + i] += in[i];
+        }
+      }
+    });
     return data.redirect(proc_buf);
   }
 
@@ -1,6 +1,7 @@
 #include "metronome.hpp"
 
 #include "core/globals.hpp"
+#include <array>
 #include <string>
 #include <cmath>
 
@@ -41,17 +42,24 @@ namespace otto::modules {
     float beat = Globals::tapedeck.position() * BPsample;
     int framesTillNext = std::fmod(beat, 1)/BPsample * Globals::tapedeck.state.playSpeed;
 
+    // The click is a note of its own, at the frame of the next beat
+    gsl::span<const midi::MidiEvent> clicks;
+    std::array<midi::MidiEvent, 1> click;
     if (framesTillNext < data.nframes
       && Globals::tapedeck.state.playing()
       && Globals::tapedeck.state.playSpeed/BPsample > 1) {
-      FaustWrapper::process(data.slice(0, framesTillNext));
-      props.trigger = true;
-      FaustWrapper::process(data.slice(framesTillNext));
-      props.trigger = false;
-    } else {
-      FaustWrapper::process(data);
+      click[0] = midi::MidiEvent::note_on(std::uint32_t(framesTillNext), 0, 0, 127);
+      clicks = click;
     }
 
+    auto out = proc_buf.view(data.nframes);
+    midi::split_block(clicks, data.nframes, [&] (auto&&) {
+      props.trigger = true;
+    }, [&] (long from, long n) {
+      process_into(data.slice(from, n), out.slice(from, n));
+    });
+    props.trigger = false;
+
     return data.redirect(FaustWrapper::proc_buf);
   }
 
@@ -72,7 +80,8 @@ namespace otto::modules {
 
   TapeTime Metronome::getBarTime(BeatPos bar) {
     double fpb = (Globals::samplerate)*60/(double)props.bpm;
-    return bar * fpb;
+    // Bars before the start of the tape would wrap around
+    return std::max(0.0, bar * fpb);
   }
 
   TapeTime Metronome::getBarTimeRel(BeatPos bar) {
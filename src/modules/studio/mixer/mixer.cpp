@@ -19,26 +19,33 @@ namespace otto::modules {
 
   // Mixing!
 
-  audio::ProcessData<2> Mixer::process_tracks(audio::ProcessData<4> data)
+  audio::ProcessData<2> Mixer::process_tracks(audio::ProcessData<tracks> data)
   {
-    auto level = util::generate_sequence<4>(
+    using Gains = std::array<float, tracks>;
+    auto level = util::generate_sequence<tracks>(
       [this] (int n) { return props.tracks[n].level.get(); });
-    auto pan = util::generate_sequence<4>(
-      [this] (int n) { return props.tracks[n].pan.get(); });
-    auto muted = util::generate_sequence<4>(
-      [this] (int n) { return props.tracks[n].muted.get(); });
-
-    for (auto&& [in, out] : util::zip(data.audio, proc_buf)) {
-        float lMix = 0, rMix = 0;
-        for (int t = 0; t < 4 ; t++) {
-          float audio = in[t] * level[t];
-          if (!muted[t]) {
-            lMix += audio * (1-pan[t]);
-            rMix += audio * (1+pan[t]);
-          }
-          graphs[t].add(audio);
-        }
-        out = {lMix, rMix};
+    // Fold panning and muting into the gains of each side, so the inner loop
+    // is the same for every track
+    Gains lGain, rGain;
+    for (int t = 0; t < tracks; t++) {
+      bool muted = props.tracks[t].muted.get();
+      float pan = props.tracks[t].pan.get();
+      lGain[t] = muted ? 0 : level[t] * (1 - pan);
+      rGain[t] = muted ? 0 : level[t] * (1 + pan);
+    }
+
+    auto out_l = proc_buf[0];
+    auto out_r = proc_buf[1];
+    for (int i = 0; i < data.nframes; i++) {
+      Gains l, r;
+      for (int t = 0; t < tracks; t++) {
+        float in = data.audio[t][i];
+        l[t] = in * lGain[t];
+        r[t] = in * rGain[t];
+        graphs[t].add(in * level[t]);
+      }
+      out_l[i] = util::audio::pairwise_sum(l);
+      out_r[i] = util::audio::pairwise_sum(r);
     }
 
     return data.redirect(proc_buf);
@@ -46,9 +53,12 @@ namespace otto::modules {
 
   audio::ProcessData<2> Mixer::process_engine(audio::ProcessData<1> data)
   {
-    for (auto&& [in, out] : util::zip(data.audio, proc_buf)) {
-      out[0] += in[0];
-      out[1] += in[0];
+    auto in = data.audio[0];
+    auto out_l = proc_buf[0];
+    auto out_r = proc_buf[1];
+    for (int i = 0; i < data.nframes; i++) {
+      out_l[i] += in[i];
+      out_r[i] += in[i];
     }
     return data.redirect(proc_buf);
   }
@@ -59,29 +69,34 @@ namespace otto::modules {
 
   using namespace ui::vg;
 
-  void MixerScreen::draw(ui::vg::Canvas& ctx) {
+  int MixerScreen::bank_start() const {
+    return Globals::tapedeck.state.track / 4 * 4;
+  }
 
-    drawMixerSegment(ctx, 1, 18, 32.5);
-    drawMixerSegment(ctx, 2, 93, 32.5);
-    drawMixerSegment(ctx, 3, 168, 32.5);
-    drawMixerSegment(ctx, 4, 243, 32.5);
+  void MixerScreen::draw(ui::vg::Canvas& ctx) {
+    int first = bank_start();
+    drawMixerSegment(ctx, first + 1, 18, 32.5);
+    drawMixerSegment(ctx, first + 2, 93, 32.5);
+    drawMixerSegment(ctx, first + 3, 168, 32.5);
+    drawMixerSegment(ctx, first + 4, 243, 32.5);
 
   }
 
   bool MixerScreen::keypress(ui::Key key) {
     using namespace ui;
+    int first = bank_start();
     switch (key) {
     case K_BLUE_CLICK:
-      module->props.tracks[0].muted.step();
+      module->props.tracks[first + 0].muted.step();
       return true;
     case K_GREEN_CLICK:
-      module->props.tracks[1].muted.step();
+      module->props.tracks[first + 1].muted.step();
       return true;
     case K_WHITE_CLICK:
-      module->props.tracks[2].muted.step();
+      module->props.tracks[first + 2].muted.step();
       return true;
     case K_RED_CLICK:
-      module->props.tracks[3].muted.step();
+      module->props.tracks[first + 3].muted.step();
       return true;
     default:
       return false;
@@ -94,10 +109,11 @@ namespace otto::modules {
   }
 
   void MixerScreen::rotary(ui::RotaryEvent e) {
+    auto& track = module->props.tracks[bank_start() + static_cast<int>(e.rotary)];
     if (Globals::ui.keys[ui::K_SHIFT]) {
-      module->props.tracks[static_cast<int>(e.rotary)].pan.step(e.clicks);
+      track.pan.step(e.clicks);
     } else {
-      module->props.tracks[static_cast<int>(e.rotary)].level.step(e.clicks);
+      track.level.step(e.clicks);
     }
   }
 
@@ -105,11 +121,11 @@ namespace otto::modules {
                                      int track, float x, float y) {
 
     Colour trackCol;
-    switch (track) {
-    case 1: trackCol = Colours::Blue; break;
-    case 2: trackCol = Colours::Green; break;
-    case 3: trackCol = Colours::White; break;
-    case 4: trackCol = Colours::Red; break;
+    switch ((track - 1) % 4) {
+    case 0: trackCol = Colours::Blue; break;
+    case 1: trackCol = Colours::Green; break;
+    case 2: trackCol = Colours::White; break;
+    case 3: trackCol = Colours::Red; break;
     }
     Colour muteCol = (module->props.tracks[track-1].muted) ? Colours::Red : Colours::Gray60;
     float mix = module->props.tracks[track-1].level;
@@ -18,6 +18,9 @@ namespace otto::modules {
     audio::ProcessBuffer<2> proc_buf;
   public:
 
+    /// Tracks mixed from the tape
+    static constexpr int tracks = util::audio::tape_tracks;
+
     struct Props : public Properties {
       struct TrackInfo : public Properties {
         Property<float> level = {this, "LEVEL", 0.5, {0, 1, 0.01}};
@@ -26,19 +29,19 @@ namespace otto::modules {
         using Properties::Properties;
       };
 
-      std::array<TrackInfo, 4> tracks = util::generate_sequence<4>(
+      std::array<TrackInfo, Mixer::tracks> tracks = util::generate_sequence<Mixer::tracks>(
         [this] (int n) {
           return TrackInfo(this, fmt::format("Track {}", n + 1));
         });
     } props;
 
-    std::array<util::audio::Graph, 4> graphs;
+    std::array<util::audio::Graph, tracks> graphs;
 
     Mixer();
 
     void display();
 
-    audio::ProcessData<2> process_tracks(audio::ProcessData<4>);
+    audio::ProcessData<2> process_tracks(audio::ProcessData<tracks>);
     audio::ProcessData<2> process_engine(audio::ProcessData<1>);
   };
 
@@ -50,6 +53,10 @@ namespace otto::modules {
     bool keyrelease(ui::Key key) override;
     void rotary(ui::RotaryEvent) override;
 
+    /// The first of the four tracks shown, which follows the track selected
+    /// on the tapedeck
+    int bank_start() const;
+
     // TODO: Convert to Widget
     void drawMixerSegment(ui::vg::Canvas& ctx, int track, float x, float y);
 
@@ -1,195 +1,2058 @@
 #include "tapebuffer.hpp"
 
-#include <thread>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <mutex>
-#include <condition_variable>
+#include <numeric>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <plog/Log.h>
 
 #include "util/tapefile.hpp"
+#include "util/compressedaudio.hpp"
+#include "util/exception.hpp"
+#include "util/io-queue.hpp"
 #include "util/timer.hpp"
+#include "util/semaphore.hpp"
 #include "core/globals.hpp"
 
 namespace otto {
 
   using value_type = tape_buffer::value_type;
   constexpr int buffer_size = tape_buffer::buffer_size;
+  constexpr int tracks = tape_buffer::tracks;
+  constexpr unsigned all_tracks = tape_buffer::all_tracks;
+  constexpr int block_size = util::TapeFile::block_size;
+
+  static_assert(util::TapeFile::written_block_size == util::CompressedAudioFile::block_frames,
+    "Compressed and uncompressed tapes track written frames in the same blocks");
+  static_assert(tracks == util::TapeFile::tracks);
+  static_assert(buffer_size % block_size == 0,
+    "Blocks of the tape file never wrap around the buffer");
+
+  /// Frames in a block that can be transferred with `O_DIRECT`, when each
+  /// sample takes `sample_size` bytes in the file
+  static int direct_block_for(std::size_t sample_size)
+  {
+    return tape_buffer::io_alignment / std::gcd(tape_buffer::io_alignment, sample_size);
+  }
+
+  /// The first frame of the block of the tape file `position` is in
+  static int block_start(int position)
+  {
+    return position >= 0 ? position / block_size * block_size
+                         : (position - block_size + 1) / block_size * block_size;
+  }
+
+  /// The rings of each track of the buffer or a <TapeCache>, indexed by
+  /// position
+  struct TrackRings {
+    std::array<float*, tracks> data;
+    /// Frames in each ring. A power of two.
+    int size;
+
+    float& at(int track, int position) const
+    {
+      return data[track][position & (size - 1)];
+    }
 
-  constexpr int wrap(std::size_t position)
+    /// The slot of `position` in each ring
+    std::array<float*, tracks> planes(int position) const
+    {
+      std::array<float*, tracks> res;
+      for (int t = 0; t < tracks; t++) res[t] = data[t] + (position & (size - 1));
+      return res;
+    }
+  };
+
+  static TrackRings rings_of(tape_buffer::buffer_type& buffer)
+  {
+    TrackRings r {{}, buffer_size};
+    for (int t = 0; t < tracks; t++) r.data[t] = buffer[t].data();
+    return r;
+  }
+
+  static TrackRings rings_of(TapeCache& cache)
   {
-    return position % buffer_size;
+    TrackRings r {{}, int(cache.size())};
+    for (int t = 0; t < tracks; t++) r.data[t] = cache.data(t);
+    return r;
   }
 
-  /// Handles all interactions with the tapefile. Works on its own thread
+  /// Samples of each track in the tape file's format, for transfers with
+  /// the file when it does not store floats
+  ///
+  /// Indexed by track and position like the buffer, so a block that is
+  /// aligned in the file is also aligned here, as `O_DIRECT` requires.
+  struct StagingRing {
+    /// \param frames A power of two, at least `tape_buffer::io_alignment`
+    StagingRing(int frames, std::size_t sample_size)
+      : frames {frames},
+        sample_size {sample_size},
+        bytes {static_cast<std::byte*>(
+            std::aligned_alloc(tape_buffer::io_alignment, tracks * frames * sample_size)), &std::free}
+    {
+      if (!bytes) throw std::bad_alloc();
+    }
+
+    /// The slot of the sample of `track` at `position`
+    std::byte* at(int track, int position) const
+    {
+      return bytes.get() + (track * std::size_t(frames) + (position & (frames - 1))) * sample_size;
+    }
+
+    const int frames;
+    const std::size_t sample_size;
+    std::unique_ptr<std::byte, decltype(&std::free)> bytes;
+  };
+
+  /// Which blocks of each track of the tape were ever written, so the
+  /// producer can make up silence for the others instead of reading it
+  ///
+  /// Shared by the producer and the writer. Blocks are marked in the tape
+  /// file before anything is written to them, so the map on disk never
+  /// misses audio, even if the program dies halfway.
+  struct WrittenBlocks {
+    static constexpr int block_size = util::TapeFile::written_block_size;
+
+    ~WrittenBlocks()
+    {
+      if (fd >= 0) ::close(fd);
+    }
+
+    /// Take over the map of `file`, storing changes to it in place
+    void open(util::TapeFile& file)
+    {
+      size = file.written_map.size();
+      bytes = std::make_unique<std::atomic<std::uint8_t>[]>(size);
+      for (int i = 0; i < size; i++) bytes[i] = file.written_map[i];
+      offset = file.written_map_offset();
+      fd = ::open(file.path.c_str(), O_RDWR);
+      if (fd < 0) {
+        LOGE << "Could not open tape file to store the written map: " << std::strerror(errno);
+      }
+    }
+
+    /// Copy the map back to `file`, which writes it with its header
+    void close(util::TapeFile& file)
+    {
+      for (int i = 0; i < size; i++) file.written_map[i] = bytes[i];
+    }
+
+    bool is_open() const
+    {
+      return bytes != nullptr;
+    }
+
+    /// Whether block `b` of `track` was ever written. Lock free.
+    bool test(int track, int b) const
+    {
+      int bit = b * tracks + track;
+      if (b < 0 || bit >= size * 8) return false;
+      return bytes[bit / 8].load(std::memory_order_acquire) & (1 << (bit % 8));
+    }
+
+    /// Mark the blocks of `track` frames `[first, last)` are in as written,
+    /// and store the map before returning
+    void mark(int track, int first, int last)
+    {
+      int b0 = std::max(0, first / block_size);
+      int b1 = std::min(size * 8 / tracks, (last + block_size - 1) / block_size);
+      bool marked = true;
+      for (int b = b0; b < b1 && marked; b++) marked = test(track, b);
+      if (marked) return;
+
+      std::lock_guard lock (mutex);
+      for (int b = b0; b < b1; b++) {
+        int bit = b * tracks + track;
+        bytes[bit / 8].fetch_or(1 << (bit % 8), std::memory_order_release);
+      }
+      if (fd < 0 || offset == 0) return;
+      int i0 = (b0 * tracks + track) / 8;
+      int i1 = ((b1 - 1) * tracks + track) / 8 + 1;
+      std::vector<std::uint8_t> copy(bytes.get() + i0, bytes.get() + i1);
+      if (::pwrite(fd, copy.data(), copy.size(), offset + i0) != i1 - i0) {
+        LOGE << "Could not store the written map: " << std::strerror(errno);
+      }
+    }
+
+    std::unique_ptr<std::atomic<std::uint8_t>[]> bytes;
+    /// Bytes in the map
+    int size = 0;
+    int fd = -1;
+    /// File offset of the map
+    std::int64_t offset = 0;
+    /// Keeps stores of the map in order
+    std::mutex mutex;
+  };
+
+  /// Set while the producer reads into the buffer, so the writer and job
+  /// threads can give way when the tape is about to run out
+  struct ReadGate {
+    void begin()
+    {
+      reading = true;
+    }
+
+    /// Stop reading, and wake up the threads waiting for it
+    void end()
+    {
+      reading = false;
+      for (int n = waiting.exchange(0); n > 0; n--) {
+        done.post();
+      }
+    }
+
+    /// Wait while reading and `pred()` holds, for at most `timeout`
+    template<typename Pred>
+    void wait(Pred&& pred, std::chrono::milliseconds timeout)
+    {
+      auto until = std::chrono::steady_clock::now() + timeout;
+      while (reading && pred()) {
+        waiting++;
+        // A post for a wait that ended early just goes around the loop again
+        if (!reading) break;
+        if (!done.wait_for(until - std::chrono::steady_clock::now())) break;
+      }
+    }
+
+  private:
+    std::atomic_bool reading {false};
+    std::atomic_int waiting {0};
+    util::semaphore done;
+  };
+
+  /// Writes recorded frames from the buffer to the tape file. Works on its
+  /// own thread, so a long write-back never holds up refilling the buffer.
+  ///
+  /// It only touches the file through its own descriptors. What depends on
+  /// the written frames, like overviews and caches, is left to the
+  /// <Producer>, which takes finished sections from <written>.
+  struct WriteBack {
+
+    const int min_write_size = tape_buffer::buffer_size >> 8;
+    /// Writes are queued in requests of this many frames
+    const int request_size = tape_buffer::buffer_size >> 6;
+    /// Requests in flight before reads get a chance to go first
+    const int batch_size = 4;
+    /// With fewer frames than this loaded ahead of the playpoint, writes wait
+    /// while the producer reads
+    const int low_margin = tape_buffer::buffer_size >> 4;
+    /// The longest a write waits for reads
+    const std::chrono::milliseconds max_yield {20};
+    const std::chrono::milliseconds idle_interval {50};
+
+    tape_buffer& owner;
+    ReadGate& reads;
+
+    util::IOQueue io;
+    int fd = -1;
+    /// The tape file opened with `O_DIRECT`, or `-1`
+    int direct_fd = -1;
+    /// Frames in a block <direct_fd> can transfer
+    int direct_block = 1;
+    std::int64_t audio_offset = 0;
+    util::SampleFormat format = util::SampleFormat::Float32;
+    /// Bytes per sample in the file
+    std::size_t sample_size = sizeof(float);
+    /// Frames are encoded here first, unless the file stores floats. Holds
+    /// two batches, so a batch never overwrites itself.
+    std::unique_ptr<StagingRing> staging;
+    /// Where the audio goes instead of the tape file, if it is compressed
+    util::CompressedAudioFile* store = nullptr;
+    /// Frames of all tracks are gathered here for the <store>, which keeps
+    /// them interleaved
+    std::vector<float> interleaved;
+    /// Marked before writing to the tape file
+    WrittenBlocks* blocks = nullptr;
+
+    /// The section of each track being written. Its frames are not in the
+    /// file yet, so they must stay in the buffer.
+    std::array<std::atomic<util::audio::Section<int>>, tracks> writing;
+
+    /// A section of a track that is in the file
+    struct Written {
+      util::audio::Section<int> section;
+      int track;
+    };
+    /// Sections that are in the file, for the producer
+    util::mpsc_queue<Written, 256> written;
+    /// Set when <written> is full, and the thread waits for <room>
+    std::atomic_bool full {false};
+    util::semaphore room;
+
+    /// Everything recorded before <flush> set `flush_requests` to `n` is
+    /// written once `flushed` is `n`
+    std::atomic<unsigned> flush_requests {0};
+    std::atomic<unsigned> flushed {0};
+
+    std::atomic_bool keepRunning {true};
+    std::atomic_bool finished {false};
+    std::atomic_bool pending {false};
+    util::semaphore wakeup;
+    /// Posted when <written>, <flushed> or <finished> change, for <flush>
+    /// and <stop>
+    util::semaphore updated;
+    std::thread thread;
+
+    WriteBack(tape_buffer& owner, ReadGate& reads)
+      : owner {owner}, reads {reads}
+    {
+      for (auto&& w : writing) w = {0, 0};
+    }
+
+    ~WriteBack()
+    {
+      if (thread.joinable()) {
+        keepRunning = false;
+        wakeup.post();
+        thread.join();
+      }
+      if (fd >= 0) ::close(fd);
+      if (direct_fd >= 0) ::close(direct_fd);
+    }
+
+    /// Open the tape file at `path`, whose audio starts at `offset` and is
+    /// stored as `format`, and start the thread
+    void start(const fs::path& path, std::int64_t offset, util::SampleFormat format,
+      bool direct, WrittenBlocks& blocks)
+    {
+      this->blocks = &blocks;
+      audio_offset = offset;
+      this->format = format;
+      sample_size = util::sample_size(format);
+      if (format != util::SampleFormat::Float32) {
+        staging = std::make_unique<StagingRing>(2 * batch_size * request_size, sample_size);
+      }
+      fd = ::open(path.c_str(), O_RDWR);
+      if (fd < 0) {
+        throw util::exception("Could not open tape file for writing: {}", std::strerror(errno));
+      }
+      if (direct) {
+        direct_fd = ::open(path.c_str(), O_RDWR | O_DIRECT);
+        if (direct_fd >= 0) {
+          direct_block = direct_block_for(sample_size);
+        }
+      }
+      thread = std::thread(&WriteBack::main_routine, this);
+    }
+
+    /// Start the thread, writing to `store` instead of the tape file
+    void start(util::CompressedAudioFile& store)
+    {
+      this->store = &store;
+      interleaved.resize(tracks * request_size);
+      thread = std::thread(&WriteBack::main_routine, this);
+    }
+
+    /// Wake up the thread to look at `owner.write_sects`. Lock free.
+    void request()
+    {
+      if (!pending.exchange(true)) {
+        wakeup.post();
+      }
+    }
+
+    /// Wait until everything recorded so far is in the file, calling
+    /// `while_waiting` whenever sections are written, and at least every
+    /// <idle_interval>
+    template<typename F>
+    void flush(F&& while_waiting)
+    {
+      unsigned n = ++flush_requests;
+      request();
+      while (int(n - flushed.load()) > 0) {
+        while_waiting();
+        updated.wait_for(idle_interval);
+      }
+    }
+
+    /// Write everything, and stop the thread, calling `while_waiting` like
+    /// <flush>
+    template<typename F>
+    void stop(F&& while_waiting)
+    {
+      keepRunning = false;
+      wakeup.post();
+      while (!finished) {
+        while_waiting();
+        updated.wait_for(idle_interval);
+      }
+      thread.join();
+    }
+
+    /// Called by the producer after taking sections from <written>
+    void took_written()
+    {
+      if (full.exchange(false)) room.post();
+    }
+
+    void main_routine()
+    {
+      // Reads go first. Failing this only matters when the CPU is busy.
+      if (::setpriority(PRIO_PROCESS, ::syscall(SYS_gettid), 5) != 0) {
+        LOGD << "Could not lower the tape writer priority";
+      }
+      while (keepRunning) {
+        {
+          TIME_SCOPE("TapeBuffer write cycle");
+          pending = false;
+          write_pending();
+        }
+        wakeup.wait_for(idle_interval);
+      }
+      write_pending<true>();
+      finished = true;
+      updated.post();
+    }
+
+    /// Write the section of each track in `owner.write_sects` if it is big,
+    /// close to being pushed out of the buffer, or a flush was requested
+    template<bool unconditionally = false>
+    void write_pending()
+    {
+      unsigned requested = flush_requests;
+      bool urgent = unconditionally || requested != flushed;
+      for (int track = 0; track < tracks; track++) {
+        auto write_sect = owner.write_sects[track].load();
+        if (write_sect.size() <= 0) continue;
+        if (!urgent
+          && write_sect.size() <= min_write_size
+          && (write_sect.in - owner.tail)  > min_write_size * 2
+          && (owner.head - write_sect.out) > min_write_size * 2) continue;
+
+        auto start = std::chrono::steady_clock::now();
+        writing[track] = write_sect;
+        write_section(track, write_sect, urgent);
+
+        // Atomically update the write section
+        util::audio::Section<int> new_sect;
+        auto expected_sect = owner.write_sects[track].load();
+        do {
+          new_sect = expected_sect - write_sect;
+        } while (!owner.write_sects[track].compare_exchange_weak(
+            expected_sect, new_sect));
+        writing[track] = {0, 0};
+        owner.stats.write_latency.record(std::chrono::steady_clock::now() - start);
+
+        while (!written.try_push({write_sect, track})) {
+          full = true;
+          // The producer may have made room before it saw `full`
+          if (written.try_push({write_sect, track})) break;
+          updated.post();
+          owner.notify_update(tape_buffer::Written);
+          room.wait_for(idle_interval);
+        }
+        updated.post();
+      }
+      if (urgent) {
+        flushed = requested;
+        updated.post();
+      }
+    }
+
+    /// Write section `s` of `track` in the buffer, in batches of requests.
+    /// Unless `urgent`, reads go first between batches.
+    void write_section(int track, util::audio::Section<int> s, bool urgent)
+    {
+      int position = std::max(0, s.in);
+      int last = std::min<int>(s.out, tape_buffer::max_length);
+      int batched = 0;
+      if (blocks) blocks->mark(track, position, last);
+      while (position < last) {
+        int wrap_pos = position & (buffer_size - 1);
+        // Requests stay inside a block, where the track is contiguous
+        int len = std::min({last - position, request_size,
+            block_start(position) + block_size - position});
+        const float* samples = owner.buffer[track].data() + wrap_pos;
+        if (store) {
+          // The store encodes and writes as it goes, so there is nothing to
+          // batch. Reads still go first between requests.
+          for (int i = 0; i < len; i++) {
+            for (int t = 0; t < tracks; t++) {
+              interleaved[i * tracks + t] = owner.buffer[t][wrap_pos + i];
+            }
+          }
+          store->write(position, interleaved.data(), len);
+          position += len;
+          if (!urgent) yield_to_reads();
+          continue;
+        }
+        if (staging) {
+          int slot = position & (staging->frames - 1);
+          len = std::min(len, staging->frames - slot);
+          util::encode_samples(format, samples, staging->at(track, position), len);
+          queue_span(track, position, staging->at(track, position), len);
+        } else {
+          queue_span(track, position, reinterpret_cast<const std::byte*>(samples), len);
+        }
+        position += len;
+        if (++batched == batch_size) {
+          complete();
+          batched = 0;
+          if (!urgent) yield_to_reads();
+        }
+      }
+      complete();
+    }
+
+    /// Queue a write of `n` contiguous samples of `track` in the file's
+    /// format from `samples` to `position`. They must be in one block of the
+    /// tape file.
+    ///
+    /// With `O_DIRECT`, only whole blocks go to <direct_fd>. The ragged ends
+    /// go through the page cache, and never share a page with them.
+    void queue_span(int track, int position, const std::byte* samples, int n)
+    {
+      int first = position;
+      int last = position;
+      if (direct_fd >= 0) {
+        first = (position + direct_block - 1) / direct_block * direct_block;
+        last = (position + n) / direct_block * direct_block;
+        if (first >= last) first = last = position;
+      }
+      auto write = [&] (int f, int pos, int k) {
+        if (k <= 0) return;
+        auto index = util::TapeFile::sample_index(track, pos);
+        io.write(f, samples + (pos - position) * sample_size, k * sample_size,
+          audio_offset + index * sample_size, k * sample_size);
+      };
+      write(fd, position, first - position);
+      write(direct_fd, first, last - first);
+      write(fd, last, position + n - last);
+    }
+
+    /// Wait for queued writes
+    void complete()
+    {
+      for (auto&& c : io.complete()) {
+        if (c.result < 0) {
+          LOGE << "Tape write failed: " << std::strerror(-c.result);
+        } else if (std::uint64_t(c.result) < c.tag) {
+          LOGE << "Tape write was cut short";
+        }
+      }
+    }
+
+    /// Wait while the producer reads, if the tape is about to run out
+    void yield_to_reads()
+    {
+      reads.wait([&] { return owner.stats.margin < low_margin; }, max_yield);
+    }
+  };
+
+  /// Runs <TapeJob>s on its own thread, a chunk at a time
+  ///
+  /// Like the <WriteBack>, it only touches the tape through its own
+  /// descriptors. The <Producer> hands it one job at a time, once
+  /// everything recorded is in the file, and brings the buffer, the caches
+  /// and the overviews up to date behind each chunk in <edited>.
+  struct JobRunner final : TapeJob::Tape {
+
+    /// With fewer frames than this loaded ahead of the playpoint, jobs wait
+    /// while the producer reads
+    const int low_margin = tape_buffer::buffer_size >> 4;
+    /// The longest a chunk waits for reads
+    const std::chrono::milliseconds max_yield {20};
+    const std::chrono::milliseconds idle_interval {50};
+
+    tape_buffer& owner;
+    ReadGate& reads;
+
+    int fd = -1;
+    std::int64_t audio_offset = 0;
+    util::SampleFormat format = util::SampleFormat::Float32;
+    /// Bytes per sample in the file
+    std::size_t sample_size = sizeof(float);
+    /// Samples of a block of a track in the file's format
+    std::vector<std::byte> raw;
+    /// Where the audio is instead of the tape file, if it is compressed
+    util::CompressedAudioFile* store = nullptr;
+    /// Frames of all tracks, for the <store>, which keeps them interleaved
+    std::vector<float> interleaved;
+    /// Marked before writing to the tape file
+    WrittenBlocks* blocks = nullptr;
+
+    /// The clipboard, as raw floats in a file next to the tape, so it
+    /// survives a restart
+    int clip_fd = -1;
+    int clip_frames = 0;
+
+    /// A section of a track a job has changed in the file
+    struct Edited {
+      util::audio::Section<int> section;
+      int track;
+    };
+    /// Sections changed by the running job, for the producer
+    util::mpsc_queue<Edited, 256> edited;
+    /// Set when <edited> is full, and the thread waits for <room>
+    std::atomic_bool full {false};
+    util::semaphore room;
+
+    TapeJob job;
+    /// Set by <run>, and cleared once the job is done
+    std::atomic_bool busy {false};
+    /// Whether <job> ran to the end. Set before <busy> is cleared.
+    bool completed = false;
+    /// Set by <run>, and cleared once the producer called <TapeJob::on_done>
+    bool unreported = false;
+    std::atomic_bool keepRunning {true};
+    util::semaphore wakeup;
+    /// Posted when <edited> or <busy> change, for <stop>
+    util::semaphore updated;
+    std::thread thread;
+
+    JobRunner(tape_buffer& owner, ReadGate& reads, const fs::path& clip_path)
+      : owner {owner}, reads {reads}
+    {
+      clip_fd = ::open(clip_path.c_str(), O_RDWR | O_CREAT, 0644);
+      if (clip_fd < 0) {
+        LOGE << "Could not open the tape clipboard: " << std::strerror(errno);
+      } else {
+        clip_frames = ::lseek(clip_fd, 0, SEEK_END) / sizeof(float);
+      }
+      owner.clip_frames = clip_frames;
+    }
+
+    ~JobRunner()
+    {
+      if (thread.joinable()) {
+        keepRunning = false;
+        wakeup.post();
+        thread.join();
+      }
+      if (fd >= 0) ::close(fd);
+      if (clip_fd >= 0) ::close(clip_fd);
+    }
+
+    /// Open the tape file at `path`, whose audio starts at `offset` and is
+    /// stored as `format`, and start the thread
+    void start(const fs::path& path, std::int64_t offset, util::SampleFormat format,
+      WrittenBlocks& blocks)
+    {
+      this->blocks = &blocks;
+      audio_offset = offset;
+      this->format = format;
+      sample_size = util::sample_size(format);
+      raw.resize(block_size * sample_size);
+      fd = ::open(path.c_str(), O_RDWR);
+      if (fd < 0) {
+        throw util::exception("Could not open tape file for jobs: {}", std::strerror(errno));
+      }
+      thread = std::thread(&JobRunner::main_routine, this);
+    }
+
+    /// Start the thread, working on `store` instead of the tape file
+    void start(util::CompressedAudioFile& store)
+    {
+      this->store = &store;
+      interleaved.resize(tracks * TapeJob::chunk_size);
+      thread = std::thread(&JobRunner::main_routine, this);
+    }
+
+    /// Run `job` on the thread. Only call while not <busy>.
+    void run(const TapeJob& job)
+    {
+      this->job = job;
+      unreported = true;
+      busy = true;
+      wakeup.post();
+    }
+
+    /// Let the running job finish, and stop the thread, calling
+    /// `while_waiting` whenever sections are edited, and at least every
+    /// <idle_interval>
+    template<typename F>
+    void stop(F&& while_waiting)
+    {
+      keepRunning = false;
+      wakeup.post();
+      while (busy) {
+        while_waiting();
+        updated.wait_for(idle_interval);
+      }
+      thread.join();
+    }
+
+    /// Called by the producer after taking sections from <edited>
+    void took_edited()
+    {
+      if (full.exchange(false)) room.post();
+    }
+
+    void main_routine()
+    {
+      // Jobs go after reads and writes. Failing this only matters when the
+      // CPU is busy.
+      if (::setpriority(PRIO_PROCESS, ::syscall(SYS_gettid), 10) != 0) {
+        LOGD << "Could not lower the tape job priority";
+      }
+      while (true) {
+        wakeup.wait();
+        if (busy) {
+          TIME_SCOPE("TapeBuffer job");
+          owner.job_progress = 0;
+          owner.running_job = job.op;
+          completed = job.run(*this);
+          if (!completed) {
+            LOGD << "Tape job cancelled";
+          }
+          owner.running_job = -1;
+          busy = false;
+          updated.post();
+          owner.notify_update(tape_buffer::Edited);
+        }
+        if (!keepRunning) break;
+      }
+    }
+
+    /* TapeJob::Tape */
+
+    int length() const override
+    {
+      return tape_buffer::max_length;
+    }
+
+    int clip_length() const override
+    {
+      return clip_frames;
+    }
+
+    void resize_clip(int frames) override
+    {
+      if (::ftruncate(clip_fd, 0) != 0
+        || ::ftruncate(clip_fd, std::int64_t(frames) * sizeof(float)) != 0) {
+        LOGE << "Could not resize the tape clipboard: " << std::strerror(errno);
+      }
+      clip_frames = frames;
+    }
+
+    void read(int track, int position, float* dst, int n) override
+    {
+      if (track == TapeJob::clipboard) {
+        int valid = std::clamp(clip_frames - position, 0, n);
+        auto done = pread_all(clip_fd, dst, valid * sizeof(float), position * sizeof(float));
+        std::fill(dst + done / sizeof(float), dst + n, 0.f);
+        return;
+      }
+      if (store) {
+        store->read(position, interleaved.data(), n);
+        for (int i = 0; i < n; i++) dst[i] = interleaved[i * tracks + track];
+        return;
+      }
+      for_each_block(position, n, [&] (int first, int last) {
+          float* samples = dst + (first - position);
+          if (blocks->is_open() && !blocks->test(track, first / block_size)) {
+            std::fill(samples, samples + (last - first), 0.f);
+            return;
+          }
+          std::size_t bytes = (last - first) * sample_size;
+          auto index = util::TapeFile::sample_index(track, first);
+          auto done = pread_all(fd, raw.data(), bytes, audio_offset + index * sample_size);
+          std::fill(raw.begin() + done, raw.begin() + bytes, std::byte(0));
+          util::decode_samples(format, raw.data(), samples, last - first);
+        });
+    }
+
+    void write(int track, int position, const float* src, int n) override
+    {
+      if (track == TapeJob::clipboard) {
+        std::size_t bytes = n * sizeof(float);
+        if (pwrite_all(clip_fd, src, bytes, position * sizeof(float)) < bytes) {
+          LOGE << "Could not write the tape clipboard: " << std::strerror(errno);
+        }
+        clip_frames = std::max(clip_frames, position + n);
+        return;
+      }
+      if (store) {
+        // The other tracks are written back as they were
+        store->read(position, interleaved.data(), n);
+        for (int i = 0; i < n; i++) interleaved[i * tracks + track] = src[i];
+        store->write(position, interleaved.data(), n);
+      } else {
+        for_each_block(position, n, [&] (int first, int last) {
+            const float* samples = src + (first - position);
+            if (blocks->is_open()) {
+              // Silence in a block that was never written is already there
+              if (!blocks->test(track, first / block_size)
+                && std::all_of(samples, samples + (last - first),
+                  [] (float f) { return f == 0; })) return;
+              blocks->mark(track, first, last);
+            }
+            std::size_t bytes = (last - first) * sample_size;
+            util::encode_samples(format, samples, raw.data(), last - first);
+            auto index = util::TapeFile::sample_index(track, first);
+            if (pwrite_all(fd, raw.data(), bytes, audio_offset + index * sample_size) < bytes) {
+              LOGE << "Tape job write failed: " << std::strerror(errno);
+            }
+          });
+      }
+      while (!edited.try_push({{position, position + n}, track})) {
+        full = true;
+        // The producer may have made room before it saw `full`
+        if (edited.try_push({{position, position + n}, track})) break;
+        updated.post();
+        owner.notify_update(tape_buffer::Edited);
+        room.wait_for(idle_interval);
+      }
+      updated.post();
+      owner.notify_update(tape_buffer::Edited);
+    }
+
+    bool progress(float done) override
+    {
+      owner.job_progress = done;
+      yield_to_reads();
+      return !owner.cancel_requested;
+    }
+
+    /// Call `f(first, last)` for the frames in `[position, position + n)` in
+    /// each block of the tape file, where a track is contiguous
+    template<typename F>
+    static void for_each_block(int position, int n, F&& f)
+    {
+      int end = position + n;
+      for (int first = position; first < end;) {
+        int last = std::min(block_start(first) + block_size, end);
+        f(first, last);
+        first = last;
+      }
+    }
+
+    /// Read up to `n` bytes at `offset`, stopping at the end of the file or
+    /// an error. Returns the number of bytes read.
+    static std::size_t pread_all(int fd, void* dst, std::size_t n, std::int64_t offset)
+    {
+      std::size_t done = 0;
+      while (done < n) {
+        auto res = ::pread(fd, static_cast<char*>(dst) + done, n - done, offset + done);
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0) {
+          LOGE << "Tape job read failed: " << std::strerror(errno);
+        }
+        if (res <= 0) break;
+        done += res;
+      }
+      return done;
+    }
+
+    /// Write `n` bytes at `offset`. Returns the number of bytes written,
+    /// which is less than `n` on errors.
+    static std::size_t pwrite_all(int fd, const void* src, std::size_t n, std::int64_t offset)
+    {
+      std::size_t done = 0;
+      while (done < n) {
+        auto res = ::pwrite(fd, static_cast<const char*>(src) + done, n - done, offset + done);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        done += res;
+      }
+      return done;
+    }
+
+    /// Wait while the producer reads, if the tape is about to run out
+    void yield_to_reads()
+    {
+      reads.wait([&] { return owner.stats.margin < low_margin; }, max_yield);
+    }
+  };
+
+  /// Handles all interactions with the tapefile except writing recorded
+  /// frames, which is left to <WriteBack>. Works on its own thread
   struct Producer {
 
-    /// The desired distance from the playpoint to the head, and vice versa for
-    /// the tail
-    const int goal_length = tape_buffer::buffer_size / 2 - 2;
+    /// The number of frames the loaded section can span
+    const int capacity = tape_buffer::buffer_size - 4;
+
+    /// The least amount of the buffer spent in the direction of travel, even
+    /// when making room for a jump target behind the playpoint
+    const int min_lead = capacity / 4;
+
+    /// The minimum number of samples to read from file. Scaled up by the
+    /// tape speed, so fast spooling reads in bigger chunks.
+    const int min_read_size = tape_buffer::buffer_size >> 8;
+
+    /// Positions the tape recently jumped away from, most recent first, or
+    /// `-1`
+    std::array<int, tape_buffer::max_jump_targets> recent_positions;
+    /// The position the seek region in each slot is around, or `-1`
+    std::array<int, tape_buffer::max_seek_regions> region_centers;
+    std::array<std::unique_ptr<TapeCache>, tape_buffer::max_seek_regions> seek_regions;
+    /// The position at the start of the last cycle
+    int last_index = 0;
+
+    /// How long to sleep when nothing happens, before doing background work
+    const std::chrono::milliseconds idle_interval {50};
+
+    /// The next overview level to load from disk, or `-1` when done
+    int next_overview_level = -1;
+    /// Whether the spool data is on disk, but not loaded yet
+    bool spool_pending = false;
+    /// Whether the spool data is being rebuilt. It is not ready until done.
+    bool spool_rebuilding = false;
+    /// Overview and spool data rebuilding progress, for tapes that have none
+    int rebuild_position = tape_buffer::max_length;
+    const int rebuild_size = 1 << 16;
+    /// Frames of each track read for the overviews and spool data
+    std::array<std::vector<float>, tracks> scratch;
+    /// Frames of all tracks read from and written to the <store>, which
+    /// keeps them interleaved
+    std::vector<float> interleaved;
+
+    /// The loop the cache was made for, as last seen in `owner.loop`
+    util::audio::Section<int> cached_loop = {0, 0};
+    /// Frames kept on each side of the loop in the cache, for interpolation
+    /// and reads that run a bit past the loop points
+    const int loop_cache_padding = min_read_size * 4;
+    /// Write back the loop cache when this much is dirty, even if it is still
+    /// being written to
+    const int loop_writeback_size = 1 << 16;
+    /// The dirty section of each track of the loop cache in the last cycle
+    std::array<util::audio::Section<int>, tracks> last_loop_dirty;
+    std::unique_ptr<TapeCache> loop_cache;
+
+    const fs::path path = Globals::data_dir / "tape.wav";
+    const fs::path store_path = Globals::data_dir / "tape.blocks";
+    const fs::path journal_path = Globals::data_dir / "tape.journal";
+    const fs::path clip_path = Globals::data_dir / "tape.clip";
+
+    /// The slices and loop points as of the last entry written to the
+    /// journal. Only touched by the producer, so they can be stored without
+    /// racing the UI.
+    std::array<TapeSliceSet, tracks> journaled;
+    util::audio::Section<int> journaled_loop = {-1, -1};
+    /// Start a new journal once it has this many entries
+    const std::size_t max_journal_length = 4096;
+    /// Wait at most this long before syncing appended entries, so a burst of
+    /// edits costs one sync. Edits made since can be lost in a crash, but the
+    /// journal stays consistent.
+    const std::chrono::seconds journal_sync_interval {1};
+    std::chrono::steady_clock::time_point last_journal_sync;
+    bool journal_unsynced = false;
+    std::vector<TapeJournal::Entry> journal_entries;
+    util::TapeFile file;
+    /// The audio, if the tape is compressed. The tape file then only holds
+    /// the metadata, and is not mapped.
+    util::CompressedAudioFile store;
+    /// Which blocks of each track of the tape file were ever written. Not
+    /// used with the <store>, which keeps track of whole frames itself.
+    WrittenBlocks written_blocks;
+
+    /// Reads into the buffer, in flight together when the kernel supports
+    /// it. See <read_wrapped>.
+    util::IOQueue io;
+    /// A descriptor of the tape file for <io>, or `-1` if it is not used, in
+    /// which case the buffer goes through the mapping like everything else
+    int io_fd = -1;
+    /// Frames in a block that <io_fd> can transfer. More than one with
+    /// `O_DIRECT`.
+    int io_block = 1;
+    /// Whether the tape file can be streamed with `O_DIRECT`
+    bool direct = false;
+    /// Buffer reads land here first, unless the file stores floats
+    std::unique_ptr<StagingRing> staging;
+    struct QueuedRead {
+      float* samples;
+      int n;
+      /// Where the samples are read to, in the file's format
+      std::byte* raw;
+    };
+    /// Queued buffer reads, indexed by tag
+    std::vector<QueuedRead> queued_reads;
+
+    ReadGate reads;
+    WriteBack writer;
+    JobRunner jobs;
+
+    std::thread thread;
+    tape_buffer& owner;
+    std::atomic_bool keepRunning {true};
+
+    /// Pending <tape_buffer::Request> flags
+    std::atomic<unsigned> requests {0};
+    /// Posted when `requests` goes from empty to non-empty
+    util::semaphore wakeup;
+
+    /// Cycles of <main_routine> started and finished, for <tape_buffer::sync>
+    std::atomic<unsigned> cycles_begun {0};
+    std::atomic<unsigned> cycles_done {0};
+    /// Threads in <tape_buffer::sync>
+    std::atomic_int syncing {0};
+    /// Posted after each cycle while anyone is <syncing>
+    util::semaphore cycle_done;
+
+    Producer(tape_buffer& owner)
+      : file {owner.sample_format}, writer {owner, reads},
+        jobs {owner, reads, clip_path}, owner {owner}
+    {
+      recent_positions.fill(-1);
+      region_centers.fill(-1);
+      last_loop_dirty.fill({0, 0});
+      thread = std::thread(&Producer::main_routine, this);
+    }
+
+    ~Producer()
+    {
+      keepRunning = false;
+      wakeup.post();
+      thread.join();
+    }
+
+    /// Add `r` to the pending requests, waking up the producer thread if it
+    /// had nothing to do. Lock free, so safe to call from the audio thread
+    void request(unsigned r)
+    {
+      if (r & tape_buffer::Written) {
+        writer.request();
+      }
+      if (requests.fetch_or(r) == 0) {
+        wakeup.post();
+      }
+    }
+
+    void main_routine()
+    {
+      // The slices come first, so the tape can be edited while the rest
+      // starts up
+      file.open(path);
+      read_slices();
+      replay_journal();
+      owner.slices_loaded = true;
+
+      open_store();
+      if (!store.is_open()) {
+        if (!file.has_current_layout()) {
+          LOGD << "Converting the tape to " << tracks << " planar tracks";
+          file.convert_layout();
+        }
+        map_file();
+        open_io();
+      }
+      init_overview();
+      init_spool();
+      init_metadata();
+      init_written_blocks();
+      compact_journal();
+      // The header is synced, and not rewritten until the end, so the writer
+      // can store the written map in place
+      if (store.is_open()) {
+        writer.start(store);
+        jobs.start(store);
+      } else {
+        writer.start(path, file.audio_offset(), file.info.format, direct, written_blocks);
+        jobs.start(path, file.audio_offset(), file.info.format, written_blocks);
+      }
+
+      while (keepRunning) {
+        {
+          TIME_SCOPE("TapeBuffer read cycle");
+          cycles_begun++;
+          // Everything requested after this point will wake us up again
+          unsigned requested = requests.exchange(0);
+          std::size_t index = owner.current_position;
+          if (requested & tape_buffer::Jumped) {
+            remember_position(last_index);
+          }
+
+          write_journal();
+          process_written();
+          process_edited();
+          start_job();
+          update_tracks();
+          update_loop_cache();
+          write_back_loop_cache();
+          if (owner.spooling && owner.spool_ready) {
+            // Reads come from the spool data
+            prefetch(index - min_read_size * 4, min_read_size * 8);
+          } else if (loop_cache && loop_cache->span().contains(index)) {
+            // Reads come from the loop cache. Keep the buffer ready for when
+            // the tape leaves the loop.
+            auto span = loop_cache->span();
+            fill_buffer(owner.speed >= 0 ? span.out : span.in);
+          } else {
+            fill_buffer(index);
+          }
+          complete_io();
+          update_seek_regions();
+          last_index = index;
+          load_overview();
+          file.flush_mapped(false);
+          IF_DEBUG(owner.dbg.margin_graph.push(
+              owner.stats.min_margin.exchange(buffer_size)));
+          cycles_done++;
+          if (syncing > 0) cycle_done.post();
+        }
+        // Wake up regularly for background work, even if the tape is stopped
+        wakeup.wait_for(idle_interval);
+      }
+
+      // Make sure everything is written. Queued jobs are dropped, but the
+      // running one is finished, rather than left half done.
+      jobs.stop([&] { process_written(); process_edited(); });
+      process_edited();
+      finish_job();
+      drop_jobs();
+      writer.stop([&] { process_written(); });
+      process_written();
+      release_loop_cache();
+      for (int r = 0; r < tape_buffer::max_seek_regions; r++) {
+        release_seek_region(r);
+      }
+      write_journal();
+      sync_journal(true);
+      compact_journal();
+
+      complete_io();
+      if (io_fd >= 0) ::close(io_fd);
+      file.unmap_audio();
+      if (written_blocks.is_open()) written_blocks.close(file);
+      file.close();
+      store.close();
+    }
+
+    /// Open the compressed audio, if the tape has it, or if it is new and
+    /// compression was asked for
+    void open_store()
+    {
+      bool exists = fs::exists(store_path);
+      if (!exists && !(owner.compressed && file.length() == 0)) return;
+      int bits = file.info.format == util::SampleFormat::PCM16 ? 16 : 24;
+      if (!exists && file.info.format == util::SampleFormat::Float32) {
+        LOGD << "Compressed tapes store floats as 24 bit samples";
+      }
+      try {
+        store.open(store_path, tracks, bits, tape_buffer::max_length);
+        if (store.channels() != tracks) {
+          LOGE << "Compressed tape has " << store.channels() << " tracks, not "
+               << tracks << ". Using the tape file";
+          store.close();
+        }
+      } catch (util::exception& e) {
+        LOGE << "Could not open compressed tape, using the tape file: " << e.what();
+      }
+    }
+
+    /// Map the whole tape into memory. On failure, file I/O falls back to
+    /// reading and writing through the file stream.
+    void map_file()
+    {
+      // The data chunk has a fixed size, so the overview and spool data can
+      // follow it
+      auto length = util::TapeFile::samples_for(tape_buffer::max_length);
+      file.reserve_audio(length);
+      try {
+        file.map_audio(length);
+        file.advise_mapped(util::MappedRegion::Advice::Sequential,
+          0, file.mapped_length());
+      } catch (util::ByteFile::Error& e) {
+        LOGE << "Could not map tape file, using stream I/O: " << e.what();
+      }
+    }
+
+    /// Use io_uring for the buffer, if the kernel has it, and `O_DIRECT` if
+    /// asked to. Otherwise, the buffer is read and written through the
+    /// mapping, where the kernel's read-ahead has to do.
+    void open_io()
+    {
+      direct = owner.direct_io;
+      if (direct && (!file.is_mapped()
+          || file.audio_offset() % tape_buffer::io_alignment != 0)) {
+        LOGE << "Tape file is not laid out for O_DIRECT, using the page cache";
+        direct = false;
+      }
+      if (!io.is_async() && !direct) return;
+      if (direct) {
+        io_fd = ::open(path.c_str(), O_RDWR | O_DIRECT);
+        if (io_fd >= 0) {
+          io_block = direct_block_for(file.sample_size());
+        } else {
+          LOGE << "Could not open tape file with O_DIRECT: " << std::strerror(errno);
+          if (!io.is_async()) return;
+        }
+      }
+      if (io_fd < 0) {
+        io_fd = ::open(path.c_str(), O_RDWR);
+      }
+      if (io_fd < 0) {
+        LOGE << "Could not open tape file for async I/O: " << std::strerror(errno);
+        return;
+      }
+      if (file.info.format != util::SampleFormat::Float32) {
+        staging = std::make_unique<StagingRing>(buffer_size, file.sample_size());
+      }
+    }
+
+    /// Update what depends on frames the writer has finished: the caches,
+    /// overviews and spool data
+    void process_written()
+    {
+      WriteBack::Written w;
+      while (writer.written.try_pop(w)) {
+        writer.took_written();
+        auto s = w.section;
+        sync_cache(loop_cache.get(), s, w.track);
+        for (auto&& region : seek_regions) {
+          sync_cache(region.get(), s, w.track);
+        }
+        update_overview(s.in, s.out, 1u << w.track);
+        update_spool(s.in, s.out);
+      }
+    }
+
+    /* Jobs */
+
+    /// Hand the next queued job to the job runner, once it is idle
+    void start_job()
+    {
+      if (jobs.busy) return;
+      finish_job();
+      TapeJob job;
+      if (owner.cancel_requested) {
+        drop_jobs();
+        owner.cancel_requested = false;
+        return;
+      }
+      if (!owner.jobs.try_pop(job)) return;
+      owner.queued_jobs--;
+      // Jobs work on the file, so everything recorded has to be there
+      writer.flush([&] { process_written(); });
+      process_written();
+      write_back_loop_cache<true>();
+      jobs.run(job);
+    }
+
+    /// Tell whoever started the job that last ran that it is over
+    void finish_job()
+    {
+      if (jobs.busy || !jobs.unreported) return;
+      jobs.unreported = false;
+      if (jobs.job.on_done) jobs.job.on_done(jobs.completed);
+    }
+
+    /// Drop the queued jobs
+    void drop_jobs()
+    {
+      TapeJob job;
+      while (owner.jobs.try_pop(job)) {
+        owner.queued_jobs--;
+        if (job.on_done) job.on_done(false);
+      }
+    }
+
+    /// Bring the buffer, the caches, the overviews and the spool data up to
+    /// date with the sections the running job has changed in the file
+    ///
+    /// Only the changed frames are read again, so playback carries on from
+    /// the buffer around them.
+    void process_edited()
+    {
+      JobRunner::Edited e;
+      while (jobs.edited.try_pop(e)) {
+        jobs.took_edited();
+        auto s = e.section;
+        unsigned mask = 1u << e.track;
+        // Frames recorded there are newer, and have to be written first
+        make_room(s);
+        if (owner.loaded_tracks & mask) {
+          int first = std::max<int>(s.in, owner.tail);
+          int last = std::min<int>(s.out, owner.head);
+          if (first < last) {
+            read_buffer(mask, first, last - first);
+            complete_io();
+          }
+        }
+        sync_cache(loop_cache.get(), s, e.track);
+        for (auto&& region : seek_regions) {
+          sync_cache(region.get(), s, e.track);
+        }
+        update_overview(s.in, s.out, mask);
+        update_spool(s.in, s.out);
+      }
+    }
+
+    /* Tracks */
+
+    /// Load the tracks the consumer wants into the buffer, and stop
+    /// streaming the others
+    ///
+    /// Tracks are dropped right away, and their rings left as they are. The
+    /// writer still writes what was recorded in them. Added tracks are read
+    /// for the whole loaded section before the consumer may use them.
+    void update_tracks()
+    {
+      // The store decodes all tracks at once, so there is nothing to save
+      unsigned wanted = store.is_open() ? all_tracks : owner.wanted_tracks & all_tracks;
+      unsigned loaded = owner.loaded_tracks & wanted;
+      owner.loaded_tracks = loaded;
+      unsigned added = wanted & ~loaded;
+      if (added == 0) return;
+
+      util::audio::Section<int> section = {owner.tail, owner.head};
+      // Frames recorded while a track was loaded before must not be
+      // overwritten
+      make_room(section);
+      read_buffer(added, section.in, section.size());
+      complete_io();
+      owner.loaded_tracks = loaded | added;
+    }
+
+    /* Loop cache */
+
+    /// Load the loop into memory when it changes, if it fits the budget
+    void update_loop_cache()
+    {
+      auto loop = owner.loop.load();
+      if (loop == cached_loop) return;
+      cached_loop = loop;
+      release_loop_cache();
+      if (loop.size() <= 0 || loop.in < 0) return;
+
+      util::audio::Section<int> span = {
+        std::max(0, loop.in - loop_cache_padding),
+        std::min<int>(tape_buffer::max_length, loop.out + loop_cache_padding)};
+      if (TapeCache::size_for(span.size()) > owner.loop_cache_budget) {
+        LOGD << "Loop of " << loop.size() << " frames does not fit in the loop cache";
+        return;
+      }
+
+      // Get everything recorded so far into the file first
+      writer.flush([&] { process_written(); });
+      process_written();
+      auto cache = std::make_unique<TapeCache>(span);
+      read_wrapped(all_tracks, rings_of(*cache), span.in, span.size());
+      owner.loop_cache = cache.get();
+      loop_cache = std::move(cache);
+      last_loop_dirty.fill({0, 0});
+    }
+
+    /// Unpublish the loop cache, wait for the consumer to let go of it, and
+    /// write back and free it
+    void release_loop_cache()
+    {
+      if (!loop_cache) return;
+      owner.loop_cache = nullptr;
+      wait_until_unused(loop_cache.get());
+      write_back_loop_cache<true>();
+      loop_cache.reset();
+    }
+
+    /// Write the dirty part of each track of the loop cache to the file
+    ///
+    /// This is lazy: unless `unconditionally` is set, it waits until overdubbing
+    /// pauses or a lot has been written.
+    template<bool unconditionally = false>
+    void write_back_loop_cache()
+    {
+      if (!loop_cache) return;
+      for (int track = 0; track < tracks; track++) {
+        auto dirty = loop_cache->peek_dirty(track);
+        bool growing = !(dirty == last_loop_dirty[track]);
+        last_loop_dirty[track] = dirty;
+        if (dirty.size() <= 0) continue;
+        if (!unconditionally && growing && dirty.size() < loop_writeback_size) continue;
+
+        dirty = loop_cache->take_dirty(track);
+        last_loop_dirty[track] = {0, 0};
+        auto cache = rings_of(*loop_cache);
+        write_wrapped(track, cache, dirty.in, dirty.size());
+        // Keep the buffer in sync where it holds the same positions
+        int first = std::max<int>(dirty.in, owner.tail);
+        int last = std::min<int>(dirty.out, owner.head);
+        for (int p = first; p < last; p++) {
+          owner.buffer[track][p & (buffer_size - 1)] = cache.at(track, p);
+        }
+        for (auto&& region : seek_regions) {
+          copy_to_cache(region.get(), dirty, track, cache);
+        }
+        update_overview(dirty.in, dirty.out, 1u << track);
+        update_spool(dirty.in, dirty.out);
+      }
+    }
+
+    /* Seek regions */
+
+    /// Add `position` to the recently left positions
+    void remember_position(int position)
+    {
+      // Wrapping around the loop is not worth remembering
+      if (loop_cache && loop_cache->span().contains(position)) return;
+      auto end = std::find(recent_positions.begin(), recent_positions.end() - 1, position);
+      std::move_backward(recent_positions.begin(), end, end + 1);
+      recent_positions[0] = position;
+    }
+
+    /// The section of tape to keep in a seek region around `center`. Mostly
+    /// ahead of it, since playback mostly goes forwards from a jump.
+    util::audio::Section<int> seek_region_span(int center)
+    {
+      return {
+        std::max(0, center - tape_buffer::seek_region_size / 4),
+        std::min<int>(tape_buffer::max_length,
+          center + tape_buffer::seek_region_size * 3 / 4)};
+    }
+
+    /// Keep a seek region around each jump target and recently left position,
+    /// so jumping there can play from memory while the buffer is refilled.
+    ///
+    /// Loads at most one region per cycle, so the buffer doesn't have to wait.
+    /// Regions that are no longer wanted are only unpublished, and their
+    /// memory is reused for the next one, so a target that moved a little
+    /// only needs the part of tape it moved onto read.
+    void update_seek_regions()
+    {
+      std::array<int, tape_buffer::max_seek_regions> wanted;
+      for (int i = 0; i < tape_buffer::max_jump_targets; i++) {
+        wanted[i] = owner.jump_targets[i];
+        wanted[tape_buffer::max_jump_targets + i] = recent_positions[i];
+      }
+
+      for (int r = 0; r < tape_buffer::max_seek_regions; r++) {
+        if (region_centers[r] < 0) continue;
+        if (std::find(wanted.begin(), wanted.end(), region_centers[r]) == wanted.end()) {
+          unpublish_seek_region(r);
+        }
+      }
+
+      for (int center : wanted) {
+        if (center < 0) continue;
+        if (std::find(region_centers.begin(), region_centers.end(), center)
+          != region_centers.end()) continue;
+        auto span = seek_region_span(center);
+        if (loop_cache && loop_cache->contains(span.in, span.out)) continue;
+
+        int r = free_seek_slot(span);
+        if (r < 0) return;
+        load_seek_region(r, span);
+        owner.seek_regions[r] = seek_regions[r].get();
+        region_centers[r] = center;
+        return;
+      }
+    }
+
+    /// The unpublished slot to load a region of `span` into, or `-1`
+    ///
+    /// Prefers the region that already holds most of `span`, and then any
+    /// allocated one, over allocating a new one.
+    int free_seek_slot(util::audio::Section<int> span)
+    {
+      int best = -1;
+      int best_score = -3;
+      for (int r = 0; r < tape_buffer::max_seek_regions; r++) {
+        if (region_centers[r] >= 0) continue;
+        auto& region = seek_regions[r];
+        // Only regions near the ends of the tape can be too small
+        int score = -2;
+        if (!region) {
+          score = -1;
+        } else if (region->fits(span)) {
+          auto old = region->span();
+          score = std::max(0, std::min(span.out, old.out) - std::max(span.in, old.in));
+        }
+        if (score > best_score) {
+          best = r;
+          best_score = score;
+        }
+      }
+      return best;
+    }
+
+    /// Fill the unpublished slot `r` with the tape in `span`
+    void load_seek_region(int r, util::audio::Section<int> span)
+    {
+      auto& region = seek_regions[r];
+      util::audio::Section<int> kept = {span.in, span.in};
+      if (region && region->fits(span)) {
+        // Unpublished regions are kept in sync with writes and edits, so
+        // only the new part has to be read
+        kept = region->move_to(span);
+      } else {
+        region = std::make_unique<TapeCache>(span);
+      }
+      auto rings = rings_of(*region);
+      if (kept.in > span.in) {
+        read_wrapped(all_tracks, rings, span.in, kept.in - span.in);
+      }
+      if (span.out > kept.out) {
+        read_wrapped(all_tracks, rings, kept.out, span.out - kept.out);
+      }
+      // Unwritten frames in the buffer are newer than the file
+      auto buffer = rings_of(owner.buffer);
+      for (int track = 0; track < tracks; track++) {
+        copy_to_cache(region.get(), owner.write_sects[track].load(), track, buffer);
+        copy_to_cache(region.get(), writer.writing[track].load(), track, buffer);
+      }
+    }
+
+    /// Stop the consumer from using the region in slot `r`, keeping its
+    /// memory for <load_seek_region>
+    void unpublish_seek_region(int r)
+    {
+      if (region_centers[r] < 0) return;
+      owner.seek_regions[r] = nullptr;
+      wait_until_unused(seek_regions[r].get());
+      region_centers[r] = -1;
+    }
+
+    void release_seek_region(int r)
+    {
+      unpublish_seek_region(r);
+      seek_regions[r].reset();
+    }
+
+    /// Wait for the consumer to let go of an unpublished cache
+    void wait_until_unused(TapeCache* cache)
+    {
+      owner.cache_unpublished = cache;
+      while (owner.cache_in_use == cache) {
+        // Posts left over from earlier waits just go around the loop again
+        owner.cache_released.wait_for(idle_interval);
+      }
+      owner.cache_unpublished = nullptr;
+    }
+
+    /// Copy the positions of `track` in `s` that `cache` holds from `src`
+    void copy_to_cache(TapeCache* cache, util::audio::Section<int> s, int track,
+      const TrackRings& src)
+    {
+      if (!cache) return;
+      auto span = cache->span();
+      int last = std::min(s.out, span.out);
+      for (int p = std::max(s.in, span.in); p < last; p++) {
+        cache->at(track, p) = src.at(track, p);
+      }
+    }
 
-    /// The minimum number of samples to read from file
-    const int min_read_size = tape_buffer::buffer_size >> 8;
-    const int min_write_size = tape_buffer::buffer_size >> 8;
+    /// Copy the positions of `track` in `s` that `cache` holds from the
+    /// buffer, where it still has them, and otherwise from the file
+    void sync_cache(TapeCache* cache, util::audio::Section<int> s, int track)
+    {
+      if (!cache) return;
+      auto span = cache->span();
+      int first = std::max(s.in, span.in);
+      int last = std::min(s.out, span.out);
+      if (first >= last) return;
+      unsigned mask = 1u << track;
+      auto rings = rings_of(*cache);
+      if (!(owner.loaded_tracks & mask)) {
+        read_wrapped(mask, rings, first, last - first);
+        return;
+      }
+      int tail = std::clamp<int>(owner.tail, first, last);
+      int head = std::clamp<int>(owner.head, tail, last);
+      read_wrapped(mask, rings, first, tail - first);
+      copy_to_cache(cache, {tail, head}, track, rings_of(owner.buffer));
+      read_wrapped(mask, rings, head, last - head);
+    }
 
-    const fs::path path = Globals::data_dir / "tape.wav";
-    util::TapeFile file;
-    std::thread thread;
-    tape_buffer& owner;
-    std::mutex global_lock;
-    std::condition_variable waiting;
-    std::atomic_bool keepRunning {true};
+    /* Overview */
 
-    Producer(tape_buffer& owner)
-      : owner {owner},
-        thread {&Producer::main_routine, this}
-    {}
+    /// Make sure the tape file has overviews. Tapes from before overviews were
+    /// added get them rebuilt in the background.
+    void init_overview()
+    {
+      if (file.has_overview()
+        && file.overviews[0].length() == tape_buffer::max_length) {
+        next_overview_level = file.overviews[0].levels() - 1;
+        rebuild_position = tape_buffer::max_length;
+        return;
+      }
+      file.create_overview(tape_buffer::max_length);
+      file.write_file();
+      next_overview_level = -1;
+      owner.overview_level = 0;
+      rebuild_position = 0;
+    }
 
-    ~Producer()
+    /// Do a bit of background work: load one overview level from disk,
+    /// coarsest first, then the spool data, or rebuild a part of missing
+    /// overviews and spool data.
+    void load_overview()
     {
-      keepRunning = false;
-      {
-        std::unique_lock lock {global_lock};
-        waiting.notify_all();
+      if (next_overview_level >= 0) {
+        file.load_overview_level(next_overview_level);
+        owner.overview_level = next_overview_level;
+        next_overview_level--;
+      } else if (spool_pending) {
+        file.load_spool();
+        spool_pending = false;
+        owner.spool_ready = true;
+      } else if (rebuild_position < (int) tape_buffer::max_length) {
+        int last = std::min<int>(rebuild_position + rebuild_size, tape_buffer::max_length);
+        update_overview(rebuild_position, last, all_tracks);
+        update_spool(rebuild_position, last);
+        rebuild_position = last;
+        if (rebuild_position == (int) tape_buffer::max_length && spool_rebuilding) {
+          spool_rebuilding = false;
+          owner.spool_ready = true;
+        }
       }
-      thread.join();
     }
 
-    void main_routine()
+    /// Recompute the overviews of frames `[first, last)` of the tracks in
+    /// the bitmask `mask` from the file, and store them
+    void update_overview(int first, int last, unsigned mask)
     {
-      file.open(path);
-      read_slices();
+      using Overview = util::audio::Overview;
+      // Levels loaded after this would overwrite the new points
+      for (; next_overview_level >= 0; next_overview_level--) {
+        file.load_overview_level(next_overview_level);
+      }
+      owner.overview_level = 0;
 
-      while (keepRunning) {
-        std::unique_lock lock {global_lock};
-        {
-          TIME_SCOPE("TapeBuffer read cycle");
-          std::size_t index = owner.current_position;
+      first = std::max(0, first) / Overview::block_size * Overview::block_size;
+      last = std::min<int>(tape_buffer::max_length, last);
+      if (first >= last) return;
 
-          write_from_buffer();
-          fill_buffer(index);
-        }
-        waiting.wait(lock);
+      load_scratch(first, last, mask);
+      for (int t = 0; t < tracks; t++) {
+        if (!(mask & (1u << t))) continue;
+        file.overviews[t].update(first, last, [&] (std::size_t i) {
+            return scratch[t][i - first];
+          });
+      }
+      file.store_overview(first, last);
+    }
+
+    /* Spool data */
+
+    /// Make sure the tape file has spool data. Like overviews, it is loaded or
+    /// rebuilt in the background.
+    void init_spool()
+    {
+      if (file.has_spool() && file.spool.length() == tape_buffer::max_length) {
+        spool_pending = true;
+        return;
       }
+      file.create_spool(tape_buffer::max_length);
+      file.write_file();
+      // Spooling reads the buffer until the spool data is rebuilt
+      spool_rebuilding = true;
+      rebuild_position = 0;
+    }
 
-      // Make sure everything is written
-      write_from_buffer<true>();
-      write_slices();
+    /// Recompute the spool data affected by frames `[first, last)`, and
+    /// store it
+    void update_spool(int first, int last)
+    {
+      if (spool_pending) {
+        // Loading it after this would overwrite the new frames
+        file.load_spool();
+        spool_pending = false;
+        owner.spool_ready = true;
+      }
+      if (first >= last) return;
+      auto [s0, s1] = file.spool.support(first, last);
+      s0 = std::max<std::int64_t>(s0, 0);
+      s1 = std::min<std::int64_t>(s1, tape_buffer::max_length);
+      if (s0 >= s1) return;
+      load_scratch(s0, s1, all_tracks);
+      auto [k0, k1] = file.spool.update(first, last, [&] (std::int64_t i) {
+          value_type frame;
+          for (int t = 0; t < tracks; t++) frame[t] = scratch[t][i - s0];
+          return frame;
+        });
+      file.store_spool(k0, k1);
+    }
 
-      file.close();
+    /// Read frames `[first, last)` of the tracks in the bitmask `mask` from
+    /// the file into <scratch>
+    void load_scratch(int first, int last, unsigned mask)
+    {
+      complete_io();
+      std::array<float*, tracks> planes;
+      for (int t = 0; t < tracks; t++) {
+        if (mask & (1u << t)) scratch[t].resize(last - first);
+        planes[t] = scratch[t].data();
+      }
+      read_span(mask, first, planes, last - first);
     }
 
-    /// Write everything in `owner.write_sect`
-    template<bool unconditionally = false>
-    void write_from_buffer()
+    /// The number of frames to keep loaded behind and ahead of the playpoint
+    struct Window {
+      int behind;
+      int ahead;
+    };
+
+    /// Decide how to split the buffer around `index`.
+    ///
+    /// A stopped tape is as likely to go one way as the other, so the window
+    /// is symmetric. A moving tape mostly keeps going, so most of the buffer is
+    /// spent in the direction of travel. Jump targets just behind the playpoint
+    /// are kept in the window as long as that leaves at least <min_lead> frames
+    /// ahead.
+    Window goal_window(int index)
     {
-      auto write_sect = owner.write_sect.load();
-      if (unconditionally
-        || write_sect.size() > min_write_size
-        || (write_sect.in - owner.tail)  <= min_read_size * 2
-        || (owner.head - write_sect.out) <= min_read_size * 2)
-      {
-        write_wrapped(write_sect.in, write_sect.size());
+      float speed = owner.speed;
+      int lead = capacity * (0.5f + 0.4f * std::min(std::abs(speed), 1.f));
+      int trail = capacity - lead;
 
-        // Atomically update `write_sect`
-        util::audio::Section<int> new_sect;
-        auto expected_sect = owner.write_sect.load();
-        do {
-          new_sect = expected_sect - write_sect;
-        } while (!owner.write_sect.compare_exchange_weak(
-            expected_sect, new_sect));
+      for (auto&& target : owner.jump_targets) {
+        int t = target;
+        if (t < 0) continue;
+        int dist = speed >= 0 ? index - t : t - index;
+        if (dist > trail && dist + min_read_size <= capacity - min_lead) {
+          trail = dist + min_read_size;
+          lead = capacity - trail;
+        }
       }
+
+      if (speed >= 0) return {trail, lead};
+      return {lead, trail};
     }
 
     /// Fill the buffer as needed, assuming `index` is the current position.
     /// This is the only function that can modify `owner.head` & `owner.tail`!
     void fill_buffer(int index)
     {
-      if (auto diff = goal_length - (owner.head - index);
-        diff > min_read_size)
-      {
-        read_wrapped(owner.head, diff);
-        owner.head = std::clamp(owner.head + diff, 0, (int) tape_buffer::max_length);
-        if (auto dst = owner.head - owner.tail; dst > buffer_size) {
+      auto [behind, ahead] = goal_window(index);
+      int read_size = min_read_size * std::max(1.f, std::abs(owner.speed.load()));
+
+      if (index < owner.tail || index > owner.head) {
+        // The tape jumped out of the loaded section. Start over from here
+        owner.tail = index;
+        owner.head = index;
+      }
+
+      int goal_head = std::min(index + ahead, (int) tape_buffer::max_length);
+      int head_diff = goal_head - owner.head;
+      int goal_tail = std::max(index - behind, 0);
+      int tail_diff = owner.tail - goal_tail;
+      if (head_diff <= read_size && tail_diff <= read_size) return;
+
+      util::audio::Section<int> head_read = {owner.head, goal_head};
+      util::audio::Section<int> tail_read = {goal_tail, owner.tail};
+      if (head_diff <= read_size) head_read = {0, 0};
+      if (tail_diff <= read_size) tail_read = {0, 0};
+      make_room(head_read);
+      make_room(tail_read);
+
+      // Both reads are queued before either is waited for, so they are in
+      // flight together
+      auto start = std::chrono::steady_clock::now();
+      unsigned loaded = owner.loaded_tracks;
+      reads.begin();
+      if (head_read.size() > 0) {
+        read_buffer(loaded, head_read.in, head_read.size());
+      }
+      if (tail_read.size() > 0) {
+        read_buffer(loaded, tail_read.in, tail_read.size());
+      }
+      complete_io();
+      reads.end();
+      owner.stats.read_latency.record(std::chrono::steady_clock::now() - start);
+
+      if (auto diff = head_diff; diff > read_size) {
+        owner.head += diff;
+        if (auto dst = owner.head - owner.tail; dst > buffer_size - 2) {
           // Get rid of overlap
-          owner.tail += std::max(0, dst - buffer_size + 2);
+          owner.tail += dst - buffer_size + 2;
         }
+        prefetch(owner.head, read_size * 4);
       }
-      if (auto diff = goal_length - (index - owner.tail);
-        diff > min_read_size)
-      {
-        int read_pos = std::clamp(owner.tail - diff, 0, (int) tape_buffer::max_length);
-        read_wrapped(read_pos, diff);
-        owner.tail = read_pos;
-        if (auto dst = owner.head - owner.tail; dst > buffer_size) {
+
+      if (auto diff = tail_diff; diff > read_size) {
+        owner.tail = goal_tail;
+        if (auto dst = owner.head - owner.tail; dst > buffer_size - 2) {
           // Get rid of overlap
-          owner.head -= std::max(0, dst - buffer_size + 2);
+          owner.head -= dst - buffer_size + 2;
+        }
+        prefetch(goal_tail - read_size * 4, read_size * 4);
+      }
+    }
+
+    /// Whether sections `a` and `b` use any of the same slots in the buffer
+    static bool share_slots(util::audio::Section<int> a, util::audio::Section<int> b)
+    {
+      if (a.size() <= 0 || b.size() <= 0) return false;
+      if (a.size() >= buffer_size || b.size() >= buffer_size) return true;
+      int d = (b.in - a.in) & (buffer_size - 1);
+      return d < a.size() || d + b.size() > buffer_size;
+    }
+
+    /// Make sure reading `s` into the buffer does not overwrite frames that
+    /// are not written yet, by waiting for the writer if it would
+    void make_room(util::audio::Section<int> s)
+    {
+      for (int track = 0; track < tracks; track++) {
+        if (share_slots(s, owner.write_sects[track].load())
+          || share_slots(s, writer.writing[track].load())) {
+          writer.flush([&] { process_written(); });
+          return;
         }
       }
     }
 
-    /// Read `n` samples to `position`, splitting the operation into two reads if
-    /// wrapping is necessary
+    /// Read `n` frames of the tracks in the bitmask `mask` at `position` into
+    /// the buffer. With <io_fd>, the reads are only queued, and done by the
+    /// next <complete_io>.
+    void read_buffer(unsigned mask, int position, int n)
+    {
+      if (io_fd >= 0) {
+        queue_wrapped(mask, position, n);
+        return;
+      }
+      read_wrapped(mask, rings_of(owner.buffer), position, n);
+    }
+
+    /// Read `n` frames of the tracks in the bitmask `mask` at `position` into
+    /// `rings`, splitting the operation into two reads if wrapping is
+    /// necessary
     ///
     /// This could have been done just using the wrapping array iterators, but
     /// performance tests (see `test/util/bytefile.t.cpp`) say the pointer
     /// optimization is around 50 times faster
-    void read_wrapped(int position, int n)
+    void read_wrapped(unsigned mask, const TrackRings& rings, int position, int n)
     {
+      // The file has to be up to date
+      complete_io();
       // We dont have to worry about thread safety in here, everything is thread local
-      int wrap_pos = wrap(position);
-      int overflow = std::max(0, wrap_pos + n - buffer_size);
-      file.seek(4 * position);
-      file.read_samples((owner.buffer.data() + wrap_pos)->data(), 4 * (n - overflow));
+      int wrap_pos = position & (rings.size - 1);
+      int overflow = std::max(0, wrap_pos + n - rings.size);
+      read_span(mask, position, rings.planes(position), n - overflow);
       if (overflow > 0) {
-        file.read_samples(owner.buffer.data()->data(), 4 * overflow);
+        read_span(mask, position + n - overflow, rings.planes(0), overflow);
       }
     }
 
-    /// Write `n` samples to `position`, splitting the operation into two writes if
-    /// wrapping is necessary
-    ///
-    /// This could have been done just using the wrapping array iterators, but
-    /// performance tests (see `test/util/bytefile.t.cpp`) say the pointer
-    /// optimization is around 50 times faster
-    void write_wrapped(int position, int n)
+    /// Write `n` frames of `track` at `position` from `rings`
+    void write_wrapped(int track, const TrackRings& rings, int position, int n)
     {
       // We dont have to worry about thread safety in here, everything is thread local
-      int wrap_pos = wrap(position);
-      int overflow = std::max(0, wrap_pos + n - buffer_size);
-      file.seek(4 * position);
-      file.write_samples((owner.buffer.data() + wrap_pos)->data(), 4 * (n - overflow));
+      int wrap_pos = position & (rings.size - 1);
+      int overflow = std::max(0, wrap_pos + n - rings.size);
+      write_span(track, position, rings.data[track] + wrap_pos, n - overflow);
       if (overflow > 0) {
-        file.write_samples(owner.buffer.data()->data(), 4 * overflow);
+        write_span(track, position + n - overflow, rings.data[track], overflow);
+      }
+    }
+
+    /// Queue a read of `n` frames of the tracks in the bitmask `mask` at
+    /// `position` into the buffer, one request per block of each track. They
+    /// are done by the next <complete_io>.
+    void queue_wrapped(unsigned mask, int position, int n)
+    {
+      position = std::max(0, position);
+      n = std::min<int>(n, tape_buffer::max_length - position);
+      for (int track = 0; track < tracks; track++) {
+        if (!(mask & (1u << track))) continue;
+        // Blocks never wrap around the buffer
+        for_each_block(track, position, n, [&] (int first, int last, bool written) {
+            float* samples = owner.buffer[track].data() + (first & (buffer_size - 1));
+            if (!written) {
+              std::fill(samples, samples + (last - first), 0.f);
+              return;
+            }
+            // With O_DIRECT, only whole blocks can be queued. The ragged ends
+            // go through the mapping, which never touches the same pages.
+            int a = (first + io_block - 1) / io_block * io_block;
+            int b = last / io_block * io_block;
+            if (a >= b) {
+              a = b = last;
+            }
+            if (a > first) {
+              read_file(track, first, samples, a - first);
+            }
+            if (b < last) {
+              read_file(track, b, samples + (b - first), last - b);
+            }
+            if (a < b) {
+              queue_span(track, a, samples + (a - first), b - a);
+            }
+          });
+      }
+    }
+
+    /// Queue a read of `n` samples of `track` at `position`, inside one
+    /// block, into the contiguous `samples`
+    void queue_span(int track, int position, float* samples, int n)
+    {
+      auto offset = file.audio_offset()
+        + util::TapeFile::sample_index(track, position) * file.sample_size();
+      auto* raw = staging ? staging->at(track, position) : reinterpret_cast<std::byte*>(samples);
+      io.read(io_fd, raw, n * file.sample_size(), offset, queued_reads.size());
+      queued_reads.push_back({samples, n, raw});
+    }
+
+    /// Wait for all queued buffer reads
+    void complete_io()
+    {
+      if (io.queued() == 0) return;
+      for (auto&& c : io.complete()) {
+        auto& q = queued_reads[c.tag];
+        int bytes = q.n * file.sample_size();
+        if (c.result < 0) {
+          LOGE << "Tape read failed: " << std::strerror(-c.result);
+        } else if (c.result < bytes) {
+          // Past the end of the file
+          std::fill(q.raw + c.result, q.raw + bytes, std::byte(0));
+        }
+        if (staging) {
+          util::decode_samples(file.info.format, q.raw, q.samples, q.n);
+        }
+      }
+      queued_reads.clear();
+    }
+
+    /// Read `n` frames of the tracks in the bitmask `mask` at `position`
+    /// into the contiguous ranges `planes`, one for each track
+    void read_span(unsigned mask, int position, const std::array<float*, tracks>& planes, int n)
+    {
+      if (store.is_open()) {
+        for (int done = 0; done < n; done += block_size) {
+          int len = std::min(n - done, block_size);
+          interleaved.resize(tracks * len);
+          store.read(position + done, interleaved.data(), len);
+          for (int t = 0; t < tracks; t++) {
+            if (!(mask & (1u << t))) continue;
+            for (int i = 0; i < len; i++) {
+              planes[t][done + i] = interleaved[i * tracks + t];
+            }
+          }
+        }
+        return;
+      }
+      for (int track = 0; track < tracks; track++) {
+        if (!(mask & (1u << track))) continue;
+        for_each_block(track, position, n, [&] (int first, int last, bool written) {
+            float* dst = planes[track] + (first - position);
+            if (written) {
+              read_file(track, first, dst, last - first);
+            } else {
+              std::fill(dst, dst + (last - first), 0.f);
+            }
+          });
+      }
+    }
+
+    /// Read `n` samples of `track` at `position`, inside one block, from the
+    /// tape file into the contiguous range `dst`
+    void read_file(int track, int position, float* dst, int n)
+    {
+      auto index = util::TapeFile::sample_index(track, position);
+      if (!file.is_mapped()) {
+        file.seek(index);
+        file.read_samples(dst, n);
+        return;
+      }
+      int valid = std::clamp<util::SoundFile::Position>(file.mapped_length() - index, 0, n);
+      file.read_mapped(index, dst, valid);
+      std::fill(dst + valid, dst + n, 0.f);
+    }
+
+    /// Write `n` frames of `track` from the contiguous range `src` to
+    /// `position`
+    void write_span(int track, int position, const float* src, int n)
+    {
+      if (store.is_open()) {
+        // The store keeps frames interleaved, so the other tracks are
+        // written back as they were
+        for (int done = 0; done < n; done += block_size) {
+          int len = std::min(n - done, block_size);
+          interleaved.resize(tracks * len);
+          store.read(position + done, interleaved.data(), len);
+          for (int i = 0; i < len; i++) {
+            interleaved[i * tracks + track] = src[done + i];
+          }
+          store.write(position + done, interleaved.data(), len);
+        }
+        return;
+      }
+      for_each_block(track, position, n, [&] (int first, int last, bool) {
+          if (first < 0) return;
+          written_blocks.mark(track, first, last);
+          const float* samples = src + (first - position);
+          auto index = util::TapeFile::sample_index(track, first);
+          if (!file.is_mapped()) {
+            file.seek(index);
+            file.write_samples(samples, last - first);
+            return;
+          }
+          int valid = std::clamp<util::SoundFile::Position>(file.mapped_length() - index, 0, last - first);
+          file.write_mapped(index, samples, valid);
+        });
+    }
+
+    /// Ask the kernel to start loading `n` frames of the loaded tracks from
+    /// `position`, so the next read from the mapping doesn't block on the
+    /// disk
+    void prefetch(int position, int n)
+    {
+      if (!file.is_mapped()) return;
+      unsigned mask = owner.loaded_tracks;
+      for (int track = 0; track < tracks; track++) {
+        if (!(mask & (1u << track))) continue;
+        for_each_block(track, position, n, [&] (int first, int last, bool written) {
+            if (!written) return;
+            file.advise_mapped(util::MappedRegion::Advice::WillNeed,
+              util::TapeFile::sample_index(track, first), last - first);
+          });
       }
     }
 
+    /// Whether block `b` of `track` was ever written
+    bool block_written(int track, int b) const
+    {
+      if (b < 0) return false;
+      if (store.is_open()) return store.block_written(b);
+      return !written_blocks.is_open() || written_blocks.test(track, b);
+    }
+
+    /// Call `f(first, last, written)` for the frames of `track` in
+    /// `[position, position + n)` in each block of the tape file, in order
+    ///
+    /// The samples of a track are contiguous within a block, in the file and
+    /// in the buffer, so each call covers one transfer.
+    template<typename F>
+    void for_each_block(int track, int position, int n, F&& f)
+    {
+      int end = position + n;
+      for (int first = position; first < end;) {
+        int start = block_start(first);
+        int last = std::min(start + block_size, end);
+        f(first, last, block_written(track, start / block_size));
+        first = last;
+      }
+    }
+
+    /* Slices and journal */
+
+    /// Load the slices and loop points stored in the file
     void read_slices()
     {
-      for (int track = 0; track < 4; track++) {
+      for (int track = 0; track < tracks; track++) {
         auto& file_slices = file.slices[track];
-        auto& owner_slices = owner.slices[track];
         auto n = file_slices.count;
 
-        owner_slices.clear();
-        std::transform(std::begin(file_slices.array), std::begin(file_slices.array) + n,
-          std::back_inserter(owner_slices.slices), [] (auto&& slice) {
-            return util::audio::Section<int>{
+        owner.slices[track].clear();
+        journaled[track].clear();
+        std::for_each(std::begin(file_slices.array), std::begin(file_slices.array) + n,
+          [&] (auto&& slice) {
+            TapeSlice s = {
               gsl::narrow_cast<int>(slice.in),
               gsl::narrow_cast<int>(slice.out)};
+            owner.slices[track].add(s);
+            journaled[track].add(s);
           });
       }
+      journaled_loop = {file.metadata.loop_in, file.metadata.loop_out};
     }
 
+    /// Store the journaled slices and loop points in `file`
     void write_slices()
     {
-      for (int track = 0; track < 4; track++) {
+      for (int track = 0; track < tracks; track++) {
         auto& file_slices = file.slices[track];
-        auto& owner_slices = owner.slices[track];
-        auto n = std::min(file_slices.array.size(), owner_slices.size());
+        auto& track_slices = journaled[track];
+        auto n = std::min(file_slices.array.size(), track_slices.size());
         file_slices.count = n;
 
-        auto last = std::transform(
-          std::begin(owner_slices),
-          std::begin(owner_slices) + n,
+        std::transform(
+          std::begin(track_slices),
+          std::begin(track_slices) + n,
           std::begin(file_slices.array),
           [] (auto&& slice) {
             return util::TapeFile::SliceData{
@@ -197,101 +2060,491 @@ namespace otto {
               gsl::narrow_cast<std::uint32_t>(slice.out)};
           });
       }
+      file.metadata.loop_in = journaled_loop.in;
+      file.metadata.loop_out = journaled_loop.out;
+    }
+
+    /// Apply a journal entry to `slices` and `loop`
+    static void apply(const TapeJournal::Entry& e,
+      std::array<TapeSliceSet, tracks>& slices, util::audio::Section<int>& loop)
+    {
+      using Entry = TapeJournal::Entry;
+      if (e.track >= slices.size()) return;
+      auto& set = slices[e.track];
+      switch (e.op) {
+      case Entry::Clear:   set.clear(); break;
+      case Entry::Add:     set.add({e.a, e.b}); break;
+      case Entry::Erase:   set.erase({e.a, e.b}); break;
+      case Entry::Cut:     set.cut(e.a); break;
+      case Entry::SetLoop: loop = {e.a, e.b}; break;
+      }
+    }
+
+    /// Apply the edits journaled since the file was last stored, and start
+    /// journaling new edits
+    void replay_journal()
+    {
+      if (TapeJournal::read(journal_path, file.metadata.generation, journal_entries)) {
+        util::audio::Section<int> loop = journaled_loop;
+        for (auto&& e : journal_entries) {
+          apply(e, owner.slices, loop);
+          apply(e, journaled, journaled_loop);
+        }
+        LOGD << "Replayed " << journal_entries.size() << " tape journal entries";
+      }
+      journal_entries.clear();
+      owner.loop_points = journaled_loop;
+      for (int track = 0; track < tracks; track++) {
+        owner.slices[track].set_journal(&owner.journal, track);
+      }
+    }
+
+    /// Tapes from before the metadata chunk was added get one
+    void init_metadata()
+    {
+      if (file.has_metadata()) return;
+      file.create_metadata();
+      file.write_file();
+    }
+
+    /// Tapes from before the written map was added get one, marking the
+    /// blocks the filesystem has data for
+    void init_written_blocks()
+    {
+      if (store.is_open()) return;
+      // A map from a shorter tape would lose the marks past its end
+      auto map_length = file.written_map.size() * 8 / tracks * util::TapeFile::written_block_size;
+      if (!file.has_written_map() || map_length < tape_buffer::max_length) {
+        file.create_written_map(tape_buffer::max_length);
+        file.write_file();
+      }
+      written_blocks.open(file);
+    }
+
+    /// Write queued edits to the journal. See <sync_journal>.
+    void write_journal()
+    {
+      TapeJournal::Entry e;
+      journal_entries.clear();
+      while (owner.journal.pop(e)) {
+        journal_entries.push_back(e);
+        apply(e, journaled, journaled_loop);
+      }
+      if (owner.journal.overflowed()) {
+        // Some edits are lost, so start over from what the UI sees
+        LOGE << "Tape journal queue overflowed";
+        for (int track = 0; track < tracks; track++) {
+          journaled[track].clear();
+          for (auto&& slice : owner.slices[track]) {
+            journaled[track].add(slice);
+          }
+        }
+        journaled_loop = owner.loop_points;
+        compact_journal();
+        return;
+      }
+      if (!journal_entries.empty()) {
+        try {
+          owner.journal.append(journal_entries.data(), journal_entries.size());
+          journal_unsynced = true;
+        } catch (util::exception& err) {
+          LOGE << err.what();
+        }
+      }
+      if (owner.journal.length() >= max_journal_length) {
+        compact_journal();
+      } else {
+        sync_journal(false);
+      }
+    }
+
+    /// Wait for appended journal entries to reach the disk, unless the last
+    /// sync was less than <journal_sync_interval> ago and `force` is not set
+    void sync_journal(bool force)
+    {
+      if (!journal_unsynced) return;
+      auto now = std::chrono::steady_clock::now();
+      if (!force && now - last_journal_sync < journal_sync_interval) return;
+      owner.journal.sync();
+      last_journal_sync = now;
+      journal_unsynced = false;
+    }
+
+    /// Store everything in the tape file, and start a new journal from there
+    ///
+    /// The new journal starts with a snapshot, and is in place before the
+    /// file is touched, so a crash at any point leaves one of them complete.
+    void compact_journal()
+    {
+      using Entry = TapeJournal::Entry;
+      auto generation = file.metadata.generation + 1;
+      journal_entries.clear();
+      for (int track = 0; track < tracks; track++) {
+        journal_entries.push_back({Entry::Clear, std::uint8_t(track)});
+        for (auto&& slice : journaled[track]) {
+          journal_entries.push_back({Entry::Add, std::uint8_t(track), 0, slice.in, slice.out});
+        }
+      }
+      journal_entries.push_back({Entry::SetLoop, 0, 0, journaled_loop.in, journaled_loop.out});
+
+      try {
+        owner.journal.start(journal_path, generation, journal_entries);
+        // The new journal is synced, and holds everything
+        journal_unsynced = false;
+        write_slices();
+        file.metadata.generation = generation;
+        file.store_slices();
+        file.store_metadata();
+        file.sync();
+      } catch (util::exception& e) {
+        LOGE << e.what();
+      } catch (util::ByteFile::Error& e) {
+        LOGE << "Could not store tape slices: " << e.what();
+      }
+      journal_entries.clear();
     }
   };
 
+  bool tape_buffer::start_job(const TapeJob& job)
+  {
+    if (!jobs.try_push(job)) return false;
+    queued_jobs++;
+    if (job.op == TapeJob::Lift) {
+      auto s = job.section;
+      clip_frames = std::max(0, std::min<int>(s.out, max_length) - std::max(0, s.in));
+    }
+    notify_update(Edited);
+    return true;
+  }
+
+  void tape_buffer::cancel_jobs()
+  {
+    cancel_requested = true;
+    notify_update(Edited);
+  }
+
+  tape_buffer::JobStatus tape_buffer::job_status() const
+  {
+    JobStatus status;
+    int op = running_job;
+    status.running = op >= 0;
+    if (status.running) status.op = TapeJob::Op(op);
+    status.progress = job_progress;
+    status.queued = queued_jobs;
+    return status;
+  }
+
   void tape_buffer::advance(int n)
   {
     current_position = std::clamp(current_position + n, 0, (int) max_length);
-    notify_update();
+    notify_update(Moved);
   }
 
-  void tape_buffer::notify_update()
+  void tape_buffer::save_loop_points(util::audio::Section<int> points)
   {
-    producer->waiting.notify_all();
+    loop_points = points;
+    journal.log(TapeJournal::Entry::SetLoop, 0, points.in, points.out);
   }
 
-  void tape_buffer::invalidate()
+  util::audio::Section<int> tape_buffer::saved_loop_points() const
   {
-    tail.exchange(current_position);
-    head.exchange(current_position);
-    notify_update();
+    return loop_points;
   }
 
-  value_type& tape_buffer::cur_value()
+  void tape_buffer::set_wanted_tracks(unsigned tracks)
   {
-    return buffer[current_position];
+    if (wanted_tracks.exchange(tracks) != tracks) {
+      notify_update(Tracks);
+    }
   }
 
-  void tape_buffer::jump_to(std::size_t position)
+  void tape_buffer::set_jump_targets(std::array<int, max_jump_targets> targets)
   {
-    current_position = position;
-    producer->waiting.notify_all();
+    for (int i = 0; i < max_jump_targets; i++) {
+      jump_targets[i] = targets[i];
+    }
+  }
+
+  void tape_buffer::account_read(float speed, int distance)
+  {
+    this->speed = speed;
+    int pos = current_position;
+    int end = pos + distance;
+    int margin;
+    if (distance >= 0) {
+      margin = head - end;
+      if (pos < tail || end > head) stats.underruns++;
+    } else {
+      margin = end - tail;
+      if (end < tail || pos > head) stats.underruns++;
+    }
+    stats.margin = margin;
+    if (margin < stats.min_margin) stats.min_margin = margin;
   }
 
-  tape_buffer::tape_buffer()
-    : producer {std::make_unique<Producer>(*this)}
-  {}
+  void tape_buffer::set_loop(util::audio::Section<int> l)
+  {
+    if (loop.load() == l) return;
+    loop = l;
+    notify_update(Looped);
+  }
 
-  tape_buffer::~tape_buffer() {}
+  TapeCache* tape_buffer::acquire_cache(std::atomic<TapeCache*>& slot)
+  {
+    auto* cache = slot.load();
+    cache_in_use = cache;
+    // The producer may have unpublished it before it saw `cache_in_use`
+    if (slot.load() != cache) {
+      release_cache();
+      return nullptr;
+    }
+    return cache;
+  }
 
-  /* Debug Info */
+  void tape_buffer::release_cache()
+  {
+    auto* cache = cache_in_use.exchange(nullptr);
+    // Either this sees the producer waiting, or the producer sees the cache
+    // released
+    if (cache && cache == cache_unpublished) {
+      cache_released.post();
+    }
+  }
 
-  void tape_buffer::DbgInfo::draw()
+  TapeCache* tape_buffer::find_cache(int first, int last)
   {
-    ImGui::Begin("Tape buffer");
-    read_size_graph.plot("Read size");
-    ImGui::End();
+    // The loop cache may be newer than the buffer
+    if (auto* cache = acquire_cache(loop_cache); cache && cache->contains(first, last)) {
+      return cache;
+    }
+    release_cache();
+    if (first >= tail && last <= head) return nullptr;
+    for (auto&& slot : seek_regions) {
+      if (auto* cache = acquire_cache(slot); cache && cache->contains(first, last)) {
+        return cache;
+      }
+      release_cache();
+    }
+    return nullptr;
+  }
+
+  util::audio::Section<int> tape_buffer::write_section(int position, int n, float speed) const
+  {
+    if (speed > 0) {
+      int write_n = n * speed;
+      return {position - write_n, position};
+    } else if (speed < 0) {
+      int write_n = n * -speed;
+      return {position + 1, position + write_n + 1};
+    }
+    return {0, 0};
+  }
+
+  void tape_buffer::mark_written(util::audio::Section<int> written, int track)
+  {
+    // Atomically update the write section of the track
+    auto& write_sect = write_sects[track];
+    util::audio::Section<int> new_sect;
+    auto expected_sect = write_sect.load();
+    do {
+      new_sect = written;
+      if (expected_sect.size() != 0) {
+        new_sect += expected_sect;
+      }
+    } while (!write_sect.compare_exchange_weak(expected_sect, new_sect));
+    notify_update(Written);
+  }
+
+  util::audio::Section<int> tape_buffer::mix_frames(const float* src, int n,
+    float speed, int track, float gain)
+  {
+    return mix_frames_at(current_position, src, n, speed, track, gain);
+  }
+
+  util::audio::Section<int> tape_buffer::mix_frames_at(int position,
+    const float* src, int n, float speed, int track, float gain)
+  {
+    auto written = write_section(position, n, speed);
+    if (written.size() == 0) return written;
+
+    auto step = util::audio::phase_step(1.f / std::abs(speed));
+    auto* cache = acquire_cache(loop_cache);
+    if (cache && cache->contains(written.in, written.out)) {
+      util::audio::varispeed_mix(cache->data(track), cache->size(), written.in,
+        written.size(), src, n, step, gain, interpolation);
+      cache->mark_dirty(track, written);
+      release_cache();
+      notify_update(Written);
+      return written;
+    }
+    release_cache();
+
+    // The ring of a track that is not loaded does not match the file
+    if (!(loaded_tracks & (1u << track))) {
+      return {written.in, written.in};
+    }
+    util::audio::varispeed_mix(buffer[track].data(), buffer_size, written.in,
+      written.size(), src, n, step, gain, interpolation);
+
+    mark_written(written, track);
+    return written;
   }
 
-  /*
-   * TapeSliceSet
-   */
+  void tape_buffer::read_block(int n, float speed, value_type* dst)
+  {
+    auto step = util::audio::phase_step(speed);
+    auto start = read_phase();
+    auto end = start + n * step;
+    // Include the frames the interpolation reads around the edges
+    int first = util::audio::phase_frames(std::min(start, end)) - 2;
+    int last = util::audio::phase_frames(std::max(start, end)) + 3;
+
+    auto* cache = find_cache(first, last);
+    bool hit = cache || (first >= tail && last <= head);
+    // Caches hold all tracks
+    unsigned mask = wanted_tracks & (cache ? all_tracks : loaded_tracks.load());
+    // All tracks are interpolated together, and the ones not wanted are
+    // silenced afterwards
+    std::array<const float*, tracks> rings;
+    for (int t = 0; t < tracks; t++) {
+      rings[t] = cache ? cache->data(t) : buffer[t].data();
+    }
+    util::audio::varispeed_read(rings, cache ? cache->size() : buffer_size,
+      start, step, dst, n, interpolation);
+    for (int t = 0; t < tracks; t++) {
+      if (mask & (1u << t)) continue;
+      for (int i = 0; i < n; i++) dst[i][t] = 0.f;
+    }
+    release_cache();
+    if (jumped.exchange(false)) {
+      (hit ? stats.jump_hits : stats.jump_misses)++;
+    }
+    advance_phase(speed, n * step, cache == nullptr);
+  }
 
-  std::vector<tape_buffer::TapeSlice>
-  tape_buffer::TapeSliceSet::overlapping_slices(TapeSlice area) const {
-    std::vector<TapeSlice> xs;
-    std::copy_if(std::begin(slices), std::end(slices), std::back_inserter(xs),
-      [&] (auto&& slice) {
-        return slice.overlaps(area);
-      });
-    return xs;
+  util::audio::Phase tape_buffer::read_phase()
+  {
+    // The phase between frames belonged to the old position
+    if (fract_stale.exchange(false)) position_fract = 0;
+    return (util::audio::Phase(current_position) << util::audio::phase_bits)
+      | position_fract;
   }
 
-  bool tape_buffer::TapeSliceSet::in_slice(int time) const {
-    return std::any_of(std::begin(slices), std::end(slices),
-      [time] (auto&& slice) { return slice.contains(time); });
+  void tape_buffer::advance_phase(float speed, util::audio::Phase d, bool buffered)
+  {
+    util::audio::Phase end = position_fract + d;
+    int frames = util::audio::phase_frames(end);
+    position_fract = end & util::audio::phase_fract_mask;
+    if (buffered) {
+      account_read(speed, frames);
+    } else {
+      this->speed = speed;
+    }
+    advance(frames);
   }
 
-  tape_buffer::TapeSlice tape_buffer::TapeSliceSet::current(int time) const {
-    for (auto&& slice : slices) {
-      if (slice.contains(time)) return slice;
+  void tape_buffer::spool_frames(int n, float speed, value_type* dst)
+  {
+    auto step = util::audio::phase_step(speed);
+    // The producer may be updating the frames we need
+    if (!spool_ready || !producer->file.spool.try_read(read_phase(), step, dst, n)) {
+      read_frames(n, speed, dst);
+      return;
     }
-    return {-1, -1};
+    util::audio::Phase end = position_fract + n * step;
+    position_fract = end & util::audio::phase_fract_mask;
+    this->speed = speed;
+    advance(util::audio::phase_frames(end));
+    IF_DEBUG(dbg.read_size_graph.push(n * speed));
   }
 
-  void tape_buffer::TapeSliceSet::erase(TapeSlice slice) {
-    for (auto&& sl : slices) {
-      sl -= slice;
+  const util::audio::Overview& tape_buffer::overview(int track) const
+  {
+    return producer->file.overviews[track];
+  }
+
+  void tape_buffer::sync()
+  {
+    auto& p = *producer;
+    p.syncing++;
+    // A cycle that is running now may have started before the call
+    unsigned target = p.cycles_begun + 1;
+    notify_update(Moved);
+    while (int(p.cycles_done - target) < 0) {
+      p.cycle_done.wait_for(std::chrono::milliseconds(100));
     }
-    std::remove_if(std::begin(slices), std::end(slices),
-      [] (auto&& in) { return in.size() == 0; });
+    p.syncing--;
+  }
+
+  void tape_buffer::notify_update(unsigned requests)
+  {
+    producer->request(requests);
+  }
+
+  void tape_buffer::invalidate()
+  {
+    tail.exchange(current_position);
+    head.exchange(current_position);
+    notify_update(Jumped);
+  }
+
+  void tape_buffer::jump_to(std::size_t position)
+  {
+    current_position = position;
+    fract_stale = true;
+    jumped = true;
+    notify_update(Jumped);
   }
 
-  void tape_buffer::TapeSliceSet::add(TapeSlice slice) {
-    erase(slice);
-    slices.push_back(slice);
+  tape_buffer::tape_buffer(bool direct_io, util::SampleFormat format, bool compressed)
+    : direct_io {direct_io}, sample_format {format}, compressed {compressed}
+  {
+    for (auto&& target : jump_targets) {
+      target = -1;
+    }
+    for (auto&& region : seek_regions) {
+      region = nullptr;
+    }
+    for (auto&& sect : write_sects) {
+      sect = {0, 0};
+    }
+    IF_DEBUG(dbg.stats = &stats);
+    producer = std::make_unique<Producer>(*this);
   }
 
-  void tape_buffer::TapeSliceSet::cut(int time) {
-    if (!in_slice(time)) return;
-    TapeSlice slice = current(time);
-    add({slice.in, time});
-    add({time + 1, slice.out});
+  tape_buffer::~tape_buffer()
+  {
+    // The producer uses the members declared after it, like the journal and
+    // the job queue, until its thread stops
+    producer.reset();
   }
 
-  void tape_buffer::TapeSliceSet::glue(TapeSlice s1, TapeSlice s2) {
-    add({std::min(s1.in, s2.in), std::max(s1.out, s2.out)});
+  /* Debug Info */
+
+  void tape_buffer::DbgInfo::draw()
+  {
+    ImGui::Begin("Tape buffer");
+    read_size_graph.plot("Read size");
+    margin_graph.plot("Min margin", 0, buffer_size);
+    if (stats) {
+      ImGui::Text("Underruns: %d", stats->underruns.load());
+      ImGui::Text("Margin: %d", stats->margin.load());
+      ImGui::Text("Jumps served from memory: %d, from disk: %d",
+        stats->jump_hits.load(), stats->jump_misses.load());
+      auto latencies = [] (const char* name, const util::latency_histogram& h) {
+        auto ms = [] (auto d) { return std::chrono::duration<float, std::milli>(d).count(); };
+        ImGui::Text("%s latency (ms): p50 %.2f, p99 %.2f, max %.2f (%d)", name,
+          ms(h.quantile(0.5f)), ms(h.quantile(0.99f)), ms(h.max()), int(h.total()));
+        std::array<float, util::latency_histogram::bucket_count> counts;
+        for (int i = 0; i < util::latency_histogram::bucket_count; i++) {
+          counts[i] = h.count(i);
+        }
+        ImGui::PlotHistogram(name, counts.data(), counts.size());
+      };
+      latencies("Read", stats->read_latency);
+      latencies("Write", stats->write_latency);
+    }
+    ImGui::End();
   }
 
 }
@@ -5,69 +5,105 @@
 #include <atomic>
 #include <memory>
 #include <set>
+#include <limits>
 
 #include "util/iterator.hpp"
 #include "util/algorithm.hpp"
 #include "util/math.hpp"
 #include "util/audio.hpp"
 #include "util/ringbuffer.hpp"
+#include "util/varispeed.hpp"
+#include "util/overview.hpp"
+#include "util/histogram.hpp"
+#include "util/sample-format.hpp"
+#include "util/mpsc-queue.hpp"
+#include "util/semaphore.hpp"
 
 #include "debug/ui.hpp"
 
+#include "tapeslices.hpp"
+#include "tapecache.hpp"
+#include "tapejournal.hpp"
+#include "tapejobs.hpp"
+
+/// Length of the tape, set by the build
+#ifndef OTTO_TAPE_MINUTES
+#define OTTO_TAPE_MINUTES 8
+#endif
+
 namespace otto {
 
   // FDCL - Defined in tapebuffer.cpp
   struct Producer;
+  struct JobRunner;
 
 
   /// The buffer used for the tapedeck
   ///
   /// Provides reading from file, variable speed reading/writing in both
   /// directions and access to tape metadata, such as slices.
+  ///
+  /// Each track has its own ring in the buffer, like in the tape file, so
+  /// recording a track writes contiguous memory, and tracks that are not
+  /// needed are not read. See <wanted_tracks>.
   class tape_buffer {
-    using Value = std::array<float, 4>;
   public:
+    static constexpr int tracks = util::audio::tape_tracks;
 
-    using TapeSlice = util::audio::Section<int>;
-
-    struct TapeSliceSet {
-      std::vector<TapeSlice> slices;
-
-      TapeSliceSet() {}
-
-      std::vector<TapeSlice> overlapping_slices(util::audio::Section<int> area) const;
-
-      bool in_slice(int time) const;
-      TapeSlice current(int time) const;
+  private:
+    using Value = std::array<float, tracks>;
 
-      void add(TapeSlice slice);
-      void erase(TapeSlice slice);
-
-      void cut(int time);
-      void glue(TapeSlice s1, TapeSlice s2);
-
-      // Iteration
-      decltype(auto) begin() { return slices.begin(); }
-      decltype(auto) end() { return slices.end(); }
-      decltype(auto) begin() const { return slices.begin(); }
-      decltype(auto) end() const { return slices.end(); }
-      decltype(auto) size() const { return slices.size(); }
-      decltype(auto) clear() { return slices.clear(); }
-    };
+  public:
 
+    using TapeSlice = otto::TapeSlice;
+    using TapeSliceSet = otto::TapeSliceSet;
 
     /* Constants */
 
     static constexpr std::size_t buffer_size = 1 << 18;
-    static constexpr std::size_t max_length = 8 * 60 * 44100;
+    /// Frames on the tape. Frame positions are `int`s, which hold about 13
+    /// hours at 44.1kHz.
+    static constexpr std::size_t max_length = std::size_t(OTTO_TAPE_MINUTES) * 60 * 44100;
+    static_assert(max_length <= std::numeric_limits<int>::max(),
+      "OTTO_TAPE_MINUTES is too long for int frame positions");
+    static constexpr int max_jump_targets = 4;
+    /// The default for <loop_cache_budget>. About 47 seconds.
+    static constexpr std::size_t default_loop_cache_budget = 1 << 21;
+    /// Seek regions are kept around each jump target, and around as many
+    /// recently left positions
+    static constexpr int max_seek_regions = 2 * max_jump_targets;
+    /// Frames in each seek region. Enough to play from while the producer
+    /// refills the buffer after a jump.
+    static constexpr int seek_region_size = 1 << 15;
+    /// Transfers with `O_DIRECT` must start and end at multiples of this many
+    /// bytes, in the file and in memory
+    static constexpr std::size_t io_alignment = 4096;
+    /// Bitmask of all tracks, for <wanted_tracks>
+    static constexpr unsigned all_tracks = (1u << tracks) - 1;
 
     using value_type = Value;
-    /// Tape slices for each of the 4 tracks
-    std::array<TapeSliceSet, 4> slices;
+    /// Tape slices for each of the tracks
+    ///
+    /// Edits are journaled, and stored in the tape file by the producer.
+    /// The producer loads them when it starts, so leave them alone until
+    /// <ready>.
+    std::array<TapeSliceSet, tracks> slices;
 
     /* Initialization */
 
-    tape_buffer();
+    /// \param direct_io Stream the buffer with `O_DIRECT`, so the tape does not
+    ///                  push everything else out of the page cache
+    /// \param format How a new tape file stores samples. 16 or 24 bits take
+    ///               half or three quarters of the disk space and bandwidth
+    ///               of floats. Existing tapes keep their format.
+    /// \param compressed Store the audio of a new tape in losslessly
+    ///                   compressed blocks, in `tape.blocks` next to the
+    ///                   tape file. Silence and quiet material take a
+    ///                   fraction of the space, at the cost of decoding on
+    ///                   the producer thread. Floats are stored as 24 bits.
+    explicit tape_buffer(bool direct_io = false,
+      util::SampleFormat format = util::SampleFormat::Float32,
+      bool compressed = false);
     ~tape_buffer();
 
     tape_buffer(tape_buffer&) = delete;
@@ -80,82 +116,158 @@ namespace otto {
       return current_position;
     }
 
+    /// Reasons for the producer to do some work
+    enum Request : unsigned {
+      Moved   = 1 << 0,
+      Written = 1 << 1,
+      Jumped  = 1 << 2,
+      Looped  = 1 << 3,
+      /// A job was queued, finished, or changed some audio
+      Edited  = 1 << 4,
+      /// <wanted_tracks> changed
+      Tracks  = 1 << 5,
+    };
+
     /// Move the point `n` forward. `n` can be negative
     void advance(int n = 1);
-    void notify_update();
-    void invalidate();
 
-    /// Get a refference to the value at point
-    value_type& cur_value();
+    /// Tell the producer where the tape is likely to jump to, like loop
+    /// points and bar lines. Negative positions are ignored.
+    ///
+    /// Targets close to the current position are kept in the buffer, others
+    /// are prefetched from disk.
+    void set_jump_targets(std::array<int, max_jump_targets> targets);
+
+    /// Store the loop points with the tape. Journaled like slice edits.
+    void save_loop_points(util::audio::Section<int> points);
+
+    /// The loop points stored with the tape, or `{-1, -1}`
+    util::audio::Section<int> saved_loop_points() const;
+
+    /// Whether the producer has loaded the <slices> and loop points
+    bool ready() const
+    {
+      return slices_loaded;
+    }
 
-    /// Write `n` frames from `iter` at speed `speed`, throug `func`
+    /// Set the section being looped, or an empty section for none
     ///
-    /// for each frame in the tape, `func` will be called with arguments
-    /// `*iter, *tape`. It is expected that `func` modifies the `tape` argument.
+    /// If it fits in <loop_cache_budget>, the producer loads it into memory.
+    /// Reads and writes inside it are then served from memory, and the
+    /// producer writes changes back to the file in the background.
+    void set_loop(util::audio::Section<int> loop);
+    /// Wait for the producer to run a whole cycle that starts after this
+    /// call, so the buffer holds the wanted tracks around the current
+    /// position
     ///
-    /// `iter` will be slowed down/sped up according to `speed`. If `speed` is
+    /// For offline renders, where what is read must not depend on timing.
+    /// Call it between blocks. A jump in the middle of a block, like
+    /// wrapping around a loop too long for the loop cache, can still read
+    /// ahead of the producer.
+    void sync();
+
+    /// Wake up the producer to handle `requests`
+    ///
+    /// This is lock free and safe to call from the audio thread. Requests made
+    /// before the producer gets around to them are coalesced, so it wakes up
+    /// at most once for any number of calls.
+    void notify_update(unsigned requests = Moved);
+    void invalidate();
+
+    /// Mix `n` mono frames from `src` into `track`, scaled by `gain`
+    ///
+    /// `src` will be slowed down/sped up according to `speed`. If `speed` is
     /// positive, the frames will be written "behind" the cursor, as in, the
     /// last frame will be positioned at `cursor - 1`. If `speed` is negative,
     /// the first frame in the range will be positioned at `cursor + 1`.
     /// If `speed` is `0`, nothing will be written
     ///
+    /// Nothing is written to a track the producer has not loaded yet. Keep
+    /// the track being recorded in <wanted_tracks>, and wait for it to show
+    /// up in <loaded_tracks> before recording.
+    ///
     /// @return the section of tape that was just written
-    template<typename Iter, typename BinaryFunc>
-    util::audio::Section<int> write_frames(Iter iter, int n, float speed,
-      BinaryFunc&& func = [] (auto&& in, auto& tape) { tape = in; })
-    {
-      util::audio::Section<int> written {0,0};
-      if (speed == 0) return written;
-      int write_n = 0;
-      float inpt_speed;
-      if (speed > 0) {
-        write_n = n * speed;
-        written = {current_position - write_n, current_position};
-        inpt_speed = 1.f / speed;
-      } else if (speed < 0) {
-        write_n = n * -speed;
-        written = {current_position + 1, current_position + write_n + 1};
-        inpt_speed = 1.f / -speed;
-      }
-
-      auto tape = buffer.iter(written.in);
-      auto inpt = util::float_step(std::move(iter), inpt_speed);
-      for (int i = 0; i < write_n; i++, tape++, inpt++) {
-        func(*inpt, *tape);
-      }
-
-      // Atomically update `write_sect`
-      util::audio::Section<int> new_sect;
-      auto expected_sect = write_sect.load();
-      do {
-        new_sect = written;
-        if (expected_sect.size() != 0) {
-          new_sect += expected_sect;
-        }
-      } while (!write_sect.compare_exchange_weak(expected_sect, new_sect));
-      notify_update();
-
-      return written;
-    }
+    util::audio::Section<int> mix_frames(const float* src, int n, float speed,
+      int track, float gain);
 
-    template<typename Iter>
-    void read_frames(int n, float speed, Iter dst)
+    /// Like <mix_frames>, but place the frames relative to `position` instead
+    /// of the current position. Used when the tape jumped during a block.
+    util::audio::Section<int> mix_frames_at(int position, const float* src,
+      int n, float speed, int track, float gain);
+
+    /// Read `n` frames into `dst` at speed `speed`, and advance the tape
+    ///
+    /// This runs a block kernel on each track, which interpolates according
+    /// to <interpolation> and keeps track of the fractional position between
+    /// calls. Tracks that are not in <wanted_tracks> are silent.
+    void read_frames(int n, float speed, value_type* dst)
     {
-      float error = 0.f;
-      auto src = util::float_step(buffer.citer(current_position), speed);
-      std::copy_n(src, n, dst);
-      advance(n * speed);
+      read_block(n, speed, dst);
       IF_DEBUG(dbg.read_size_graph.push(n * speed));
     }
 
+    /// Read `n` frames into `dst` from the decimated spool data, at speed
+    /// `speed`, and advance the tape
+    ///
+    /// This does not touch the buffer, so fast spooling does not need the
+    /// producer to stream the tape from disk. Falls back to <read_frames>
+    /// until the spool data is ready, and while the producer is updating the
+    /// part of it that is needed.
+    void spool_frames(int n, float speed, value_type* dst);
+
+    /// The waveform overview of `track`, for drawing
+    ///
+    /// Levels are loaded in the background, coarsest first. Only levels at or
+    /// above <overview_level> are safe to read. While recording, points may
+    /// be read while being updated, which is harmless for drawing.
+    const util::audio::Overview& overview(int track) const;
+
     /// Jumps the tape to absolute position `p`
     ///
-    /// Use sparingly - a jump clears the entire buffer
+    /// Jumps to the loop, to jump targets and to recently left positions are
+    /// served from memory while the producer moves the buffer. Others have to
+    /// wait for the disk. See <Stats::jump_hits>.
     void jump_to(std::size_t p);
 
+    /* Background jobs */
+
+    /// Queue `job` to run on the job thread, after the jobs queued before
+    ///
+    /// Everything recorded before the job starts is in the file when it
+    /// runs, and the buffer and caches are updated behind each chunk it
+    /// writes. Recording over the frames a job is editing may undo the edit
+    /// there. Lock free, unless copying <TapeJob::on_done> allocates.
+    ///
+    /// \returns `false` if too many jobs are queued
+    bool start_job(const TapeJob& job);
+
+    /// Stop the running job after its current chunk, and drop the queued
+    /// ones
+    void cancel_jobs();
+
+    /// What the job thread is doing, for the UI
+    struct JobStatus {
+      bool running = false;
+      /// The running job, if any
+      TapeJob::Op op = TapeJob::Bounce;
+      /// The fraction of it done
+      float progress = 0;
+      /// Jobs waiting to run after it
+      int queued = 0;
+    };
+
+    JobStatus job_status() const;
+
+    /// Frames on the clipboard, once the queued jobs have run
+    int clip_length() const
+    {
+      return clip_frames;
+    }
+
     /* Member variables */
 
-    using buffer_type = util::wrapping_array<value_type, buffer_size>;
+    /// A ring of <buffer_size> frames per track, indexed by position
+    using buffer_type = std::array<std::array<float, buffer_size>, tracks>;
 
     /// The current file position
     /// This variable should only be modified by the consumer - to everyone else
@@ -167,21 +279,167 @@ namespace otto {
     std::atomic_int head {0};
     std::atomic_int tail {0};
 
-    std::atomic<util::audio::Section<int>> write_sect;
-
-    buffer_type buffer;
+    /// Frames of each track written to the buffer, but not to the file yet
+    std::array<std::atomic<util::audio::Section<int>>, tracks> write_sects;
+
+    /// Bitmask of the tracks the consumer needs, like the unmuted tracks and
+    /// the one being recorded. The producer only streams these from disk.
+    std::atomic<unsigned> wanted_tracks {all_tracks};
+
+    /// Set <wanted_tracks>, and wake up the producer if they changed, so
+    /// added tracks are loaded right away. Lock free.
+    void set_wanted_tracks(unsigned tracks);
+
+    /// Bitmask of the tracks the buffer holds between `tail` and `head`. Set
+    /// by the producer a while after they are wanted.
+    std::atomic<unsigned> loaded_tracks {0};
+
+    /// The speed of the last read. Used by the producer to decide where to
+    /// spend the buffer. Should be set to `0` by the consumer when it stops
+    /// reading.
+    std::atomic<float> speed {0};
+
+    std::array<std::atomic_int, max_jump_targets> jump_targets;
+
+    /// The most frames the loop cache may hold. Only read by the producer when
+    /// the loop changes.
+    std::atomic<std::size_t> loop_cache_budget {default_loop_cache_budget};
+
+    /// Set by the consumer while it reads with <spool_frames>. The producer
+    /// does not fill the buffer meanwhile, and just prefetches around the
+    /// playpoint so playback can resume quickly.
+    std::atomic_bool spooling {false};
+
+    /// Set by the producer once the spool data is loaded, or rebuilt for the
+    /// whole tape
+    std::atomic_bool spool_ready {false};
+    /// See <ready>
+    std::atomic_bool slices_loaded {false};
+
+    /// The finest loaded level of the overviews. Levels are loaded coarsest
+    /// first, so all levels above this one are also loaded.
+    std::atomic_int overview_level {std::numeric_limits<int>::max()};
+
+    /// How to read between frames when the speed is not `1` or `-1`
+    util::audio::Interpolation interpolation = util::audio::Interpolation::Linear;
+
+    /// Counters for how well the producer keeps up with reading
+    struct Stats {
+      /// Number of reads that were not entirely inside `[tail, head]`
+      std::atomic_int underruns {0};
+      /// Frames loaded ahead of the last read, in the read direction
+      std::atomic_int margin {0};
+      /// The smallest margin since the producer last looked
+      std::atomic_int min_margin {buffer_size};
+      /// Reads right after a jump that found their frames in memory
+      std::atomic_int jump_hits {0};
+      /// Reads right after a jump that did not
+      std::atomic_int jump_misses {0};
+      /// Time from the producer starting to read into the buffer, until the
+      /// frames were there
+      util::latency_histogram read_latency;
+      /// Time from the writer taking a section of recorded frames, until they
+      /// were in the file
+      util::latency_histogram write_latency;
+    } stats;
+
+    /// Aligned for `O_DIRECT`, which transfers straight to and from it
+    alignas(io_alignment) buffer_type buffer;
 
     // Defined in implementation file
     friend struct Producer;
+    friend struct JobRunner;
     std::unique_ptr<Producer> producer;
 
     struct DbgInfo : debug::Info {
       debug::graph<1 << 10> read_size_graph;
+      debug::graph<1 << 10> margin_graph;
+      const Stats* stats = nullptr;
 
       void draw() override;
     };
 
     IF_DEBUG(DbgInfo dbg);
 
+  private:
+
+    /// Update <stats> for a read of `distance` frames from the current position
+    void account_read(float speed, int distance);
+
+    /// The tape section a write of `n` frames at `speed`, relative to
+    /// `position`, covers
+    util::audio::Section<int> write_section(int position, int n, float speed) const;
+
+    /// Add `written` to the section of `track` in <write_sects>, and notify
+    /// the producer
+    void mark_written(util::audio::Section<int> written, int track);
+
+    /// The read position including the fraction left over from the last read
+    ///
+    /// Drops the fraction if the tape jumped since
+    util::audio::Phase read_phase();
+
+    /// Advance the read position by the fixed point distance `d`. Only reads
+    /// from the buffer are counted in <stats>.
+    void advance_phase(float speed, util::audio::Phase d, bool buffered = true);
+
+    /// The block kernel path of <read_frames>
+    void read_block(int n, float speed, value_type* dst);
+
+    /// Get the cache published in `slot` for use on the consumer thread, or
+    /// `nullptr`
+    ///
+    /// Until <release_cache> is called, the producer will not free it. Only
+    /// one cache can be held at a time.
+    TapeCache* acquire_cache(std::atomic<TapeCache*>& slot);
+    void release_cache();
+
+    /// Acquire the loop cache or a seek region holding positions
+    /// `[first, last)`, unless the buffer holds them. Returns `nullptr` if
+    /// reads should go to the buffer, whether it holds them or not.
+    TapeCache* find_cache(int first, int last);
+
+    /// The section requested with <set_loop>
+    std::atomic<util::audio::Section<int>> loop {util::audio::Section<int>{0, 0}};
+    /// Published by the producer once loaded
+    std::atomic<TapeCache*> loop_cache {nullptr};
+    /// Read only copies of tape around likely jump destinations, published by
+    /// the producer
+    std::array<std::atomic<TapeCache*>, max_seek_regions> seek_regions;
+    /// The cache the consumer is using right now
+    std::atomic<TapeCache*> cache_in_use {nullptr};
+    /// The cache the producer waits for the consumer to let go of
+    std::atomic<TapeCache*> cache_unpublished {nullptr};
+    /// Posted by <release_cache> when it lets go of <cache_unpublished>
+    util::semaphore cache_released;
+    /// Set by <jump_to>, so the next read is counted in <Stats::jump_hits>
+    std::atomic_bool jumped {false};
+
+    static constexpr std::size_t max_queued_jobs = 16;
+    /// Jobs for the producer to hand to the job thread
+    util::mpsc_queue<TapeJob, max_queued_jobs> jobs;
+    std::atomic_int queued_jobs {0};
+    /// The <TapeJob::Op> of the running job, or `-1`
+    std::atomic_int running_job {-1};
+    std::atomic<float> job_progress {0};
+    /// Set by <cancel_jobs>, and cleared by the producer once the job
+    /// thread stopped
+    std::atomic_bool cancel_requested {false};
+    /// See <clip_length>
+    std::atomic_int clip_frames {0};
+
+    const bool direct_io;
+    const util::SampleFormat sample_format;
+    const bool compressed;
+
+    /// Edits to <slices> and the loop points, for the producer to persist
+    TapeJournal journal;
+    std::atomic<util::audio::Section<int>> loop_points {util::audio::Section<int>{-1, -1}};
+
+    /// Fractional part of the read position. Only used by the consumer
+    std::uint32_t position_fract = 0;
+    /// Set by <jump_to>, which may run on another thread, so the consumer
+    /// drops <position_fract>
+    std::atomic_bool fract_stale {false};
   };
 }
@@ -0,0 +1,53 @@
+#include "tapecache.hpp"
+
+#include <algorithm>
+
+namespace otto {
+
+  std::size_t TapeCache::size_for(std::size_t frames)
+  {
+    std::size_t size = 1;
+    while (size < frames) size <<= 1;
+    return size;
+  }
+
+  TapeCache::TapeCache(Section span)
+    : _span (span),
+      _size (size_for(std::max(span.size(), 1))),
+      samples (tracks * _size)
+  {
+    for (auto&& d : dirty) {
+      d = Section{0, 0};
+    }
+  }
+
+  TapeCache::Section TapeCache::move_to(Section span)
+  {
+    // Positions are stored at their index in the ring, so the ones both
+    // spans have are already in place
+    Section kept = {std::max(span.in, _span.in), std::min(span.out, _span.out)};
+    if (kept.size() <= 0) kept = {span.in, span.in};
+    _span = span;
+    for (auto&& d : dirty) {
+      d = Section{0, 0};
+    }
+    return kept;
+  }
+
+  void TapeCache::mark_dirty(int track, Section s)
+  {
+    if (s.size() <= 0) return;
+    Section new_sect;
+    auto expected = dirty[track].load();
+    do {
+      new_sect = s;
+      if (expected.size() > 0) new_sect += expected;
+    } while (!dirty[track].compare_exchange_weak(expected, new_sect));
+  }
+
+  TapeCache::Section TapeCache::take_dirty(int track)
+  {
+    return dirty[track].exchange({0, 0});
+  }
+
+}
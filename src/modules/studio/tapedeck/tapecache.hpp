@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "util/audio.hpp"
+
+namespace otto {
+
+  /// A section of tape held entirely in memory
+  ///
+  /// Each track is stored in its own ring with a power of two size, indexed
+  /// by tape position like the main tape buffer, so the same block kernels
+  /// can read and write it. The producer allocates and fills it, and writes
+  /// back the <dirty> section of each track. The consumer reads it and
+  /// writes to it without locks.
+  class TapeCache {
+  public:
+    static constexpr int tracks = util::audio::tape_tracks;
+    using Section = util::audio::Section<int>;
+
+    /// The size of the ring needed to hold `frames` frames
+    static std::size_t size_for(std::size_t frames);
+
+    /// Allocate a cache for the positions `[span.in, span.out)`. Frames are
+    /// zeroed, and should be filled by the caller before publishing it.
+    explicit TapeCache(Section span);
+
+    TapeCache(const TapeCache&) = delete;
+
+    /// Whether the ring is large enough to hold `span`
+    bool fits(Section span) const
+    {
+      return size_for(std::max(span.size(), 1)) <= _size;
+    }
+
+    /// Hold `span` instead, without reallocating. The frames of positions
+    /// that both spans have are kept, and the rest should be filled by the
+    /// caller before publishing it again. `span` has to <fits>.
+    ///
+    /// \returns the positions that were kept
+    Section move_to(Section span);
+
+    /// The positions held, `[in, out)`
+    Section span() const { return _span; }
+
+    /// Whether all positions in `[first, last)` are held
+    bool contains(int first, int last) const
+    {
+      return first >= _span.in && last <= _span.out;
+    }
+
+    /// The ring of `track`
+    float* data(int track) { return samples.data() + track * _size; }
+    const float* data(int track) const { return samples.data() + track * _size; }
+    /// Frames in the ring of each track
+    std::size_t size() const { return _size; }
+
+    float& at(int track, int position)
+    {
+      return data(track)[position & (_size - 1)];
+    }
+
+    /// Add `s` to the section of `track` that needs writing back. Lock free.
+    void mark_dirty(int track, Section s);
+
+    /// Take the section of `track` that needs writing back, leaving it empty
+    Section take_dirty(int track);
+
+    /// The section of `track` that needs writing back
+    Section peek_dirty(int track) const { return dirty[track].load(); }
+
+  private:
+    Section _span;
+    std::size_t _size;
+    std::vector<float> samples;
+    std::array<std::atomic<Section>, tracks> dirty;
+  };
+
+}
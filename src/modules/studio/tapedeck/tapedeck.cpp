@@ -14,6 +14,12 @@ namespace otto::modules {
 
   using TapeTime = std::size_t;
 
+  /// A tape position from a bar time, which the metronome happily puts past
+  /// the end of the tape
+  static int clampTime(double time) {
+    return int(std::clamp<double>(time, 0, tape_buffer::max_length));
+  }
+
   /************************************************/
   /* Tapedeck::State Implementation             */
   /************************************************/
@@ -22,7 +28,7 @@ namespace otto::modules {
     return !recording();
   }
   bool Tapedeck::State::doTapeOps() const {
-    return stopped();
+    return tapeLoaded && stopped();
   }
   bool Tapedeck::State::doPlayAudio() const {
     return playSpeed != 0;
@@ -31,7 +37,7 @@ namespace otto::modules {
     return !recording();
   }
   bool Tapedeck::State::doStartRec() const {
-    return !spooling() && !recording();
+    return tapeLoaded && !spooling() && !recording();
   }
   bool Tapedeck::State::doStartSpool() const {
     return !recording();
@@ -53,7 +59,8 @@ namespace otto::modules {
     return playType == STOPPED;
   }
   bool Tapedeck::State::recording() const {
-    return readyToRec && playing();
+    // Held off until the producer loads the track, or the audio is dropped
+    return readyToRec && playing() && trackLoaded;
   }
 
   // Playback control
@@ -108,6 +115,7 @@ namespace otto::modules {
   // Looping
 
   void Tapedeck::loopInHere() {
+    if (!state.tapeLoaded) return;
     loopSect.in = tapeBuffer->position();
     if (loopSect.in == loopSect.out) {
       loopSect.in = -1;
@@ -116,9 +124,11 @@ namespace otto::modules {
     if (loopSect.in > loopSect.out) {
       loopSect.out = loopSect.in;
     }
+    tapeBuffer->save_loop_points(loopSect);
   }
 
   void Tapedeck::loopOutHere() {
+    if (!state.tapeLoaded) return;
     loopSect.out = tapeBuffer->position();
     if (loopSect.in == loopSect.out) {
       loopSect.in = -1;
@@ -130,6 +140,7 @@ namespace otto::modules {
     if (loopSect.in == -1) {
       loopSect.in = loopSect.out;
     }
+    tapeBuffer->save_loop_points(loopSect);
   }
 
   void Tapedeck::goToLoopIn() {
@@ -146,11 +157,42 @@ namespace otto::modules {
 
 
   void Tapedeck::goToBar(BeatPos bar) {
-    if (state.doJumps()) tapeBuffer->jump_to(Globals::metronome.getBarTime(bar));
+    if (state.doJumps()) tapeBuffer->jump_to(clampTime(Globals::metronome.getBarTime(bar)));
   }
 
   void Tapedeck::goToBarRel(BeatPos bars) {
-    if (state.doJumps()) tapeBuffer->jump_to(Globals::metronome.getBarTimeRel(bars));
+    if (state.doJumps()) tapeBuffer->jump_to(clampTime(Globals::metronome.getBarTimeRel(bars)));
+  }
+
+  // Tape operations
+
+  void Tapedeck::lift() {
+    if (!state.doTapeOps()) return;
+    // Until a lift is done and erased, its slice is still there to be lifted
+    // again
+    auto status = tapeBuffer->job_status();
+    if (status.running || status.queued > 0 || liftDone) return;
+    auto slice = tapeBuffer->slices[state.track].current(position());
+    if (slice.size() <= 0) return;
+    liftedSlice = slice;
+    liftedTrack = state.track;
+    auto job = TapeJob::lift(state.track, slice);
+    // Called on the producer thread, which must not touch the slices
+    job.on_done = [this] (bool completed) {
+      if (completed) liftDone = true;
+    };
+    tapeBuffer->start_job(job);
+  }
+
+  void Tapedeck::drop() {
+    if (!state.doTapeOps()) return;
+    int length = tapeBuffer->clip_length();
+    if (length <= 0) return;
+    int pos = position();
+    if (tapeBuffer->start_job(TapeJob::drop(state.track, pos))) {
+      tapeBuffer->slices[state.track].add({pos,
+          std::min<int>(pos + length, tape_buffer::max_length)});
+    }
   }
 
   int Tapedeck::timeUntil(std::size_t tt) {
@@ -171,13 +213,32 @@ namespace otto::modules {
     }
   }
 
+  int Tapedeck::framesUntilWrap(int n, float speed) {
+    if (!state.doLoop() || !state.looping || loopSect.size() <= 0) return n;
+    int pos = position();
+    if (speed == 0 || !loopSect.contains(pos)) return n;
+    float dist = speed > 0 ? loopSect.out - pos : pos - loopSect.in;
+    return std::clamp<int>(std::ceil(dist / std::abs(speed)), 0, n);
+  }
+
   /*
    * Audio Processing
    */
 
-  audio::ProcessData<4> Tapedeck::process_playback(audio::ProcessData<0> data) {
+  audio::ProcessData<tape_buffer::tracks> Tapedeck::process_playback(audio::ProcessData<0> data) {
     TIME_SCOPE("Tapedeck::process_playback");
 
+    // The tape buffer loads the slices and loop points in the background
+    if (!state.tapeLoaded && tapeBuffer->ready()) {
+      loopSect = tapeBuffer->saved_loop_points();
+      state.tapeLoaded = true;
+    }
+
+    if (liftDone) {
+      tapeBuffer->slices[liftedTrack].erase(liftedSlice);
+      liftDone = false;
+    }
+
     // Animate the tape speed
     {
       constexpr int time = 200; // animation time from 0 to 1 in ms
@@ -216,7 +277,7 @@ namespace otto::modules {
     // Start recording by pressing a key
     if (!state.recording() && state.doStartRec() && state.readyToRec) {
       for (auto&& e : data.midi) {
-        if (mpark::holds_alternative<midi::NoteOnEvent>(e))
+        if (e.is_note_on())
           state.play();
       }
     }
@@ -224,14 +285,55 @@ namespace otto::modules {
     float realSpeed = props.baseSpeed * state.playSpeed;
     auto pos = position();
 
+    // Tell the tape buffer where we might be jumping to
+    {
+      float bar = Globals::metronome.bar_for_time(pos);
+      tapeBuffer->set_jump_targets({
+          loopSect.in, loopSect.out,
+          clampTime(Globals::metronome.time_for_bar(std::max(0.f, std::ceil(bar) - 1))),
+          clampTime(Globals::metronome.time_for_bar(std::floor(bar) + 1))});
+    }
+
+    // Only stream the tracks that are heard, the one recorded to, and the one
+    // bounced from, which is recorded even when it is muted
+    {
+      unsigned wanted = 1u << state.track;
+      for (int t = 0; t < tape_buffer::tracks; t++) {
+        if (!Globals::mixer.props.tracks[t].muted) wanted |= 1u << t;
+      }
+      if (Globals::selector.props.input == modules::InputSelector::Selection::TrackFB) {
+        wanted |= 1u << Globals::selector.props.track;
+      }
+      tapeBuffer->set_wanted_tracks(wanted);
+      // Recording waits for the producer to load the track
+      state.trackLoaded = state.tapeLoaded && (tapeBuffer->loaded_tracks & (1u << state.track));
+    }
+
     proc_buf.clear();
 
     // Read audio
-    if (state.doPlayAudio()) {
-      tapeBuffer->read_frames(data.nframes, realSpeed, std::begin(proc_buf));
+    tapeBuffer->spooling = state.spooling();
+    tapeBuffer->set_loop(state.looping ? loopSect : util::audio::Section<int>{0, 0});
+    wrapFrames = -1;
+    if (state.spooling()) {
+      tapeBuffer->spool_frames(data.nframes, realSpeed, proc_buf.data());
+    } else if (state.doPlayAudio()) {
+      int n = framesUntilWrap(data.nframes, realSpeed);
+      tapeBuffer->read_frames(n, realSpeed, proc_buf.data());
+      if (n < data.nframes) {
+        // The loop is in memory, so this does not need the disk
+        wrapFrames = n;
+        wrapPosition = position();
+        int length = loopSect.size();
+        tapeBuffer->jump_to(realSpeed > 0 ? wrapPosition - length : wrapPosition + length);
+        tapeBuffer->read_frames(data.nframes - n, realSpeed, proc_buf.data() + n);
+      }
+    } else {
+      tapeBuffer->speed = 0;
     }
 
-    return data.redirect(proc_buf);
+    using View = audio::AudioView<tape_buffer::tracks>;
+    return data.redirect(View::interleaved(proc_buf.data(), data.nframes));
   }
 
   audio::ProcessData<0> Tapedeck::process_record(audio::ProcessData<1> data) {
@@ -246,10 +348,22 @@ namespace otto::modules {
 
     if (state.recording()) {
       // Write audio
-      auto sect = tapeBuffer->write_frames(std::begin(data.audio), data.nframes,
-        realSpeed, [&, track = state.track] (auto&& src, auto& dst) {
-          dst[track] += src[0] * props.gain;
-        });
+      auto in = data.audio[0];
+      const float* src = in.data();
+      if (!in.is_contiguous()) {
+        in.copy_to(rec_buf.data());
+        src = rec_buf.data();
+      }
+      int n = data.nframes;
+      if (wrapFrames >= 0) {
+        // Playback wrapped around the loop, so the start of the block goes
+        // before the wrap
+        recSect += tapeBuffer->mix_frames_at(wrapPosition, src, wrapFrames,
+          realSpeed, state.track, props.gain);
+        src += wrapFrames;
+        n -= wrapFrames;
+      }
+      auto sect = tapeBuffer->mix_frames(src, n, realSpeed, state.track, props.gain);
       recSect += sect;
     }
 
@@ -265,8 +379,8 @@ namespace otto::modules {
     // Graph
 
     procGraph.clear();
-    for (auto&& smpl : data.audio) {
-      procGraph.add(smpl[0] * props.gain);
+    for (int i = 0; i < data.nframes; i++) {
+      procGraph.add(data.audio[0][i] * props.gain);
     }
 
     return data.midi_only();
@@ -16,7 +16,10 @@ namespace otto::modules {
   class Tapedeck final : public modules::Module {
     std::unique_ptr<ui::ModuleScreen<Tapedeck>> tapeScreen;
 
-    audio::ProcessBuffer<4> proc_buf;
+    /// Frames as the tape buffer reads them, passed on as a strided view
+    audio::RTBuffer<tape_buffer::value_type> proc_buf;
+    /// Recorded audio, when it doesn't come in one piece
+    audio::RTBuffer<float> rec_buf;
   public:
 
     struct State {
@@ -45,6 +48,12 @@ namespace otto::modules {
       float prevSpeed = 0;
       int track       = 0;
       bool looping    = false;
+      /// Whether the tape buffer has loaded the slices and loop points. Set
+      /// by the audio thread.
+      bool tapeLoaded = false;
+      /// Whether the tape buffer streams <track>, so what is recorded to it
+      /// is kept. Set by the audio thread.
+      bool trackLoaded = false;
 
       template<typename Ret, typename Callable1, typename Callable2>
       Ret forPlayDir(Callable1&& forward, Callable2&& reverse) {
@@ -90,9 +99,23 @@ namespace otto::modules {
     util::audio::Section<int> loopSect;
     util::audio::Section<int> recSect;
 
+    /// Frames read before the tape wrapped around the loop in the current
+    /// block, or `-1`. Recording uses this to split the block the same way.
+    int wrapFrames = -1;
+    /// The position the tape wrapped from
+    int wrapPosition = 0;
+
     int overruns = 0;
 
-    audio::ProcessData<4> process_playback(audio::ProcessData<0>);
+    /// The slice the last lift took, and its track
+    TapeSlice liftedSlice;
+    int liftedTrack = 0;
+    /// Set by the producer once the lift has run. <process_playback> then
+    /// erases <liftedSlice>, as the slices are only changed from there and
+    /// the UI.
+    std::atomic<bool> liftDone {false};
+
+    audio::ProcessData<tape_buffer::tracks> process_playback(audio::ProcessData<0>);
     audio::ProcessData<0> process_record(audio::ProcessData<1>);
 
     void display() override;
@@ -108,7 +131,18 @@ namespace otto::modules {
     void goToBar(int bar);
     void goToBarRel(int bars);
 
+    /// Move the slice of the current track at the playpoint to the clipboard,
+    /// leaving silence. Runs in the background.
+    void lift();
+    /// Write the clipboard to the current track at the playpoint, as a new
+    /// slice. Runs in the background.
+    void drop();
+
     int timeUntil(std::size_t tt);
+
+    /// The number of frames, at most `n`, to read at `speed` before the tape
+    /// reaches the end of the loop and wraps around
+    int framesUntilWrap(int n, float speed);
   };
 
 } // otto::module
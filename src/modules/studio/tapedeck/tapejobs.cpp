@@ -0,0 +1,176 @@
+#include "tapejobs.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace otto {
+
+  using Section = TapeJob::Section;
+
+  namespace {
+    /// Call `f(position, n)` for each chunk of `s`, from the end if
+    /// `backwards`, reporting progress going from `from` to `to`
+    ///
+    /// \returns `false` if the tape stopped the job
+    template<typename F>
+    bool for_chunks(TapeJob::Tape& tape, Section s, bool backwards,
+      float from, float to, F&& f)
+    {
+      int total = s.size();
+      for (int done = 0; done < total;) {
+        int n = std::min(TapeJob::chunk_size, total - done);
+        f(backwards ? s.out - done - n : s.in + done, n);
+        done += n;
+        if (!tape.progress(from + (to - from) * done / total)) return false;
+      }
+      return true;
+    }
+
+    Section clip_to(Section s, int length)
+    {
+      return {std::max(0, s.in), std::min(length, s.out)};
+    }
+  }
+
+  TapeJob TapeJob::bounce(const std::array<float, tracks>& gains, int track, Section section)
+  {
+    TapeJob job;
+    job.op = Bounce;
+    job.track = track;
+    job.section = section;
+    job.gains = gains;
+    return job;
+  }
+
+  TapeJob TapeJob::reverse(int track, Section section)
+  {
+    TapeJob job;
+    job.op = Reverse;
+    job.track = track;
+    job.section = section;
+    return job;
+  }
+
+  TapeJob TapeJob::normalize(int track, Section section, float level)
+  {
+    TapeJob job;
+    job.op = Normalize;
+    job.track = track;
+    job.section = section;
+    job.level = level;
+    return job;
+  }
+
+  TapeJob TapeJob::copy(int source, Section section, int track, int position)
+  {
+    TapeJob job;
+    job.op = Copy;
+    job.source = source;
+    job.section = section;
+    job.track = track;
+    job.position = position;
+    return job;
+  }
+
+  TapeJob TapeJob::lift(int track, Section section)
+  {
+    TapeJob job;
+    job.op = Lift;
+    job.track = track;
+    job.section = section;
+    return job;
+  }
+
+  TapeJob TapeJob::drop(int track, int position)
+  {
+    TapeJob job;
+    job.op = Drop;
+    job.track = track;
+    job.position = position;
+    return job;
+  }
+
+  bool TapeJob::run(Tape& tape) const
+  {
+    std::vector<float> a(chunk_size);
+    std::vector<float> b(chunk_size);
+    int length = tape.length();
+    auto s = clip_to(section, length);
+
+    switch (op) {
+    case Bounce:
+      return for_chunks(tape, s, false, 0, 1, [&] (int p, int n) {
+          std::fill_n(b.begin(), n, 0.f);
+          for (int t = 0; t < tracks; t++) {
+            if (gains[t] == 0) continue;
+            tape.read(t, p, a.data(), n);
+            for (int i = 0; i < n; i++) b[i] += a[i] * gains[t];
+          }
+          tape.write(track, p, b.data(), n);
+        });
+
+    case Reverse:
+      // Swap chunks from both ends, meeting in the middle
+      return for_chunks(tape, {0, s.size() / 2}, false, 0, 1, [&] (int k, int n) {
+          int p = s.in + k;
+          int q = s.out - k - n;
+          tape.read(track, p, a.data(), n);
+          tape.read(track, q, b.data(), n);
+          std::reverse(a.begin(), a.begin() + n);
+          std::reverse(b.begin(), b.begin() + n);
+          tape.write(track, p, b.data(), n);
+          tape.write(track, q, a.data(), n);
+        });
+
+    case Normalize: {
+      float peak = 0;
+      bool ok = for_chunks(tape, s, false, 0, 0.5f, [&] (int p, int n) {
+          tape.read(track, p, a.data(), n);
+          for (int i = 0; i < n; i++) peak = std::max(peak, std::abs(a[i]));
+        });
+      if (!ok) return false;
+      if (peak == 0) return true;
+      float gain = level / peak;
+      return for_chunks(tape, s, false, 0.5f, 1, [&] (int p, int n) {
+          tape.read(track, p, a.data(), n);
+          for (int i = 0; i < n; i++) a[i] *= gain;
+          tape.write(track, p, a.data(), n);
+        });
+    }
+
+    case Copy: {
+      int offset = position - section.in;
+      s.in = std::max(s.in, -offset);
+      s.out = std::min(s.out, length - offset);
+      if (s.size() <= 0) return true;
+      // Like memmove, copy from the end when that would overwrite what is
+      // still to be copied
+      bool backwards = source == track && offset > 0;
+      return for_chunks(tape, s, backwards, 0, 1, [&] (int p, int n) {
+          tape.read(source, p, a.data(), n);
+          tape.write(track, p + offset, a.data(), n);
+        });
+    }
+
+    case Lift:
+      tape.resize_clip(std::max(0, s.size()));
+      std::fill(b.begin(), b.end(), 0.f);
+      return for_chunks(tape, s, false, 0, 1, [&] (int p, int n) {
+          tape.read(track, p, a.data(), n);
+          tape.write(clipboard, p - s.in, a.data(), n);
+          tape.write(track, p, b.data(), n);
+        });
+
+    case Drop: {
+      s = clip_to({position, position + tape.clip_length()}, length);
+      return for_chunks(tape, s, false, 0, 1, [&] (int p, int n) {
+          tape.read(clipboard, p - position, a.data(), n);
+          tape.write(track, p, a.data(), n);
+        });
+    }
+    }
+    return true;
+  }
+
+}
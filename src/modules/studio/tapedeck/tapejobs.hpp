@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+#include "util/audio.hpp"
+
+namespace otto {
+
+  /// An edit of the tape's audio that takes too long for the audio or UI
+  /// thread, like bouncing tracks together or reversing a slice
+  ///
+  /// Jobs are queued with <tape_buffer::start_job>, and run on a worker
+  /// thread a chunk at a time, so the producer can bring the buffer, the
+  /// caches and the overviews up to date behind each chunk. Jobs only change
+  /// audio. Slices are left to whoever starts them, after <on_done>.
+  struct TapeJob {
+    static constexpr int tracks = util::audio::tape_tracks;
+    using Section = util::audio::Section<int>;
+
+    /// Frames read and written at a time
+    static constexpr int chunk_size = 1 << 14;
+
+    /// The clipboard, as a track of <Tape>. Holds what was lifted.
+    static constexpr int clipboard = tracks;
+
+    enum Op : std::uint8_t {
+      /// Replace `section` of `track` with the mix of all tracks, scaled by
+      /// `gains`
+      Bounce,
+      /// Reverse `section` of `track`
+      Reverse,
+      /// Scale `section` of `track` so its peak is at `level`
+      Normalize,
+      /// Copy `section` of `source` to `track` at `position`
+      Copy,
+      /// Move `section` of `track` to the clipboard, leaving silence
+      Lift,
+      /// Write the clipboard to `track` at `position`
+      Drop,
+    };
+
+    Op op = Bounce;
+    std::uint8_t track = 0;
+    std::uint8_t source = 0;
+    Section section = {0, 0};
+    int position = 0;
+    float level = 1;
+    std::array<float, tracks> gains = {};
+
+    /// Called on the producer thread once the job is over, with whether it
+    /// ran to the end. Jobs that are cancelled or dropped before they run
+    /// are over too. It must not change the slices, which belong to the
+    /// audio and UI threads, but can signal one of them to.
+    std::function<void(bool completed)> on_done;
+
+    static TapeJob bounce(const std::array<float, tracks>& gains, int track, Section section);
+    static TapeJob reverse(int track, Section section);
+    static TapeJob normalize(int track, Section section, float level = 1);
+    static TapeJob copy(int source, Section section, int track, int position);
+    static TapeJob lift(int track, Section section);
+    static TapeJob drop(int track, int position);
+
+    /// The audio a job works on
+    struct Tape {
+      virtual ~Tape() = default;
+
+      /// Frames on each track
+      virtual int length() const = 0;
+      /// Frames on the clipboard
+      virtual int clip_length() const = 0;
+      /// Make the clipboard `frames` frames of silence
+      virtual void resize_clip(int frames) = 0;
+
+      /// Read `n` frames of `track` at `position` into `dst`
+      virtual void read(int track, int position, float* dst, int n) = 0;
+      /// Write `n` frames from `src` to `track` at `position`
+      virtual void write(int track, int position, const float* src, int n) = 0;
+
+      /// Called after each chunk with the fraction of the job done
+      ///
+      /// \returns `false` to stop the job there
+      virtual bool progress(float /*done*/) { return true; }
+    };
+
+    /// Run the job on `tape`. Sections are clipped to the tape.
+    ///
+    /// \returns `false` if <Tape::progress> stopped it
+    bool run(Tape& tape) const;
+  };
+
+}
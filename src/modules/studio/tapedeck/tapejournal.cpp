@@ -0,0 +1,168 @@
+#include "tapejournal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <plog/Log.h>
+
+#include "util/exception.hpp"
+
+namespace otto {
+
+  namespace {
+    /// File header. Entries follow directly after it.
+    struct Header {
+      std::array<char, 4> magic = {{'O', 'T', 'J', 'L'}};
+      std::uint32_t version = 0;
+      std::uint32_t generation = 0;
+      std::uint32_t reserved = 0;
+    };
+
+    static_assert(sizeof(Header) == 16);
+
+    /// Write all of `n` bytes, or throw
+    void write_all(int fd, const void* data, std::size_t n)
+    {
+      auto* p = static_cast<const char*>(data);
+      while (n > 0) {
+        auto res = ::write(fd, p, n);
+        if (res < 0) {
+          if (errno == EINTR) continue;
+          throw util::exception("Tape journal: write: {}", std::strerror(errno));
+        }
+        p += res;
+        n -= res;
+      }
+    }
+  }
+
+  std::uint32_t TapeJournal::Entry::checksum() const
+  {
+    // FNV-1a over everything before `check`
+    auto* p = reinterpret_cast<const unsigned char*>(this);
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < offsetof(Entry, check); i++) {
+      hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  TapeJournal::~TapeJournal()
+  {
+    close();
+  }
+
+  void TapeJournal::log(Entry::Op op, int track, int a, int b)
+  {
+    Entry e;
+    e.op = op;
+    e.track = track;
+    e.a = a;
+    e.b = b;
+    if (!queue.try_push(e)) {
+      _overflowed = true;
+    }
+  }
+
+  bool TapeJournal::pop(Entry& e)
+  {
+    return queue.try_pop(e);
+  }
+
+  bool TapeJournal::overflowed()
+  {
+    return _overflowed.exchange(false);
+  }
+
+  bool TapeJournal::read(const fs::path& path, std::uint32_t generation,
+    std::vector<Entry>& entries)
+  {
+    entries.clear();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    Header header;
+    bool valid = ::read(fd, &header, sizeof(header)) == sizeof(header)
+      && header.magic == Header().magic
+      && header.version == version
+      && (header.generation == generation || header.generation == generation + 1);
+    if (valid) {
+      std::array<Entry, 256> block;
+      ssize_t n;
+      while ((n = ::read(fd, block.data(), sizeof(block))) > 0) {
+        auto count = std::size_t(n) / sizeof(Entry);
+        for (std::size_t i = 0; i < count; i++) {
+          if (block[i].check != block[i].checksum()) {
+            LOGE << "Tape journal is damaged after " << entries.size() << " entries";
+            ::close(fd);
+            return true;
+          }
+          entries.push_back(block[i]);
+        }
+        if (std::size_t(n) % sizeof(Entry) != 0) break;
+      }
+    }
+    ::close(fd);
+    return valid;
+  }
+
+  void TapeJournal::start(const fs::path& path, std::uint32_t generation,
+    const std::vector<Entry>& snapshot)
+  {
+    close();
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    int tmp = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmp < 0) {
+      throw util::exception("Tape journal: open: {}", std::strerror(errno));
+    }
+    Header header;
+    header.version = version;
+    header.generation = generation;
+    fd = tmp;
+    write_all(fd, &header, sizeof(header));
+    _length = 0;
+    append(snapshot.data(), snapshot.size());
+    sync();
+    // The new journal replaces the old one all at once
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      throw util::exception("Tape journal: rename: {}", std::strerror(errno));
+    }
+  }
+
+  void TapeJournal::append(const Entry* entries, std::size_t n)
+  {
+    if (fd < 0 || n == 0) return;
+    std::array<Entry, 256> block;
+    while (n > 0) {
+      auto count = std::min(n, block.size());
+      for (std::size_t i = 0; i < count; i++) {
+        block[i] = entries[i];
+        block[i].check = block[i].checksum();
+      }
+      write_all(fd, block.data(), count * sizeof(Entry));
+      entries += count;
+      n -= count;
+      _length += count;
+    }
+  }
+
+  void TapeJournal::sync()
+  {
+    if (fd < 0) return;
+    ::fdatasync(fd);
+  }
+
+  void TapeJournal::close()
+  {
+    if (fd < 0) return;
+    ::close(fd);
+    fd = -1;
+  }
+
+}
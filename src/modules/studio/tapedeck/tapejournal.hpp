@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <filesystem.hpp>
+
+#include "util/mpsc-queue.hpp"
+
+namespace otto {
+
+  /// An append only log of edits to the tape's slices and metadata
+  ///
+  /// Edits are queued from any thread with <log>, and the producer writes
+  /// them to disk with <append> and <sync>. Every so often, the producer
+  /// writes everything to the tape file, and starts a new journal with a
+  /// snapshot of the current state, so replaying it stays fast.
+  ///
+  /// The journal belongs to a generation of the tape file. A journal for the
+  /// next generation may exist if a compaction was cut short, and holds
+  /// everything needed on its own.
+  class TapeJournal {
+  public:
+
+    struct Entry {
+      enum Op : std::uint8_t {
+        /// Remove all slices of `track`
+        Clear,
+        /// Add the slice `[a, b]` to `track`
+        Add,
+        /// Erase `[a, b]` from the slices of `track`
+        Erase,
+        /// Cut the slice of `track` containing `a`
+        Cut,
+        /// Set the loop points to `[a, b]`
+        SetLoop,
+      };
+
+      std::uint8_t op = Clear;
+      std::uint8_t track = 0;
+      std::uint16_t reserved = 0;
+      std::int32_t a = 0;
+      std::int32_t b = 0;
+      /// Checksum of the fields above, so torn writes are detected
+      std::uint32_t check = 0;
+
+      std::uint32_t checksum() const;
+    };
+
+    static_assert(sizeof(Entry) == 16);
+
+    static constexpr std::size_t queue_size = 1024;
+
+    TapeJournal() = default;
+    TapeJournal(const TapeJournal&) = delete;
+    ~TapeJournal();
+
+    /// Queue an edit for the producer. Lock free, safe from any thread.
+    void log(Entry::Op op, int track, int a = 0, int b = 0);
+
+    /// Take the oldest queued edit. Only call from the producer thread.
+    bool pop(Entry& e);
+
+    /// Whether edits were lost since the last call, because the queue was
+    /// full. If so, the journal no longer matches, and needs a new snapshot.
+    bool overflowed();
+
+    /// Read the journal at `path`, if it belongs to `generation` or the one
+    /// after it
+    ///
+    /// Reading stops at the first damaged entry.
+    ///
+    /// \returns whether `entries` should be replayed
+    static bool read(const fs::path& path, std::uint32_t generation,
+      std::vector<Entry>& entries);
+
+    /// Atomically replace the journal at `path` with one for `generation`,
+    /// starting with `snapshot`, and keep it open for appending
+    void start(const fs::path& path, std::uint32_t generation,
+      const std::vector<Entry>& snapshot);
+
+    /// Append `n` entries. They are durable after <sync>.
+    void append(const Entry* entries, std::size_t n);
+
+    /// Wait for appended entries to reach the disk
+    void sync();
+
+    /// The number of entries in the open journal
+    std::size_t length() const { return _length; }
+
+    void close();
+
+  private:
+
+    static constexpr std::uint32_t version = 1;
+
+    util::mpsc_queue<Entry, queue_size> queue;
+    std::atomic_bool _overflowed {false};
+
+    int fd = -1;
+    std::size_t _length = 0;
+  };
+
+}
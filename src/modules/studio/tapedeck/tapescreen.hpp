@@ -21,6 +21,16 @@ namespace otto::modules {
 
     using ui::ModuleScreen<Tapedeck>::ModuleScreen;
 
+    /// Select track `n` of the bank of four holding the current track. With
+    /// `shift`, select track `n` of the next bank, wrapping to the first.
+    void select_track(int n, bool shift)
+    {
+      int bank = module->state.track / 4;
+      if (shift && (bank + 1) * 4 < tape_buffer::tracks) bank++;
+      else if (shift) bank = 0;
+      module->state.track = bank * 4 + n;
+    }
+
     bool keypress(ui::Key key) override
     {
       bool shift = Globals::ui.keys[ui::K_SHIFT];
@@ -34,16 +44,16 @@ namespace otto::modules {
         }
         return false;
       case ui::K_TRACK_1:
-        module->state.track = 0;
+        select_track(0, shift);
         return true;
       case ui::K_TRACK_2:
-        module->state.track = 1;
+        select_track(1, shift);
         return true;
       case ui::K_TRACK_3:
-        module->state.track = 2;
+        select_track(2, shift);
         return true;
       case ui::K_TRACK_4:
-        module->state.track = 3;
+        select_track(3, shift);
         return true;
       case ui::K_LEFT:
         if (shift) module->goToBarRel(-1);
@@ -75,15 +85,11 @@ namespace otto::modules {
         }
           return true;
       case ui::K_LIFT:
-        if (module->state.doTapeOps())
-          // TODO:
-          // module->tapeBuffer.lift(module->state.track);
-          return true;
+        module->lift();
+        return true;
       case ui::K_DROP:
-        if (module->state.doTapeOps())
-          // TODO:
-          // module->tapeBuffer.drop(module->state.track);
-          return true;
+        module->drop();
+        return true;
       default:
         return false;
       }
@@ -145,6 +151,7 @@ namespace otto::modules {
       draw_timeline(ctx);
       draw_static_backround(ctx);
       draw_text(ctx);
+      draw_job_progress(ctx);
       draw_state_icon(ctx);
       draw_speed_indicator(ctx);
       draw_slider(ctx);
@@ -404,6 +411,29 @@ namespace otto::modules {
       ctx.restore();
     }
 
+    /// A bar under the timestamp while a tape job runs
+    void draw_job_progress(Canvas& ctx)
+    {
+      auto status = module->tapeBuffer->job_status();
+      if (!status.running && status.queued == 0) return;
+      ctx.save();
+      ctx.lineWidth(2.0);
+      ctx.lineCap(Canvas::LineCap::ROUND);
+      ctx.beginPath();
+      ctx.moveTo(130.5, 50.0);
+      ctx.lineTo(190.5, 50.0);
+      ctx.strokeStyle(Colours::Tape);
+      ctx.stroke();
+      if (status.running) {
+        ctx.beginPath();
+        ctx.moveTo(130.5, 50.0);
+        ctx.lineTo(130.5 + 60 * status.progress, 50.0);
+        ctx.strokeStyle(Colours::White);
+        ctx.stroke();
+      }
+      ctx.restore();
+    }
+
     void draw_timeline(Canvas& ctx)
     {
       // tAPEDECK/TIMELINEMARKERS
@@ -467,11 +497,15 @@ namespace otto::modules {
       }
 
       // tAPEDECK/TIMELINE
-      ctx.lineWidth(2.0);
+      constexpr int tracks = tape_buffer::tracks;
+      // The tracks share the height of four rows at 5px
+      constexpr float row_spacing = 14.8f / (tracks - 1);
+      auto track_y = [&] (int track) { return 203.f + row_spacing * track; };
+      ctx.lineWidth(std::min(2.f, row_spacing));
 
       auto draw_slice = [&] (auto slice, int track) {
         if (slice.size() == 0) return;
-        float y = 203 + 5 * track;
+        float y = track_y(track);
         ctx.beginPath();
         ctx.moveTo(std::max(left_edge,  time_to_coord(slice.in)), y);
         ctx.lineTo(std::min(right_edge, time_to_coord(slice.out - 1)), y);
@@ -479,7 +513,7 @@ namespace otto::modules {
       };
 
       ctx.strokeStyle(Colours::Tape);
-      for (int track = 0; track < 4; track++) {
+      for (int track = 0; track < tracks && module->state.tapeLoaded; track++) {
         for (auto&& slice : module->tapeBuffer->slices[track]
                .overlapping_slices(view_time)) {
           draw_slice(slice, track);
@@ -491,100 +525,30 @@ namespace otto::modules {
       auto slice = module->recSect;
       if (slice.size() > 0 ) {
         ctx.strokeStyle(Colours::Red);
-      } else {
+      } else if (module->state.tapeLoaded) {
         slice = module->tapeBuffer->slices[cur_track].current(module->position());
         ctx.strokeStyle(Colours::Blue);
+      } else {
+        slice = {0, 0};
       }
       draw_slice(slice, cur_track);
 
       // tAPEDECK/TIMELINE/TAPEINDICATORLEFT
+      // tAPEDECK/TIMELINE/TAPEINDICATORRIGHT
 
       auto indicator_colour = [&] (int track) {
         return (module->state.track == track) ?
         Colour(Colours::White) : Colour::bytes(60, 60, 59);
       };
 
-      // tAPEDECK/TIMELINE/TAPEINDICATORLEFT/1
-      ctx.beginPath();
-      ctx.moveTo(23.2, 203.0);
-      ctx.bezierCurveTo(23.2, 203.9, 22.5, 204.6, 21.6, 204.6);
-      ctx.bezierCurveTo(20.7, 204.6, 20.0, 203.9, 20.0, 203.0);
-      ctx.bezierCurveTo(20.0, 202.2, 20.7, 201.5, 21.6, 201.5);
-      ctx.bezierCurveTo(22.5, 201.5, 23.2, 202.2, 23.2, 203.0);
-      ctx.closePath();
-      ctx.fill(indicator_colour(0));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORLEFT/2
-      ctx.beginPath();
-      ctx.moveTo(23.2, 208.3);
-      ctx.bezierCurveTo(23.2, 209.2, 22.5, 209.9, 21.6, 209.9);
-      ctx.bezierCurveTo(20.7, 209.9, 20.0, 209.2, 20.0, 208.3);
-      ctx.bezierCurveTo(20.0, 207.4, 20.7, 206.7, 21.6, 206.7);
-      ctx.bezierCurveTo(22.5, 206.7, 23.2, 207.4, 23.2, 208.3);
-      ctx.closePath();
-      ctx.fill(indicator_colour(1));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORLEFT/3
-      ctx.beginPath();
-      ctx.moveTo(23.2, 213.0);
-      ctx.bezierCurveTo(23.2, 213.9, 22.5, 214.6, 21.6, 214.6);
-      ctx.bezierCurveTo(20.7, 214.6, 20.0, 213.9, 20.0, 213.0);
-      ctx.bezierCurveTo(20.0, 212.2, 20.7, 211.5, 21.6, 211.5);
-      ctx.bezierCurveTo(22.5, 211.5, 23.2, 212.2, 23.2, 213.0);
-      ctx.closePath();
-      ctx.fill(indicator_colour(2));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORLEFT/4
-      ctx.beginPath();
-      ctx.moveTo(23.2, 217.8);
-      ctx.bezierCurveTo(23.2, 218.6, 22.5, 219.4, 21.6, 219.4);
-      ctx.bezierCurveTo(20.7, 219.4, 20.0, 218.6, 20.0, 217.8);
-      ctx.bezierCurveTo(20.0, 216.9, 20.7, 216.2, 21.6, 216.2);
-      ctx.bezierCurveTo(22.5, 216.2, 23.2, 216.9, 23.2, 217.8);
-      ctx.closePath();
-      ctx.fill(indicator_colour(3));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORRIGHT
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORRIGHT/2
-      ctx.beginPath();
-      ctx.moveTo(299.4, 203.0);
-      ctx.bezierCurveTo(299.4, 203.9, 298.7, 204.6, 297.8, 204.6);
-      ctx.bezierCurveTo(296.9, 204.6, 296.2, 203.9, 296.2, 203.0);
-      ctx.bezierCurveTo(296.2, 202.2, 296.9, 201.5, 297.8, 201.5);
-      ctx.bezierCurveTo(298.7, 201.5, 299.4, 202.2, 299.4, 203.0);
-      ctx.closePath();
-      ctx.fill(indicator_colour(0));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORRIGHT/3
-      ctx.beginPath();
-      ctx.moveTo(299.4, 208.3);
-      ctx.bezierCurveTo(299.4, 209.2, 298.7, 209.9, 297.8, 209.9);
-      ctx.bezierCurveTo(296.9, 209.9, 296.2, 209.2, 296.2, 208.3);
-      ctx.bezierCurveTo(296.2, 207.4, 296.9, 206.7, 297.8, 206.7);
-      ctx.bezierCurveTo(298.7, 206.7, 299.4, 207.4, 299.4, 208.3);
-      ctx.closePath();
-      ctx.fill(indicator_colour(1));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORRIGHT/3
-      ctx.beginPath();
-      ctx.moveTo(299.4, 213.0);
-      ctx.bezierCurveTo(299.4, 213.9, 298.7, 214.6, 297.8, 214.6);
-      ctx.bezierCurveTo(296.9, 214.6, 296.2, 213.9, 296.2, 213.0);
-      ctx.bezierCurveTo(296.2, 212.2, 296.9, 211.5, 297.8, 211.5);
-      ctx.bezierCurveTo(298.7, 211.5, 299.4, 212.2, 299.4, 213.0);
-      ctx.closePath();
-      ctx.fill(indicator_colour(2));
-
-      // tAPEDECK/TIMELINE/TAPEINDICATORRIGHT/4
-      ctx.beginPath();
-      ctx.moveTo(299.4, 217.8);
-      ctx.bezierCurveTo(299.4, 218.6, 298.7, 219.4, 297.8, 219.4);
-      ctx.bezierCurveTo(296.9, 219.4, 296.2, 218.6, 296.2, 217.8);
-      ctx.bezierCurveTo(296.2, 216.9, 296.9, 216.2, 297.8, 216.2);
-      ctx.bezierCurveTo(298.7, 216.2, 299.4, 216.9, 299.4, 217.8);
-      ctx.closePath();
-      ctx.fill(indicator_colour(3));
+      float indicator_radius = std::min(1.6f, row_spacing / 2);
+      for (int track = 0; track < tracks; track++) {
+        for (float x : {21.6f, 297.8f}) {
+          ctx.beginPath();
+          ctx.circle(x, track_y(track), indicator_radius);
+          ctx.fill(indicator_colour(track));
+        }
+      }
 
       ctx.restore();
     }
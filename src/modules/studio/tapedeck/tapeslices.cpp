@@ -0,0 +1,113 @@
+#include "tapeslices.hpp"
+
+#include <algorithm>
+
+#include "tapejournal.hpp"
+
+namespace otto {
+
+  TapeSliceSet::TapeSliceSet()
+  {
+    // Most edits happen while drawing, so don't reallocate unless the
+    // tape has more slices than can be saved anyway.
+    slices.reserve(max_slices);
+  }
+
+  void TapeSliceSet::set_journal(TapeJournal* journal, int track)
+  {
+    this->journal = journal;
+    this->track = track;
+  }
+
+  std::vector<TapeSlice>::iterator TapeSliceSet::first_ending_after(int time)
+  {
+    return std::lower_bound(slices.begin(), slices.end(), time,
+      [] (const TapeSlice& s, int t) { return s.out < t; });
+  }
+
+  TapeSliceSet::iterator TapeSliceSet::first_ending_after(int time) const
+  {
+    return std::lower_bound(slices.begin(), slices.end(), time,
+      [] (const TapeSlice& s, int t) { return s.out < t; });
+  }
+
+  util::IteratorRange<TapeSliceSet::iterator>
+  TapeSliceSet::overlapping_slices(TapeSlice area) const
+  {
+    auto first = first_ending_after(area.in);
+    auto last = std::upper_bound(first, slices.end(), area.out,
+      [] (int t, const TapeSlice& s) { return t < s.in; });
+    return util::range(first, last);
+  }
+
+  bool TapeSliceSet::in_slice(int time) const
+  {
+    auto iter = first_ending_after(time);
+    return iter != slices.end() && iter->in <= time;
+  }
+
+  TapeSlice TapeSliceSet::current(int time) const
+  {
+    auto iter = first_ending_after(time);
+    if (iter != slices.end() && iter->in <= time) return *iter;
+    return {-1, -1};
+  }
+
+  void TapeSliceSet::erase(TapeSlice area)
+  {
+    if (area.out < area.in) return;
+    if (journal) journal->log(TapeJournal::Entry::Erase, track, area.in, area.out);
+    erase_unlogged(area);
+  }
+
+  void TapeSliceSet::erase_unlogged(TapeSlice area)
+  {
+    auto first = first_ending_after(area.in);
+    auto last = std::upper_bound(first, slices.end(), area.out,
+      [] (int t, const TapeSlice& s) { return t < s.in; });
+    if (first == last) return;
+
+    // What is left of the outermost slices
+    TapeSlice before = {first->in, area.in - 1};
+    TapeSlice after = {area.out + 1, std::prev(last)->out};
+
+    auto pos = slices.erase(first, last);
+    if (after.size() > 0) pos = slices.insert(pos, after);
+    if (before.size() > 0) slices.insert(pos, before);
+  }
+
+  void TapeSliceSet::add(TapeSlice slice)
+  {
+    if (slice.size() <= 0) return;
+    if (journal) journal->log(TapeJournal::Entry::Add, track, slice.in, slice.out);
+    erase_unlogged(slice);
+    slices.insert(first_ending_after(slice.in), slice);
+  }
+
+  void TapeSliceSet::cut(int time)
+  {
+    auto iter = first_ending_after(time);
+    if (iter == slices.end() || iter->in > time) return;
+    if (journal) journal->log(TapeJournal::Entry::Cut, track, time);
+    TapeSlice second = {time + 1, iter->out};
+    iter->out = time;
+    if (iter->size() <= 0) {
+      iter = slices.erase(iter);
+    } else {
+      iter++;
+    }
+    if (second.size() > 0) slices.insert(iter, second);
+  }
+
+  void TapeSliceSet::glue(TapeSlice s1, TapeSlice s2)
+  {
+    add({std::min(s1.in, s2.in), std::max(s1.out, s2.out)});
+  }
+
+  void TapeSliceSet::clear()
+  {
+    if (journal) journal->log(TapeJournal::Entry::Clear, track);
+    slices.clear();
+  }
+
+}
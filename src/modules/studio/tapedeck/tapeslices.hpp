@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include "util/audio.hpp"
+#include "util/iterator.hpp"
+#include "util/tapefile.hpp"
+
+namespace otto {
+
+  class TapeJournal;
+
+  using TapeSlice = util::audio::Section<int>;
+
+  /// The slices of one tape track
+  ///
+  /// Slices are closed intervals, `[in, out]`. They are kept sorted and
+  /// non-overlapping, so both the `in`s and the `out`s are in increasing
+  /// order, and point and range queries are binary searches.
+  class TapeSliceSet {
+  public:
+    using iterator = std::vector<TapeSlice>::const_iterator;
+
+    /// The number of slices a <util::TapeFile> stores per track
+    static constexpr std::size_t max_slices = util::TapeFile::max_slices;
+
+    TapeSliceSet();
+
+    /// Log all edits from now on to `journal`, as edits of `track`. Pass
+    /// `nullptr` to stop logging, like while replaying a journal.
+    void set_journal(TapeJournal* journal, int track);
+
+    /// The slices overlapping `area`, in order. Does not allocate.
+    util::IteratorRange<iterator> overlapping_slices(TapeSlice area) const;
+
+    bool in_slice(int time) const;
+
+    /// The slice containing `time`, or `{-1, -1}`
+    TapeSlice current(int time) const;
+
+    /// Add `slice`, replacing whatever was in that area
+    void add(TapeSlice slice);
+
+    /// Clear `area`, trimming and splitting the slices overlapping it
+    void erase(TapeSlice area);
+
+    /// Split the slice containing `time` in two, at `time`
+    void cut(int time);
+
+    /// Join two slices, and everything between them, into one
+    void glue(TapeSlice s1, TapeSlice s2);
+
+    // Iteration
+    iterator begin() const { return slices.begin(); }
+    iterator end() const { return slices.end(); }
+    std::size_t size() const { return slices.size(); }
+    void clear();
+
+  private:
+    void erase_unlogged(TapeSlice area);
+
+    /// The first slice that ends at or after `time`
+    std::vector<TapeSlice>::iterator first_ending_after(int time);
+    iterator first_ending_after(int time) const;
+
+    std::vector<TapeSlice> slices;
+    TapeJournal* journal = nullptr;
+    int track = 0;
+  };
+}
@@ -33,69 +33,63 @@ namespace otto::modules {
 
   audio::ProcessData<1> SynthSampler::process(audio::ProcessData<0> data)
   {
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent,
-        [&] (midi::NoteOnEvent& e) {
-          if (e.channel == 0) {
-            props.playProgress = (props.fwd()) ? 0 : props.length() - 1;
-            props.trigger = true;
-          }
-        }, [] (auto) {});
-    }
-
-    float playSpeed = props.speed * sampleSpeed;
-
-    // Process audio
-    if (props.playProgress >= 0 && playSpeed > 0) {
-      if (props.fwd()) {
-        if (props.loop() && props.trigger) {
-          for(int i = 0; i < data.nframes; ++i) {
-            proc_buf[i][0] += sampleData[props.in + props.playProgress];
-            props.playProgress += playSpeed;
+    proc_buf.clear();
+    auto out = proc_buf[0];
+
+    midi::split_block(data.midi, data.nframes, [&] (const midi::MidiEvent& e) {
+      if (e.channel != 0) return;
+      if (e.is_note_on()) {
+        props.playProgress = (props.fwd()) ? 0 : props.length() - 1;
+        props.trigger = true;
+      } else if (e.is_note_off()) {
+        props.trigger = false;
+        if (props.stop()) {
+          props.playProgress = -1;
+        }
+      }
+    }, [&] (long from, long n) {
+      float playSpeed = props.speed * sampleSpeed;
+
+      // Process audio
+      if (props.playProgress >= 0 && playSpeed > 0) {
+        if (props.fwd()) {
+          if (props.loop() && props.trigger) {
+            for(int i = from; i < from + n; ++i) {
+              out[i] += sampleData[props.in + props.playProgress];
+              props.playProgress += playSpeed;
+              if (props.playProgress >= props.length()) {
+                props.playProgress = 0;
+              }
+            }
+          } else {
+            int frms = std::min<int>(n, props.length() - props.playProgress);
+            for(int i = from; i < from + frms; ++i) {
+              out[i] += sampleData[props.in + props.playProgress];
+              props.playProgress += playSpeed;
+            }
             if (props.playProgress >= props.length()) {
-              props.playProgress = 0;
+              props.playProgress = -1;
             }
           }
         } else {
-          int frms = std::min<int>(data.nframes, props.length() - props.playProgress);
-          for(int i = 0; i < frms; ++i) {
-            proc_buf[i][0] += sampleData[props.in + props.playProgress];
-            props.playProgress += playSpeed;
-          }
-          if (props.playProgress >= props.length()) {
-            props.playProgress = -1;
-          }
-        }
-      } else {
-        if (props.loop() && props.trigger) {
-          for(int i = 0; i < data.nframes; ++i) {
-            proc_buf[i][0] += sampleData[props.in + props.playProgress];
-            props.playProgress -= playSpeed;
-            if (props.playProgress < 0) {
-              props.playProgress = props.length() -1;
+          if (props.loop() && props.trigger) {
+            for(int i = from; i < from + n; ++i) {
+              out[i] += sampleData[props.in + props.playProgress];
+              props.playProgress -= playSpeed;
+              if (props.playProgress < 0) {
+                props.playProgress = props.length() -1;
+              }
+            }
+          } else {
+            int frms = std::min<int>(n, props.playProgress);
+            for(int i = from; i < from + frms; ++i) {
+              out[i] += sampleData[props.in + props.playProgress];
+              props.playProgress -= playSpeed;
             }
-          }
-        } else {
-          int frms = std::min<int>(data.nframes, props.playProgress);
-          for(int i = 0; i < frms; ++i) {
-            proc_buf[i][0] += sampleData[props.in + props.playProgress];
-            props.playProgress -= playSpeed;
           }
         }
       }
-    }
-
-    for (auto &&nEvent : data.midi) {
-      util::match(nEvent,
-        [&] (midi::NoteOffEvent& e) {
-          if (e.channel == 0) {
-            props.trigger = false;
-            if (props.stop()) {
-              props.playProgress = -1;
-            }
-          }
-        }, [] (auto) {});
-    }
+    });
 
     return data.redirect(proc_buf);
   }
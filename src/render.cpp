@@ -0,0 +1,167 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fmt/format.h>
+#include <plog/Log.h>
+#include <plog/Appenders/ConsoleAppender.h>
+
+#include "core/audio/midi.hpp"
+#include "core/audio/offline_backend.hpp"
+#include "modules/studio/tapedeck/tapedeck.hpp"
+#include "modules/studio/mixer/mixer.hpp"
+#include "modules/drums/simple-drums/simple-drums.hpp"
+#include "modules/drums/drum-sampler/drum-sampler.hpp"
+#include "modules/synths/synth-sampler/synth-sampler.hpp"
+#include "modules/synths/nuke/nuke.hpp"
+#include "core/globals.hpp"
+#include "util/exception.hpp"
+
+// Renders OTTO offline, without a sound system or UI:
+//
+//     otto_render [-i input.wav] [-m script.midi] [-b buffer size]
+//                 [-r sample rate] [-n frames] [-j workers]
+//                 [--data-dir dir] output.wav
+//
+// The render works on a copy of the data directory, `data` unless another
+// is given, in a temporary directory that is removed when done. The tape
+// and settings there are never changed.
+//
+// Prints the throughput and the cost of each buffer when done.
+
+static void usage()
+{
+  fmt::print(stderr, "usage: otto_render [-i input.wav] [-m script.midi] "
+    "[-b buffer size] [-r sample rate] [-n frames] [-j workers] "
+    "[--data-dir dir] output.wav\n");
+  std::exit(2);
+}
+
+/// Make a new, empty directory for this render
+static filesystem::path make_temp_dir()
+{
+  auto path = (filesystem::temp_directory_path() / "otto_render.XXXXXX").string();
+  if (::mkdtemp(path.data()) == nullptr) {
+    throw otto::util::exception("Could not make a temporary directory: {}",
+      std::strerror(errno));
+  }
+  return path;
+}
+
+int main(int argc, char *argv[]) {
+  using namespace otto;
+  using Options = audio::OfflineBackend::Options;
+
+  Options options;
+  filesystem::path data_source = Globals::data_dir;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--data-dir") {
+      if (++i == argc) usage();
+      data_source = argv[i];
+    } else if (arg.size() == 2 && arg[0] == '-') {
+      if (++i == argc) usage();
+      switch (arg[1]) {
+      case 'i': options.input = argv[i]; break;
+      case 'm': options.midi = argv[i]; break;
+      case 'b': options.buffer_size = std::atoi(argv[i]); break;
+      case 'r': options.samplerate = std::atoi(argv[i]); break;
+      case 'n': options.frames = std::atol(argv[i]); break;
+      case 'j': Globals::audio.worker_options.workers = std::atoi(argv[i]); break;
+      default: usage();
+      }
+    } else if (options.output.empty()) {
+      options.output = arg;
+    } else {
+      usage();
+    }
+  }
+  if (options.output.empty() || options.buffer_size <= 0 || options.samplerate <= 0) {
+    usage();
+  }
+
+  filesystem::path temp_dir;
+  auto cleanup = [&] {
+    Globals::events.preExit.runAll();
+    Globals::mixer.exit();
+    Globals::tapedeck.exit();
+    Globals::audio.exit();
+    Globals::events.postExit.runAll();
+    if (!temp_dir.empty()) {
+      std::error_code ec;
+      filesystem::remove_all(temp_dir, ec);
+    }
+  };
+
+  try {
+    static plog::ConsoleAppender<plog::TxtFormatter> consoleAppender;
+    plog::init(plog::warning, &consoleAppender);
+
+    temp_dir = make_temp_dir();
+    Globals::data_dir = temp_dir / "data";
+    if (filesystem::exists(data_source)) {
+      filesystem::copy(data_source, Globals::data_dir, filesystem::copy_options::recursive);
+    } else {
+      filesystem::create_directory(Globals::data_dir);
+    }
+
+    midi::generateFreqTable(440);
+
+    using namespace modules;
+
+    Globals::drums.registerModule<DrumSampler>("Sampler");
+    Globals::drums.registerModule<SimpleDrumsModule>("Additive Drums");
+
+    Globals::synth.registerModule<NukeSynth>("Nuke");
+    Globals::synth.registerModule<SynthSampler>("Sampler");
+
+    // The tape is streamed on another thread. Waiting for it before each
+    // buffer makes renders of the tape repeatable.
+    options.before_cycle = [] { Globals::tapedeck.tapeBuffer->sync(); };
+
+    audio::OfflineBackend* backend = nullptr;
+    Globals::audio.backend_factory = [&] (audio::MainAudio& owner) {
+      auto b = std::make_unique<audio::OfflineBackend>(owner, options);
+      backend = b.get();
+      return std::unique_ptr<audio::AudioBackend>(std::move(b));
+    };
+
+    // Like <Globals::init>, without the UI
+    Globals::events.preInit.runAll();
+    Globals::dataFile.path = Globals::data_dir / "modules.json";
+    Globals::dataFile.read();
+    Globals::audio.init();
+    Globals::tapedeck.init();
+    Globals::mixer.init();
+    Globals::synth.current().init();
+    Globals::drums.current().init();
+    Globals::events.postInit.runAll();
+
+    // Renders everything before it returns
+    Globals::audio.start_processing();
+
+    auto& stats = backend->stats();
+    auto us = [] (auto d) {
+      return std::chrono::duration<double, std::micro>(d).count();
+    };
+    auto period = std::chrono::duration<double, std::micro>(std::chrono::seconds(1))
+      * options.buffer_size / options.samplerate;
+    fmt::print("{} frames in {} buffers of {} at {}Hz\n",
+      stats.frames, stats.cycles, options.buffer_size, options.samplerate);
+    fmt::print("{:.3f}s, {:.1f}x realtime\n",
+      us(stats.elapsed) / 1e6, stats.realtime_factor(options.samplerate));
+    fmt::print("per buffer: p50 < {:.0f}us, p99 < {:.0f}us, max {:.0f}us, of {:.0f}us\n",
+      us(stats.cycle_time.quantile(0.5)), us(stats.cycle_time.quantile(0.99)),
+      us(stats.cycle_time.max()), period.count());
+    fmt::print("{} buffers took longer than they last\n", stats.overruns);
+
+  } catch (std::exception& e) {
+    LOGF << e.what();
+    cleanup();
+    return 1;
+  }
+
+  cleanup();
+  return 0;
+}
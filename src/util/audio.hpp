@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <type_traits>
 #include <cmath>
 #include <gsl/span>
@@ -7,8 +8,18 @@
 #include "util/dyn-array.hpp"
 #include "util/iterator.hpp"
 
+/// Tracks on the tape, set by the build
+#ifndef OTTO_TAPE_TRACKS
+#define OTTO_TAPE_TRACKS 4
+#endif
+
 namespace otto::util::audio {
 
+  /// Tracks on the tape and into the mixer
+  constexpr int tape_tracks = OTTO_TAPE_TRACKS;
+  static_assert(tape_tracks == 4 || tape_tracks == 8 || tape_tracks == 16,
+    "OTTO_TAPE_TRACKS must be 4, 8 or 16");
+
   /*
    * Mixes two signals, and normalizes the result.
    * Simple weighted average
@@ -26,6 +37,23 @@ namespace otto::util::audio {
   template<int nChannels = 4, typename SampleType = float>
   using AudioFrame = std::array<SampleType, nChannels>;
 
+  /// The sum of the elements of `a`, added pairwise
+  ///
+  /// Each step adds two halves, which the compiler can do as one vector
+  /// operation. A plain loop has to add one element at a time, since
+  /// reordering it would change the rounding.
+  template<std::size_t N>
+  float pairwise_sum(std::array<float, N> a)
+  {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+    for (std::size_t w = N / 2; w > 0; w /= 2) {
+      for (std::size_t i = 0; i < w; i++) {
+        a[i] += a[i + w];
+      }
+    }
+    return a[0];
+  }
+
   template<typename Rng1, typename Rng2>
   void add_all(Rng1&& r1, Rng2&& r2)
   {
@@ -1,5 +1,10 @@
 #include "util/bytefile.hpp"
 
+#include <cstring>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <plog/Log.h>
 #include <fmt/format.h>
 
@@ -60,6 +65,19 @@ namespace otto::util {
     };
   }
 
+  void ByteFile::sync() {
+    if (!is_open()) throw Error(Error::Type::FileNotOpen, "ByteFile::sync()");
+    fstream.flush();
+    // fsync applies to the file, not just writes through this descriptor
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd) != 0) {
+      auto message = fmt::format("fsync: {}", std::strerror(errno));
+      if (fd >= 0) ::close(fd);
+      throw Error(Error::Type::ExceptionThrown, message);
+    }
+    ::close(fd);
+  }
+
   void ByteFile::create_file() {
     close();
     fstream.open(path, std::ios::trunc | std::ios::out | std::ios::binary);
@@ -107,4 +125,153 @@ namespace otto::util {
     return Position(end);
   }
 
+  void ByteFile::resize(Position n) {
+    if (!is_open()) throw Error(Error::Type::FileNotOpen, "ByteFile::resize()");
+    fstream.flush();
+    if (::truncate(path.c_str(), n) != 0) {
+      throw Error(Error::Type::ExceptionThrown,
+        fmt::format("truncate({}): {}", n, std::strerror(errno)));
+    }
+  }
+
+  void ByteFile::allocate(Position offset, std::size_t n) {
+    if (!is_open()) throw Error(Error::Type::FileNotOpen, "ByteFile::allocate()");
+    fstream.flush();
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+      throw Error(Error::Type::ExceptionThrown,
+        fmt::format("open: {}", std::strerror(errno)));
+    }
+    int res;
+    do {
+      res = ::fallocate(fd, 0, offset, n);
+    } while (res != 0 && errno == EINTR);
+    int err = errno;
+    ::close(fd);
+    if (res != 0 && err != EOPNOTSUPP && err != ENOSYS) {
+      throw Error(Error::Type::ExceptionThrown,
+        fmt::format("fallocate({}, {}): {}", offset, n, std::strerror(err)));
+    }
+  }
+
+  std::vector<std::pair<ByteFile::Position, ByteFile::Position>>
+  ByteFile::data_extents(Position offset, std::size_t n) {
+    if (!is_open()) throw Error(Error::Type::FileNotOpen, "ByteFile::data_extents()");
+    fstream.flush();
+    Position end = offset + n;
+    std::vector<std::pair<Position, Position>> extents;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      extents.push_back({offset, end});
+      return extents;
+    }
+    for (Position p = offset; p < end;) {
+      auto first = ::lseek(fd, p, SEEK_DATA);
+      if (first < 0) {
+        // ENXIO means only a hole is left. Anything else, and we can't tell
+        if (errno != ENXIO) extents.push_back({p, end});
+        break;
+      }
+      if (first >= end) break;
+      auto last = ::lseek(fd, first, SEEK_HOLE);
+      if (last < 0) last = end;
+      extents.push_back({first, std::min<Position>(last, end)});
+      p = last;
+    }
+    ::close(fd);
+    return extents;
+  }
+
+  MappedRegion ByteFile::map(Position offset, std::size_t n) {
+    if (!is_open()) throw Error(Error::Type::FileNotOpen, "ByteFile::map()");
+    if (size() < Position(offset + n)) {
+      resize(offset + n);
+    }
+    fstream.flush();
+
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+      throw Error(Error::Type::ExceptionThrown,
+        fmt::format("open: {}", std::strerror(errno)));
+    }
+
+    static const std::size_t page_size = ::sysconf(_SC_PAGESIZE);
+    MappedRegion region;
+    region.page_offset = offset % page_size;
+    region.length = n;
+    void* ptr = ::mmap(nullptr, region.page_offset + n, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, offset - region.page_offset);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+      throw Error(Error::Type::ExceptionThrown,
+        fmt::format("mmap: {}", std::strerror(errno)));
+    }
+    region.base = static_cast<std::byte*>(ptr);
+    return region;
+  }
+
+  /****************************************/
+  /* MappedRegion Implementation          */
+  /****************************************/
+
+  MappedRegion::MappedRegion(MappedRegion&& o)
+    : base (std::exchange(o.base, nullptr)),
+      page_offset (o.page_offset),
+      length (std::exchange(o.length, 0))
+  {}
+
+  MappedRegion::~MappedRegion() {
+    reset();
+  }
+
+  MappedRegion& MappedRegion::operator=(MappedRegion&& o) {
+    reset();
+    base = std::exchange(o.base, nullptr);
+    page_offset = o.page_offset;
+    length = std::exchange(o.length, 0);
+    return *this;
+  }
+
+  void MappedRegion::reset() {
+    if (base == nullptr) return;
+    flush(0, length, true);
+    ::munmap(base, page_offset + length);
+    base = nullptr;
+    length = 0;
+  }
+
+  std::pair<std::byte*, std::size_t>
+  MappedRegion::page_range(std::size_t offset, std::size_t n) const {
+    static const std::size_t page_size = ::sysconf(_SC_PAGESIZE);
+    offset = std::min(offset, length);
+    n = std::min(n, length - offset);
+    std::size_t first = (page_offset + offset) / page_size * page_size;
+    std::size_t last = page_offset + offset + n;
+    return {base + first, last - first};
+  }
+
+  void MappedRegion::advise(Advice a, std::size_t offset, std::size_t n) const {
+    if (base == nullptr) return;
+    int advice = MADV_NORMAL;
+    switch (a) {
+    case Advice::Normal:     advice = MADV_NORMAL; break;
+    case Advice::Sequential: advice = MADV_SEQUENTIAL; break;
+    case Advice::Random:     advice = MADV_RANDOM; break;
+    case Advice::WillNeed:   advice = MADV_WILLNEED; break;
+    case Advice::DontNeed:   advice = MADV_DONTNEED; break;
+    }
+    auto [ptr, len] = page_range(offset, n);
+    // Advice is only a hint, failure is not an error
+    ::madvise(ptr, len, advice);
+  }
+
+  void MappedRegion::flush(std::size_t offset, std::size_t n, bool sync) const {
+    if (base == nullptr) return;
+    auto [ptr, len] = page_range(offset, n);
+    if (::msync(ptr, len, sync ? MS_SYNC : MS_ASYNC) != 0) {
+      LOGE << "msync failed: " << std::strerror(errno);
+    }
+  }
+
 } // otto
@@ -4,6 +4,7 @@
 #include <iterator>
 #include <utility>
 #include <fstream>
+#include <vector>
 #include <filesystem.hpp>
 
 #include "util/result.hpp"
@@ -92,6 +93,58 @@ namespace otto::util {
 
   };
 
+  /// A shared memory mapping of a byte range of a file
+  ///
+  /// Obtained through <ByteFile::map>. The mapping is released on destruction,
+  /// but dirty pages are only guaranteed to reach the disk after a call to
+  /// <flush>.
+  class MappedRegion {
+  public:
+
+    enum class Advice {
+      Normal,
+      Sequential,
+      Random,
+      WillNeed,
+      DontNeed,
+    };
+
+    MappedRegion() = default;
+    MappedRegion(MappedRegion&&);
+    MappedRegion(const MappedRegion&) = delete;
+    ~MappedRegion();
+
+    MappedRegion& operator=(MappedRegion&&);
+
+    std::byte* data() const { return base + page_offset; }
+    std::size_t size() const { return length; }
+
+    explicit operator bool() const { return base != nullptr; }
+
+    /// Give the kernel a hint about how `[offset, offset + n)` will be used
+    void advise(Advice, std::size_t offset, std::size_t n) const;
+
+    /// Write dirty pages in `[offset, offset + n)` back to the file
+    ///
+    /// If `sync` is `false`, the writeback is only scheduled.
+    void flush(std::size_t offset, std::size_t n, bool sync = true) const;
+
+    /// Write back and unmap.
+    void reset();
+
+  private:
+    friend class ByteFile;
+
+    /// Page aligned pointer returned by `mmap`
+    std::byte* base = nullptr;
+    /// Distance from `base` to the first requested byte
+    std::size_t page_offset = 0;
+    std::size_t length = 0;
+
+    /// Round `[offset, offset + n)` out to page boundaries, relative to `base`
+    std::pair<std::byte*, std::size_t> page_range(std::size_t offset, std::size_t n) const;
+  };
+
   /// TODO: Documentation
   class ByteFile {
   public:
@@ -126,17 +179,26 @@ namespace otto::util {
       }
     };
 
-    using Position = int;
+    /// Byte offsets. 64 bits, so files can be larger than 4 GB.
+    using Position = std::int64_t;
     using Path = filesystem::path;
 
+    /// The value of a 32 bit chunk size field when the real size is stored
+    /// elsewhere, like in the `ds64` chunk of an RF64 file
+    static constexpr std::uint32_t large_chunk_size = 0xFFFFFFFF;
+
     struct Chunk {
       bytes<4> id;
       bytes<4> size = {0,0,0,0};
+      /// The size of a chunk too large for <size>, which is then
+      /// <large_chunk_size>. `0` for other chunks.
+      std::uint64_t large_size = 0;
 
       Position offset;
 
       Chunk(bytes<4> id = {0,0,0,0}) : id (id) {}
-      Chunk(const Chunk& o) : id (o.id), size (o.size), offset (o.offset) {}
+      Chunk(const Chunk& o)
+        : id (o.id), size (o.size), large_size (o.large_size), offset (o.offset) {}
       virtual ~Chunk() = default;
 
       Position beginning()
@@ -146,7 +208,20 @@ namespace otto::util {
 
       Position past_end()
       {
-        return offset + 8 + size.as_u();
+        return offset + 8 + length();
+      }
+
+      /// The size of the chunk, whether it fits in <size> or not
+      std::uint64_t length()
+      {
+        return large_size != 0 ? large_size : size.as_u();
+      }
+
+      /// Set the size, to <large_size> if it does not fit in <size>
+      void set_length(std::uint64_t n)
+      {
+        large_size = n >= large_chunk_size ? n : 0;
+        size.as_u() = n >= large_chunk_size ? large_chunk_size : std::uint32_t(n);
       }
 
       void write(ByteFile& file) {
@@ -156,8 +231,8 @@ namespace otto::util {
         write_fields(file);
 
         // Update size if changed
-        if (std::size_t rs = file.position() - offset - 8; rs > size.as_u()) {
-          size.as_u() = rs;
+        if (std::uint64_t rs = file.position() - offset - 8; rs > length()) {
+          set_length(rs);
           file.seek(offset + 4);
           file.write_bytes(size);
           file.seek(past_end());
@@ -197,6 +272,10 @@ namespace otto::util {
     void open(const Path&);
     void close();
     void flush();
+    /// Wait for everything written to the file so far, through the stream or
+    /// a mapping, to reach the disk. Unlike <flush>, this does not write
+    /// the header.
+    void sync();
     bool is_open() const;
     virtual void create_file();
     virtual void read_file();
@@ -206,6 +285,31 @@ namespace otto::util {
     Position position();
     Position size();
 
+    /// Set the size of the file on disk, padding with zeros
+    void resize(Position);
+
+    /// Allocate disk blocks for `n` bytes starting at `offset`, extending the
+    /// file if needed
+    ///
+    /// Writes to the range then never wait for the filesystem to find space.
+    /// Does nothing where the filesystem does not support it.
+    void allocate(Position offset, std::size_t n);
+
+    /// The parts of `n` bytes starting at `offset` that may hold data, as
+    /// `[first, last)` offsets
+    ///
+    /// Holes left by never writing to a sparse file are skipped, and so are
+    /// allocated but unwritten ranges on filesystems that report them.
+    /// Where the filesystem can not tell, the whole range is returned.
+    std::vector<std::pair<Position, Position>> data_extents(Position offset, std::size_t n);
+
+    /// Map `n` bytes starting at `offset` into memory
+    ///
+    /// The file is extended if it is shorter than `offset + n`. Pending stream
+    /// writes are flushed first, but the stream and the mapping are not
+    /// otherwise synchronized, so don't write the same range through both.
+    MappedRegion map(Position offset, std::size_t n);
+
     template<typename OutIter,
       typename = std::enable_if<is_iterator_v<OutIter, std::byte,
                                   std::output_iterator_tag>>>
@@ -0,0 +1,390 @@
+#include "util/compressedaudio.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <plog/Log.h>
+
+#include "util/exception.hpp"
+#include "util/lossless.hpp"
+#include "util/sample-format.hpp"
+
+namespace otto::util {
+
+  /*
+   * File layout, all little endian:
+   *
+   *  0  "RIFF", size, "OTCA"
+   * 12  "fmt ", 16, version (2), channels (2), bits (2), 0 (2),
+   *     block frames (4), length in frames (4)
+   * 36  "BIDX", 16 * blocks, then for each block: offset (8), size (4),
+   *     capacity (4)
+   *     "BLKS", size, then the blocks, in no particular order
+   *
+   * The chunk sizes of RIFF and BLKS are only updated on <sync> and
+   * <close>. The file size is what counts.
+   */
+
+  namespace {
+    constexpr std::uint16_t version = 1;
+    constexpr std::uint64_t header_size = 44;
+    constexpr std::uint64_t entry_size = 16;
+    /// Blocks that are appended get this much room to grow, in quarters
+    constexpr std::uint32_t slack_quarters = 1;
+    constexpr std::uint32_t block_alignment = 512;
+
+    void put_u16(std::byte* p, std::uint16_t v) { std::memcpy(p, &v, 2); }
+    void put_u32(std::byte* p, std::uint32_t v) { std::memcpy(p, &v, 4); }
+    void put_u64(std::byte* p, std::uint64_t v) { std::memcpy(p, &v, 8); }
+    std::uint16_t get_u16(const std::byte* p) { std::uint16_t v; std::memcpy(&v, p, 2); return v; }
+    std::uint32_t get_u32(const std::byte* p) { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+    std::uint64_t get_u64(const std::byte* p) { std::uint64_t v; std::memcpy(&v, p, 8); return v; }
+    void put_id(std::byte* p, const char* id) { std::memcpy(p, id, 4); }
+    bool has_id(const std::byte* p, const char* id) { return std::memcmp(p, id, 4) == 0; }
+  }
+
+  CompressedAudioFile::~CompressedAudioFile()
+  {
+    close();
+  }
+
+  void CompressedAudioFile::open(const Path& path, int channels, int bits, Position length)
+  {
+    close();
+    std::lock_guard lock (mutex);
+    this->path = path;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      throw util::exception("Could not open {}: {}", path.c_str(), std::strerror(errno));
+    }
+    struct stat st;
+    ::fstat(fd, &st);
+    if (st.st_size == 0) {
+      num_channels = channels;
+      sample_bits = bits;
+      num_frames = length;
+      index.assign(block_count(), {});
+      file_end = data_offset();
+      write_header();
+    } else {
+      try {
+        read_header();
+      } catch (...) {
+        ::close(fd);
+        fd = -1;
+        throw;
+      }
+      file_end = std::max<std::uint64_t>(st.st_size, data_offset());
+      if (length > num_frames) {
+        // The index grows into the data, so the blocks are moved after it
+        num_frames = length;
+        index.resize(block_count());
+        compact_locked();
+      } else if (wasteful()) {
+        compact_locked();
+      }
+    }
+  }
+
+  void CompressedAudioFile::close()
+  {
+    std::lock_guard lock (mutex);
+    if (fd < 0) return;
+    write_header();
+    ::close(fd);
+    fd = -1;
+    for (auto&& c : cache) c.block = -1;
+  }
+
+  bool CompressedAudioFile::is_open() const
+  {
+    return fd >= 0;
+  }
+
+  int CompressedAudioFile::block_count() const
+  {
+    return (num_frames + block_frames - 1) / block_frames;
+  }
+
+  int CompressedAudioFile::frames_in(int block) const
+  {
+    return std::min(block_frames, num_frames - block * block_frames);
+  }
+
+  std::uint64_t CompressedAudioFile::index_offset(int block) const
+  {
+    return header_size + block * entry_size;
+  }
+
+  std::uint64_t CompressedAudioFile::data_offset() const
+  {
+    return index_offset(block_count()) + 8;
+  }
+
+  void CompressedAudioFile::read_header()
+  {
+    std::byte h[header_size];
+    pread_all(fd, h, header_size, 0);
+    if (!has_id(h, "RIFF") || !has_id(h + 8, "OTCA") || !has_id(h + 12, "fmt ")
+      || !has_id(h + 36, "BIDX")) {
+      throw util::exception("{} is not a compressed audio file", path.c_str());
+    }
+    if (get_u16(h + 20) != version || get_u32(h + 28) != block_frames) {
+      throw util::exception("{} has an unsupported layout", path.c_str());
+    }
+    num_channels = get_u16(h + 22);
+    sample_bits = get_u16(h + 24);
+    num_frames = get_u32(h + 32);
+
+    std::vector<std::byte> entries(block_count() * entry_size);
+    pread_all(fd, entries.data(), entries.size(), header_size);
+    index.resize(block_count());
+    for (int b = 0; b < block_count(); b++) {
+      auto* e = entries.data() + b * entry_size;
+      index[b] = {get_u64(e), get_u32(e + 8), get_u32(e + 12)};
+    }
+  }
+
+  void CompressedAudioFile::write_header()
+  {
+    std::vector<std::byte> h(data_offset());
+    put_id(h.data(), "RIFF");
+    put_u32(h.data() + 4, std::min<std::uint64_t>(file_end - 8, 0xFFFFFFFF));
+    put_id(h.data() + 8, "OTCA");
+    put_id(h.data() + 12, "fmt ");
+    put_u32(h.data() + 16, 16);
+    put_u16(h.data() + 20, version);
+    put_u16(h.data() + 22, num_channels);
+    put_u16(h.data() + 24, sample_bits);
+    put_u16(h.data() + 26, 0);
+    put_u32(h.data() + 28, block_frames);
+    put_u32(h.data() + 32, num_frames);
+    put_id(h.data() + 36, "BIDX");
+    put_u32(h.data() + 40, block_count() * entry_size);
+    for (int b = 0; b < block_count(); b++) {
+      auto* e = h.data() + index_offset(b);
+      put_u64(e, index[b].offset);
+      put_u32(e + 8, index[b].size);
+      put_u32(e + 12, index[b].capacity);
+    }
+    auto* blks = h.data() + index_offset(block_count());
+    put_id(blks, "BLKS");
+    put_u32(blks + 4, std::min<std::uint64_t>(file_end - data_offset(), 0xFFFFFFFF));
+    pwrite_all(fd, h.data(), h.size(), 0);
+  }
+
+  void CompressedAudioFile::write_index_entry(int block)
+  {
+    std::byte e[entry_size];
+    put_u64(e, index[block].offset);
+    put_u32(e + 8, index[block].size);
+    put_u32(e + 12, index[block].capacity);
+    pwrite_all(fd, e, entry_size, index_offset(block));
+  }
+
+  CompressedAudioFile::CachedBlock& CompressedAudioFile::load_block(int block, bool decode)
+  {
+    use_counter++;
+    for (auto&& c : cache) {
+      if (c.block == block) {
+        c.last_use = use_counter;
+        return c;
+      }
+    }
+    auto& c = *std::min_element(cache.begin(), cache.end(),
+      [] (auto& a, auto& b) { return a.last_use < b.last_use; });
+    c.block = block;
+    c.last_use = use_counter;
+    int frames = frames_in(block);
+    c.frames.resize(block_frames * num_channels);
+    if (!decode) return c;
+
+    auto& entry = index[block];
+    if (entry.offset == 0) {
+      std::fill(c.frames.begin(), c.frames.end(), 0.f);
+      return c;
+    }
+    coded.resize(entry.size);
+    ints.resize(frames * num_channels);
+    pread_all(fd, coded.data(), entry.size, entry.offset);
+    if (lossless::decode(coded.data(), coded.size(), ints.data(), frames, num_channels, sample_bits)) {
+      dequantize_samples(sample_bits, ints.data(), c.frames.data(), ints.size());
+    } else {
+      LOGE << "Block " << block << " of " << path.c_str() << " is corrupt";
+      std::fill(c.frames.begin(), c.frames.end(), 0.f);
+    }
+    return c;
+  }
+
+  void CompressedAudioFile::store_block(CachedBlock& cached)
+  {
+    int block = cached.block;
+    int frames = frames_in(block);
+    ints.resize(frames * num_channels);
+    quantize_samples(sample_bits, cached.frames.data(), ints.data(), ints.size());
+    coded.clear();
+    lossless::encode(ints.data(), frames, num_channels, sample_bits, coded);
+
+    auto& entry = index[block];
+    if (entry.offset == 0 || coded.size() > entry.capacity) {
+      std::uint32_t capacity = coded.size() + coded.size() * slack_quarters / 4;
+      capacity = (capacity + block_alignment - 1) / block_alignment * block_alignment;
+      entry.offset = file_end;
+      entry.capacity = capacity;
+      file_end += capacity;
+    }
+    entry.size = coded.size();
+    // The block goes first, so a crash in between leaves the old one indexed,
+    // unless it was rewritten in place
+    pwrite_all(fd, coded.data(), coded.size(), entry.offset);
+    write_index_entry(block);
+  }
+
+  void CompressedAudioFile::read(Position p, float* dst, Position n)
+  {
+    std::lock_guard lock (mutex);
+    int first = std::clamp(p, 0, num_frames);
+    int last = std::clamp(p + n, first, num_frames);
+    std::fill(dst, dst + (first - p) * num_channels, 0.f);
+    std::fill(dst + (last - p) * num_channels, dst + n * num_channels, 0.f);
+    for (int pos = first; pos < last;) {
+      int block = pos / block_frames;
+      int in_block = pos - block * block_frames;
+      int len = std::min(last - pos, block_frames - in_block);
+      float* out = dst + (pos - p) * num_channels;
+      if (index[block].offset == 0) {
+        std::fill(out, out + len * num_channels, 0.f);
+      } else {
+        auto& c = load_block(block);
+        std::copy_n(c.frames.data() + in_block * num_channels, len * num_channels, out);
+      }
+      pos += len;
+    }
+  }
+
+  void CompressedAudioFile::write(Position p, const float* src, Position n)
+  {
+    std::lock_guard lock (mutex);
+    int first = std::clamp(p, 0, num_frames);
+    int last = std::clamp(p + n, first, num_frames);
+    for (int pos = first; pos < last;) {
+      int block = pos / block_frames;
+      int in_block = pos - block * block_frames;
+      int len = std::min(last - pos, block_frames - in_block);
+      auto& c = load_block(block, len < frames_in(block));
+      std::copy_n(src + (pos - p) * num_channels, len * num_channels,
+        c.frames.data() + in_block * num_channels);
+      store_block(c);
+      pos += len;
+    }
+  }
+
+  bool CompressedAudioFile::block_written(int b) const
+  {
+    std::lock_guard lock (mutex);
+    return b >= 0 && b < int(index.size()) && index[b].offset != 0;
+  }
+
+  void CompressedAudioFile::sync()
+  {
+    std::lock_guard lock (mutex);
+    if (fd < 0) return;
+    write_header();
+    ::fdatasync(fd);
+  }
+
+  CompressedAudioFile::Stats CompressedAudioFile::stats() const
+  {
+    std::lock_guard lock (mutex);
+    Stats s;
+    s.file_bytes = file_end;
+    for (auto&& e : index) {
+      if (e.offset == 0) continue;
+      s.audio_bytes += e.size;
+      s.written_blocks++;
+    }
+    return s;
+  }
+
+  bool CompressedAudioFile::wasteful() const
+  {
+    std::uint64_t used = data_offset();
+    for (auto&& e : index) used += e.capacity;
+    std::uint64_t unused = file_end - used;
+    return unused > (1 << 20) && unused > (used - data_offset()) / 4;
+  }
+
+  void CompressedAudioFile::compact()
+  {
+    std::lock_guard lock (mutex);
+    if (fd < 0) return;
+    compact_locked();
+  }
+
+  void CompressedAudioFile::compact_locked()
+  {
+    Path tmp_path = path;
+    tmp_path += ".tmp";
+    int tmp = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tmp < 0) {
+      LOGE << "Could not compact " << path.c_str() << ": " << std::strerror(errno);
+      return;
+    }
+    int old = fd;
+    fd = tmp;
+    std::uint64_t end = data_offset();
+    std::vector<std::byte> data;
+    for (auto&& e : index) {
+      if (e.offset == 0) continue;
+      data.resize(e.size);
+      pread_all(old, data.data(), e.size, e.offset);
+      pwrite_all(tmp, data.data(), e.size, end);
+      e.offset = end;
+      end += e.capacity;
+    }
+    file_end = end;
+    write_header();
+    ::fsync(tmp);
+    ::rename(tmp_path.c_str(), path.c_str());
+    ::close(old);
+  }
+
+  void CompressedAudioFile::pread_all(int fd, void* dst, std::size_t n, std::uint64_t offset)
+  {
+    auto* p = static_cast<char*>(dst);
+    while (n > 0) {
+      auto r = ::pread(fd, p, n, offset);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) {
+        if (r < 0) LOGE << "Compressed audio read failed: " << std::strerror(errno);
+        // Past the end of the file
+        std::memset(p, 0, n);
+        return;
+      }
+      p += r;
+      n -= r;
+      offset += r;
+    }
+  }
+
+  void CompressedAudioFile::pwrite_all(int fd, const void* src, std::size_t n, std::uint64_t offset)
+  {
+    auto* p = static_cast<const char*>(src);
+    while (n > 0) {
+      auto r = ::pwrite(fd, p, n, offset);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) {
+        LOGE << "Compressed audio write failed: " << std::strerror(errno);
+        return;
+      }
+      p += r;
+      n -= r;
+      offset += r;
+    }
+  }
+
+}
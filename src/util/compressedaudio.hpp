@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <filesystem.hpp>
+
+namespace otto::util {
+
+  /// Audio stored in independently compressed blocks, with an index
+  ///
+  /// The audio is split into blocks of <block_frames> frames, each coded
+  /// with <lossless::encode>. An index chunk at the start of the file holds
+  /// where each block is, so any range of frames can be read by decoding
+  /// just the blocks that cover it. Blocks that were never written take no
+  /// space, and read as silence.
+  ///
+  /// Samples are quantized to <bits> bits, so the compression is lossless
+  /// with respect to a PCM file of the same depth.
+  ///
+  /// Rewritten blocks are stored in place if they fit, and appended to the
+  /// file otherwise. The space they leave behind is reclaimed when the file
+  /// is opened, if there is enough of it.
+  ///
+  /// All member functions may be called from several threads at once.
+  class CompressedAudioFile {
+  public:
+    using Position = int;
+    using Path = filesystem::path;
+
+    /// Frames in each block
+    static constexpr int block_frames = 4096;
+
+    CompressedAudioFile() = default;
+    ~CompressedAudioFile();
+
+    CompressedAudioFile(const CompressedAudioFile&) = delete;
+
+    /// Open `path`, creating it if it does not exist
+    ///
+    /// The file holds `length` frames of `channels` samples of `bits` bits.
+    /// An existing file keeps the layout it was created with, but grows to
+    /// `length` frames if it is shorter.
+    ///
+    /// \throws util::exception if the file can not be opened, or is not a
+    ///         compressed audio file
+    void open(const Path& path, int channels, int bits, Position length);
+
+    /// Write the index and close the file
+    void close();
+
+    bool is_open() const;
+
+    int channels() const { return num_channels; }
+    int bits() const { return sample_bits; }
+    /// The number of frames in the file
+    Position length() const { return num_frames; }
+
+    /// Read frames `[p, p + n)` into `dst`, interleaved. Frames outside the
+    /// file, and in blocks that were never written, are silent.
+    void read(Position p, float* dst, Position n);
+
+    /// Write `n` interleaved frames from `src` to `p`. Frames outside the
+    /// file are ignored.
+    ///
+    /// Blocks that are only partially covered are decoded first.
+    void write(Position p, const float* src, Position n);
+
+    /// Whether any frame of block `b` was ever written
+    bool block_written(int b) const;
+
+    /// Wait for everything written to reach the disk
+    void sync();
+
+    /// Rewrite the file without the space left by moved blocks
+    void compact();
+
+    struct Stats {
+      /// Size of the file
+      std::int64_t file_bytes = 0;
+      /// Bytes of compressed audio in use
+      std::int64_t audio_bytes = 0;
+      /// Blocks that were ever written
+      int written_blocks = 0;
+    };
+
+    Stats stats() const;
+
+  private:
+
+    struct IndexEntry {
+      /// File offset of the block, or `0` if it was never written
+      std::uint64_t offset = 0;
+      /// Bytes of compressed data
+      std::uint32_t size = 0;
+      /// Bytes reserved for it, so it can grow a bit in place
+      std::uint32_t capacity = 0;
+    };
+
+    /// A decoded block, kept so consecutive small reads and writes don't
+    /// decode it over and over
+    struct CachedBlock {
+      int block = -1;
+      std::uint64_t last_use = 0;
+      std::vector<float> frames;
+    };
+
+    int block_count() const;
+    std::uint64_t index_offset(int block) const;
+    std::uint64_t data_offset() const;
+
+    void read_header();
+    /// Write the header and the whole index
+    void write_header();
+    void write_index_entry(int block);
+
+    /// The decoded frames of `block`, from the cache if possible. Unless
+    /// `decode`, a block that is not cached is left with garbage, for when
+    /// all of it is about to be overwritten.
+    CachedBlock& load_block(int block, bool decode = true);
+    /// Encode the cached `block`, and store it
+    void store_block(CachedBlock& cached);
+
+    static void pread_all(int fd, void* dst, std::size_t n, std::uint64_t offset);
+    static void pwrite_all(int fd, const void* src, std::size_t n, std::uint64_t offset);
+    /// Frames in `block`. Only the last one may be short.
+    int frames_in(int block) const;
+    /// Whether enough space is unused to be worth a <compact>
+    bool wasteful() const;
+    void compact_locked();
+
+    mutable std::mutex mutex;
+
+    Path path;
+    int fd = -1;
+    int num_channels = 0;
+    int sample_bits = 0;
+    Position num_frames = 0;
+    std::vector<IndexEntry> index;
+    /// Where the next block is appended
+    std::uint64_t file_end = 0;
+
+    std::array<CachedBlock, 4> cache;
+    std::uint64_t use_counter = 0;
+    std::vector<std::int32_t> ints;
+    std::vector<std::byte> coded;
+  };
+
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "util/varispeed.hpp"
+
+namespace otto::util::audio {
+
+  /// A low-passed and decimated copy of `N` channel audio
+  ///
+  /// Every <factor>th frame of the source is kept, after a windowed sinc
+  /// low-pass filter, and stored as 16 bit integers. This is plenty for fast
+  /// forward/rewind sounds, at a fraction of the bandwidth of the source.
+  ///
+  /// One thread may <update> while another reads with <try_read>. Each block
+  /// of <lock_block> kept frames has a version, which is odd while the block
+  /// is being updated, so a read that overlaps an update is detected and
+  /// can be done some other way.
+  template<std::size_t N>
+  class DecimatedAudio {
+  public:
+
+    using Frame = std::array<std::int16_t, N>;
+
+    static constexpr int factor = 8;
+    /// Source frames on each side of a kept frame that affect it
+    static constexpr int half_width = 8 * factor;
+    /// Kept frames under one version
+    static constexpr int lock_block = 1024;
+
+    DecimatedAudio() = default;
+
+    DecimatedAudio(const DecimatedAudio& o)
+    {
+      *this = o;
+    }
+
+    /// Copies the frames. Not safe while either is updated.
+    DecimatedAudio& operator=(const DecimatedAudio& o)
+    {
+      if (this == &o) return *this;
+      resize(o._length);
+      _frames = o._frames;
+      return *this;
+    }
+
+    /// Resize to cover `length` source frames. All frames are reset.
+    ///
+    /// Not safe while another thread reads.
+    void resize(std::size_t length)
+    {
+      _length = length;
+      _frames.assign((length + factor - 1) / factor, Frame{});
+      std::size_t blocks = (_frames.size() + lock_block - 1) / lock_block;
+      _versions = std::make_unique<std::atomic<std::uint32_t>[]>(blocks);
+      for (std::size_t b = 0; b < blocks; b++) _versions[b] = 0;
+    }
+
+    /// The number of source frames covered
+    std::size_t length() const { return _length; }
+
+    /// The kept frames. Writing them directly bypasses the versions, so only
+    /// do that while nobody reads.
+    std::vector<Frame>& frames() { return _frames; }
+    const std::vector<Frame>& frames() const { return _frames; }
+
+    /// The range of source frames needed to recompute the frames affected
+    /// by a change to source frames `[first, last)`
+    std::pair<std::int64_t, std::int64_t> support(std::int64_t first, std::int64_t last) const
+    {
+      auto [k0, k1] = affected(first, last);
+      return {k0 * factor - half_width, (k1 - 1) * factor + half_width + 1};
+    }
+
+    /// Recompute the frames affected by a change to source frames
+    /// `[first, last)`.
+    ///
+    /// `get(i)` should return the source frame `i` as a `std::array<float, N>`
+    /// for all `i` in the <support> of the range. Frames outside
+    /// `[0, length)` are never requested.
+    ///
+    /// \returns The range of changed frames
+    template<typename Get>
+    std::pair<std::size_t, std::size_t> update(std::int64_t first, std::int64_t last, Get&& get)
+    {
+      auto [k0, k1] = affected(first, last);
+      if (k0 >= k1) return {std::size_t(k0), std::size_t(k1)};
+      const auto& h = coefficients();
+      std::int64_t b0 = k0 / lock_block;
+      std::int64_t b1 = (k1 - 1) / lock_block + 1;
+      // Odd versions tell readers the blocks are changing
+      for (std::int64_t b = b0; b < b1; b++) {
+        _versions[b].store(_versions[b].load(std::memory_order_relaxed) + 1,
+          std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_release);
+      for (std::int64_t k = k0; k < k1; k++) {
+        std::array<float, N> acc {};
+        std::int64_t center = k * factor;
+        std::int64_t i0 = std::max<std::int64_t>(0, center - half_width);
+        std::int64_t i1 = std::min<std::int64_t>(_length - 1, center + half_width);
+        for (std::int64_t i = i0; i <= i1; i++) {
+          auto&& f = get(i);
+          float c = h[i - center + half_width];
+          for (std::size_t ch = 0; ch < N; ch++) {
+            acc[ch] += f[ch] * c;
+          }
+        }
+        for (std::size_t ch = 0; ch < N; ch++) {
+          _frames[k][ch] = std::lround(std::clamp(acc[ch], -1.f, 1.f) * 32767.f);
+        }
+      }
+      for (std::int64_t b = b0; b < b1; b++) {
+        _versions[b].store(_versions[b].load(std::memory_order_relaxed) + 1,
+          std::memory_order_release);
+      }
+      return {std::size_t(k0), std::size_t(k1)};
+    }
+
+    /// Read `n` frames at source rate, starting at source position `start`
+    /// and stepping `step` source frames per output frame, interpolating
+    /// linearly.
+    void read(Phase start, Phase step, std::array<float, N>* dst, int n) const
+    {
+      if (_frames.size() < 2) {
+        std::fill_n(dst, n, std::array<float, N>{});
+        return;
+      }
+      const std::int64_t last = _frames.size() - 2;
+      Phase p = start / factor;
+      Phase dp = step / factor;
+      for (int i = 0; i < n; i++, p += dp) {
+        std::int64_t k = std::clamp<std::int64_t>(phase_frames(p), 0, last);
+        float t = std::clamp(float(p - (Phase(k) << phase_bits)) / phase_one, 0.f, 1.f);
+        auto& a = _frames[k];
+        auto& b = _frames[k + 1];
+        for (std::size_t ch = 0; ch < N; ch++) {
+          dst[i][ch] = (a[ch] + (b[ch] - a[ch]) * t) * (1.f / 32767.f);
+        }
+      }
+    }
+
+    /// Like <read>, but safe while another thread runs <update>
+    ///
+    /// \returns `false` if an update overlapped the frames read, in which
+    ///           case `dst` holds garbage
+    bool try_read(Phase start, Phase step, std::array<float, N>* dst, int n) const
+    {
+      if (_frames.size() < 2 || n <= 0) {
+        read(start, step, dst, n);
+        return true;
+      }
+      const std::int64_t last = _frames.size() - 2;
+      Phase end = start + step * (n - 1);
+      std::int64_t k0 = std::clamp<std::int64_t>(phase_frames(std::min(start, end) / factor), 0, last);
+      std::int64_t k1 = std::clamp<std::int64_t>(phase_frames(std::max(start, end) / factor), 0, last) + 1;
+      std::int64_t b0 = k0 / lock_block;
+      std::int64_t b1 = k1 / lock_block + 1;
+      // Versions only grow, so the sums match only if none of them changed
+      std::uint32_t before = 0;
+      for (std::int64_t b = b0; b < b1; b++) {
+        auto v = _versions[b].load(std::memory_order_acquire);
+        if (v & 1) return false;
+        before += v;
+      }
+      read(start, step, dst, n);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      std::uint32_t after = 0;
+      for (std::int64_t b = b0; b < b1; b++) {
+        after += _versions[b].load(std::memory_order_relaxed);
+      }
+      return after == before;
+    }
+
+  private:
+
+    /// The range of kept frames affected by source frames `[first, last)`
+    std::pair<std::int64_t, std::int64_t> affected(std::int64_t first, std::int64_t last) const
+    {
+      std::int64_t size = _frames.size();
+      std::int64_t k0 = std::clamp<std::int64_t>(
+        (first - half_width + factor - 1) / factor, 0, size);
+      std::int64_t k1 = std::clamp<std::int64_t>(
+        (last - 1 + half_width) / factor + 1, k0, size);
+      return {k0, k1};
+    }
+
+    /// Blackman windowed sinc, cut off a bit below the new nyquist frequency
+    static const std::array<float, 2 * half_width + 1>& coefficients()
+    {
+      static const auto h = [] {
+        std::array<float, 2 * half_width + 1> h;
+        const double fc = 0.4 / factor;
+        double sum = 0;
+        for (int i = 0; i < int(h.size()); i++) {
+          double x = i - half_width;
+          double sinc = x == 0 ? 2 * fc : std::sin(2 * M_PI * fc * x) / (M_PI * x);
+          double w = 0.42 + 0.5 * std::cos(M_PI * x / (half_width + 1))
+            + 0.08 * std::cos(2 * M_PI * x / (half_width + 1));
+          h[i] = sinc * w;
+          sum += h[i];
+        }
+        for (auto&& c : h) c /= sum;
+        return h;
+      }();
+      return h;
+    }
+
+    std::size_t _length = 0;
+    std::vector<Frame> _frames;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> _versions;
+  };
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace otto::util {
+
+  /// A histogram of durations, in power of two buckets of microseconds
+  ///
+  /// Recording is lock free, and may happen on one thread while others read.
+  class latency_histogram {
+  public:
+    using Duration = std::chrono::nanoseconds;
+
+    /// Bucket `0` counts durations under 1µs, bucket `i` those in
+    /// `[2^(i-1), 2^i)` µs. The last bucket also counts everything longer.
+    static constexpr int bucket_count = 24;
+
+    void record(Duration d)
+    {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+      int bucket = 0;
+      while (us > 0 && bucket < bucket_count - 1) {
+        us >>= 1;
+        bucket++;
+      }
+      buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+      auto ns = d.count();
+      auto prev = longest.load(std::memory_order_relaxed);
+      while (ns > prev && !longest.compare_exchange_weak(prev, ns, std::memory_order_relaxed));
+    }
+
+    std::uint32_t count(int bucket) const
+    {
+      return buckets[bucket].load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t total() const
+    {
+      std::uint64_t sum = 0;
+      for (auto&& b : buckets) sum += b.load(std::memory_order_relaxed);
+      return sum;
+    }
+
+    /// The end of the range counted in `bucket`
+    static Duration upper_bound(int bucket)
+    {
+      return std::chrono::microseconds(std::int64_t(1) << bucket);
+    }
+
+    /// An upper bound for the `q` quantile, for `q` in `[0, 1]`
+    Duration quantile(float q) const
+    {
+      auto n = total();
+      if (n == 0) return Duration(0);
+      std::uint64_t rank = q * (n - 1);
+      std::uint64_t seen = 0;
+      for (int i = 0; i < bucket_count - 1; i++) {
+        seen += count(i);
+        if (seen > rank) return std::min(upper_bound(i), max());
+      }
+      return max();
+    }
+
+    /// The longest duration recorded
+    Duration max() const
+    {
+      return Duration(longest.load(std::memory_order_relaxed));
+    }
+
+    void clear()
+    {
+      for (auto&& b : buckets) b.store(0, std::memory_order_relaxed);
+      longest.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    std::array<std::atomic<std::uint32_t>, bucket_count> buckets = {};
+    std::atomic<Duration::rep> longest {0};
+  };
+
+}
@@ -0,0 +1,257 @@
+#include "util/io-queue.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup) \
+  && defined(__NR_io_uring_enter)
+#define OTTO_HAVE_IO_URING 1
+#else
+#define OTTO_HAVE_IO_URING 0
+#endif
+
+#include <plog/Log.h>
+
+namespace otto::util {
+
+  IOQueue::IOQueue(unsigned depth)
+  {
+    if (depth > 0 && !setup_ring(depth)) {
+      LOGD << "io_uring is not available, using synchronous I/O";
+    }
+  }
+
+  IOQueue::~IOQueue()
+  {
+    complete();
+    release_ring();
+  }
+
+  void IOQueue::read(int fd, void* dst, std::size_t n, std::int64_t offset, std::uint64_t tag)
+  {
+    pending.push_back({false, fd, dst, n, offset, tag});
+  }
+
+  void IOQueue::write(int fd, const void* src, std::size_t n, std::int64_t offset, std::uint64_t tag)
+  {
+    pending.push_back({true, fd, const_cast<void*>(src), n, offset, tag});
+  }
+
+  int IOQueue::perform(const Request& r)
+  {
+    ssize_t res;
+    do {
+      res = r.write
+        ? ::pwrite(r.fd, r.data, r.n, r.offset)
+        : ::pread(r.fd, r.data, r.n, r.offset);
+    } while (res < 0 && errno == EINTR);
+    return res < 0 ? -errno : int(res);
+  }
+
+#if OTTO_HAVE_IO_URING
+
+  namespace {
+    template<typename T>
+    T* offset_ptr(void* base, std::size_t offset)
+    {
+      return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+  }
+
+  bool IOQueue::setup_ring(unsigned depth)
+  {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = ::syscall(__NR_io_uring_setup, depth, &params);
+    if (fd < 0) return false;
+    ring_fd = fd;
+    sq_entries = params.sq_entries;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+      sq_ring = nullptr;
+      release_ring();
+      return false;
+    }
+    if (single_mmap) {
+      cq_ring = sq_ring;
+    } else {
+      cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+      if (cq_ring == MAP_FAILED) {
+        cq_ring = nullptr;
+        release_ring();
+        return false;
+      }
+    }
+    sqe_array_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqe_array = ::mmap(nullptr, sqe_array_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_array == MAP_FAILED) {
+      sqe_array = nullptr;
+      release_ring();
+      return false;
+    }
+
+    sq_head = offset_ptr<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = offset_ptr<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = offset_ptr<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_index = offset_ptr<unsigned>(sq_ring, params.sq_off.array);
+    cq_head = offset_ptr<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = offset_ptr<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = offset_ptr<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = offset_ptr<void>(cq_ring, params.cq_off.cqes);
+    return true;
+  }
+
+  void IOQueue::release_ring()
+  {
+    if (sqe_array) ::munmap(sqe_array, sqe_array_size);
+    if (cq_ring && cq_ring != sq_ring) ::munmap(cq_ring, cq_ring_size);
+    if (sq_ring) ::munmap(sq_ring, sq_ring_size);
+    sqe_array = cq_ring = sq_ring = nullptr;
+    if (ring_fd >= 0) ::close(ring_fd);
+    ring_fd = -1;
+  }
+
+  unsigned IOQueue::fill_submissions(std::size_t& next)
+  {
+    unsigned tail = *sq_tail;
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+    auto* sqes = static_cast<io_uring_sqe*>(sqe_array);
+    while (next < pending.size() && in_flight + count < sq_entries
+      && tail - head < sq_entries) {
+      auto& r = pending[next];
+      unsigned index = tail & *sq_mask;
+      auto& sqe = sqes[index];
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = r.write ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe.fd = r.fd;
+      sqe.addr = reinterpret_cast<std::uint64_t>(r.data);
+      sqe.len = r.n;
+      sqe.off = r.offset;
+      sqe.user_data = next;
+      sq_index[index] = index;
+      tail++;
+      next++;
+      count++;
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  unsigned IOQueue::reap()
+  {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+    auto* entries = static_cast<io_uring_cqe*>(cqes);
+    for (; head != tail; head++, count++) {
+      auto& cqe = entries[head & *cq_mask];
+      auto& r = pending[cqe.user_data];
+      int res = cqe.res;
+      if (res == -EINVAL || res == -EOPNOTSUPP) {
+        // Older kernels have io_uring, but not these opcodes
+        res = perform(r);
+      }
+      completions.push_back({r.tag, res});
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    in_flight -= count;
+    return count;
+  }
+
+  const std::vector<IOQueue::Completion>& IOQueue::complete()
+  {
+    completions.clear();
+    if (!is_async()) {
+      for (auto&& r : pending) {
+        completions.push_back({r.tag, perform(r)});
+      }
+      pending.clear();
+      return completions;
+    }
+
+    std::size_t next = 0;
+    // Requests in the submission queue that the kernel has not taken yet
+    unsigned unsubmitted = 0;
+    while (next < pending.size() || in_flight > 0) {
+      unsigned filled = fill_submissions(next);
+      in_flight += filled;
+      unsubmitted += filled;
+      int res = ::syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1,
+        IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (res >= 0) {
+        unsubmitted -= std::min<unsigned>(res, unsubmitted);
+      } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        LOGE << "io_uring_enter: " << std::strerror(errno);
+        // Give up on the ring, and finish what is left synchronously.
+        // Requests the kernel already took are waited for first.
+        in_flight -= unsubmitted;
+        next -= unsubmitted;
+        while (in_flight > 0) {
+          if (reap() == 0) {
+            ::syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+          }
+        }
+        for (; next < pending.size(); next++) {
+          completions.push_back({pending[next].tag, perform(pending[next])});
+        }
+        release_ring();
+        break;
+      }
+      reap();
+    }
+    pending.clear();
+    return completions;
+  }
+
+#else
+
+  bool IOQueue::setup_ring(unsigned)
+  {
+    return false;
+  }
+
+  void IOQueue::release_ring() {}
+
+  unsigned IOQueue::fill_submissions(std::size_t&)
+  {
+    return 0;
+  }
+
+  unsigned IOQueue::reap()
+  {
+    return 0;
+  }
+
+  const std::vector<IOQueue::Completion>& IOQueue::complete()
+  {
+    completions.clear();
+    for (auto&& r : pending) {
+      completions.push_back({r.tag, perform(r)});
+    }
+    pending.clear();
+    return completions;
+  }
+
+#endif
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace otto::util {
+
+  /// Batched file I/O, with many requests in flight at once
+  ///
+  /// Reads and writes are queued, and then all performed by <complete>. On
+  /// Linux with io_uring, they are submitted together and run concurrently,
+  /// so a slow write does not hold up an unrelated read. Elsewhere, or if
+  /// the kernel does not support it, they are performed one after another
+  /// with `pread`/`pwrite`.
+  class IOQueue {
+  public:
+
+    struct Completion {
+      /// The tag the request was queued with
+      std::uint64_t tag;
+      /// Bytes transferred, or a negative `errno`
+      int result;
+    };
+
+    /// \param depth The most requests in flight at a time. With `0`, requests
+    ///              are always performed synchronously.
+    explicit IOQueue(unsigned depth = 32);
+    ~IOQueue();
+
+    IOQueue(const IOQueue&) = delete;
+
+    /// Whether requests actually run concurrently
+    bool is_async() const { return ring_fd >= 0; }
+
+    /// Queue a read of `n` bytes at `offset` in `fd` into `dst`
+    void read(int fd, void* dst, std::size_t n, std::int64_t offset, std::uint64_t tag);
+
+    /// Queue a write of `n` bytes from `src` to `offset` in `fd`
+    void write(int fd, const void* src, std::size_t n, std::int64_t offset, std::uint64_t tag);
+
+    /// The number of requests waiting for <complete>
+    std::size_t queued() const { return pending.size(); }
+
+    /// Perform all queued requests, and wait for them to finish
+    ///
+    /// Short reads and writes are not retried. The returned reference is valid
+    /// until the next call.
+    const std::vector<Completion>& complete();
+
+  private:
+
+    struct Request {
+      bool write;
+      int fd;
+      void* data;
+      std::size_t n;
+      std::int64_t offset;
+      std::uint64_t tag;
+    };
+
+    /// Perform `r` synchronously
+    static int perform(const Request& r);
+
+    bool setup_ring(unsigned depth);
+    void release_ring();
+    /// Fill submission slots from `pending`, starting at `next`
+    unsigned fill_submissions(std::size_t& next);
+    /// Move finished requests to `completions`
+    unsigned reap();
+
+    std::vector<Request> pending;
+    std::vector<Completion> completions;
+
+    int ring_fd = -1;
+    unsigned in_flight = 0;
+
+    // Shared with the kernel. See io_uring_setup(2).
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    void* sqe_array = nullptr;
+    std::size_t sq_ring_size = 0;
+    std::size_t cq_ring_size = 0;
+    std::size_t sqe_array_size = 0;
+    unsigned sq_entries = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_index = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    void* cqes = nullptr;
+  };
+
+}
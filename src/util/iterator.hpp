@@ -664,4 +664,31 @@ namespace otto::util {
   auto zip(Ranges&&... ranges) {
     return ZippedRange<Ranges...>(std::forward<Ranges>(ranges)...);
   }
+
+  /// A pair of iterators, usable in range based `for` loops
+  template<typename Iter>
+  struct IteratorRange {
+
+    IteratorRange(Iter first, Iter last)
+      : first {first},
+        last {last}
+    {}
+
+    Iter begin() const { return first; }
+
+    Iter end() const { return last; }
+
+    bool empty() const { return first == last; }
+
+    auto size() const { return std::distance(first, last); }
+
+    Iter first;
+    Iter last;
+  };
+
+  /// Create a range from two iterators
+  template<typename Iter>
+  IteratorRange<Iter> range(Iter first, Iter last) {
+    return {first, last};
+  }
 }
@@ -0,0 +1,310 @@
+#include "util/lossless.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+namespace otto::util::lossless {
+
+  namespace {
+
+    enum ChannelType : std::uint32_t {
+      Constant = 0,
+      Verbatim = 1,
+      Fixed = 2,
+    };
+
+    constexpr int max_order = 4;
+    constexpr int max_rice_parameter = 30;
+
+    struct BitWriter {
+      std::vector<std::byte>& out;
+      std::uint64_t acc = 0;
+      /// Bits in the low end of `acc` not written to `out` yet
+      int count = 0;
+
+      /// Write the low `n` bits of `v`, for `n` up to 32
+      void put(std::uint32_t v, int n)
+      {
+        acc = (acc << n) | (v & ((std::uint64_t(1) << n) - 1));
+        count += n;
+        while (count >= 8) {
+          count -= 8;
+          out.push_back(std::byte(acc >> count));
+        }
+      }
+
+      /// Write `q` zeros, then a one
+      void put_unary(std::uint32_t q)
+      {
+        for (; q >= 32; q -= 32) put(0, 32);
+        put(1, q + 1);
+      }
+
+      /// Pad to a whole byte
+      void finish()
+      {
+        if (count > 0) put(0, 8 - count);
+      }
+    };
+
+    struct BitReader {
+      const std::byte* data;
+      std::size_t size;
+      std::size_t pos = 0;
+      /// The next bits, from the top
+      std::uint64_t window = 0;
+      int avail = 0;
+      bool overrun = false;
+
+      void refill()
+      {
+        while (avail <= 56 && pos < size) {
+          window |= std::uint64_t(data[pos++]) << (56 - avail);
+          avail += 8;
+        }
+      }
+
+      void consume(int n)
+      {
+        window = n >= 64 ? 0 : window << n;
+        avail -= n;
+      }
+
+      /// Read `n` bits, for `n` up to 32
+      std::uint32_t get(int n)
+      {
+        if (n == 0) return 0;
+        if (avail < n) refill();
+        if (avail < n) {
+          overrun = true;
+          return 0;
+        }
+        std::uint32_t v = window >> (64 - n);
+        consume(n);
+        return v;
+      }
+
+      std::int32_t get_signed(int n)
+      {
+        std::uint32_t v = get(n);
+        // Sign extend from `n` bits
+        return std::int32_t(v << (32 - n)) >> (32 - n);
+      }
+
+      /// Count zeros up to the next one, and skip them and the one
+      std::uint32_t get_unary()
+      {
+        std::uint32_t q = 0;
+        while (true) {
+          if (avail < 64) refill();
+          if (avail == 0) {
+            overrun = true;
+            return 0;
+          }
+          if (window == 0) {
+            // All available bits are zeros
+            q += avail;
+            consume(avail);
+            continue;
+          }
+          int zeros = __builtin_clzll(window);
+          if (zeros >= avail) {
+            overrun = true;
+            return 0;
+          }
+          consume(zeros + 1);
+          return q + zeros;
+        }
+      }
+    };
+
+    inline std::uint32_t zigzag(std::int32_t v)
+    {
+      return (std::uint32_t(v) << 1) ^ std::uint32_t(v >> 31);
+    }
+
+    inline std::int32_t unzigzag(std::uint32_t u)
+    {
+      return std::int32_t(u >> 1) ^ -std::int32_t(u & 1);
+    }
+
+    /// The residual of fixed predictor `order` at `x`, which must have
+    /// `order` samples before it
+    inline std::int32_t residual(const std::int32_t* x, int order)
+    {
+      switch (order) {
+      case 0: return x[0];
+      case 1: return x[0] - x[-1];
+      case 2: return x[0] - 2 * x[-1] + x[-2];
+      case 3: return x[0] - 3 * x[-1] + 3 * x[-2] - x[-3];
+      default: return x[0] - 4 * x[-1] + 6 * x[-2] - 4 * x[-3] + x[-4];
+      }
+    }
+
+    /// Undo <residual>
+    inline std::int32_t predict(const std::int32_t* x, int order, std::int32_t e)
+    {
+      switch (order) {
+      case 0: return e;
+      case 1: return e + x[-1];
+      case 2: return e + 2 * x[-1] - x[-2];
+      case 3: return e + 3 * x[-1] - 3 * x[-2] + x[-3];
+      default: return e + 4 * x[-1] - 6 * x[-2] + 4 * x[-3] - x[-4];
+      }
+    }
+
+    /// The residual partition `p` of a channel of `frames` samples, starting
+    /// after the `order` warm up samples
+    inline std::pair<int, int> partition_range(int p, int frames, int order)
+    {
+      int first = std::max(order, p * frames / partitions);
+      int last = std::max(first, (p + 1) * frames / partitions);
+      return {first, last};
+    }
+
+    /// Bits taken by Rice coding `u` with parameter `k`
+    std::uint64_t rice_cost(const std::uint32_t* u, int n, int k)
+    {
+      std::uint64_t bits = std::uint64_t(n) * (k + 1);
+      for (int i = 0; i < n; i++) bits += u[i] >> k;
+      return bits;
+    }
+
+    /// The cheapest Rice parameter for `u`, and its cost in bits
+    std::pair<int, std::uint64_t> best_rice_parameter(const std::uint32_t* u, int n)
+    {
+      if (n == 0) return {0, 0};
+      std::uint64_t sum = 0;
+      for (int i = 0; i < n; i++) sum += u[i];
+      // For geometrically distributed values, the best parameter is close
+      // to the log of the mean
+      std::uint64_t mean = sum / n;
+      int guess = 0;
+      while (guess < max_rice_parameter && (mean >> (guess + 1)) > 0) guess++;
+      int best = guess;
+      std::uint64_t best_cost = rice_cost(u, n, guess);
+      for (int k : {guess - 1, guess + 1}) {
+        if (k < 0 || k > max_rice_parameter) continue;
+        auto cost = rice_cost(u, n, k);
+        if (cost < best_cost) {
+          best = k;
+          best_cost = cost;
+        }
+      }
+      return {best, best_cost};
+    }
+
+    void encode_channel(const std::int32_t* x, int frames, int bits,
+      BitWriter& out, std::vector<std::uint32_t>& u)
+    {
+      if (std::all_of(x + 1, x + frames, [&] (auto s) { return s == x[0]; })) {
+        out.put(Constant, 2);
+        out.put(x[0], bits);
+        return;
+      }
+
+      // Pick the order with the smallest residual
+      int order = 0;
+      if (frames > max_order) {
+        std::array<std::uint64_t, max_order + 1> sums = {};
+        for (int i = max_order; i < frames; i++) {
+          for (int o = 0; o <= max_order; o++) {
+            sums[o] += std::abs(residual(x + i, o));
+          }
+        }
+        order = std::min_element(sums.begin(), sums.end()) - sums.begin();
+      }
+
+      u.resize(frames);
+      for (int i = order; i < frames; i++) {
+        u[i] = zigzag(residual(x + i, order));
+      }
+      std::array<int, partitions> parameters;
+      std::uint64_t cost = 3 + std::uint64_t(order) * bits;
+      for (int p = 0; p < partitions; p++) {
+        auto [first, last] = partition_range(p, frames, order);
+        auto [k, c] = best_rice_parameter(u.data() + first, last - first);
+        parameters[p] = k;
+        cost += 5 + c;
+      }
+
+      if (cost >= std::uint64_t(frames) * bits) {
+        out.put(Verbatim, 2);
+        for (int i = 0; i < frames; i++) out.put(x[i], bits);
+        return;
+      }
+
+      out.put(Fixed, 2);
+      out.put(order, 3);
+      for (int i = 0; i < order; i++) out.put(x[i], bits);
+      for (int p = 0; p < partitions; p++) {
+        auto [first, last] = partition_range(p, frames, order);
+        int k = parameters[p];
+        out.put(k, 5);
+        for (int i = first; i < last; i++) {
+          out.put_unary(u[i] >> k);
+          out.put(u[i], k);
+        }
+      }
+    }
+
+    bool decode_channel(BitReader& in, std::int32_t* x, int frames, int bits)
+    {
+      switch (in.get(2)) {
+      case Constant:
+        std::fill(x, x + frames, in.get_signed(bits));
+        break;
+      case Verbatim:
+        for (int i = 0; i < frames; i++) x[i] = in.get_signed(bits);
+        break;
+      case Fixed: {
+        int order = in.get(3);
+        if (order > max_order || order > frames) return false;
+        for (int i = 0; i < order; i++) x[i] = in.get_signed(bits);
+        for (int p = 0; p < partitions; p++) {
+          auto [first, last] = partition_range(p, frames, order);
+          int k = in.get(5);
+          for (int i = first; i < last; i++) {
+            std::uint32_t q = in.get_unary();
+            std::uint32_t e = (q << k) | in.get(k);
+            x[i] = predict(x + i, order, unzigzag(e));
+          }
+          if (in.overrun) return false;
+        }
+        break;
+      }
+      default:
+        return false;
+      }
+      return !in.overrun;
+    }
+
+  } // namespace
+
+  void encode(const std::int32_t* src, int frames, int channels, int bits,
+    std::vector<std::byte>& dst)
+  {
+    BitWriter out {dst};
+    std::vector<std::int32_t> channel(frames);
+    std::vector<std::uint32_t> u;
+    for (int c = 0; c < channels; c++) {
+      for (int i = 0; i < frames; i++) channel[i] = src[i * channels + c];
+      encode_channel(channel.data(), frames, bits, out, u);
+    }
+    out.finish();
+  }
+
+  bool decode(const std::byte* src, std::size_t size, std::int32_t* dst,
+    int frames, int channels, int bits)
+  {
+    BitReader in {src, size};
+    std::vector<std::int32_t> channel(frames);
+    for (int c = 0; c < channels; c++) {
+      if (!decode_channel(in, channel.data(), frames, bits)) return false;
+      for (int i = 0; i < frames; i++) dst[i * channels + c] = channel[i];
+    }
+    return true;
+  }
+
+}
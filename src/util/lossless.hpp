@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace otto::util::lossless {
+
+  /// Lossless compression of blocks of integer samples, in the style of FLAC
+  ///
+  /// Each channel of a block is coded on its own. A channel that holds the
+  /// same value throughout, like silence, takes a few bytes. Otherwise the
+  /// samples are predicted with the best of FLAC's fixed polynomials of
+  /// order 0 to 4, and the prediction residual is Rice coded, with a
+  /// parameter chosen for each of <partitions> parts of the block. If that
+  /// does not pay off, the samples are stored verbatim.
+  ///
+  /// Blocks don't refer to each other, so any one of them can be decoded on
+  /// its own.
+
+  /// Residual partitions per channel of a block
+  constexpr int partitions = 8;
+
+  /// Compress `frames` interleaved frames of `channels` samples from `src`,
+  /// and append them to `dst`
+  ///
+  /// \param bits Significant bits of each sample, at most 24. Samples must be
+  ///             in the range of a signed integer of that many bits.
+  void encode(const std::int32_t* src, int frames, int channels, int bits,
+    std::vector<std::byte>& dst);
+
+  /// Decompress a block made by <encode> with the same `frames`, `channels`
+  /// and `bits` from the `size` bytes at `src` into `dst`
+  ///
+  /// \returns `false` if the data is corrupt, in which case `dst` holds
+  ///          garbage
+  bool decode(const std::byte* src, std::size_t size, std::int32_t* dst,
+    int frames, int channels, int bits);
+
+}
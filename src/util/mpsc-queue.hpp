@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace otto::util {
+
+  /// A bounded, lock free queue for many producers and one consumer
+  ///
+  /// Each slot has a sequence number telling whose turn it is, so pushing is
+  /// a single compare-and-swap on the write position, and popping needs no
+  /// atomic read-modify-write at all. `N` must be a power of two.
+  template<typename T, std::size_t N>
+  class mpsc_queue {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+  public:
+
+    static constexpr std::size_t capacity = N;
+
+    mpsc_queue()
+    {
+      for (std::size_t i = 0; i < N; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    mpsc_queue(const mpsc_queue&) = delete;
+
+    /// Push `value`. Safe to call from any thread.
+    ///
+    /// \returns `false` if the queue is full
+    bool try_push(const T& value)
+    {
+      std::size_t pos = push_pos.load(std::memory_order_relaxed);
+      while (true) {
+        Cell& cell = cells[pos & (N - 1)];
+        std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+        auto diff = std::intptr_t(seq) - std::intptr_t(pos);
+        if (diff == 0) {
+          if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.value = value;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = push_pos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /// Pop the oldest value into `value`. Only call from the consumer thread.
+    ///
+    /// \returns `false` if the queue is empty
+    bool try_pop(T& value)
+    {
+      Cell& cell = cells[pop_pos & (N - 1)];
+      std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+      if (std::intptr_t(seq) - std::intptr_t(pop_pos + 1) < 0) return false;
+      value = cell.value;
+      cell.sequence.store(pop_pos + N, std::memory_order_release);
+      pop_pos++;
+      return true;
+    }
+
+  private:
+    struct Cell {
+      std::atomic<std::size_t> sequence;
+      T value;
+    };
+
+    std::array<Cell, N> cells;
+    std::atomic<std::size_t> push_pos {0};
+    std::size_t pop_pos = 0;
+  };
+
+}
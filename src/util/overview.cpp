@@ -0,0 +1,85 @@
+#include "util/overview.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace otto::util::audio {
+
+  Overview::Overview(std::size_t length)
+  {
+    resize(length);
+  }
+
+  void Overview::resize(std::size_t length)
+  {
+    _length = length;
+    offsets = {0};
+    std::size_t n = (length + block_size - 1) / block_size;
+    while (n > 0) {
+      offsets.push_back(offsets.back() + n);
+      if (n == 1) break;
+      n = (n + fanout - 1) / fanout;
+    }
+    _points.assign(offsets.back(), Point{});
+  }
+
+  std::size_t Overview::frames_per_point(int level) const
+  {
+    std::size_t res = block_size;
+    for (int i = 0; i < level; i++) res *= fanout;
+    return res;
+  }
+
+  gsl::span<Overview::Point> Overview::level(int l)
+  {
+    return {_points.data() + offsets[l],
+        std::ptrdiff_t(offsets[l + 1] - offsets[l])};
+  }
+
+  gsl::span<const Overview::Point> Overview::level(int l) const
+  {
+    return {_points.data() + offsets[l],
+        std::ptrdiff_t(offsets[l + 1] - offsets[l])};
+  }
+
+  int Overview::level_for(float frames) const
+  {
+    int l = 0;
+    while (l + 1 < levels() && frames_per_point(l + 1) <= frames) l++;
+    return l;
+  }
+
+  void Overview::propagate(int l, std::size_t first, std::size_t last)
+  {
+    auto below = level(l - 1);
+    auto lvl = level(l);
+    last = std::min<std::size_t>(last, lvl.size());
+    for (std::size_t p = first; p < last; p++) {
+      std::size_t begin = p * fanout;
+      std::size_t end = std::min<std::size_t>(begin + fanout, below.size());
+      Point res = below[begin];
+      float sum_squares = 0;
+      for (std::size_t i = begin; i < end; i++) {
+        res.min = std::min(res.min, below[i].min);
+        res.max = std::max(res.max, below[i].max);
+        float rms = below[i].rms / 255.f;
+        sum_squares += rms * rms;
+      }
+      res.rms = std::lround(std::sqrt(sum_squares / (end - begin)) * 255.f);
+      lvl[p] = res;
+    }
+  }
+
+  Overview::Point Overview::quantize(float min, float max, float mean_square)
+  {
+    auto to_i8 = [] (float f) {
+      return std::int8_t(std::lround(std::clamp(f, -1.f, 1.f) * 127.f));
+    };
+    Point res;
+    res.min = to_i8(min);
+    res.max = to_i8(max);
+    res.rms = std::lround(std::clamp(std::sqrt(mean_square), 0.f, 1.f) * 255.f);
+    return res;
+  }
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <gsl/span>
+
+namespace otto::util::audio {
+
+  /// A min/max/RMS mipmap of one channel of audio
+  ///
+  /// Level 0 summarizes blocks of <block_size> frames, and each level above
+  /// summarizes <fanout> points of the level below, up to a single point.
+  /// Values are quantized to a byte each, which is plenty for drawing.
+  ///
+  /// All levels are kept in one contiguous array, finest first, so it can be
+  /// stored and loaded level by level.
+  class Overview {
+  public:
+
+    struct Point {
+      std::int8_t min = 0;
+      std::int8_t max = 0;
+      std::uint8_t rms = 0;
+      std::uint8_t reserved = 0;
+    };
+
+    static constexpr std::size_t block_size = 1024;
+    static constexpr std::size_t fanout = 4;
+
+    Overview() = default;
+    explicit Overview(std::size_t length);
+
+    /// Resize to cover `length` frames. All points are reset.
+    void resize(std::size_t length);
+
+    /// The number of frames covered
+    std::size_t length() const { return _length; }
+
+    int levels() const { return int(offsets.size()) - 1; }
+
+    /// The number of frames summarized by each point in `level`
+    std::size_t frames_per_point(int level) const;
+
+    gsl::span<Point> level(int l);
+    gsl::span<const Point> level(int l) const;
+
+    /// The coarsest level with no more than `frames` frames per point
+    int level_for(float frames) const;
+
+    /// Recompute the points covering frames `[first, last)`
+    ///
+    /// `get(i)` should return the sample at frame `i`. Level 0 is computed
+    /// from whole blocks, and the levels above from the level below.
+    template<typename Get>
+    void update(std::size_t first, std::size_t last, Get&& get);
+
+    /// Recompute points `[first, last)` of `level` from the level below
+    void propagate(int level, std::size_t first, std::size_t last);
+
+    /// All points, level 0 first
+    std::vector<Point>& points() { return _points; }
+    const std::vector<Point>& points() const { return _points; }
+
+    /// The index of the first point of `level` in <points>
+    std::size_t level_offset(int level) const { return offsets[level]; }
+
+  private:
+
+    static Point quantize(float min, float max, float mean_square);
+
+    std::size_t _length = 0;
+    /// Start of each level in `_points`, and the total size at the end
+    std::vector<std::size_t> offsets = {0};
+    std::vector<Point> _points;
+  };
+
+  /*
+   * Template definitions
+   */
+
+  template<typename Get>
+  void Overview::update(std::size_t first, std::size_t last, Get&& get)
+  {
+    last = std::min(last, _length);
+    if (first >= last) return;
+    std::size_t first_point = first / block_size;
+    std::size_t last_point = (last + block_size - 1) / block_size;
+    auto lvl = level(0);
+    for (std::size_t p = first_point; p < last_point; p++) {
+      std::size_t end = std::min((p + 1) * block_size, _length);
+      float min = 0, max = 0, sum_squares = 0;
+      for (std::size_t i = p * block_size; i < end; i++) {
+        float s = get(i);
+        min = std::min(min, s);
+        max = std::max(max, s);
+        sum_squares += s * s;
+      }
+      lvl[p] = quantize(min, max, sum_squares / (end - p * block_size));
+    }
+    for (int l = 1; l < levels(); l++) {
+      first_point /= fanout;
+      last_point = (last_point + fanout - 1) / fanout;
+      propagate(l, first_point, last_point);
+    }
+  }
+
+}
@@ -0,0 +1,128 @@
+#include "util/sample-format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace otto::util {
+
+  namespace {
+
+    /// Samples converted at a time, where a conversion takes two passes
+    constexpr std::size_t block_size = 256;
+
+    /// Round `v` to the nearest integer in `[lo, hi]`, halfway cases away from
+    /// zero. Unlike `std::lround`, this vectorizes without `-ffast-math`, as
+    /// long as the clamping comes after the rounding.
+    inline std::int32_t round_clamped(float v, float lo, float hi)
+    {
+      float r = v + std::copysign(0.5f, v);
+      return std::int32_t(std::min(std::max(r, lo), hi));
+    }
+
+    void decode_pcm16(const std::byte* src, float* dst, std::size_t n)
+    {
+      constexpr float scale = 1.f / (1 << 15);
+      for (std::size_t i = 0; i < n; i++) {
+        std::int16_t v;
+        std::memcpy(&v, src + 2 * i, 2);
+        dst[i] = v * scale;
+      }
+    }
+
+    void encode_pcm16(const float* src, std::byte* dst, std::size_t n)
+    {
+      constexpr float scale = 1 << 15;
+      for (std::size_t i = 0; i < n; i++) {
+        std::int16_t s = round_clamped(src[i] * scale, -scale, scale - 1);
+        std::memcpy(dst + 2 * i, &s, 2);
+      }
+    }
+
+    // Packed 24 bit samples don't fit vector lanes, so the bytes are moved
+    // to and from 32 bit integers in a scalar pass, and the arithmetic is
+    // done in a separate, vectorized one.
+
+    void decode_pcm24(const std::byte* src, float* dst, std::size_t n)
+    {
+      auto* bytes = reinterpret_cast<const std::uint8_t*>(src);
+      std::int32_t ints[block_size];
+      for (std::size_t i0 = 0; i0 < n; i0 += block_size) {
+        std::size_t len = std::min(block_size, n - i0);
+        for (std::size_t i = 0; i < len; i++) {
+          auto* b = bytes + 3 * (i0 + i);
+          // Assemble in the top bits, and shift down to extend the sign
+          ints[i] = std::int32_t(std::uint32_t(b[0]) << 8
+            | std::uint32_t(b[1]) << 16 | std::uint32_t(b[2]) << 24) >> 8;
+        }
+        dequantize_samples(24, ints, dst + i0, len);
+      }
+    }
+
+    void encode_pcm24(const float* src, std::byte* dst, std::size_t n)
+    {
+      auto* bytes = reinterpret_cast<std::uint8_t*>(dst);
+      std::int32_t ints[block_size];
+      for (std::size_t i0 = 0; i0 < n; i0 += block_size) {
+        std::size_t len = std::min(block_size, n - i0);
+        quantize_samples(24, src + i0, ints, len);
+        for (std::size_t i = 0; i < len; i++) {
+          auto* b = bytes + 3 * (i0 + i);
+          auto s = std::uint32_t(ints[i]);
+          b[0] = s;
+          b[1] = s >> 8;
+          b[2] = s >> 16;
+        }
+      }
+    }
+
+  } // namespace
+
+  void decode_samples(SampleFormat f, const std::byte* src, float* dst, std::size_t n)
+  {
+    switch (f) {
+    case SampleFormat::Float32:
+      std::memcpy(dst, src, n * sizeof(float));
+      break;
+    case SampleFormat::PCM16:
+      decode_pcm16(src, dst, n);
+      break;
+    case SampleFormat::PCM24:
+      decode_pcm24(src, dst, n);
+      break;
+    }
+  }
+
+  void encode_samples(SampleFormat f, const float* src, std::byte* dst, std::size_t n)
+  {
+    switch (f) {
+    case SampleFormat::Float32:
+      std::memcpy(dst, src, n * sizeof(float));
+      break;
+    case SampleFormat::PCM16:
+      encode_pcm16(src, dst, n);
+      break;
+    case SampleFormat::PCM24:
+      encode_pcm24(src, dst, n);
+      break;
+    }
+  }
+
+  void quantize_samples(int bits, const float* src, std::int32_t* dst, std::size_t n)
+  {
+    const float scale = std::int32_t(1) << (bits - 1);
+    for (std::size_t i = 0; i < n; i++) {
+      dst[i] = round_clamped(src[i] * scale, -scale, scale - 1);
+    }
+  }
+
+  void dequantize_samples(int bits, const std::int32_t* src, float* dst, std::size_t n)
+  {
+    const float scale = 1.f / (std::int32_t(1) << (bits - 1));
+    for (std::size_t i = 0; i < n; i++) {
+      dst[i] = src[i] * scale;
+    }
+  }
+
+}
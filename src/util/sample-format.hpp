@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace otto::util {
+
+  /// How samples are stored in a file. In memory, they are always `float`.
+  enum struct SampleFormat {
+    Float32,
+    /// Signed 16 bit integers
+    PCM16,
+    /// Signed 24 bit integers, packed in 3 bytes
+    PCM24,
+  };
+
+  /// Size in bytes of one sample stored as `f`
+  constexpr std::size_t sample_size(SampleFormat f)
+  {
+    switch (f) {
+    case SampleFormat::Float32: return 4;
+    case SampleFormat::PCM16: return 2;
+    case SampleFormat::PCM24: return 3;
+    }
+    return 4;
+  }
+
+  /// Convert `n` little endian samples stored as `f` at `src` to floats in
+  /// `[-1, 1)`
+  ///
+  /// The loops are written so the compiler can vectorize them. `src` and
+  /// `dst` must not overlap.
+  void decode_samples(SampleFormat f, const std::byte* src, float* dst, std::size_t n);
+
+  /// Convert `n` floats to little endian samples stored as `f`
+  ///
+  /// Integer formats are rounded to the nearest value, and clipped to the
+  /// representable range. `src` and `dst` must not overlap.
+  void encode_samples(SampleFormat f, const float* src, std::byte* dst, std::size_t n);
+
+  /// Convert `n` floats to signed integers of `bits` bits, rounded and
+  /// clipped like <encode_samples>
+  void quantize_samples(int bits, const float* src, std::int32_t* dst, std::size_t n);
+
+  /// Convert `n` signed integers of `bits` bits to floats in `[-1, 1)`
+  void dequantize_samples(int bits, const std::int32_t* src, float* dst, std::size_t n);
+
+}
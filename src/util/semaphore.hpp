@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace otto::util {
+
+  /// A counting semaphore that can be posted from a realtime thread
+  ///
+  /// On linux, <post> is a single atomic increment, followed by a futex wake
+  /// only if another thread is actually blocked in <wait>. It never takes a
+  /// lock, so a low priority waiter can't hold up the poster.
+  ///
+  /// Elsewhere it falls back to a mutex and a condition variable, which is
+  /// not realtime safe.
+  class semaphore {
+  public:
+
+    semaphore(int initial = 0) : count {initial} {}
+
+    semaphore(const semaphore&) = delete;
+    semaphore& operator=(const semaphore&) = delete;
+
+    /// Increment the count, and wake a waiting thread if there is one
+    void post()
+    {
+#ifdef __linux__
+      count.fetch_add(1);
+      if (waiters.load() > 0) {
+        futex(FUTEX_WAKE_PRIVATE, 1, nullptr);
+      }
+#else
+      std::unique_lock lock {mutex};
+      count++;
+      cond.notify_one();
+#endif
+    }
+
+    /// Decrement the count if it is positive, without blocking
+    ///
+    /// \returns whether the count was decremented
+    bool try_wait()
+    {
+      int c = count.load();
+      while (c > 0) {
+        if (count.compare_exchange_weak(c, c - 1)) return true;
+      }
+      return false;
+    }
+
+    /// Block until the count is positive, then decrement it
+    void wait()
+    {
+      while (!wait_impl(nullptr));
+    }
+
+    /// Like <wait>, but give up after `timeout`
+    ///
+    /// \returns whether the count was decremented
+    template<typename Rep, typename Period>
+    bool wait_for(std::chrono::duration<Rep, Period> timeout)
+    {
+      auto end = std::chrono::steady_clock::now() + timeout;
+      while (true) {
+        auto left = end - std::chrono::steady_clock::now();
+        if (left <= left.zero()) return try_wait();
+        if (wait_impl(&left)) return true;
+      }
+    }
+
+  private:
+
+    /// Wait once. May return `false` spuriously
+    bool wait_impl(const std::chrono::steady_clock::duration* timeout)
+    {
+      if (try_wait()) return true;
+#ifdef __linux__
+      waiters.fetch_add(1);
+      if (timeout) {
+        auto secs = std::chrono::duration_cast<std::chrono::seconds>(*timeout);
+        auto nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(*timeout - secs);
+        timespec ts {(std::time_t) secs.count(), (long) nsecs.count()};
+        futex(FUTEX_WAIT_PRIVATE, 0, &ts);
+      } else {
+        // Returns immediately if the count is no longer 0
+        futex(FUTEX_WAIT_PRIVATE, 0, nullptr);
+      }
+      waiters.fetch_sub(1);
+#else
+      std::unique_lock lock {mutex};
+      auto pred = [this] { return count.load() > 0; };
+      if (timeout) {
+        cond.wait_for(lock, *timeout, pred);
+      } else {
+        cond.wait(lock, pred);
+      }
+#endif
+      return try_wait();
+    }
+
+#ifdef __linux__
+    long futex(int op, int val, const timespec* timeout)
+    {
+      static_assert(sizeof(count) == sizeof(int), "futex needs a plain int");
+      return ::syscall(SYS_futex, reinterpret_cast<int*>(&count), op, val,
+        timeout, nullptr, 0);
+    }
+#else
+    std::mutex mutex;
+    std::condition_variable cond;
+#endif
+
+    std::atomic<int> count;
+    std::atomic<int> waiters {0};
+  };
+
+}
@@ -1,4 +1,5 @@
 #include "util/soundfile.hpp"
+#include <cstdint>
 #include <plog/Log.h>
 
 namespace otto::util {
@@ -15,8 +16,23 @@ namespace otto::util {
 
     void read_fields(ByteFile& file) override {
       file.read_bytes(format).unwrap_ok();
-      file.for_chunks_in_range(offset + 12, offset + 8 + size.as_u(),
+      // In an RF64 file, the first chunk holds the real sizes of the file
+      // and the data chunk
+      bytes<4> first_id;
+      bytes<8> riff_size = 0;
+      bytes<8> data_size = 0;
+      file.read_bytes(first_id).unwrap_ok();
+      if (id == "RF64" && first_id == "ds64") {
+        file.seek(offset + 20);
+        file.read_bytes(riff_size).unwrap_ok();
+        file.read_bytes(data_size).unwrap_ok();
+        large_size = riff_size.as_u();
+      }
+      file.for_chunks_in_range(offset + 12, offset + 8 + length(),
         [&](Chunk& c) {
+          if (c.id == "data" && c.size.as_u() == ByteFile::large_chunk_size) {
+            c.large_size = data_size.as_u();
+          }
           chunks.emplace_back(new Chunk(c));
         });
     }
@@ -50,26 +66,41 @@ namespace otto::util {
       file.read_bytes(blockAlign).unwrap_ok();
       file.read_bytes(bitsPerSample).unwrap_ok();
 
-      if (audioFormat.as_u() != 3) {
-        throw "Unsupported audio format. \
-               Currently only float is supported";
+      std::uint16_t format = audioFormat.as_u();
+      if (format == 0xFFFE) {
+        // WAVE_FORMAT_EXTENSIBLE. The format is the start of the sub format
+        // GUID, after the extension size, valid bits and channel mask.
+        bytes<2> extension_size, valid_bits, sub_format;
+        bytes<4> channel_mask;
+        file.read_bytes(extension_size).unwrap_ok();
+        file.read_bytes(valid_bits).unwrap_ok();
+        file.read_bytes(channel_mask).unwrap_ok();
+        file.read_bytes(sub_format).unwrap_ok();
+        format = sub_format.as_u();
       }
 
       sf.info.channels = numChannels.as_u();
       sf.info.samplerate = sampleRate.as_u();
 
-      if (bitsPerSample.as_u() != 32) {
-        throw "Unsupported sample size. \
-              Currently only 32bit float is supported";
+      auto bits = bitsPerSample.as_u();
+      if (format == 3 && bits == 32) {
+        sf.info.format = SampleFormat::Float32;
+      } else if (format == 1 && bits == 16) {
+        sf.info.format = SampleFormat::PCM16;
+      } else if (format == 1 && bits == 24) {
+        sf.info.format = SampleFormat::PCM24;
+      } else {
+        throw "Unsupported sample format. \
+              Currently only 32bit float and 16/24bit integers are supported";
       }
     }
 
     void write_fields(ByteFile& file) override {
       auto& sf = (SoundFile&)file;
-      audioFormat.as_u() = 3;
+      audioFormat.as_u() = sf.info.format == SampleFormat::Float32 ? 3 : 1;
       numChannels.as_u() = sf.info.channels;
       sampleRate.as_u() = sf.info.samplerate;
-      bitsPerSample.as_u() = sf.sample_size * 8;
+      bitsPerSample.as_u() = sf.sample_size() * 8;
       byteRate.as_u() =
         sampleRate.as_u() * numChannels.as_u() * bitsPerSample.as_u() / 8;
       blockAlign.as_u() = numChannels.as_u() * bitsPerSample.as_u() / 8;
@@ -90,10 +121,78 @@ namespace otto::util {
     void read_fields(ByteFile& file) override {
       auto& sf = (SoundFile&)file;
       sf.audioOffset = offset + 8;
+      sf.audioLength = length() / sf.sample_size();
     }
     void write_fields(ByteFile& file) override {
       auto& sf = (SoundFile&)file;
       sf.audioOffset = offset + 8;
+      sf.audioLength = length() / sf.sample_size();
+      // Skip the audio, so trailing chunks are written after it
+      file.seek(offset + 8 + length());
+    }
+  };
+
+  /// The sizes of an RF64 file, whose RIFF and data chunk sizes are
+  /// <ByteFile::large_chunk_size>
+  ///
+  /// It comes first, and takes its room from the padding before the data
+  /// chunk, so turning a RIFF file into RF64 never moves the audio.
+  struct WAVE_ds64 : Chunk {
+    /// Including the chunk header
+    static constexpr int chunk_size = 8 + 28;
+
+    WAVE_ds64() : Chunk("ds64") {
+      size = bytes<4>::from_u(chunk_size - 8);
+    }
+    WAVE_ds64(Chunk& c) : Chunk(c) {}
+
+    bytes<8> riffSize = 0;
+    bytes<8> dataSize = 0;
+    bytes<8> sampleCount = 0;
+    /// Sizes of other large chunks. There are none.
+    bytes<4> tableLength = 0;
+
+    void read_fields(ByteFile& file) override {
+      file.read_bytes(riffSize).unwrap_ok();
+      file.read_bytes(dataSize).unwrap_ok();
+      file.read_bytes(sampleCount).unwrap_ok();
+      file.read_bytes(tableLength).unwrap_ok();
+    }
+
+    void write_fields(ByteFile& file) override {
+      file.write_bytes(riffSize);
+      file.write_bytes(dataSize);
+      file.write_bytes(sampleCount);
+      file.write_bytes(tableLength);
+    }
+  };
+
+  /// Pads the data chunk to start at a multiple of
+  /// <SoundFile::audio_alignment>
+  ///
+  /// The size is decided when the file is created, and kept after that, so
+  /// rewriting the header never moves the audio.
+  struct WAVE_pad : Chunk {
+    WAVE_pad() : Chunk("JUNK") {}
+    WAVE_pad(Chunk& c) : Chunk(c) {}
+
+    void read_fields(ByteFile& file) override {
+      auto& sf = (SoundFile&)file;
+      sf.paddingSize = size.as_u() + (sf.isRF64 ? WAVE_ds64::chunk_size : 0);
+    }
+
+    void write_fields(ByteFile& file) override {
+      auto& sf = (SoundFile&)file;
+      if (sf.paddingSize < 0) {
+        auto align = std::max<ByteFile::Position>(sf.audio_alignment, 2);
+        // The data chunk header follows
+        auto data_start = file.position() + 8;
+        sf.paddingSize = (align - data_start % align) % align;
+        // Leave room for a ds64 chunk
+        while (sf.paddingSize < WAVE_ds64::chunk_size) sf.paddingSize += align;
+      }
+      std::vector<std::byte> zeros(sf.paddingSize - (sf.isRF64 ? WAVE_ds64::chunk_size : 0));
+      file.write_bytes(zeros.data(), zeros.size());
     }
   };
 
@@ -103,12 +202,17 @@ namespace otto::util {
 
   SoundFile::SoundFile() {}
 
+  SoundFile::~SoundFile() {
+    unmap_audio();
+  }
+
   void SoundFile::read_file() {
     ByteFile::seek(0);
     Header header;
     header.read(*this);
 
-    if (header.id == "RIFF" && header.format == "WAVE") {
+    isRF64 = header.id == "RF64";
+    if ((header.id == "RIFF" || isRF64) && header.format == "WAVE") {
       info.type = Info::Type::WAVE;
     } else if (header.id == "FORM" && header.format == "AIFF") {
       info.type = Info::Type::AIFF;
@@ -124,11 +228,22 @@ namespace otto::util {
       LOGD << path.c_str();
       LOGD << "-------------------";
 
+      audioOffset = 0;
+      hasTrailingChunks = false;
+      hasPadding = false;
       for (auto&& chunk : header.chunks) {
+        if (chunk->id == "JUNK" && audioOffset == 0) {
+          chunk = std::make_unique<WAVE_pad>(*chunk);
+          hasPadding = true;
+        }
+        if (chunk->id == "ds64")
+          chunk = std::make_unique<WAVE_ds64>(*chunk);
         if (chunk->id == "fmt ")
           chunk = std::make_unique<WAVE_fmt>(*chunk);
         if (chunk->id == "data")
           chunk = std::make_unique<WAVE_data>(*chunk);
+        else if (chunk->offset > audioOffset && audioOffset > 0)
+          hasTrailingChunks = true;
         replace_custom_chunk(chunk);
 
         // re-read the chunk as the new type
@@ -137,7 +252,7 @@ namespace otto::util {
 
         LOGD << " Chunk:  " << std::string((char*)chunk->id.data, 4);
         LOGD << " Offset: " << chunk->offset;
-        LOGD << " Size:   " << chunk->size.as_u();
+        LOGD << " Size:   " << chunk->length();
         LOGD << "-------------------";
       } break;
 
@@ -150,24 +265,26 @@ namespace otto::util {
   }
 
   void SoundFile::write_file() {
-    ByteFile::seek(0);
-    Header header;
-
     switch (info.type) {
     case Info::Type::WAVE:
       LOGD << "Writing Wave file: ";
       LOGD << path.c_str();
       LOGD << "-------------------";
 
-      header.id = "RIFF";
-      header.format = "WAVE";
-      header.chunks.push_back(std::make_unique<WAVE_fmt>());
-      add_custom_chunks(header.chunks);
-      header.chunks.push_back(std::make_unique<WAVE_data>());
-      header.chunks.back()->size = ByteFile::size() - audioOffset;
-      header.write(*this);
+      if (ByteFile::size() == 0) {
+        // A new file
+        hasPadding = true;
+        paddingSize = -1;
+      }
+      if (write_wave_header() - 8 >= large_chunk_size && !isRF64) {
+        if (hasPadding && paddingSize >= WAVE_ds64::chunk_size) {
+          isRF64 = true;
+          write_wave_header();
+        } else {
+          LOGE << path.c_str() << " is too large for a RIFF file, and has no room to be RF64";
+        }
+      }
 
-      LOGD << "Wrote " << header.chunks.size() << " chunks";
       LOGE_IF(!fstream.good()) << "fstream errored";
       LOGD << "-------------------";
       break;
@@ -176,13 +293,59 @@ namespace otto::util {
     }
   }
 
+  ByteFile::Position SoundFile::write_wave_header() {
+    ByteFile::seek(0);
+    Header header;
+    header.id = isRF64 ? "RF64" : "RIFF";
+    header.format = "WAVE";
+    WAVE_ds64* ds64 = nullptr;
+    if (isRF64) {
+      ds64 = new WAVE_ds64();
+      header.chunks.emplace_back(ds64);
+      header.size.as_u() = large_chunk_size;
+    }
+    header.chunks.push_back(std::make_unique<WAVE_fmt>());
+    add_custom_chunks(header.chunks);
+    if (hasPadding) {
+      header.chunks.push_back(std::make_unique<WAVE_pad>());
+    }
+    header.chunks.push_back(std::make_unique<WAVE_data>());
+    auto& data = *header.chunks.back();
+    add_trailing_chunks(header.chunks);
+    hasTrailingChunks = &data != header.chunks.back().get();
+    if (hasTrailingChunks) {
+      data.set_length(audioLength * sample_size());
+    } else {
+      data.set_length(ByteFile::size() - audioOffset);
+    }
+    if (isRF64) {
+      data.large_size = data.length();
+      data.size.as_u() = large_chunk_size;
+    }
+    header.write(*this);
+    ByteFile::Position end = ByteFile::position();
+    if (hasTrailingChunks) {
+      // Trailing chunks may have shrunk
+      ByteFile::resize(end);
+    }
+    if (ds64) {
+      ds64->riffSize.as_u() = end - 8;
+      ds64->dataSize.as_u() = data.length();
+      ds64->sampleCount.as_u() = data.length() / (sample_size() * info.channels);
+      ByteFile::seek(ds64->offset + 8);
+      ds64->write_fields(*this);
+    }
+    LOGD << "Wrote " << header.chunks.size() << " chunks";
+    return end;
+  }
+
   Position SoundFile::seek(Position p) {
-    return (ByteFile::seek(audioOffset + p * sample_size)
-      - audioOffset) / sample_size;
+    Position size = sample_size();
+    return (ByteFile::seek(audioOffset + p * size) - audioOffset) / size;
   }
 
   Position SoundFile::position() {
-    Position r = (ByteFile::position() - audioOffset) / sample_size;
+    Position r = (ByteFile::position() - audioOffset) / Position(sample_size());
     if (r < 0) {
       seek(0);
       return 0;
@@ -191,6 +354,158 @@ namespace otto::util {
   }
 
   Position SoundFile::length() {
-    return (ByteFile::size() - audioOffset) / sample_size;
+    if (hasTrailingChunks) return audioLength;
+    return (ByteFile::size() - audioOffset) / sample_size();
+  }
+
+  void SoundFile::reserve_audio(Position length) {
+    Position old_length = this->length();
+    if (old_length >= length) {
+      // Tapes from before preallocation may still be sparse
+      ByteFile::allocate(audioOffset, length * sample_size());
+      return;
+    }
+    ByteFile::Position old_end = audioOffset + old_length * sample_size();
+    ByteFile::Position old_size = ByteFile::size();
+    ByteFile::Position new_end = audioOffset + length * sample_size();
+
+    audioLength = length;
+    if (!hasTrailingChunks && old_size < new_end) {
+      ByteFile::resize(new_end);
+    }
+    // Trailing chunks are moved past the new end
+    write_file();
+    if (ByteFile::size() < new_end) {
+      ByteFile::resize(new_end);
+    }
+
+    // Clear whatever trailing chunks used to be where the audio now is
+    ByteFile::Position stale_end = std::min(old_size, new_end);
+    if (stale_end > old_end) {
+      std::vector<std::byte> zeros(stale_end - old_end);
+      ByteFile::seek(old_end);
+      ByteFile::write_bytes(zeros.data(), zeros.size());
+    }
+    fstream.flush();
+    ByteFile::allocate(audioOffset, length * sample_size());
+  }
+
+  /*
+   * Memory mapping
+   */
+
+  void SoundFile::map_audio(Position length) {
+    unmap_audio();
+    // Rewrites the header if needed, so a crash leaves a valid file
+    reserve_audio(length);
+    mapping = ByteFile::map(audioOffset, length * sample_size());
+    dirty_in = dirty_out = 0;
+  }
+
+  void SoundFile::unmap_audio() {
+    if (!mapping) return;
+    flush_mapped(true);
+    mapping.reset();
+  }
+
+  bool SoundFile::is_mapped() const {
+    return bool(mapping);
+  }
+
+  void SoundFile::read_block(Sample* dst, int n) {
+    if (!is_open()) throw ByteFile::Error(ByteFile::Error::Type::FileNotOpen);
+    if (n <= 0) return;
+    std::size_t size = sample_size();
+    int read = 0;
+    if (info.format == SampleFormat::Float32) {
+      fstream.read(reinterpret_cast<char*>(dst), n * size);
+      read = fstream.gcount() / size;
+    } else {
+      std::array<std::byte, iter_block_size * 4 * 4> raw;
+      int block = raw.size() / size;
+      while (read < n) {
+        int len = std::min(n - read, block);
+        fstream.read(reinterpret_cast<char*>(raw.data()), len * size);
+        int got = fstream.gcount() / size;
+        decode_samples(info.format, raw.data(), dst + read, got);
+        read += got;
+        if (got < len) break;
+      }
+    }
+    if (fstream.eof()) fstream.clear();
+    std::fill(dst + read, dst + n, 0.f);
+  }
+
+  void SoundFile::write_block(const Sample* src, int n) {
+    if (!is_open()) throw ByteFile::Error(ByteFile::Error::Type::FileNotOpen);
+    if (n <= 0) return;
+    std::size_t size = sample_size();
+    if (info.format == SampleFormat::Float32) {
+      fstream.write(reinterpret_cast<const char*>(src), n * size);
+      return;
+    }
+    std::array<std::byte, iter_block_size * 4 * 4> raw;
+    int block = raw.size() / size;
+    for (int i = 0; i < n; i += block) {
+      int len = std::min(n - i, block);
+      encode_samples(info.format, src + i, raw.data(), len);
+      fstream.write(reinterpret_cast<const char*>(raw.data()), len * size);
+    }
+  }
+
+  SoundFile::Sample* SoundFile::mapped_data() {
+    return reinterpret_cast<Sample*>(mapping.data());
+  }
+
+  const SoundFile::Sample* SoundFile::mapped_data() const {
+    return reinterpret_cast<const Sample*>(mapping.data());
+  }
+
+  void SoundFile::read_mapped(Position p, Sample* dst, Position n) const {
+    if (n <= 0) return;
+    decode_samples(info.format, mapping.data() + p * sample_size(), dst, n);
+  }
+
+  void SoundFile::write_mapped(Position p, const Sample* src, Position n) {
+    if (n <= 0) return;
+    encode_samples(info.format, src, mapping.data() + p * sample_size(), n);
+    mark_dirty(p, n);
+  }
+
+  Position SoundFile::mapped_length() const {
+    return mapping.size() / sample_size();
+  }
+
+  void SoundFile::advise_mapped(MappedRegion::Advice a, Position p, Position n) const {
+    if (p < 0) {
+      n += p;
+      p = 0;
+    }
+    if (n <= 0) return;
+    mapping.advise(a, p * sample_size(), n * sample_size());
+  }
+
+  void SoundFile::mark_dirty(Position p, Position n) {
+    if (n <= 0) return;
+    if (dirty_in == dirty_out) {
+      dirty_in = p;
+      dirty_out = p + n;
+      dirty_since = std::chrono::steady_clock::now();
+    } else {
+      dirty_in = std::min(dirty_in, p);
+      dirty_out = std::max(dirty_out, p + n);
+    }
+    flush_mapped(false);
+  }
+
+  void SoundFile::flush_mapped(bool force) {
+    if (!mapping || dirty_in == dirty_out) return;
+    std::size_t bytes = (dirty_out - dirty_in) * sample_size();
+    if (!force && bytes < flush_policy.max_dirty_bytes
+      && std::chrono::steady_clock::now() - dirty_since < flush_policy.max_dirty_time) {
+      return;
+    }
+    mapping.flush(dirty_in * sample_size(), bytes, force);
+    dirty_in = dirty_out = 0;
   }
 }
@@ -1,22 +1,23 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 
 #include "util/bytefile.hpp"
 #include "util/algorithm.hpp"
+#include "util/sample-format.hpp"
 
 namespace otto::util {
 
   /// A file handler for sound (wav, aiff) files
   class SoundFile : public ByteFile {
     public:
-    /// Used for indexing into the file
-    using Position = int;
-    /// The type of a sample
+    /// Used for indexing into the file, in samples
+    using Position = std::int64_t;
+    /// The type of a sample in memory
     using Sample = float;
     using Chunk = ByteFile::Chunk;
-    /// Size in bytes of one sample
-    constexpr static std::size_t sample_size = sizeof(Sample);
 
     enum class Error {
       UnrecognizedFileType,
@@ -26,14 +27,41 @@ namespace otto::util {
       enum class Type {
         WAVE,
         AIFF,
-      } type;
+      } type = Type::WAVE;
 
       int channels = 1;
       int samplerate = 44100;
+      /// How samples are stored in the file. Set before opening a new file to
+      /// choose its format. Existing files keep theirs.
+      SampleFormat format = SampleFormat::Float32;
     } info;
 
+    /// Size in bytes of one sample in the file
+    std::size_t sample_size() const { return util::sample_size(info.format); }
+
+    /// When dirty, memory mapped audio data is written back
+    struct FlushPolicy {
+      /// Schedule a writeback once this many bytes are dirty
+      std::size_t max_dirty_bytes = 1 << 20;
+      /// Schedule a writeback once the oldest unflushed write is this old
+      std::chrono::milliseconds max_dirty_time {500};
+    };
+
+    FlushPolicy flush_policy;
+
+    /// Start the audio data of new files at a multiple of this many bytes,
+    /// or `0` to not care
+    ///
+    /// Padding is inserted before the data chunk. Files created without it
+    /// keep their layout, since moving the audio would be too slow.
+    ///
+    /// New files are padded either way, with room for the `ds64` chunk of an
+    /// RF64 file. Files that outgrow the 32 bit sizes of RIFF are stored as
+    /// RF64, which then takes the room from the padding.
+    ByteFile::Position audio_alignment = 0;
+
     SoundFile();
-    virtual ~SoundFile() = default;
+    virtual ~SoundFile();
 
     using ByteFile::open;
     using ByteFile::close;
@@ -47,6 +75,63 @@ namespace otto::util {
     Position position();
     Position length();
 
+    /// Make the data chunk at least `length` samples long
+    ///
+    /// The file is extended with silence, and the header is rewritten. This is
+    /// required before writing audio to files with trailing chunks, which
+    /// can't grow on their own. Disk blocks are allocated for all of it, so
+    /// recording doesn't wait for the filesystem.
+    void reserve_audio(Position length);
+
+    /// The byte offset of the first sample in the file, for I/O that
+    /// bypasses this class
+    ByteFile::Position audio_offset() const { return audioOffset; }
+
+    /* Memory mapped access */
+
+    /// Map the audio data into memory
+    ///
+    /// The data chunk is extended to `length` samples if it is shorter, and the
+    /// header is rewritten to match. While mapped, samples should be accessed
+    /// through <mapped_data> rather than <read_samples>/<write_samples>.
+    void map_audio(Position length);
+
+    /// Write back all dirty data and release the mapping
+    void unmap_audio();
+
+    bool is_mapped() const;
+
+    /// The mapped samples, as stored in the file. These are only <Sample>s
+    /// if <Info::format> is `Float32`, otherwise use <read_mapped> and
+    /// <write_mapped>.
+    Sample* mapped_data();
+    const Sample* mapped_data() const;
+
+    /// Convert the `n` mapped samples from `p` into `dst`
+    void read_mapped(Position p, Sample* dst, Position n) const;
+
+    /// Convert `n` samples from `src` into the mapping at `p`, and
+    /// <mark_dirty> them
+    void write_mapped(Position p, const Sample* src, Position n);
+
+    /// The number of mapped samples
+    Position mapped_length() const;
+
+    /// Hint the kernel about how samples `[p, p + n)` will be accessed
+    void advise_mapped(MappedRegion::Advice, Position p, Position n) const;
+
+    /// Record that samples `[p, p + n)` were written through the mapping
+    ///
+    /// Schedules a writeback if the <flush_policy> calls for it
+    void mark_dirty(Position p, Position n);
+
+    /// Write back dirty mapped data
+    ///
+    /// If `force` is false, this only schedules a writeback when the
+    /// <flush_policy> says so. Otherwise all dirty data is written
+    /// synchronously.
+    void flush_mapped(bool force = true);
+
     template<typename OutIter,
       typename = std::enable_if<
         is_iterator_v<OutIter, Sample, std::output_iterator_tag>>>
@@ -74,6 +159,14 @@ namespace otto::util {
     /// It should push back any custom metadata chunks to `v`
     virtual void add_custom_chunks(std::vector<std::unique_ptr<Chunk>>& v) {}
 
+    /// When extending <SoundFile>, override this function.
+    ///
+    /// It should push back any custom chunks to be stored after the audio
+    /// data to `v`. Unlike chunks before the data, these can change size
+    /// without moving the audio. If there are any, the length of the data
+    /// chunk is fixed, see <reserve_audio>.
+    virtual void add_trailing_chunks(std::vector<std::unique_ptr<Chunk>>& v) {}
+
     /// When extending <SoundFile>, override this function.
     ///
     /// It should check the id of `ptr`, and if it matches,
@@ -85,18 +178,44 @@ namespace otto::util {
     friend struct Header;
     friend struct WAVE_fmt;
     friend struct WAVE_data;
+    friend struct WAVE_pad;
+    friend struct WAVE_ds64;
 
-    ByteFile::Position audioOffset;
+    ByteFile::Position audioOffset = 0;
+    /// Length of the data chunk in samples, as of the last read or write of
+    /// the header
+    Position audioLength = 0;
+    /// Whether any chunks follow the data chunk
+    bool hasTrailingChunks = false;
+    /// Whether the data chunk is preceded by padding, see <audio_alignment>
+    bool hasPadding = false;
+    /// Bytes of padding, or `-1` if not decided yet. Counted as in a RIFF
+    /// file, so in an RF64 file, the `ds64` chunk is included.
+    ByteFile::Position paddingSize = -1;
+    /// Whether the file is RF64 rather than RIFF
+    bool isRF64 = false;
 
-    Sample bytes_to_sample(bytes<sample_size> bytes) {
-      return bytes.cast<Sample>();
-    }
+    MappedRegion mapping;
+    /// Dirty mapped samples, `[dirty_in, dirty_out)`
+    Position dirty_in = 0;
+    Position dirty_out = 0;
+    std::chrono::steady_clock::time_point dirty_since;
 
-    bytes<sample_size> sample_to_bytes(Sample sample) {
-      bytes<sample_size> bytes;
-      bytes.cast<Sample>() = sample;
-      return bytes;
-    }
+    /// Read `n` samples at the current position into `dst`, converting them
+    /// from <Info::format>. Samples past the end of the file are `0`.
+    void read_block(Sample* dst, int n);
+
+    /// Write `n` samples from `src` at the current position, converting them
+    /// to <Info::format>
+    void write_block(const Sample* src, int n);
+
+    /// Write the chunks of a WAVE file, as RF64 if <isRF64>. Returns the end
+    /// of the last chunk.
+    ByteFile::Position write_wave_header();
+
+    /// Samples converted at a time by the iterator overloads of
+    /// <read_samples> and <write_samples>
+    static constexpr int iter_block_size = 256;
 
   };
 
@@ -105,44 +224,25 @@ namespace otto::util {
    */
 
   template<typename OutIter, typename>
-    void SoundFile::read_samples(OutIter f, OutIter l) {
+  void SoundFile::read_samples(OutIter f, OutIter l) {
     if constexpr (std::is_pointer_v<OutIter>) {
-        auto r = ByteFile::read_bytes(reinterpret_cast<std::byte*>(f),
-          reinterpret_cast<std::byte*>(l));
-        r.if_err([&] (auto&& e) {
-            std::generate(e, l, [] { return 0; });
-          });
-      } else {
-      bytes<sample_size> buf;
-      int i = 0;
-      for (auto iter = f; iter != l; iter++, i++) {
-        if (ByteFile::read_bytes(buf).is_err()) {
-          std::generate(iter, l, [] { return 0; });
-          break;
-        }
-        *iter = bytes_to_sample(buf);
-      }
+      read_block(f, l - f);
+    } else {
+      read_samples(f, std::distance(f, l));
     }
   }
 
   template<typename OutIter, typename>
-    void SoundFile::read_samples(OutIter&& iter, int n) {
-    if constexpr (std::is_pointer_v<OutIter>) {
-        ByteFile::read_bytes(reinterpret_cast<std::byte*>(iter),
-          n * sample_size).if_err(
-            [&] (auto&& e) {
-              std::generate_n(iter + e, n - e, [] { return 0; });
-            });
-      } else {
-      bytes<sample_size> buf;
-      int i = 0;
-      for (auto cur = iter; i < n; iter++, i++) {
-        auto r = ByteFile::read_bytes(buf);
-        if (r.is_err()) {
-          std::generate_n(cur, n - r.unwrap_err(), [] { return 0; });
-          break;
-        }
-        *cur = bytes_to_sample(buf);
+  void SoundFile::read_samples(OutIter&& iter, int n) {
+    if constexpr (std::is_pointer_v<std::decay_t<OutIter>>) {
+      read_block(iter, n);
+    } else {
+      std::array<Sample, iter_block_size> block;
+      auto out = iter;
+      for (int i = 0; i < n; i += block.size()) {
+        int len = std::min<int>(n - i, block.size());
+        read_block(block.data(), len);
+        out = std::copy_n(block.data(), len, out);
       }
     }
   }
@@ -150,23 +250,26 @@ namespace otto::util {
   template<typename InIter, typename>
   void SoundFile::write_samples(InIter f, InIter l) {
     if constexpr (std::is_pointer_v<InIter>) {
-      ByteFile::write_bytes(reinterpret_cast<std::byte*>(f),
-                            reinterpret_cast<std::byte*>(l));
+      write_block(f, l - f);
     } else {
-      std::for_each(f, l, [&] (Sample s) {
-          ByteFile::write_bytes(sample_to_bytes(s));
-        });
+      write_samples(f, std::distance(f, l));
     }
   }
 
   template<typename InIter, typename>
-  void SoundFile::write_samples(InIter&& i, int n) {
-    if constexpr (std::is_pointer_v<InIter>) {
-      ByteFile::write_bytes(reinterpret_cast<std::byte*>(i), n * sample_size);
+  void SoundFile::write_samples(InIter&& iter, int n) {
+    if constexpr (std::is_pointer_v<std::decay_t<InIter>>) {
+      write_block(iter, n);
     } else {
-      for_each_n(std::forward<InIter>(i), n, [&] (Sample s) {
-          ByteFile::write_bytes(sample_to_bytes(s));
-        });
+      std::array<Sample, iter_block_size> block;
+      auto in = iter;
+      for (int i = 0; i < n; i += block.size()) {
+        int len = std::min<int>(n - i, block.size());
+        for (int j = 0; j < len; j++, in++) {
+          block[j] = *in;
+        }
+        write_block(block.data(), len);
+      }
     }
   }
 }
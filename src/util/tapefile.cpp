@@ -1,4 +1,6 @@
-#include "tapefile.hpp"
+#include "util/tapefile.hpp"
+
+#include "util/algorithm.hpp"
 
 namespace otto::util {
 
@@ -6,8 +8,15 @@ namespace otto::util {
   using SliceData = TapeFile::SliceData;
 
   struct TRCKChunk : Chunk {
+    /// Bytes of the slices of one track
+    static constexpr std::size_t slice_bytes = TapeFile::max_slices * sizeof(SliceData);
+
     uint16_t index = 0;
-    TRCKChunk(uint16_t idx) : Chunk("TRCK"), index (idx) {}
+    TRCKChunk(uint16_t idx) : Chunk("TRCK"), index (idx) {
+      // Known up front, so rewriting the chunk in place never leaves a
+      // wrong size on disk
+      size = bytes<4>::from_u(2 + 2 + slice_bytes);
+    }
     TRCKChunk(const Chunk& c) : Chunk(c) {}
 
     void write_fields(ByteFile& f) override {
@@ -15,7 +24,7 @@ namespace otto::util {
       f.write_bytes(bytes<2>::from_u(index));
       f.write_bytes(bytes<2>::from_u(tf.slices[index].count));
       f.write_bytes((std::byte*) tf.slices[index].array.data(),
-        2048 * sizeof(SliceData));
+        slice_bytes);
     }
 
     void read_fields(ByteFile& f) override {
@@ -23,11 +32,17 @@ namespace otto::util {
       bytes<2> temp;
       f.read_bytes(temp).unwrap_ok();
       index = temp.as_u();
+      // Tracks past the ones of this build are read, and dropped
+      TapeFile::SliceArray dropped;
+      auto& slices = index < tf.slices.size() ? tf.slices[index] : dropped;
       f.read_bytes(temp).unwrap_ok();
-      tf.slices[index].count = temp.as_u();
-      f.read_bytes((std::byte*) tf.slices[index].array.data(),
-        2048 * sizeof(SliceData)).unwrap_ok();
+      slices.count = temp.as_u();
+      f.read_bytes((std::byte*) slices.array.data(),
+        slice_bytes).unwrap_ok();
     }
+
+    /// Bytes the chunk takes in the file, including the chunk header
+    static constexpr std::size_t file_size = 8 + 2 + 2 + slice_bytes;
   };
 
   struct TAPEChunk : Chunk {
@@ -35,9 +50,16 @@ namespace otto::util {
     TAPEChunk() : Chunk("TAPE") {}
     bytes<4> version = {1,0,0,0};
 
-    TRCKChunk tracks[4] = {{0}, {1}, {2}, {3}};
+    std::array<TRCKChunk, TapeFile::tracks> tracks = util::generate_sequence<TapeFile::tracks>(
+      [] (int n) { return TRCKChunk(n); });
+
+    /// Tapes from version 2 on are planar
+    static constexpr int planar_version = 2;
 
     void write_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      tf.slicesOffset = f.position();
+      version = bytes<4>::from_u(tf.planar ? planar_version : 1);
       f.write_bytes(version);
       for (auto&& trck : tracks) {
         trck.write(f);
@@ -45,17 +67,426 @@ namespace otto::util {
     }
 
     void read_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      tf.slicesOffset = f.position();
       f.read_bytes(version).unwrap_ok();
-      for (auto&& trck : tracks) {
+      tf.planar = version.as_u() >= planar_version;
+      // Tapes from builds with another number of tracks have as many TRCK
+      // chunks
+      std::size_t count = (size.as_u() - 4) / TRCKChunk::file_size;
+      for (std::size_t i = 0; i < count; i++) {
+        TRCKChunk trck {std::uint16_t(0)};
         trck.read(f);
       }
     }
   };
 
+  /// Fixed size metadata, so it can be updated in place
+  struct METAChunk : Chunk {
+    METAChunk(const Chunk& c) : Chunk(c) {}
+    METAChunk() : Chunk("META") {}
+    bytes<4> version = {1,0,0,0};
+
+    void write_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      f.write_bytes(version);
+      tf.metadataOffset = f.position();
+      f.write_bytes(bytes<4>::from_u(tf.metadata.generation));
+      f.write_bytes(bytes<4>::from_i(tf.metadata.loop_in));
+      f.write_bytes(bytes<4>::from_i(tf.metadata.loop_out));
+    }
+
+    void read_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      bytes<4> generation, loop_in, loop_out;
+      f.read_bytes(version).unwrap_ok();
+      tf.metadataOffset = f.position();
+      f.read_bytes(generation).unwrap_ok();
+      f.read_bytes(loop_in).unwrap_ok();
+      f.read_bytes(loop_out).unwrap_ok();
+      tf.metadata.generation = generation.as_u();
+      tf.metadata.loop_in = loop_in.as_i();
+      tf.metadata.loop_out = loop_out.as_i();
+      tf.hasMetadata = true;
+    }
+  };
+
+  /// Waveform overviews of all tracks.
+  ///
+  /// Header fields, followed by the points of every level of each track in
+  /// turn. Reading only parses the header, the points are loaded lazily.
+  struct OVRVChunk : Chunk {
+    OVRVChunk(const Chunk& c) : Chunk(c) {}
+    OVRVChunk() : Chunk("OVRV") {}
+    bytes<4> version = {1,0,0,0};
+
+    using Overview = audio::Overview;
+
+    void write_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      auto& ovs = tf.overviews;
+      f.write_bytes(version);
+      f.write_bytes(bytes<4>::from_u(Overview::block_size));
+      f.write_bytes(bytes<4>::from_u(Overview::fanout));
+      f.write_bytes(bytes<4>::from_u(ovs[0].length()));
+      f.write_bytes(bytes<2>::from_u(ovs.size()));
+      tf.overviewOffset = f.position();
+      for (auto&& ov : ovs) {
+        f.write_bytes((std::byte*) ov.points().data(),
+          ov.points().size() * sizeof(Overview::Point));
+      }
+    }
+
+    void read_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      bytes<4> block_size, fanout, length;
+      bytes<2> tracks;
+      f.read_bytes(version).unwrap_ok();
+      f.read_bytes(block_size).unwrap_ok();
+      f.read_bytes(fanout).unwrap_ok();
+      f.read_bytes(length).unwrap_ok();
+      f.read_bytes(tracks).unwrap_ok();
+      if (block_size.as_u() != Overview::block_size
+        || fanout.as_u() != Overview::fanout
+        || tracks.as_u() != tf.overviews.size()) {
+        // Incompatible, will be rebuilt
+        return;
+      }
+      for (auto&& ov : tf.overviews) {
+        ov.resize(length.as_u());
+      }
+      tf.overviewOffset = f.position();
+      tf.overviewLoaded.assign(tf.overviews[0].levels(), false);
+    }
+  };
+
+  /// Decimated audio of all tracks.
+  ///
+  /// Header fields, followed by interleaved 16 bit frames. Reading only
+  /// parses the header, the frames are loaded with <TapeFile::load_spool>.
+  struct SPOLChunk : Chunk {
+    SPOLChunk(const Chunk& c) : Chunk(c) {}
+    SPOLChunk() : Chunk("SPOL") {}
+    bytes<4> version = {1,0,0,0};
+
+    using Spool = audio::DecimatedAudio<TapeFile::tracks>;
+
+    void write_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      auto& frames = tf.spool.frames();
+      f.write_bytes(version);
+      f.write_bytes(bytes<4>::from_u(Spool::factor));
+      f.write_bytes(bytes<4>::from_u(tf.spool.length()));
+      f.write_bytes(bytes<2>::from_u(std::tuple_size_v<Spool::Frame>));
+      tf.spoolOffset = f.position();
+      f.write_bytes((std::byte*) frames.data(), frames.size() * sizeof(Spool::Frame));
+    }
+
+    void read_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      bytes<4> factor, length;
+      bytes<2> tracks;
+      f.read_bytes(version).unwrap_ok();
+      f.read_bytes(factor).unwrap_ok();
+      f.read_bytes(length).unwrap_ok();
+      f.read_bytes(tracks).unwrap_ok();
+      if (factor.as_u() != Spool::factor
+        || tracks.as_u() != std::tuple_size_v<Spool::Frame>) {
+        // Incompatible, will be rebuilt
+        return;
+      }
+      tf.spool.resize(length.as_u());
+      tf.spoolOffset = f.position();
+      tf.hasSpool = true;
+      tf.spoolLoaded = false;
+    }
+  };
+
+  /// Which blocks of audio were ever written
+  ///
+  /// Header fields, followed by one bit per block of each track. The bits
+  /// are stored in place by the owner of the file, so the chunk never
+  /// changes size.
+  struct WMAPChunk : Chunk {
+    WMAPChunk(const Chunk& c) : Chunk(c) {}
+    WMAPChunk() : Chunk("WMAP") {}
+    /// Version 1 had one bit per block, for all tracks
+    bytes<4> version = {2,0,0,0};
+
+    void write_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      f.write_bytes(version);
+      f.write_bytes(bytes<4>::from_u(TapeFile::written_block_size));
+      f.write_bytes(bytes<4>::from_u(tf.written_map.size()));
+      tf.writtenMapOffset = f.position();
+      f.write_bytes((std::byte*) tf.written_map.data(), tf.written_map.size());
+    }
+
+    void read_fields(ByteFile& f) override {
+      auto& tf = dynamic_cast<TapeFile&>(f);
+      bytes<4> block_size, size;
+      f.read_bytes(version).unwrap_ok();
+      f.read_bytes(block_size).unwrap_ok();
+      f.read_bytes(size).unwrap_ok();
+      if (version.as_u() != 2 || block_size.as_u() != TapeFile::written_block_size) {
+        // Incompatible, will be recreated
+        return;
+      }
+      tf.written_map.resize(size.as_u());
+      tf.writtenMapOffset = f.position();
+      f.read_bytes((std::byte*) tf.written_map.data(), tf.written_map.size()).unwrap_ok();
+      tf.hasWrittenMap = true;
+    }
+  };
+
+  void TapeFile::read_file() {
+    overviewOffset = 0;
+    overviewLoaded.clear();
+    for (auto&& ov : overviews) {
+      ov.resize(0);
+    }
+    spoolOffset = 0;
+    hasSpool = false;
+    spoolLoaded = false;
+    spool.resize(0);
+    metadataOffset = 0;
+    hasMetadata = false;
+    metadata = {};
+    writtenMapOffset = 0;
+    hasWrittenMap = false;
+    written_map.clear();
+    // Files without a TAPE chunk of a later version are interleaved
+    planar = false;
+    SoundFile::read_file();
+  }
+
+  void TapeFile::write_file() {
+    // The overview chunk may move, so get everything into memory first
+    for (int l = 0; l < int(overviewLoaded.size()); l++) {
+      load_overview_level(l);
+    }
+    load_spool();
+    SoundFile::write_file();
+  }
+
+  bool TapeFile::has_current_layout() const {
+    return planar && info.channels == tracks;
+  }
+
+  void TapeFile::convert_layout() {
+    if (has_current_layout()) return;
+    Path tmp_path = path;
+    tmp_path += ".tmp";
+    fs::remove(tmp_path);
+    int channels = info.channels;
+    std::size_t frames = length() / channels;
+    int kept = std::min(channels, tracks);
+
+    {
+      TapeFile tmp {info.format};
+      tmp.info = info;
+      tmp.info.channels = tracks;
+      tmp.open(tmp_path);
+      tmp.slices = slices;
+      tmp.metadata = metadata;
+      tmp.hasMetadata = hasMetadata;
+      if (has_overview()) {
+        for (int l = 0; l < int(overviewLoaded.size()); l++) {
+          load_overview_level(l);
+        }
+        tmp.create_overview(overviews[0].length());
+        tmp.overviews = overviews;
+      }
+      if (has_spool()) {
+        load_spool();
+        tmp.create_spool(spool.length());
+        tmp.spool = spool;
+      }
+      tmp.reserve_audio(samples_for(frames));
+      // Empty, so nothing is marked yet
+      tmp.create_written_map(frames);
+
+      std::vector<float> block(block_size * channels);
+      std::vector<float> track(block_size);
+      for (std::size_t b = 0; b * block_size < frames; b++) {
+        auto first = b * block_size;
+        auto n = std::min(block_size, frames - first);
+        if (!planar) {
+          seek(first * channels);
+          read_samples(block.data(), n * channels);
+        }
+        for (int t = 0; t < kept; t++) {
+          if (planar) {
+            seek(sample_index(t, first, channels));
+            read_samples(track.data(), n);
+          } else {
+            for (std::size_t i = 0; i < n; i++) {
+              track[i] = block[i * channels + t];
+            }
+          }
+          bool silent = std::all_of(track.begin(), track.begin() + n,
+            [] (float f) { return f == 0.f; });
+          if (silent) continue;
+          tmp.seek(sample_index(t, first));
+          tmp.write_samples(track.data(), n);
+          tmp.mark_written(t, b);
+        }
+      }
+      tmp.close();
+    }
+
+    close();
+    fs::rename(tmp_path, path);
+    open(path);
+  }
+
+  bool TapeFile::has_overview() const {
+    return !overviewLoaded.empty();
+  }
+
+  void TapeFile::create_overview(std::size_t length) {
+    for (auto&& ov : overviews) {
+      ov.resize(length);
+    }
+    overviewOffset = 0;
+    overviewLoaded.assign(overviews[0].levels(), true);
+  }
+
+  bool TapeFile::overview_level_loaded(int level) const {
+    return level < int(overviewLoaded.size()) && overviewLoaded[level];
+  }
+
+  void TapeFile::load_overview_level(int level) {
+    if (level >= int(overviewLoaded.size()) || overviewLoaded[level]) return;
+    if (overviewOffset != 0) {
+      using Point = audio::Overview::Point;
+      for (std::size_t t = 0; t < overviews.size(); t++) {
+        auto& ov = overviews[t];
+        auto lvl = ov.level(level);
+        ByteFile::seek(overviewOffset
+          + (t * ov.points().size() + ov.level_offset(level)) * sizeof(Point));
+        ByteFile::read_bytes((std::byte*) lvl.data(), lvl.size() * sizeof(Point))
+          .unwrap_ok();
+      }
+    }
+    overviewLoaded[level] = true;
+  }
+
+  void TapeFile::store_overview(std::size_t first, std::size_t last) {
+    if (overviewOffset == 0) return;
+    using Point = audio::Overview::Point;
+    for (int l = 0; l < int(overviewLoaded.size()); l++) {
+      if (!overviewLoaded[l]) continue;
+      for (std::size_t t = 0; t < overviews.size(); t++) {
+        auto& ov = overviews[t];
+        auto fpp = ov.frames_per_point(l);
+        std::size_t p0 = first / fpp;
+        std::size_t p1 = std::min<std::size_t>((last + fpp - 1) / fpp, ov.level(l).size());
+        if (p0 >= p1) continue;
+        ByteFile::seek(overviewOffset
+          + (t * ov.points().size() + ov.level_offset(l) + p0) * sizeof(Point));
+        ByteFile::write_bytes((std::byte*) (ov.level(l).data() + p0),
+          (p1 - p0) * sizeof(Point));
+      }
+    }
+  }
+
+  bool TapeFile::has_spool() const {
+    return hasSpool;
+  }
+
+  void TapeFile::create_spool(std::size_t length) {
+    spool.resize(length);
+    spoolOffset = 0;
+    hasSpool = true;
+    spoolLoaded = true;
+  }
+
+  bool TapeFile::spool_loaded() const {
+    return spoolLoaded;
+  }
+
+  void TapeFile::load_spool() {
+    if (!hasSpool || spoolLoaded) return;
+    auto& frames = spool.frames();
+    ByteFile::seek(spoolOffset);
+    ByteFile::read_bytes((std::byte*) frames.data(),
+      frames.size() * sizeof(decltype(spool)::Frame)).unwrap_ok();
+    spoolLoaded = true;
+  }
+
+  void TapeFile::store_spool(std::size_t first, std::size_t last) {
+    if (spoolOffset == 0 || !spoolLoaded) return;
+    using Frame = decltype(spool)::Frame;
+    last = std::min(last, spool.frames().size());
+    if (first >= last) return;
+    ByteFile::seek(spoolOffset + first * sizeof(Frame));
+    ByteFile::write_bytes((std::byte*) (spool.frames().data() + first),
+      (last - first) * sizeof(Frame));
+  }
+
+  void TapeFile::store_slices() {
+    if (slicesOffset == 0) return;
+    ByteFile::seek(slicesOffset);
+    TAPEChunk().write_fields(*this);
+  }
+
+  bool TapeFile::has_written_map() const {
+    return hasWrittenMap;
+  }
+
+  void TapeFile::create_written_map(std::size_t length) {
+    std::size_t blocks = (length + written_block_size - 1) / written_block_size;
+    written_map.assign((blocks * tracks + 7) / 8, 0);
+    auto block_bytes = written_block_size * tracks * sample_size();
+    for (auto [first, last] : data_extents(audioOffset, blocks * block_bytes)) {
+      std::size_t b0 = (first - audioOffset) / block_bytes;
+      std::size_t b1 = std::min(blocks, (last - audioOffset + block_bytes - 1) / block_bytes);
+      for (auto b = b0; b < b1; b++) {
+        for (int t = 0; t < tracks; t++) {
+          mark_written(t, b);
+        }
+      }
+    }
+    writtenMapOffset = 0;
+    hasWrittenMap = true;
+  }
+
+  ByteFile::Position TapeFile::written_map_offset() const {
+    return writtenMapOffset;
+  }
+
+  bool TapeFile::has_metadata() const {
+    return hasMetadata;
+  }
+
+  void TapeFile::create_metadata() {
+    metadataOffset = 0;
+    hasMetadata = true;
+  }
+
+  void TapeFile::store_metadata() {
+    if (metadataOffset == 0) return;
+    ByteFile::seek(metadataOffset);
+    ByteFile::write_bytes(bytes<4>::from_u(metadata.generation));
+    ByteFile::write_bytes(bytes<4>::from_i(metadata.loop_in));
+    ByteFile::write_bytes(bytes<4>::from_i(metadata.loop_out));
+  }
+
   void TapeFile::add_custom_chunks(std::vector<std::unique_ptr<Chunk>>& v) {
     v.push_back(std::make_unique<TAPEChunk>());
   }
+  void TapeFile::add_trailing_chunks(std::vector<std::unique_ptr<Chunk>>& v) {
+    if (has_overview()) v.push_back(std::make_unique<OVRVChunk>());
+    if (has_spool()) v.push_back(std::make_unique<SPOLChunk>());
+    if (has_metadata()) v.push_back(std::make_unique<METAChunk>());
+    if (has_written_map()) v.push_back(std::make_unique<WMAPChunk>());
+  }
   void TapeFile::replace_custom_chunk(std::unique_ptr<Chunk>& ptr) {
     if (ptr->id == "TAPE") ptr = std::make_unique<TAPEChunk>(*ptr);
+    if (ptr->id == "OVRV") ptr = std::make_unique<OVRVChunk>(*ptr);
+    if (ptr->id == "SPOL") ptr = std::make_unique<SPOLChunk>(*ptr);
+    if (ptr->id == "META") ptr = std::make_unique<METAChunk>(*ptr);
+    if (ptr->id == "WMAP") ptr = std::make_unique<WMAPChunk>(*ptr);
   }
 }
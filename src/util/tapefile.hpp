@@ -1,35 +1,239 @@
+#pragma once
+
+#include "util/audio.hpp"
 #include "util/soundfile.hpp"
+#include "util/overview.hpp"
+#include "util/decimated.hpp"
 
 namespace otto::util {
 
+  /// The tape: audio of all tracks, and the slices, overviews and other
+  /// data that go with it
+  ///
+  /// The audio is planar. It is stored in blocks of <block_size> frames,
+  /// each holding the block's samples of the first track, then of the
+  /// second, and so on, so each track can be read and written on its own.
+  /// Use <sample_index> to find a sample. Tapes from before this are
+  /// interleaved until converted with <convert_layout>.
   class TapeFile : public SoundFile {
   public:
     using SoundFile::Info;
 
+    static constexpr int tracks = audio::tape_tracks;
+
+    /// Frames in each block of the planar layout
+    static constexpr std::size_t block_size = 1 << 12;
+
     struct SliceData {
       uint32_t in = 0;
       uint32_t out = 0;
     };
 
+    /// The number of slices stored per track
+    static constexpr std::size_t max_slices = 2048;
+
     struct SliceArray {
-      std::array<SliceData, 2048> array;
+      std::array<SliceData, max_slices> array;
       uint16_t count = 0;
     };
 
-    std::array<SliceArray, 4> slices;
+    std::array<SliceArray, tracks> slices;
+
+    /// Small, fixed size state stored with the tape
+    struct Metadata {
+      /// Incremented every time the slices and metadata are stored. A journal
+      /// of later edits refers to this.
+      uint32_t generation = 0;
+      int32_t loop_in = -1;
+      int32_t loop_out = -1;
+    } metadata;
+
+    /// Waveform overviews of each track
+    ///
+    /// Stored in a chunk after the audio data. When a file is opened, only
+    /// the chunk header is read, and levels are loaded on demand with
+    /// <load_overview_level>.
+    std::array<audio::Overview, tracks> overviews;
 
-    TapeFile()
+    /// Decimated copy of all tracks, for spooling
+    ///
+    /// Stored in a chunk after the audio data, and loaded in full with
+    /// <load_spool>. It is small enough to keep in memory.
+    audio::DecimatedAudio<tracks> spool;
+
+    /// Frames in each block of <written_map>. The same as the blocks of the
+    /// planar layout, so each bit covers one contiguous range of samples.
+    static constexpr std::size_t written_block_size = block_size;
+
+    /// Which blocks of <written_block_size> frames of each track were ever
+    /// written, one bit each, lowest first, with the tracks of a block next
+    /// to each other. See <written>. Blocks that were not are silent, so
+    /// reading them can be skipped.
+    ///
+    /// Stored in a chunk after the audio data. Once that is on disk, changes
+    /// are stored in place by the owner, at <written_map_offset>.
+    std::vector<std::uint8_t> written_map;
+
+    /// \param format How a new file stores samples. Existing files keep
+    ///               their format.
+    explicit TapeFile(SampleFormat format = SampleFormat::Float32)
     {
-      info.channels = 4;
+      info.channels = tracks;
+      info.format = format;
+      audio_alignment = 4096;
     }
 
     virtual ~TapeFile() = default;
 
+    void read_file() override;
+    void write_file() override;
+
+    /// Whether the audio is in the planar layout. New files are, unless
+    /// this is cleared before creating them.
+    bool planar = true;
+
+    /// Whether the audio is planar, with <tracks> tracks
+    bool has_current_layout() const;
+
+    /// Convert a tape that is interleaved, or has another number of tracks,
+    /// to the planar layout with <tracks> tracks
+    ///
+    /// The audio is copied to a new file, which then replaces this one, so
+    /// the old tape stays intact until the new one is complete. Blocks of a
+    /// track that are silent are left unwritten in the written map. Tracks
+    /// past <tracks> are dropped, and new ones are silent.
+    ///
+    /// Does nothing if the tape has the current layout already.
+    void convert_layout();
+
+    /// The sample of `track` at `frame` in the planar layout, as an index
+    /// into the audio data of a tape with `track_count` tracks
+    ///
+    /// Samples of one track are contiguous within a block of <block_size>
+    /// frames.
+    static Position sample_index(int track, Position frame, int track_count = tracks)
+    {
+      return (frame / block_size * track_count + track) * block_size + frame % block_size;
+    }
+
+    /// Samples of audio data that hold `frames` frames in the planar
+    /// layout. A whole number of blocks.
+    static Position samples_for(Position frames)
+    {
+      return (frames + block_size - 1) / block_size * block_size * tracks;
+    }
+
+    /// Whether the file has overviews, either from disk or <create_overview>
+    bool has_overview() const;
+
+    /// Reset the overviews to cover `length` frames of silence
+    ///
+    /// They are written to disk with the next header write.
+    void create_overview(std::size_t length);
+
+    bool overview_level_loaded(int level) const;
+
+    /// Read `level` of all tracks' overviews from disk
+    void load_overview_level(int level);
+
+    /// Write the points covering frames `[first, last)` of all tracks'
+    /// overviews to disk. Only the loaded levels are written.
+    ///
+    /// Does nothing if the overviews have not been written to disk yet.
+    void store_overview(std::size_t first, std::size_t last);
+
+    /// Whether the file has spool data, either from disk or <create_spool>
+    bool has_spool() const;
+
+    /// Reset the spool data to cover `length` frames of silence
+    ///
+    /// It is written to disk with the next header write.
+    void create_spool(std::size_t length);
+
+    bool spool_loaded() const;
+
+    /// Read the spool data from disk
+    void load_spool();
+
+    /// Write frames `[first, last)` of <spool> to disk
+    ///
+    /// These are indices into `spool.frames()`, as returned by
+    /// `spool.update()`. Does nothing if the spool data has not been written
+    /// to disk yet.
+    void store_spool(std::size_t first, std::size_t last);
+
+    /// Write <slices> to disk in place, without rewriting the header
+    void store_slices();
+
+    /// Whether the file has a written map, either from disk or
+    /// <create_written_map>
+    bool has_written_map() const;
+
+    /// Make a written map covering `length` frames
+    ///
+    /// Blocks that hold data according to the filesystem are marked for all
+    /// tracks, so tapes from before the map keep their audio. It is written
+    /// to disk with the next header write.
+    void create_written_map(std::size_t length);
+
+    /// Whether block `block` of `track` is marked in <written_map>
+    bool written(int track, std::size_t block) const
+    {
+      auto bit = block * tracks + track;
+      return bit / 8 < written_map.size() && (written_map[bit / 8] & (1 << (bit % 8)));
+    }
+
+    /// Mark block `block` of `track` in <written_map>
+    void mark_written(int track, std::size_t block)
+    {
+      auto bit = block * tracks + track;
+      if (bit / 8 < written_map.size()) written_map[bit / 8] |= 1 << (bit % 8);
+    }
+
+    /// File offset of the first byte of <written_map>, or `0` if it is not
+    /// on disk
+    ByteFile::Position written_map_offset() const;
+
+    /// Whether the file has a metadata chunk, either from disk or
+    /// <create_metadata>
+    bool has_metadata() const;
+
+    /// Add a metadata chunk, which is written with the next header write
+    void create_metadata();
+
+    /// Write <metadata> to disk in place, without rewriting the header.
+    /// Does nothing if the chunk has not been written to disk yet.
+    void store_metadata();
+
   protected:
 
     void add_custom_chunks(std::vector<std::unique_ptr<Chunk>>& v) override;
+    void add_trailing_chunks(std::vector<std::unique_ptr<Chunk>>& v) override;
     void replace_custom_chunk(std::unique_ptr<Chunk>& ptr) override;
 
+    friend struct OVRVChunk;
+    friend struct SPOLChunk;
+    friend struct TAPEChunk;
+    friend struct METAChunk;
+    friend struct WMAPChunk;
+
+    /// File offset of the first overview point, or `0` if not on disk
+    ByteFile::Position overviewOffset = 0;
+    std::vector<bool> overviewLoaded;
+
+    /// File offset of the first spool frame, or `0` if not on disk
+    ByteFile::Position spoolOffset = 0;
+    bool hasSpool = false;
+    bool spoolLoaded = false;
+
+    /// File offset of the fields of the TAPE chunk
+    ByteFile::Position slicesOffset = 0;
+    /// File offset of the fields of the META chunk, or `0` if not on disk
+    ByteFile::Position metadataOffset = 0;
+    bool hasMetadata = false;
+    /// File offset of the written map, or `0` if not on disk
+    ByteFile::Position writtenMapOffset = 0;
+    bool hasWrittenMap = false;
   };
 
 }
@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <fstream>
 #include <functional>
+#include <mutex>
+#include <unordered_map>
 
 #include <json.hpp>
 #include "filesystem.hpp"
@@ -94,15 +96,26 @@ namespace otto::util::timer {
   };
 
   struct TimerDispatcher {
+    /// Only touch through <timer>, which holds <mutex>
     std::unordered_map<std::string, Timer> timers;
-    fs::path path = Globals::data_dir / "timers.json";
+    std::mutex mutex;
 
     virtual ~TimerDispatcher() {}
 
+    /// The timer called `name`, added if it isn't there yet
+    ///
+    /// Safe to call from any thread. The reference stays valid as other
+    /// timers are added, so callers on the audio thread should look it up
+    /// once and keep it, like <TIME_SCOPE> does.
+    Timer& timer(const std::string& name) {
+      std::lock_guard lock(mutex);
+      return timers[name];
+    }
+
     /// Time a call to function `f`
     template<typename Callable, typename... Args>
     auto timedCall(const std::string& name, Callable&& f, Args... args) {
-      Timer& timer = timers[name];
+      Timer& timer = this->timer(name);
       timer.startTimer();
       auto&& ret = std::invoke(std::forward<Callable>(f), std::forward<Args>(args)...);
       timer.stopTimer();
@@ -110,10 +123,11 @@ namespace otto::util::timer {
     }
 
     ScopeTimer timeScope(const std::string& name) {
-      return ScopeTimer(timers[name]);
+      return ScopeTimer(timer(name));
     }
 
     nlohmann::json jsonSerialize() {
+      std::lock_guard lock(mutex);
       nlohmann::json output = nlohmann::json::object();
       for (auto&& [n, t] : timers) {
         output[n] = t.jsonSerialize();
@@ -122,7 +136,7 @@ namespace otto::util::timer {
     }
 
     void writeToFile() {
-      std::ofstream stream(path, std::ios::trunc);
+      std::ofstream stream(Globals::data_dir / "timers.json", std::ios::trunc);
       stream << std::setw(2) << jsonSerialize() << std::endl;
       stream.close();
     }
@@ -132,11 +146,11 @@ namespace otto::util::timer {
   struct GlobalTimerDispatcher : public TimerDispatcher {
 
     GlobalTimerDispatcher() : TimerDispatcher() {
-      timers["Program time"].startTimer();
+      timer("Program time").startTimer();
     }
 
     ~GlobalTimerDispatcher() {
-      timers["Program time"].stopTimer();
+      timer("Program time").stopTimer();
       writeToFile();
     }
   };
@@ -145,4 +159,14 @@ namespace otto::util::timer {
 
 } // otto::util::timer
 
-#define TIME_SCOPE(name) auto timer = ::otto::util::timer::dispatcher.timeScope(name);
+/// Time the rest of the scope, under the timer called `name`
+///
+/// The timer is looked up once per call site, so the lock in
+/// <TimerDispatcher::timer> is only taken the first time through.
+#define TIME_SCOPE(name)                                            \
+  ::otto::util::timer::ScopeTimer timer {                           \
+    [] () -> ::otto::util::timer::Timer& {                          \
+      static auto& t = ::otto::util::timer::dispatcher.timer(name); \
+      return t;                                                     \
+    }()                                                             \
+  };
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+namespace otto::util::audio {
+
+  /// How to read between frames when playing at non-integer speeds
+  enum class Interpolation {
+    /// Truncate to the previous frame
+    None,
+    /// Linear interpolation between the two nearest frames
+    Linear,
+    /// 4-point Catmull-Rom spline
+    Cubic,
+  };
+
+  /// A fixed point position in frames, with 32 fractional bits
+  using Phase = std::int64_t;
+
+  constexpr int phase_bits = 32;
+  constexpr Phase phase_one = Phase(1) << phase_bits;
+  constexpr Phase phase_fract_mask = phase_one - 1;
+
+  /// The phase increment per frame when playing at `speed`
+  inline Phase phase_step(float speed)
+  {
+    return std::llround(double(speed) * phase_one);
+  }
+
+  /// The whole frame part of `p`, rounded towards negative infinity
+  constexpr std::int64_t phase_frames(Phase p)
+  {
+    return p >> phase_bits;
+  }
+
+  inline float phase_fract(Phase p)
+  {
+    return float(p & phase_fract_mask) * (1.f / phase_one);
+  }
+
+  namespace detail {
+
+    /// Frames needed before and after the read position
+    template<Interpolation I>
+    constexpr int taps_before = I == Interpolation::Cubic ? 1 : 0;
+    template<Interpolation I>
+    constexpr int taps_after = I == Interpolation::Cubic ? 2
+      : I == Interpolation::Linear ? 1 : 0;
+
+    /// Interpolate between `x[1]` and `x[2]`, which are one channel, or a
+    /// vector of channels. Cubic interpolation also reads `x[0]` and `x[3]`.
+    ///
+    /// Vectors only go through references, since passing them by value
+    /// changes the ABI when they are wider than the instruction set enabled.
+    template<Interpolation I, typename T>
+    inline void interpolate_taps(const T (&x)[4], float t, T& out)
+    {
+      if constexpr (I == Interpolation::Linear) {
+        out = x[1] + (x[2] - x[1]) * t;
+      } else {
+        T c1 = 0.5f * (x[2] - x[0]);
+        T c2 = x[0] + 2.f * x[2] - (2.5f * x[1] + 0.5f * x[3]);
+        T c3 = 0.5f * (x[3] - x[0]) + 1.5f * (x[1] - x[2]);
+        out = ((c3 * t + c2) * t + c1) * t + x[1];
+      }
+    }
+
+    /// The vector type of `N` floats, if the compiler has one. Frames of 4, 8
+    /// or 16 channels are interpolated as vectors, so more tracks cost less
+    /// than proportionally more time.
+    template<std::size_t N>
+    struct float_vector {
+      static constexpr bool valid = false;
+    };
+#if defined(__GNUC__)
+    // Spelled out for each size, since the attribute is not applied to
+    // dependent sizes.
+    template<>
+    struct float_vector<4> {
+      static constexpr bool valid = true;
+      typedef float type __attribute__((vector_size(16)));
+    };
+    template<>
+    struct float_vector<8> {
+      static constexpr bool valid = true;
+      typedef float type __attribute__((vector_size(32)));
+    };
+    template<>
+    struct float_vector<16> {
+      static constexpr bool valid = true;
+      typedef float type __attribute__((vector_size(64)));
+    };
+#endif
+
+    /// Interpolate around `at[0]`. Cubic interpolation reads `at[-1]` to
+    /// `at[2]`, linear reads `at[0]` and `at[1]`.
+    template<Interpolation I, std::size_t N>
+    inline void interpolate(const std::array<float, N>* at, float t,
+      std::array<float, N>& out)
+    {
+      constexpr int first = 1 - taps_before<I>;
+      constexpr int last = 1 + taps_after<I>;
+      if constexpr (I == Interpolation::None) {
+        out = at[0];
+      } else if constexpr (float_vector<N>::valid) {
+        using V = typename float_vector<N>::type;
+        static_assert(sizeof(V) == sizeof(out));
+        V x[4], r;
+        for (int k = first; k <= last; k++) {
+          std::memcpy(&x[k], at[k - 1].data(), sizeof(V));
+        }
+        interpolate_taps<I>(x, t, r);
+        std::memcpy(out.data(), &r, sizeof(V));
+      } else {
+        for (std::size_t c = 0; c < N; c++) {
+          float x[4];
+          for (int k = first; k <= last; k++) x[k] = at[k - 1][c];
+          interpolate_taps<I>(x, t, out[c]);
+        }
+      }
+    }
+
+    /// The inner loop. All frames touched must be inside `src`
+    template<Interpolation I, std::size_t N>
+    void read_contiguous(const std::array<float, N>* src, Phase p, Phase step,
+      std::array<float, N>* dst, int n)
+    {
+      for (int i = 0; i < n; i++, p += step) {
+        interpolate<I>(src + phase_frames(p), phase_fract(p), dst[i]);
+      }
+    }
+
+    template<Interpolation I, std::size_t N>
+    void read_ring(const std::array<float, N>* ring, std::size_t size, Phase p,
+      Phase step, std::array<float, N>* dst, int n)
+    {
+      const std::int64_t mask = size - 1;
+      const Phase ring_mask = (Phase(size) << phase_bits) - 1;
+      // Range of indices where all taps are inside the ring
+      const std::int64_t lo = taps_before<I>;
+      const std::int64_t hi = std::int64_t(size) - taps_after<I>;
+
+      while (n > 0) {
+        p &= ring_mask;
+        std::int64_t idx = phase_frames(p);
+        int k = 1;
+        if (idx >= lo && idx < hi) {
+          // The number of frames before the taps reach the edge of the ring
+          std::int64_t len = n;
+          if (step > 0) {
+            len = ((hi << phase_bits) - p + step - 1) / step;
+          } else if (step < 0) {
+            len = (p - (lo << phase_bits)) / -step + 1;
+          }
+          k = std::clamp<std::int64_t>(len, 1, n);
+          read_contiguous<I>(ring, p, step, dst, k);
+        } else {
+          // Straddling the wrap point, gather the taps one by one
+          std::array<float, N> taps[4];
+          for (int t = 0; t < 4; t++) {
+            taps[t] = ring[(idx + t - 1) & mask];
+          }
+          interpolate<I>(taps + 1, phase_fract(p), *dst);
+        }
+        p += k * step;
+        dst += k;
+        n -= k;
+      }
+    }
+  }
+
+  /// Read `n` frames at variable speed from a ring buffer
+  ///
+  /// `ring` holds `size` frames, and `size` must be a power of two. Output
+  /// frame `i` is read from position `start + i * step`, wrapped into the
+  /// ring. The ring is processed as contiguous spans, so the inner loop
+  /// never has to wrap indices.
+  ///
+  /// Speeds of exactly `1` and `-1` at whole frame positions are plain
+  /// (reversed) copies.
+  template<std::size_t N>
+  void varispeed_read(const std::array<float, N>* ring, std::size_t size,
+    Phase start, Phase step, std::array<float, N>* dst, int n,
+    Interpolation interp = Interpolation::Linear)
+  {
+    const std::int64_t mask = size - 1;
+    if ((start & phase_fract_mask) == 0 && (step == phase_one || step == -phase_one)) {
+      std::int64_t idx = phase_frames(start) & mask;
+      while (n > 0) {
+        if (step > 0) {
+          int k = std::min<std::int64_t>(n, size - idx);
+          std::copy_n(ring + idx, k, dst);
+          idx = (idx + k) & mask;
+          dst += k;
+          n -= k;
+        } else {
+          int k = std::min<std::int64_t>(n, idx + 1);
+          std::reverse_copy(ring + idx + 1 - k, ring + idx + 1, dst);
+          idx = (idx - k) & mask;
+          dst += k;
+          n -= k;
+        }
+      }
+      return;
+    }
+
+    switch (interp) {
+    case Interpolation::None:
+      detail::read_ring<Interpolation::None>(ring, size, start, step, dst, n);
+      break;
+    case Interpolation::Linear:
+      detail::read_ring<Interpolation::Linear>(ring, size, start, step, dst, n);
+      break;
+    case Interpolation::Cubic:
+      detail::read_ring<Interpolation::Cubic>(ring, size, start, step, dst, n);
+      break;
+    }
+  }
+
+  /// <varispeed_read> for a ring of single samples, like one track of a
+  /// planar buffer
+  inline void varispeed_read(const float* ring, std::size_t size,
+    Phase start, Phase step, float* dst, int n,
+    Interpolation interp = Interpolation::Linear)
+  {
+    using Mono = std::array<float, 1>;
+    static_assert(sizeof(Mono) == sizeof(float));
+    varispeed_read(reinterpret_cast<const Mono*>(ring), size, start, step,
+      reinterpret_cast<Mono*>(dst), n, interp);
+  }
+
+  namespace detail {
+
+    template<Interpolation I, std::size_t N>
+    void read_planar(const std::array<const float*, N>& rings, std::size_t size,
+      Phase p, Phase step, std::array<float, N>* dst, int n)
+    {
+      const std::int64_t mask = size - 1;
+      constexpr int first = -taps_before<I>;
+      constexpr int last = taps_after<I>;
+      for (int i = 0; i < n; i++, p += step) {
+        std::int64_t idx = phase_frames(p);
+        std::array<float, N> taps[4];
+        for (int t = first; t <= last; t++) {
+          std::int64_t at = (idx + t) & mask;
+          for (std::size_t c = 0; c < N; c++) {
+            taps[t + 1][c] = rings[c][at];
+          }
+        }
+        interpolate<I>(taps + 1, phase_fract(p), dst[i]);
+      }
+    }
+  }
+
+  /// <varispeed_read> from a planar ring buffer, with a ring for each
+  /// channel, into interleaved frames
+  ///
+  /// The position and the interpolation weights are worked out once for all
+  /// channels, and the taps are gathered into frames, so the interpolation
+  /// itself runs across channels like in the interleaved case.
+  template<std::size_t N>
+  void varispeed_read(const std::array<const float*, N>& rings, std::size_t size,
+    Phase start, Phase step, std::array<float, N>* dst, int n,
+    Interpolation interp = Interpolation::Linear)
+  {
+    const std::int64_t mask = size - 1;
+    if ((start & phase_fract_mask) == 0 && (step == phase_one || step == -phase_one)) {
+      std::int64_t idx = phase_frames(start);
+      int dir = step > 0 ? 1 : -1;
+      for (std::size_t c = 0; c < N; c++) {
+        const float* ring = rings[c];
+        for (int i = 0; i < n; i++) {
+          dst[i][c] = ring[(idx + dir * i) & mask];
+        }
+      }
+      return;
+    }
+
+    switch (interp) {
+    case Interpolation::None:
+      detail::read_planar<Interpolation::None>(rings, size, start, step, dst, n);
+      break;
+    case Interpolation::Linear:
+      detail::read_planar<Interpolation::Linear>(rings, size, start, step, dst, n);
+      break;
+    case Interpolation::Cubic:
+      detail::read_planar<Interpolation::Cubic>(rings, size, start, step, dst, n);
+      break;
+    }
+  }
+
+  namespace detail {
+
+    template<Interpolation I, std::size_t N>
+    void mix_contiguous(std::array<float, N>* dst, int n, const float* src,
+      int src_n, Phase p, Phase step, int channel, float gain)
+    {
+      const std::int64_t last = src_n - 1;
+      for (int i = 0; i < n; i++, p += step) {
+        std::int64_t idx = std::min(phase_frames(p), last);
+        float t = phase_fract(p);
+        float x0 = src[idx];
+        float v = x0;
+        if constexpr (I == Interpolation::Linear) {
+          float x1 = src[std::min(idx + 1, last)];
+          v = x0 + (x1 - x0) * t;
+        } else if constexpr (I == Interpolation::Cubic) {
+          float xm1 = src[std::max<std::int64_t>(idx - 1, 0)];
+          float x1 = src[std::min(idx + 1, last)];
+          float x2 = src[std::min(idx + 2, last)];
+          float c1 = 0.5f * (x1 - xm1);
+          float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+          float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+          v = ((c3 * t + c2) * t + c1) * t + x0;
+        }
+        dst[i][channel] += v * gain;
+      }
+    }
+
+    template<Interpolation I, std::size_t N>
+    void mix_ring(std::array<float, N>* ring, std::size_t size, std::int64_t pos,
+      int n, const float* src, int src_n, Phase step, int channel, float gain)
+    {
+      std::int64_t idx = pos & (size - 1);
+      Phase p = 0;
+      while (n > 0) {
+        int k = std::min<std::int64_t>(n, size - idx);
+        mix_contiguous<I>(ring + idx, k, src, src_n, p, step, channel, gain);
+        p += k * step;
+        idx = 0;
+        n -= k;
+      }
+    }
+  }
+
+  /// Mix mono audio into one channel of a ring buffer at variable speed
+  ///
+  /// Adds `src`, scaled by `gain`, to channel `channel` of the `n` frames
+  /// starting at position `pos` in `ring` (`size` frames, a power of two).
+  /// Ring frame `pos + i` gets the source sample at position `i * step`.
+  /// `src` holds `src_n` samples, and reads past the end repeat the last one.
+  template<std::size_t N>
+  void varispeed_mix(std::array<float, N>* ring, std::size_t size,
+    std::int64_t pos, int n, const float* src, int src_n, Phase step,
+    int channel, float gain, Interpolation interp = Interpolation::Linear)
+  {
+    if (n <= 0 || src_n <= 0) return;
+    if (step == phase_one) interp = Interpolation::None;
+    switch (interp) {
+    case Interpolation::None:
+      detail::mix_ring<Interpolation::None>(ring, size, pos, n, src, src_n,
+        step, channel, gain);
+      break;
+    case Interpolation::Linear:
+      detail::mix_ring<Interpolation::Linear>(ring, size, pos, n, src, src_n,
+        step, channel, gain);
+      break;
+    case Interpolation::Cubic:
+      detail::mix_ring<Interpolation::Cubic>(ring, size, pos, n, src, src_n,
+        step, channel, gain);
+      break;
+    }
+  }
+
+  /// <varispeed_mix> for a ring of single samples, like one track of a
+  /// planar buffer. The writes are contiguous.
+  inline void varispeed_mix(float* ring, std::size_t size, std::int64_t pos,
+    int n, const float* src, int src_n, Phase step, float gain,
+    Interpolation interp = Interpolation::Linear)
+  {
+    using Mono = std::array<float, 1>;
+    varispeed_mix(reinterpret_cast<Mono*>(ring), size, pos, n, src, src_n,
+      step, 0, gain, interp);
+  }
+
+}
@@ -0,0 +1,122 @@
+#include "util/worker-pool.hpp"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+#include <plog/Log.h>
+
+namespace otto::util {
+
+  namespace {
+    /// Tell the core we are spinning, so a sibling hyperthread can go ahead
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+      asm volatile("yield");
+#endif
+    }
+  }
+
+  worker_pool::worker_pool(Options opts) : options (opts)
+  {
+    int workers = options.workers;
+    if (workers < 0) {
+      workers = std::max<int>(std::thread::hardware_concurrency(), 1) - 1;
+    }
+    workers = std::min(workers, max_tasks - 1);
+    threads.reserve(workers);
+    for (int i = 0; i < workers; i++) {
+      threads.emplace_back([this] { worker_routine(); });
+    }
+  }
+
+  worker_pool::~worker_pool()
+  {
+    stopping = true;
+    for (std::size_t i = 0; i < threads.size(); i++) {
+      wakeup.post();
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  void worker_pool::run_tasks(const Task* tasks, int n)
+  {
+    std::copy(tasks, tasks + n, slots.begin());
+    remaining.store(n, std::memory_order_relaxed);
+    std::uint32_t round = round_of(state.load(std::memory_order_relaxed)) + 1;
+    // Publishes the slots. Paired with the load of `state` in
+    // <worker_routine> after a worker counts itself as sleeping, so either
+    // the worker sees this round, or we see the worker.
+    state.store(pack(round, 0, n));
+    int asleep = std::min(sleeping.load(), n - 1);
+    for (int i = 0; i < asleep; i++) {
+      wakeup.post();
+    }
+
+    while (run_one(round));
+    // Only tasks already running are left. Spin on them, but let other
+    // threads have the core if they take long, in case one of them is on it.
+    for (int spins = 0; remaining.load(std::memory_order_acquire) > 0; spins++) {
+      if (spins < 1000) {
+        cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  bool worker_pool::run_one(std::uint32_t round)
+  {
+    auto s = state.load(std::memory_order_acquire);
+    int task;
+    do {
+      task = next_of(s);
+      if (round_of(s) != round || task >= count_of(s)) return false;
+    } while (!state.compare_exchange_weak(s, pack(round, task + 1, count_of(s)),
+        std::memory_order_acq_rel));
+
+    // The slot stays put until `remaining` reaches 0
+    auto& t = slots[task];
+    t.call(t.data);
+    remaining.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  void worker_pool::worker_routine()
+  {
+    if (options.priority > 0) {
+      sched_param param = {};
+      param.sched_priority = options.priority;
+      if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        LOGW << "Could not run an audio worker with SCHED_FIFO";
+      }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    // Rounds start at 1, so a worker that starts late still joins the first
+    std::uint32_t seen = 0;
+    while (!stopping) {
+      auto spin_until = Clock::now() + options.spin;
+      while (round_of(state.load(std::memory_order_acquire)) == seen && !stopping) {
+        if (Clock::now() < spin_until) {
+          cpu_relax();
+          continue;
+        }
+        sleeping.fetch_add(1);
+        if (round_of(state.load()) == seen && !stopping) {
+          wakeup.wait();
+        }
+        sleeping.fetch_sub(1);
+        spin_until = Clock::now() + options.spin;
+      }
+      seen = round_of(state.load(std::memory_order_acquire));
+      while (run_one(seen));
+    }
+  }
+
+}
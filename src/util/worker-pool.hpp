@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/semaphore.hpp"
+
+namespace otto::util {
+
+  /// A fixed set of threads that run a few tasks at once, for the audio thread
+  ///
+  /// <run> hands its tasks to the workers, runs what they haven't picked up
+  /// itself, and returns when all of them are done. Handing out tasks is a
+  /// compare-and-swap per task, and nothing allocates or locks, so it can be
+  /// called every cycle.
+  ///
+  /// Between calls, workers spin for a short while, in case the next call
+  /// comes soon, and then sleep on a <semaphore>. With no workers, or on a
+  /// single core, <run> just calls the tasks in order.
+  class worker_pool {
+  public:
+
+    /// The most tasks one call to <run> takes
+    static constexpr int max_tasks = 16;
+
+    struct Options {
+      /// Threads besides the calling one. `-1` for one per extra core.
+      int workers = -1;
+      /// `SCHED_FIFO` priority of the workers. `0` to leave them be.
+      int priority = 0;
+      /// How long workers spin waiting for tasks before they sleep
+      std::chrono::microseconds spin {50};
+    };
+
+    worker_pool() : worker_pool(Options{}) {}
+    explicit worker_pool(Options);
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    /// The number of worker threads
+    int workers() const { return threads.size(); }
+
+    /// Call each of `tasks` once, in parallel, and wait for them all
+    ///
+    /// Tasks must not throw, and must not call <run> themselves. Only one
+    /// thread may call <run> at a time.
+    template<typename... Tasks>
+    void run(Tasks&&... tasks)
+    {
+      static_assert(sizeof...(Tasks) <= max_tasks, "Too many tasks for one run");
+      if (threads.empty() || sizeof...(Tasks) == 1) {
+        (tasks(), ...);
+        return;
+      }
+      std::array<Task, sizeof...(Tasks)> list = {Task{
+          [] (void* f) { (*static_cast<std::remove_reference_t<Tasks>*>(f))(); },
+          const_cast<void*>(static_cast<const void*>(&tasks))}...};
+      run_tasks(list.data(), list.size());
+    }
+
+  private:
+
+    struct Task {
+      void (*call)(void*);
+      void* data;
+    };
+
+    void run_tasks(const Task* tasks, int n);
+    void worker_routine();
+
+    /// Claim and run one task of round `round`
+    ///
+    /// \returns `false` if there are none left
+    bool run_one(std::uint32_t round);
+
+    // The round, the next task to hand out, and the number of tasks, in one
+    // word, so a worker that is late for a round can't claim a task of the
+    // next one.
+    static std::uint64_t pack(std::uint32_t round, int next, int count)
+    {
+      return std::uint64_t(round) << 32 | std::uint64_t(next) << 16 | std::uint64_t(count);
+    }
+    static std::uint32_t round_of(std::uint64_t s) { return s >> 32; }
+    static int next_of(std::uint64_t s) { return (s >> 16) & 0xFFFF; }
+    static int count_of(std::uint64_t s) { return s & 0xFFFF; }
+
+    Options options;
+    std::array<Task, max_tasks> slots;
+    std::atomic<std::uint64_t> state {0};
+    std::atomic<int> remaining {0};
+    std::atomic<int> sleeping {0};
+    std::atomic<bool> stopping {false};
+    semaphore wakeup;
+    std::vector<std::thread> threads;
+  };
+
+}
@@ -0,0 +1,43 @@
+#include "testing.t.hpp"
+
+#include <thread>
+
+#include "core/audio/alsa_backend.hpp"
+#include "util/exception.hpp"
+
+namespace otto::audio {
+
+  TEST_CASE("ALSA backend", "[audio] [alsa]") {
+    MainAudio audio;
+    AlsaBackend::Options options;
+
+    SECTION("Periods are negotiated and played on the null PCM") {
+      options.playback = "null";
+      options.period_size = 128;
+      options.periods = 3;
+      AlsaBackend backend {audio, options};
+      REQUIRE(backend.period_size() == 128);
+      REQUIRE(backend.samplerate() == 44100);
+      REQUIRE(backend.cycles() == 0);
+
+      backend.start();
+
+      for (int i = 0; i < 100 && backend.cycles() < 4; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      REQUIRE(backend.cycles() >= 4);
+      REQUIRE(backend.xruns() == 0);
+
+      backend.stop();
+      auto cycles = backend.cycles();
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      REQUIRE(backend.cycles() == cycles);
+    }
+
+    SECTION("Missing PCMs are reported") {
+      options.playback = "otto_no_such_pcm";
+      REQUIRE_THROWS_AS(AlsaBackend(audio, options), const util::exception&);
+    }
+  }
+
+}
@@ -0,0 +1,99 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "core/audio/midi.hpp"
+
+namespace otto::midi {
+
+  TEST_CASE("MIDI events", "[midi] [audio]") {
+
+    SECTION("Channel messages are parsed") {
+      MidiEvent e;
+      MidiEvent::byte on[] = {0x93, 60, 100};
+      REQUIRE(MidiEvent::parse(on, 12, e));
+      REQUIRE(e.is_note_on());
+      REQUIRE(e.channel == 3);
+      REQUIRE(e.key() == 60);
+      REQUIRE(e.velocity() == 100);
+      REQUIRE(e.time == 12);
+
+      MidiEvent::byte cc[] = {0xB0, 7, 90};
+      REQUIRE(MidiEvent::parse(cc, 0, e));
+      REQUIRE(e.is_control_change());
+      REQUIRE(e.controller() == 7);
+      REQUIRE(e.value() == 90);
+
+      MidiEvent::byte bend[] = {0xE0, 0, 64};
+      REQUIRE_FALSE(MidiEvent::parse(bend, 0, e));
+    }
+
+    SECTION("A note on with velocity 0 is a note off") {
+      MidiEvent e;
+      MidiEvent::byte on[] = {0x90, 60, 0};
+      REQUIRE(MidiEvent::parse(on, 0, e));
+      REQUIRE(e.is_note_off());
+    }
+
+    SECTION("Factories set the type along with the data") {
+      auto on = MidiEvent::note_on(5, 2, 64, 127);
+      REQUIRE(on.is_note_on());
+      REQUIRE(on.time == 5);
+      REQUIRE(on.channel == 2);
+      REQUIRE(on.key() == 64);
+      REQUIRE(on.velocity() == 127);
+
+      REQUIRE(MidiEvent::note_off(0, 0, 64).is_note_off());
+
+      auto cc = MidiEvent::control_change(0, 1, 7, 90);
+      REQUIRE(cc.is_control_change());
+      REQUIRE(cc.controller() == 7);
+      REQUIRE(cc.value() == 90);
+    }
+  }
+
+  TEST_CASE("MidiBuffer", "[midi] [audio]") {
+    MidiBuffer buf;
+    auto at = [] (std::uint32_t time, int key) {
+      return MidiEvent::note_on(time, 0, key, 100);
+    };
+
+    SECTION("Events are kept in time order") {
+      buf.push(at(10, 1));
+      buf.push(at(2, 2));
+      buf.push(at(10, 3));
+      buf.push(at(5, 4));
+      REQUIRE(buf.size() == 4);
+      std::vector<int> keys;
+      for (auto&& e : buf) keys.push_back(e.key());
+      REQUIRE(keys == (std::vector<int>{2, 4, 1, 3}));
+    }
+
+    SECTION("Events past the capacity are dropped and counted") {
+      for (int i = 0; i < MidiBuffer::capacity; i++) {
+        REQUIRE(buf.push(at(i, 0)));
+      }
+      REQUIRE_FALSE(buf.push(at(0, 0)));
+      REQUIRE(buf.size() == MidiBuffer::capacity);
+      REQUIRE(buf.dropped() == 1);
+      buf.clear();
+      REQUIRE(buf.empty());
+    }
+
+    SECTION("Blocks are split at the frame of each event") {
+      buf.push(at(0, 1));
+      buf.push(at(3, 2));
+      buf.push(at(3, 3));
+      buf.push(at(20, 4));
+      std::vector<long> calls;
+      split_block(buf, 8, [&] (const MidiEvent& e) {
+        calls.push_back(-e.key());
+      }, [&] (long from, long n) {
+        calls.push_back(from);
+        calls.push_back(n);
+      });
+      REQUIRE(calls == (std::vector<long>{-1, 0, 3, -2, -3, 3, 5, -4}));
+    }
+  }
+
+}
@@ -0,0 +1,64 @@
+#include "testing.t.hpp"
+
+#include <sstream>
+
+#include "core/audio/midi_script.hpp"
+#include "util/exception.hpp"
+
+namespace otto::midi {
+
+  TEST_CASE("MidiScript", "[midi] [audio]") {
+    std::istringstream text {
+      "# frame type channel data\n"
+      "300 off 0 60 0\n"
+      "\n"
+      "0   on  0 60 100  # first\n"
+      "256 cc  3 7  90\n"
+      "300 on  0 62 80\n"
+    };
+    MidiScript script {text};
+
+    SECTION("Events are sorted by frame, keeping their order within a frame") {
+      auto& events = script.events();
+      REQUIRE(events.size() == 4);
+      REQUIRE(events[0].frame == 0);
+      REQUIRE(events[1].event.is_control_change());
+      REQUIRE(events[2].event.is_note_off());
+      REQUIRE(events[3].event.key() == 62);
+    }
+
+    SECTION("Events are handed out per buffer, timed from its start") {
+      MidiBuffer buf;
+      script.events_in(0, 256, buf);
+      REQUIRE(buf.size() == 1);
+      auto& on = buf.data()[0];
+      REQUIRE(on.is_note_on());
+      REQUIRE(on.key() == 60);
+      REQUIRE(on.velocity() == 100);
+      REQUIRE(on.time == 0);
+
+      buf.clear();
+      script.events_in(256, 256, buf);
+      REQUIRE(buf.size() == 3);
+      auto& cc = buf.data()[0];
+      REQUIRE(cc.is_control_change());
+      REQUIRE(cc.channel == 3);
+      REQUIRE(cc.value() == 90);
+      REQUIRE(cc.time == 0);
+      REQUIRE(buf.data()[1].is_note_off());
+      REQUIRE(buf.data()[1].time == 44);
+
+      buf.clear();
+      script.events_in(512, 256, buf);
+      REQUIRE(buf.empty());
+    }
+
+    SECTION("Malformed lines are reported") {
+      std::istringstream bad {"0 on 0 60 100\n10 up 0 60 100\n"};
+      REQUIRE_THROWS_AS(MidiScript(bad), const util::exception&);
+      std::istringstream range {"0 on 16 60 100\n"};
+      REQUIRE_THROWS_AS(MidiScript(range), const util::exception&);
+    }
+  }
+
+}
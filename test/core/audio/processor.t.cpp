@@ -0,0 +1,56 @@
+#include "testing.t.hpp"
+
+#include "core/audio/processor.hpp"
+
+namespace otto::audio {
+
+  TEST_CASE("Audio views", "[audio]") {
+    constexpr int frames = 8;
+
+    SECTION("Process buffers are planar") {
+      ProcessBuffer<2> buf {frames};
+      REQUIRE(buf.size() == frames);
+      auto view = buf.view();
+      REQUIRE(view.is_contiguous());
+      REQUIRE(view.data()[1] == view.data()[0] + frames);
+      buf[1][3] = 1;
+      REQUIRE(view[1][3] == 1);
+      REQUIRE(view[0][3] == 0);
+    }
+
+    SECTION("Interleaved frames are viewed as strided channels") {
+      std::array<std::array<float, 4>, frames> interleaved;
+      for (int i = 0; i < frames; i++) {
+        for (int c = 0; c < 4; c++) interleaved[i][c] = i * 10 + c;
+      }
+      auto view = AudioView<4>::interleaved(interleaved.data(), frames);
+      REQUIRE_FALSE(view.is_contiguous());
+      REQUIRE(view[2][5] == 52);
+
+      auto pair = view.select<3, 1>();
+      REQUIRE(pair[0][1] == 13);
+      REQUIRE(pair[1][1] == 11);
+
+      auto one = view.channel(2).slice(3, 2);
+      REQUIRE(one.size() == 2);
+      REQUIRE(one[0][0] == 32);
+      one[0][1] = -1;
+      REQUIRE(interleaved[4][2] == -1);
+
+      std::array<float, frames> copy;
+      view[1].copy_to(copy.data());
+      REQUIRE(copy[7] == 71);
+    }
+
+    SECTION("Process data passes channels on without copying") {
+      ProcessBuffer<4> buf {frames};
+      ProcessData<4> data {buf.view(), {}, frames};
+      auto track = data.channel(2);
+      REQUIRE(track.audio[0].data() == buf[2].data());
+      auto sliced = data.slice(2, 4).select<0, 3>();
+      REQUIRE(sliced.nframes == 4);
+      REQUIRE(sliced.audio[1].data() == buf[3].data() + 2);
+    }
+  }
+
+}
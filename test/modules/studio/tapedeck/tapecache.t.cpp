@@ -0,0 +1,53 @@
+#include "testing.t.hpp"
+
+#include "modules/studio/tapedeck/tapecache.hpp"
+
+namespace otto {
+
+  TEST_CASE("TapeCache", "[tapedeck] [modules]") {
+    TapeCache cache {{1000, 2100}};
+
+    SECTION("The ring is the smallest power of two that fits") {
+      REQUIRE(TapeCache::size_for(1100) == 2048);
+      REQUIRE(TapeCache::size_for(1024) == 1024);
+      REQUIRE(cache.size() == 2048);
+    }
+
+    SECTION("Positions map to distinct samples of each track") {
+      for (int p = 1000; p < 2100; p++) {
+        for (int t = 0; t < TapeCache::tracks; t++) {
+          cache.at(t, p) = p + t * 10000;
+        }
+      }
+      for (int p = 1000; p < 2100; p++) {
+        REQUIRE(cache.at(0, p) == p);
+        REQUIRE(cache.at(3, p) == p + 30000);
+      }
+      // Each track is contiguous
+      REQUIRE(&cache.at(1, 1001) == &cache.at(1, 1000) + 1);
+      REQUIRE(cache.contains(1000, 2100));
+      REQUIRE_FALSE(cache.contains(999, 1500));
+      REQUIRE_FALSE(cache.contains(1500, 2101));
+    }
+
+    SECTION("Dirty sections are merged until taken") {
+      REQUIRE(cache.peek_dirty(0).size() == 0);
+      cache.mark_dirty(0, {1200, 1300});
+      cache.mark_dirty(0, {1100, 1150});
+      cache.mark_dirty(0, {1400, 1400});
+      REQUIRE((cache.peek_dirty(0) == TapeCache::Section{1100, 1300}));
+      REQUIRE((cache.take_dirty(0) == TapeCache::Section{1100, 1300}));
+      REQUIRE(cache.peek_dirty(0).size() == 0);
+      cache.mark_dirty(0, {1500, 1600});
+      REQUIRE((cache.take_dirty(0) == TapeCache::Section{1500, 1600}));
+    }
+
+    SECTION("Each track has its own dirty section") {
+      cache.mark_dirty(1, {1200, 1300});
+      cache.mark_dirty(2, {1500, 1600});
+      REQUIRE(cache.peek_dirty(0).size() == 0);
+      REQUIRE((cache.take_dirty(1) == TapeCache::Section{1200, 1300}));
+      REQUIRE((cache.peek_dirty(2) == TapeCache::Section{1500, 1600}));
+    }
+  }
+}
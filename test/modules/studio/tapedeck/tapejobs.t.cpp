@@ -0,0 +1,150 @@
+#include "testing.t.hpp"
+
+#include "modules/studio/tapedeck/tapejobs.hpp"
+
+namespace otto {
+
+  /// A tape in memory, which remembers what was written
+  struct MemoryTape final : TapeJob::Tape {
+    static constexpr int tracks = TapeJob::tracks;
+
+    explicit MemoryTape(int length)
+    {
+      for (auto&& track : data) track.resize(length);
+    }
+
+    int length() const override { return data[0].size(); }
+    int clip_length() const override { return clip.size(); }
+
+    void resize_clip(int frames) override
+    {
+      clip.assign(frames, 0.f);
+    }
+
+    std::vector<float>& track(int t)
+    {
+      return t == TapeJob::clipboard ? clip : data[t];
+    }
+
+    void read(int t, int position, float* dst, int n) override
+    {
+      REQUIRE(n <= TapeJob::chunk_size);
+      std::copy_n(track(t).begin() + position, n, dst);
+    }
+
+    void write(int t, int position, const float* src, int n) override
+    {
+      REQUIRE(n <= TapeJob::chunk_size);
+      std::copy_n(src, n, track(t).begin() + position);
+      writes.push_back({t, {position, position + n}});
+    }
+
+    bool progress(float done) override
+    {
+      REQUIRE(done >= last_progress);
+      last_progress = done;
+      return --chunks_left != 0;
+    }
+
+    std::array<std::vector<float>, tracks> data;
+    std::vector<float> clip;
+    struct Write {
+      int track;
+      TapeJob::Section section;
+    };
+    std::vector<Write> writes;
+    float last_progress = 0;
+    /// Stop the job after this many chunks
+    int chunks_left = -1;
+  };
+
+  TEST_CASE("TapeJob", "[tapedeck] [modules]") {
+    constexpr int chunk = TapeJob::chunk_size;
+    constexpr int length = 5 * chunk;
+    MemoryTape tape {length};
+    for (int t = 0; t < MemoryTape::tracks; t++) {
+      for (int i = 0; i < length; i++) tape.data[t][i] = i + t * length;
+    }
+    auto original = tape.data;
+
+    SECTION("Bounce mixes tracks by their gains") {
+      std::array<float, TapeJob::tracks> gains = {};
+      gains[0] = 1;
+      gains[1] = 0.5f;
+      REQUIRE(TapeJob::bounce(gains, 2, {100, 2 * chunk + 100}).run(tape));
+      for (int i = 100; i < 2 * chunk + 100; i++) {
+        REQUIRE(tape.data[2][i] == original[0][i] + 0.5f * original[1][i]);
+      }
+      REQUIRE(tape.data[2][99] == original[2][99]);
+      REQUIRE(tape.data[2][2 * chunk + 100] == original[2][2 * chunk + 100]);
+      REQUIRE(tape.data[0] == original[0]);
+      REQUIRE(tape.last_progress == 1);
+    }
+
+    SECTION("Reverse swaps frames across the middle") {
+      TapeJob::Section s = {10, 3 * chunk + 11};
+      REQUIRE(TapeJob::reverse(1, s).run(tape));
+      for (int i = s.in; i < s.out; i++) {
+        REQUIRE(tape.data[1][i] == original[1][s.out - 1 - (i - s.in)]);
+      }
+      REQUIRE(tape.data[1][9] == original[1][9]);
+      REQUIRE(tape.data[1][s.out] == original[1][s.out]);
+    }
+
+    SECTION("Normalize scales the peak to the level") {
+      for (int i = 0; i < length; i++) tape.data[0][i] = (i % 7 - 3) * 0.1f;
+      REQUIRE(TapeJob::normalize(0, {0, length}, 0.9f).run(tape));
+      REQUIRE(tape.data[0][0] == Approx(-0.9f));
+      REQUIRE(tape.data[0][6] == Approx(0.9f));
+    }
+
+    SECTION("Normalizing silence leaves it alone") {
+      std::fill(tape.data[0].begin(), tape.data[0].end(), 0.f);
+      REQUIRE(TapeJob::normalize(0, {0, length}).run(tape));
+      REQUIRE(tape.writes.empty());
+    }
+
+    SECTION("Copying forwards onto the same track overlaps correctly") {
+      TapeJob::Section s = {0, 2 * chunk + 5};
+      REQUIRE(TapeJob::copy(3, s, 3, 1000).run(tape));
+      for (int i = 0; i < s.size(); i++) {
+        REQUIRE(tape.data[3][1000 + i] == original[3][i]);
+      }
+      REQUIRE(tape.data[3][999] == original[3][999]);
+    }
+
+    SECTION("Copies are clipped to the end of the tape") {
+      REQUIRE(TapeJob::copy(0, {0, length}, 1, length - 10).run(tape));
+      for (int i = 0; i < 10; i++) {
+        REQUIRE(tape.data[1][length - 10 + i] == original[0][i]);
+      }
+      REQUIRE(tape.data[1][length - 11] == original[1][length - 11]);
+    }
+
+    SECTION("Lift moves a section to the clipboard, and drop puts it back") {
+      TapeJob::Section s = {500, chunk + 700};
+      REQUIRE(TapeJob::lift(2, s).run(tape));
+      REQUIRE(tape.clip_length() == s.size());
+      for (int i = s.in; i < s.out; i++) {
+        REQUIRE(tape.data[2][i] == 0);
+        REQUIRE(tape.clip[i - s.in] == original[2][i]);
+      }
+      REQUIRE(tape.data[2][s.out] == original[2][s.out]);
+
+      tape.last_progress = 0;
+      REQUIRE(TapeJob::drop(0, 3 * chunk).run(tape));
+      for (int i = 0; i < s.size(); i++) {
+        REQUIRE(tape.data[0][3 * chunk + i] == original[2][s.in + i]);
+      }
+    }
+
+    SECTION("A stopped job stops after the chunk") {
+      tape.chunks_left = 2;
+      REQUIRE_FALSE(TapeJob::reverse(0, {0, length}).run(tape));
+      // Each chunk of a reverse writes both ends
+      REQUIRE(tape.writes.size() == 4);
+      REQUIRE(tape.last_progress < 1);
+    }
+  }
+
+}
@@ -0,0 +1,95 @@
+#include "testing.t.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "modules/studio/tapedeck/tapejournal.hpp"
+#include "modules/studio/tapedeck/tapeslices.hpp"
+
+namespace otto {
+
+  using Entry = TapeJournal::Entry;
+
+  static std::vector<Entry> drain(TapeJournal& journal)
+  {
+    std::vector<Entry> res;
+    Entry e;
+    while (journal.pop(e)) res.push_back(e);
+    return res;
+  }
+
+  TEST_CASE("TapeJournal", "[tapedeck] [modules]") {
+    fs::path path = test::dir / "test.journal";
+    fs::remove(path);
+    TapeJournal journal;
+
+    SECTION("Slice edits are logged") {
+      TapeSliceSet set;
+      set.set_journal(&journal, 2);
+      set.add({10, 20});
+      set.add({30, 40});
+      set.glue({10, 20}, {30, 40});
+      set.cut(25);
+      set.erase({0, 12});
+      set.clear();
+
+      auto entries = drain(journal);
+      REQUIRE(entries.size() == 6);
+      REQUIRE(entries[0].op == Entry::Add);
+      REQUIRE(entries[0].track == 2);
+      REQUIRE(entries[2].op == Entry::Add);
+      REQUIRE(entries[2].a == 10);
+      REQUIRE(entries[2].b == 40);
+      REQUIRE(entries[3].op == Entry::Cut);
+      REQUIRE(entries[3].a == 25);
+      REQUIRE(entries[4].op == Entry::Erase);
+      REQUIRE(entries[5].op == Entry::Clear);
+      REQUIRE_FALSE(journal.overflowed());
+    }
+
+    SECTION("A full queue is reported") {
+      for (std::size_t i = 0; i < TapeJournal::queue_size + 1; i++) {
+        journal.log(Entry::Cut, 0, i);
+      }
+      REQUIRE(journal.overflowed());
+      REQUIRE_FALSE(journal.overflowed());
+      REQUIRE(drain(journal).size() == TapeJournal::queue_size);
+    }
+
+    SECTION("Entries round trip through the file") {
+      std::vector<Entry> snapshot = {{Entry::Clear, 0}, {Entry::Add, 0, 0, 5, 10}};
+      journal.start(path, 7, snapshot);
+      Entry cut = {Entry::Cut, 0, 0, 7};
+      journal.append(&cut, 1);
+      journal.sync();
+      REQUIRE(journal.length() == 3);
+      journal.close();
+
+      std::vector<Entry> read;
+      REQUIRE(TapeJournal::read(path, 7, read));
+      REQUIRE(read.size() == 3);
+      REQUIRE(read[1].b == 10);
+      REQUIRE(read[2].op == Entry::Cut);
+
+      // A journal for the next generation is still good
+      REQUIRE(TapeJournal::read(path, 6, read));
+      REQUIRE_FALSE(TapeJournal::read(path, 8, read));
+      REQUIRE(read.empty());
+      REQUIRE_FALSE(TapeJournal::read(test::dir / "missing.journal", 0, read));
+    }
+
+    SECTION("Reading stops at a damaged entry") {
+      std::vector<Entry> snapshot(3, Entry{Entry::Add, 1, 0, 1, 2});
+      journal.start(path, 0, snapshot);
+      journal.close();
+      {
+        int fd = ::open(path.c_str(), O_WRONLY);
+        ::pwrite(fd, "x", 1, 16 + 16 + 4);
+        ::close(fd);
+      }
+      std::vector<Entry> read;
+      REQUIRE(TapeJournal::read(path, 0, read));
+      REQUIRE(read.size() == 1);
+    }
+  }
+}
@@ -0,0 +1,88 @@
+#include "testing.t.hpp"
+
+#include <vector>
+
+#include "modules/studio/tapedeck/tapeslices.hpp"
+
+namespace otto {
+
+  using Slices = std::vector<TapeSlice>;
+
+  static std::vector<TapeSlice> to_vector(const TapeSliceSet& set) {
+    return {set.begin(), set.end()};
+  }
+
+  static std::vector<TapeSlice> to_vector(util::IteratorRange<TapeSliceSet::iterator> r) {
+    return {r.begin(), r.end()};
+  }
+
+  TEST_CASE("TapeSliceSet", "[tapedeck] [modules]") {
+    TapeSliceSet set;
+    set.add({100, 200});
+    set.add({0, 50});
+    set.add({300, 400});
+
+    SECTION("Slices are kept sorted") {
+      REQUIRE((to_vector(set) == Slices{{0, 50}, {100, 200}, {300, 400}}));
+    }
+
+    SECTION("Point queries") {
+      REQUIRE(set.in_slice(0));
+      REQUIRE(set.in_slice(200));
+      REQUIRE_FALSE(set.in_slice(201));
+      REQUIRE_FALSE(set.in_slice(1000));
+      REQUIRE((set.current(150) == TapeSlice{100, 200}));
+      REQUIRE((set.current(250) == TapeSlice{-1, -1}));
+    }
+
+    SECTION("Range queries") {
+      REQUIRE((to_vector(set.overlapping_slices({50, 100}))
+        == Slices{{0, 50}, {100, 200}}));
+      REQUIRE((to_vector(set.overlapping_slices({201, 299})).empty()));
+      REQUIRE((set.overlapping_slices({-100, 1000}).size() == 3));
+    }
+
+    SECTION("Adding over existing slices trims them") {
+      set.add({150, 350});
+      REQUIRE((to_vector(set) == Slices{
+          {0, 50}, {100, 149}, {150, 350}, {351, 400}}));
+    }
+
+    SECTION("Adding inside a slice splits it") {
+      set.add({120, 130});
+      REQUIRE((to_vector(set) == Slices{
+          {0, 50}, {100, 119}, {120, 130}, {131, 200}, {300, 400}}));
+    }
+
+    SECTION("Erase removes slices") {
+      set.erase({40, 320});
+      REQUIRE((to_vector(set) == Slices{{0, 39}, {321, 400}}));
+    }
+
+    SECTION("Cut and glue") {
+      set.cut(150);
+      REQUIRE((to_vector(set) == Slices{
+          {0, 50}, {100, 150}, {151, 200}, {300, 400}}));
+      set.glue({100, 150}, {151, 200});
+      REQUIRE((to_vector(set) == Slices{{0, 50}, {100, 200}, {300, 400}}));
+      set.cut(250);
+      REQUIRE(set.size() == 3);
+    }
+
+    SECTION("Thousands of random edits keep the set sorted and disjoint") {
+      for (int i = 0; i < 5000; i++) {
+        int in = Random::get(0, 100000);
+        TapeSlice s = {in, in + Random::get(1, 500)};
+        if (Random::get<bool>()) {
+          set.add(s);
+        } else {
+          set.erase(s);
+        }
+      }
+      auto v = to_vector(set);
+      for (std::size_t i = 1; i < v.size(); i++) {
+        REQUIRE(v[i - 1].out < v[i].in);
+      }
+    }
+  }
+}
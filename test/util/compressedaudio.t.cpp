@@ -0,0 +1,167 @@
+#include "../testing.t.hpp"
+
+#include <cmath>
+
+#include "util/compressedaudio.hpp"
+#include "util/soundfile.hpp"
+
+namespace otto::util {
+
+  constexpr int channels = 4;
+  constexpr int block = CompressedAudioFile::block_frames;
+
+  /// `n` frames of a few sines, quantized to 24 bits, like a recording
+  static std::vector<float> make_audio(int n, int offset = 0)
+  {
+    std::vector<float> audio(n * channels);
+    for (int i = 0; i < n; i++) {
+      for (int c = 0; c < channels; c++) {
+        float v = 0.5f * std::sin((i + offset) * 0.01f * (c + 1));
+        audio[i * channels + c] = std::round(v * (1 << 23)) / (1 << 23);
+      }
+    }
+    return audio;
+  }
+
+  TEST_CASE("CompressedAudioFile", "[CompressedAudioFile] [util]") {
+    fs::path path = test::dir / "test.blocks";
+    fs::remove(path);
+    CompressedAudioFile file;
+    file.open(path, channels, 24, 10 * block + 100);
+    REQUIRE(file.is_open());
+
+    SECTION("Unwritten frames are silent and take no space") {
+      std::vector<float> out(3 * block * channels, 1.f);
+      file.read(block, out.data(), 3 * block);
+      REQUIRE(std::all_of(out.begin(), out.end(), [] (float f) { return f == 0.f; }));
+      REQUIRE(file.stats().written_blocks == 0);
+      REQUIRE_FALSE(file.block_written(1));
+    }
+
+    SECTION("Round trip across block boundaries") {
+      int p = block - 300;
+      int n = 2 * block + 700;
+      auto in = make_audio(n);
+      file.write(p, in.data(), n);
+      REQUIRE(file.stats().written_blocks == 4);
+      REQUIRE(file.block_written(0));
+      REQUIRE_FALSE(file.block_written(4));
+
+      std::vector<float> out(n * channels);
+      file.read(p, out.data(), n);
+      REQUIRE(out == in);
+
+      SECTION("Surrounding frames are untouched") {
+        std::vector<float> before(300 * channels, 1.f);
+        file.read(p - 300, before.data(), 300);
+        REQUIRE(std::all_of(before.begin(), before.end(), [] (float f) { return f == 0.f; }));
+      }
+
+      SECTION("Survives reopening") {
+        file.close();
+        CompressedAudioFile other;
+        other.open(path, 1, 16, 0);
+        REQUIRE(other.channels() == channels);
+        REQUIRE(other.bits() == 24);
+        REQUIRE(other.length() == 10 * block + 100);
+        std::fill(out.begin(), out.end(), 0.f);
+        other.read(p, out.data(), n);
+        REQUIRE(out == in);
+      }
+    }
+
+    SECTION("Writes past the end are clipped") {
+      auto in = make_audio(300);
+      file.write(10 * block, in.data(), 300);
+      std::vector<float> out(300 * channels, 1.f);
+      file.read(10 * block, out.data(), 300);
+      REQUIRE(std::equal(out.begin(), out.begin() + 100 * channels, in.begin()));
+      REQUIRE(std::all_of(out.begin() + 100 * channels, out.end(), [] (float f) { return f == 0.f; }));
+    }
+
+    SECTION("Blocks that grow are moved, and compacted away") {
+      std::vector<float> silence(8 * block * channels, 0.f);
+      file.write(0, silence.data(), 8 * block);
+      auto small = file.stats().file_bytes;
+
+      std::vector<float> noise(8 * block * channels);
+      for (auto& f : noise) f = std::round(Random::get<float>(-1, 1) * (1 << 23)) / (1 << 23);
+      file.write(0, noise.data(), 8 * block);
+      auto stats = file.stats();
+      REQUIRE(stats.file_bytes > small + stats.audio_bytes);
+
+      file.compact();
+      REQUIRE(file.stats().file_bytes < stats.file_bytes);
+      std::vector<float> out(8 * block * channels);
+      file.read(0, out.data(), 8 * block);
+      REQUIRE(out == noise);
+
+      file.close();
+      file.open(path, channels, 24, 0);
+      file.read(0, out.data(), 8 * block);
+      REQUIRE(out == noise);
+    }
+
+    SECTION("Not a compressed audio file") {
+      file.close();
+      fs::path other = test::dir / "garbage.blocks";
+      {
+        std::ofstream f(other.c_str());
+        f << "This is not audio, but it is long enough to hold a header";
+      }
+      CompressedAudioFile bad;
+      REQUIRE_THROWS(bad.open(other, channels, 24, 100));
+      REQUIRE_FALSE(bad.is_open());
+    }
+  }
+
+  TEST_CASE("CompressedAudioFile Performance", "[CompressedAudioFile] [util]") {
+    constexpr int frames = 64 * block;
+    auto audio = make_audio(frames);
+    std::vector<float> out(audio.size());
+
+    fs::path path = test::dir / "perf.blocks";
+    fs::remove(path);
+    CompressedAudioFile compressed;
+    compressed.open(path, channels, 24, frames);
+
+    fs::path raw_path = test::dir / "perf.wav";
+    fs::remove(raw_path);
+    SoundFile raw;
+    raw.info.channels = channels;
+    raw.info.format = SampleFormat::PCM24;
+    raw.open(raw_path);
+
+    auto compressed_write = test::measure::execution([&] {
+        compressed.write(0, audio.data(), frames);
+        compressed.sync();
+      });
+    auto raw_write = test::measure::execution([&] {
+        raw.seek(0);
+        raw.write_samples(audio.data(), audio.size());
+        raw.flush();
+      });
+
+    auto compressed_read = test::measure::execution([&] {
+        compressed.read(0, out.data(), frames);
+      });
+    REQUIRE(out == audio);
+    auto raw_read = test::measure::execution([&] {
+        raw.seek(0);
+        raw.read_samples(out.data(), out.size());
+      });
+
+    double seconds = frames / 44100.0;
+    auto compressed_bytes = compressed.stats().audio_bytes;
+    auto raw_bytes = std::int64_t(frames) * channels * 3;
+    WARN(fmt::format("Disk per second of playback: {} kB compressed, {} kB raw 24 bit",
+        int(compressed_bytes / seconds / 1000), int(raw_bytes / seconds / 1000)));
+    WARN(fmt::format("Writing: {}ms compressed, {}ms raw",
+        compressed_write.count() / 1e6, raw_write.count() / 1e6));
+    WARN(fmt::format("Reading: {}ms compressed, {}ms raw, {} times realtime",
+        compressed_read.count() / 1e6, raw_read.count() / 1e6,
+        int(seconds * 1e9 / compressed_read.count())));
+    REQUIRE(compressed_bytes < raw_bytes);
+  }
+
+}
@@ -0,0 +1,81 @@
+#include "../testing.t.hpp"
+
+#include <cmath>
+
+#include "util/decimated.hpp"
+
+namespace otto::util::audio {
+
+  TEST_CASE("DecimatedAudio", "[decimated] [util]") {
+    using Spool = DecimatedAudio<2>;
+    constexpr int length = 4096;
+    Spool spool;
+    spool.resize(length);
+    REQUIRE(spool.frames().size() == length / Spool::factor);
+
+    SECTION("DC passes through") {
+      spool.update(0, length, [] (auto) { return std::array<float, 2>{{0.5f, -0.25f}}; });
+      std::array<float, 2> out[16];
+      spool.read(Phase(1000) << phase_bits, phase_step(5), out, 16);
+      for (auto&& f : out) {
+        REQUIRE(f[0] == Approx(0.5f).margin(0.001));
+        REQUIRE(f[1] == Approx(-0.25f).margin(0.001));
+      }
+    }
+
+    SECTION("Frequencies above the new nyquist are filtered out") {
+      auto tone = [] (float freq) {
+        return [freq] (std::int64_t i) {
+          float s = std::sin(2 * M_PI * freq * i);
+          return std::array<float, 2>{{s, s}};
+        };
+      };
+      spool.update(0, length, tone(0.2f / Spool::factor));
+      auto max_low = std::max_element(spool.frames().begin(), spool.frames().end())->at(0);
+      REQUIRE(max_low > 30000);
+
+      spool.update(0, length, tone(0.8f / Spool::factor));
+      for (std::size_t k = 16; k < spool.frames().size() - 16; k++) {
+        REQUIRE(std::abs(spool.frames()[k][0]) < 1000);
+      }
+    }
+
+    SECTION("Updates only touch affected frames") {
+      auto [s0, s1] = spool.support(1000, 1010);
+      REQUIRE(s0 <= 1000 - Spool::half_width);
+      REQUIRE(s1 >= 1010 + Spool::half_width);
+      auto [k0, k1] = spool.update(1000, 1010, [&] (std::int64_t i) {
+          REQUIRE(i >= s0);
+          REQUIRE(i < s1);
+          return std::array<float, 2>{{1.f, 1.f}};
+        });
+      REQUIRE(k0 > 0);
+      REQUIRE(k1 < spool.frames().size());
+      REQUIRE(spool.frames()[k0 - 1][0] == 0);
+      REQUIRE(spool.frames()[k0][0] != 0);
+    }
+
+    SECTION("Reads that overlap an update fail") {
+      std::array<float, 2> out[16];
+      auto start = Phase(1000) << phase_bits;
+      REQUIRE(spool.try_read(start, phase_step(5), out, 16));
+
+      bool read_during_update = true;
+      spool.update(1000, 1010, [&] (std::int64_t) {
+          read_during_update = spool.try_read(start, phase_step(5), out, 16);
+          return std::array<float, 2>{{1.f, 1.f}};
+        });
+      REQUIRE_FALSE(read_during_update);
+      REQUIRE(spool.try_read(start, phase_step(5), out, 16));
+
+      // Far away blocks are not held up
+      spool.resize(4 * Spool::lock_block * Spool::factor);
+      auto far = Phase(3 * Spool::lock_block * Spool::factor) << phase_bits;
+      spool.update(0, 16, [&] (std::int64_t) {
+          read_during_update = spool.try_read(far, phase_step(1), out, 16);
+          return std::array<float, 2>{{1.f, 1.f}};
+        });
+      REQUIRE(read_during_update);
+    }
+  }
+}
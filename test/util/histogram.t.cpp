@@ -0,0 +1,41 @@
+#include "../testing.t.hpp"
+
+#include "util/histogram.hpp"
+
+namespace otto::util {
+
+  using namespace std::chrono_literals;
+
+  TEST_CASE("Latency histogram", "[histogram] [util]") {
+    latency_histogram h;
+    REQUIRE(h.total() == 0);
+    REQUIRE(h.quantile(0.5f) == 0ns);
+
+    h.record(500ns);
+    REQUIRE(h.count(0) == 1);
+    h.record(1us);
+    REQUIRE(h.count(1) == 1);
+    h.record(3us);
+    REQUIRE(h.count(2) == 1);
+    h.record(1h);
+    REQUIRE(h.count(latency_histogram::bucket_count - 1) == 1);
+    REQUIRE(h.total() == 4);
+    REQUIRE(h.max() == 1h);
+
+    SECTION("Quantiles are upper bounds") {
+      for (int i = 0; i < 96; i++) {
+        h.record(100us);
+      }
+      REQUIRE(h.quantile(0.5f) >= 100us);
+      REQUIRE(h.quantile(0.5f) <= 128us);
+      REQUIRE(h.quantile(1.f) == 1h);
+    }
+
+    SECTION("Clear") {
+      h.clear();
+      REQUIRE(h.total() == 0);
+      REQUIRE(h.max() == 0ns);
+    }
+  }
+
+}
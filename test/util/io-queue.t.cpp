@@ -0,0 +1,65 @@
+#include "../testing.t.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util/io-queue.hpp"
+
+namespace otto::util {
+
+  /// Write a file in more requests than the queue's depth, out of order, and
+  /// read it back
+  static void round_trip(IOQueue& io)
+  {
+    fs::path path = test::dir / "io-queue.bin";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+
+    constexpr int blocks = 64;
+    constexpr int block_size = 4096;
+    std::vector<std::uint32_t> data(blocks * block_size);
+    std::generate(data.begin(), data.end(), [] { return Random::get<std::uint32_t>(); });
+
+    for (int b = blocks - 1; b >= 0; b--) {
+      io.write(fd, data.data() + b * block_size, block_size * 4,
+        std::int64_t(b) * block_size * 4, b);
+    }
+    REQUIRE(io.queued() == blocks);
+    auto& written = io.complete();
+    REQUIRE(written.size() == blocks);
+    for (auto&& c : written) {
+      REQUIRE(c.result == block_size * 4);
+    }
+    REQUIRE(io.queued() == 0);
+
+    std::vector<std::uint32_t> read(data.size() + block_size, 0);
+    for (int b = 0; b <= blocks; b++) {
+      io.read(fd, read.data() + b * block_size, block_size * 4,
+        std::int64_t(b) * block_size * 4, b);
+    }
+    auto& completed = io.complete();
+    REQUIRE(completed.size() == blocks + 1);
+    for (auto&& c : completed) {
+      // The last block is past the end of the file
+      REQUIRE(c.result == (c.tag == blocks ? 0 : block_size * 4));
+    }
+    REQUIRE(std::equal(data.begin(), data.end(), read.begin()));
+
+    ::close(fd);
+  }
+
+  TEST_CASE("IOQueue", "[IOQueue] [util]") {
+
+    SECTION("Synchronous") {
+      IOQueue io {0};
+      REQUIRE(!io.is_async());
+      round_trip(io);
+    }
+
+    SECTION("io_uring, if available") {
+      IOQueue io {8};
+      round_trip(io);
+    }
+  }
+
+}
@@ -0,0 +1,68 @@
+#include "../testing.t.hpp"
+
+#include <cmath>
+
+#include "util/lossless.hpp"
+
+namespace otto::util {
+
+  /// Encode and decode `in`, and check that nothing changed
+  static std::size_t check_round_trip(const std::vector<std::int32_t>& in, int channels, int bits)
+  {
+    int frames = in.size() / channels;
+    std::vector<std::byte> coded;
+    lossless::encode(in.data(), frames, channels, bits, coded);
+    std::vector<std::int32_t> out(in.size());
+    REQUIRE(lossless::decode(coded.data(), coded.size(), out.data(), frames, channels, bits));
+    REQUIRE(out == in);
+    return coded.size();
+  }
+
+  TEST_CASE("Lossless block coding", "[lossless] [util]") {
+    constexpr int frames = 4096;
+    constexpr int channels = 4;
+
+    SECTION("Silence takes a few bytes") {
+      std::vector<std::int32_t> in(frames * channels, 0);
+      REQUIRE(check_round_trip(in, channels, 24) < 16);
+    }
+
+    SECTION("Smooth signals compress well") {
+      std::vector<std::int32_t> in(frames * channels);
+      for (int i = 0; i < frames; i++) {
+        for (int c = 0; c < channels; c++) {
+          float v = 0.5f * std::sin(i * 0.01f * (c + 1)) + Random::get<float>(-1e-6, 1e-6);
+          in[i * channels + c] = std::lround(v * (1 << 23));
+        }
+      }
+      auto size = check_round_trip(in, channels, 24);
+      REQUIRE(size < frames * channels * 3 / 2);
+    }
+
+    SECTION("Noise falls back to verbatim") {
+      std::vector<std::int32_t> in(frames * channels);
+      std::generate(in.begin(), in.end(), [] { return Random::get<std::int32_t>(-(1 << 15), (1 << 15) - 1); });
+      auto size = check_round_trip(in, channels, 16);
+      REQUIRE(size <= frames * channels * 2 + channels);
+    }
+
+    SECTION("Extreme values and short blocks") {
+      std::vector<std::int32_t> in;
+      for (int i = 0; i < 3 * channels; i++) {
+        in.push_back(i % 2 ? (1 << 23) - 1 : -(1 << 23));
+      }
+      check_round_trip(in, channels, 24);
+      check_round_trip({5, 5, 5, 5}, channels, 24);
+    }
+
+    SECTION("Corrupt data is detected") {
+      std::vector<std::int32_t> in(frames * channels);
+      std::generate(in.begin(), in.end(), [] { return Random::get<std::int32_t>(-1000, 1000); });
+      std::vector<std::byte> coded;
+      lossless::encode(in.data(), frames, channels, 24, coded);
+      std::vector<std::int32_t> out(in.size());
+      REQUIRE_FALSE(lossless::decode(coded.data(), coded.size() / 2, out.data(), frames, channels, 24));
+    }
+  }
+
+}
@@ -0,0 +1,52 @@
+#include "../testing.t.hpp"
+
+#include <thread>
+#include <vector>
+
+#include "util/mpsc-queue.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("mpsc_queue", "[mpsc_queue] [util]") {
+    mpsc_queue<int, 8> queue;
+    int v;
+
+    SECTION("Values come out in order, until the queue is full") {
+      REQUIRE_FALSE(queue.try_pop(v));
+      for (int i = 0; i < 8; i++) {
+        REQUIRE(queue.try_push(i));
+      }
+      REQUIRE_FALSE(queue.try_push(8));
+      for (int i = 0; i < 8; i++) {
+        REQUIRE(queue.try_pop(v));
+        REQUIRE(v == i);
+      }
+      REQUIRE_FALSE(queue.try_pop(v));
+    }
+
+    SECTION("Nothing is lost with several producers") {
+      constexpr int per_thread = 20000;
+      constexpr int threads = 4;
+      std::vector<std::thread> producers;
+      for (int t = 0; t < threads; t++) {
+        producers.emplace_back([&, t] {
+            for (int i = 0; i < per_thread; i++) {
+              while (!queue.try_push(t * per_thread + i)) std::this_thread::yield();
+            }
+          });
+      }
+      std::vector<int> last(threads, -1);
+      int received = 0;
+      while (received < threads * per_thread) {
+        if (!queue.try_pop(v)) continue;
+        // Each producer's values arrive in the order they were pushed
+        int t = v / per_thread;
+        REQUIRE(v % per_thread == last[t] + 1);
+        last[t] = v % per_thread;
+        received++;
+      }
+      for (auto&& p : producers) p.join();
+      REQUIRE_FALSE(queue.try_pop(v));
+    }
+  }
+}
@@ -0,0 +1,34 @@
+#include "../testing.t.hpp"
+
+#include "util/overview.hpp"
+
+namespace otto::util::audio {
+
+  TEST_CASE("Overview", "[overview] [util]") {
+    Overview ov {100 * Overview::block_size + 10};
+
+    SECTION("Levels go down to a single point") {
+      REQUIRE(ov.level(0).size() == 101);
+      REQUIRE(ov.level(1).size() == 26);
+      REQUIRE(ov.level(ov.levels() - 1).size() == 1);
+      REQUIRE(ov.frames_per_point(2) == Overview::block_size * 16);
+      REQUIRE(ov.level_for(Overview::block_size * 5) == 1);
+      REQUIRE(ov.level_for(0) == 0);
+    }
+
+    SECTION("Updates propagate to all levels") {
+      auto first = 40 * Overview::block_size + 3;
+      ov.update(first, first + 10, [&] (std::size_t i) {
+          return i == first ? 1.f : -0.5f;
+        });
+      for (int l = 0; l < ov.levels(); l++) {
+        auto p = ov.level(l)[first / ov.frames_per_point(l)];
+        REQUIRE(p.max == 127);
+        REQUIRE(p.min == -64);
+        REQUIRE(p.rms > 0);
+      }
+      REQUIRE(ov.level(0)[39].max == 0);
+      REQUIRE(ov.level(0)[39].rms == 0);
+    }
+  }
+}
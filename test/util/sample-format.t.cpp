@@ -0,0 +1,75 @@
+#include "../testing.t.hpp"
+
+#include "util/sample-format.hpp"
+
+namespace otto::util {
+
+  /// Encode `in` as `f`, and decode it again
+  static std::vector<float> round_trip(SampleFormat f, const std::vector<float>& in)
+  {
+    std::vector<std::byte> raw(in.size() * sample_size(f));
+    std::vector<float> out(in.size());
+    encode_samples(f, in.data(), raw.data(), in.size());
+    decode_samples(f, raw.data(), out.data(), in.size());
+    return out;
+  }
+
+  static void check_format(SampleFormat f, int bits)
+  {
+    float step = 1.f / (1 << (bits - 1));
+
+    // More than a conversion block, and not a multiple of one
+    std::vector<float> in;
+    std::generate_n(std::back_inserter(in), 1000,
+      [] { return Random::get<float>(-1.0, 1.0); });
+
+    SECTION("Values on the grid are exact") {
+      for (auto& v : in) v = std::round(v / step) * step;
+      in.back() = -1.f;
+      REQUIRE(round_trip(f, in) == in);
+    }
+
+    SECTION("Values are rounded to the nearest step") {
+      auto out = round_trip(f, in);
+      for (std::size_t i = 0; i < in.size(); i++) {
+        REQUIRE(std::abs(out[i] - in[i]) <= step / 2);
+      }
+    }
+
+    SECTION("Values out of range are clipped") {
+      std::vector<float> loud = {1.f, 2.f, -1.5f, -1.f};
+      auto out = round_trip(f, loud);
+      REQUIRE(out[0] == 1.f - step);
+      REQUIRE(out[1] == 1.f - step);
+      REQUIRE(out[2] == -1.f);
+      REQUIRE(out[3] == -1.f);
+    }
+
+    SECTION("Samples are little endian") {
+      std::vector<float> in = {0.5f};
+      std::vector<std::byte> raw(sample_size(f));
+      encode_samples(f, in.data(), raw.data(), 1);
+      REQUIRE(raw.back() == std::byte(0x40));
+      REQUIRE(std::all_of(raw.begin(), raw.end() - 1, [] (auto b) { return b == std::byte(0); }));
+    }
+  }
+
+  TEST_CASE("Sample formats", "[SampleFormat] [util]") {
+
+    SECTION("Float") {
+      std::vector<float> in;
+      std::generate_n(std::back_inserter(in), 1000,
+        [] { return Random::get<float>(-2.0, 2.0); });
+      REQUIRE(round_trip(SampleFormat::Float32, in) == in);
+    }
+
+    SECTION("16 bit") {
+      check_format(SampleFormat::PCM16, 16);
+    }
+
+    SECTION("24 bit") {
+      check_format(SampleFormat::PCM24, 24);
+    }
+  }
+
+}
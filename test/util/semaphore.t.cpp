@@ -0,0 +1,44 @@
+#include "../testing.t.hpp"
+
+#include <thread>
+
+#include "util/semaphore.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("Semaphore", "[semaphore] [util]") {
+    semaphore sem;
+
+    SECTION("try_wait only succeeds while the count is positive") {
+      REQUIRE_FALSE(sem.try_wait());
+      sem.post();
+      sem.post();
+      REQUIRE(sem.try_wait());
+      REQUIRE(sem.try_wait());
+      REQUIRE_FALSE(sem.try_wait());
+    }
+
+    SECTION("wait_for times out") {
+      REQUIRE_FALSE(sem.wait_for(std::chrono::milliseconds(10)));
+      sem.post();
+      REQUIRE(sem.wait_for(std::chrono::milliseconds(10)));
+    }
+
+    SECTION("Every post wakes a waiter") {
+      constexpr int n = 10000;
+      std::atomic_int received {0};
+      std::thread consumer {[&] {
+          for (int i = 0; i < n; i++) {
+            sem.wait();
+            received++;
+          }
+        }};
+      for (int i = 0; i < n; i++) {
+        sem.post();
+      }
+      consumer.join();
+      REQUIRE(received == n);
+      REQUIRE_FALSE(sem.try_wait());
+    }
+  }
+}
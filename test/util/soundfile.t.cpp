@@ -1,5 +1,7 @@
 #include "../testing.t.hpp"
 
+#include <sys/stat.h>
+
 #include "util/soundfile.hpp"
 
 namespace otto::util {
@@ -90,4 +92,173 @@ namespace otto::util {
     }
 
   }
+
+  TEST_CASE("Aligned audio data", "[SoundFile] [util]") {
+    fs::path path = test::dir / "aligned.wav";
+    fs::remove(path);
+
+    std::vector<Sample> audio;
+    std::generate_n(std::back_inserter(audio), 2048,
+      []{return Random::get<float>(-1.0, 1.0);});
+
+    SoundFile file;
+    file.audio_alignment = 4096;
+    file.open(path);
+    REQUIRE(file.audio_offset() % 4096 == 0);
+    auto offset = file.audio_offset();
+    file.write_samples(audio.begin(), audio.end());
+    file.close();
+
+    SECTION("The layout survives reopening") {
+      SoundFile file;
+      file.open(path);
+      REQUIRE(file.audio_offset() == offset);
+      std::vector<Sample> rAudio;
+      file.read_samples(std::back_inserter(rAudio), 2048);
+      REQUIRE(std::equal(audio.begin(), audio.end(), rAudio.begin()));
+    }
+
+    SECTION("Existing files are not padded") {
+      SoundFile plain;
+      plain.open(somePath);
+      auto plain_offset = plain.audio_offset();
+      plain.close();
+      plain.audio_alignment = 4096;
+      plain.open(somePath);
+      plain.close();
+      plain.open(somePath);
+      REQUIRE(plain.audio_offset() == plain_offset);
+    }
+
+    SECTION("Reserved audio is allocated") {
+      SoundFile file;
+      file.open(path);
+      file.reserve_audio(1 << 16);
+      REQUIRE(file.length() == 1 << 16);
+      struct stat st;
+      REQUIRE(::stat(path.c_str(), &st) == 0);
+      // Filesystems without fallocate are allowed to stay sparse
+      WARN("Allocated " << st.st_blocks * 512 << " bytes");
+    }
+  }
+
+  TEST_CASE("Files larger than 4GB", "[SoundFile] [util]") {
+    fs::path path = test::dir / "large.wav";
+    fs::remove(path);
+
+    std::vector<Sample> audio;
+    std::generate_n(std::back_inserter(audio), 2048,
+      []{return Random::get<float>(-1.0, 1.0);});
+    // Past what the 32 bit sizes of a RIFF file can hold
+    SoundFile::Position length = (std::int64_t(1) << 32) / 4 + 4096;
+
+    ByteFile::Position offset;
+    {
+      SoundFile file;
+      file.open(path);
+      file.write_samples(audio.begin(), audio.end());
+      offset = file.audio_offset();
+      file.close();
+    }
+    // Sparse, so the test doesn't need the disk space
+    fs::resize_file(path, offset + length * 4);
+    {
+      SoundFile file;
+      file.open(path);
+      REQUIRE(file.length() == length);
+      file.seek(length - 2048);
+      file.write_samples(audio.begin(), audio.end());
+      file.close();
+    }
+
+    std::ifstream raw(path.c_str(), std::ios::binary);
+    char id[4];
+    raw.read(id, 4);
+    REQUIRE(std::string(id, 4) == "RF64");
+
+    SoundFile file;
+    file.open(path);
+    REQUIRE(file.audio_offset() == offset);
+    REQUIRE(file.length() == length);
+    std::vector<Sample> rAudio;
+    file.read_samples(std::back_inserter(rAudio), 2048);
+    REQUIRE(rAudio == audio);
+    rAudio.clear();
+    file.seek(length - 2048);
+    file.read_samples(std::back_inserter(rAudio), 2048);
+    REQUIRE(rAudio == audio);
+    file.close();
+    fs::remove(path);
+  }
+
+  /// Write a file of samples that `format` stores exactly, which are
+  /// `step` apart, and check reading it back
+  static void check_integer_file(SampleFormat format, float step)
+  {
+    fs::path path = test::dir / "integer.wav";
+    fs::remove(path);
+
+    std::vector<Sample> audio;
+    std::generate_n(std::back_inserter(audio), 2048,
+      [&] { return std::round(Random::get<float>(-1.0, 1.0) / step) * step; });
+
+    {
+      SoundFile file;
+      file.info.format = format;
+      file.info.channels = 2;
+      file.open(path);
+      file.write_samples(audio.data(), audio.size());
+      REQUIRE(file.length() == 2048);
+      file.close();
+    }
+    REQUIRE(fs::file_size(path) < 2048 * 4);
+
+    SECTION("The format is read from the file") {
+      SoundFile file;
+      file.open(path);
+      REQUIRE(file.info.format == format);
+      REQUIRE(file.length() == 2048);
+      std::vector<Sample> rAudio;
+      file.read_samples(std::back_inserter(rAudio), 2048);
+      REQUIRE(rAudio == audio);
+    }
+
+    SECTION("Reads past the end are silent") {
+      SoundFile file;
+      file.open(path);
+      file.seek(2000);
+      std::vector<Sample> rAudio(100, 1.f);
+      file.read_samples(rAudio.data(), rAudio.size());
+      REQUIRE(std::equal(audio.begin() + 2000, audio.end(), rAudio.begin()));
+      REQUIRE(std::all_of(rAudio.begin() + 48, rAudio.end(), [] (auto s) { return s == 0; }));
+    }
+
+    SECTION("Mapped access converts") {
+      SoundFile file;
+      file.open(path);
+      file.map_audio(4096);
+      std::vector<Sample> rAudio(2048);
+      file.read_mapped(0, rAudio.data(), 2048);
+      REQUIRE(rAudio == audio);
+      file.write_mapped(2048, audio.data(), 2048);
+      file.unmap_audio();
+      file.close();
+
+      file.open(path);
+      rAudio.resize(4096);
+      file.read_samples(rAudio.data(), 4096);
+      REQUIRE(std::equal(audio.begin(), audio.end(), rAudio.begin() + 2048));
+    }
+  }
+
+  TEST_CASE("Integer samples", "[SoundFile] [util]") {
+
+    SECTION("16 bit") {
+      check_integer_file(SampleFormat::PCM16, 1.f / (1 << 15));
+    }
+
+    SECTION("24 bit") {
+      check_integer_file(SampleFormat::PCM24, 1.f / (1 << 23));
+    }
+  }
 }
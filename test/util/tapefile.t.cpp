@@ -36,4 +36,267 @@ namespace otto::util {
     REQUIRE(std::equal(std::begin(testData), std::end(testData),
         std::begin(f.slices[0].array)));
   }
+
+  TEST_CASE("Memory mapped audio", "[TapeFile] [util]") {
+    fs::path somePath = test::dir / "test2.tape";
+    fs::remove(somePath);
+
+    std::vector<float> audio;
+    std::generate_n(std::back_inserter(audio), 4 * 2048,
+      [] { return Random::get<float>(-1.0, 1.0); });
+
+    {
+      TapeFile file;
+      file.open(somePath);
+      file.map_audio(4 * 4096);
+
+      REQUIRE(file.is_mapped());
+      REQUIRE(file.mapped_length() == 4 * 4096);
+      REQUIRE(file.length() == 4 * 4096);
+
+      std::copy(audio.begin(), audio.end(), file.mapped_data() + 4 * 1024);
+      file.mark_dirty(4 * 1024, audio.size());
+      file.unmap_audio();
+      file.close();
+    }
+
+    TapeFile file;
+    file.open(somePath);
+    REQUIRE(file.length() == 4 * 4096);
+
+    std::vector<float> read(audio.size());
+    file.seek(4 * 1024);
+    file.read_samples(read.data(), read.size());
+    REQUIRE(read == audio);
+  }
+
+  TEST_CASE("Overview persistence", "[TapeFile] [util]") {
+    fs::path somePath = test::dir / "test3.tape";
+    fs::remove(somePath);
+
+    std::vector<float> audio(4 * 4096, 0.25f);
+
+    {
+      TapeFile file;
+      file.open(somePath);
+      file.reserve_audio(4 * 8192);
+      file.create_overview(8192);
+      file.write_file();
+
+      file.seek(0);
+      file.write_samples(audio.data(), audio.size());
+      for (auto&& ov : file.overviews) {
+        ov.update(0, 4096, [] (auto) { return 0.25f; });
+      }
+      file.store_overview(0, 4096);
+      file.close();
+    }
+
+    TapeFile file;
+    file.open(somePath);
+    REQUIRE(file.has_overview());
+    REQUIRE(file.length() == 4 * 8192);
+
+    int top = file.overviews[0].levels() - 1;
+    REQUIRE_FALSE(file.overview_level_loaded(0));
+    file.load_overview_level(top);
+    REQUIRE(file.overview_level_loaded(top));
+    REQUIRE(file.overviews[2].level(top)[0].max == 32);
+
+    file.load_overview_level(0);
+    REQUIRE(file.overviews[3].level(0)[3].max == 32);
+    REQUIRE(file.overviews[3].level(0)[4].max == 0);
+
+    SECTION("Growing the audio moves the overview") {
+      file.reserve_audio(4 * 16384);
+      file.close();
+      file.open(somePath);
+      REQUIRE(file.length() == 4 * 16384);
+      file.load_overview_level(0);
+      REQUIRE(file.overviews[1].level(0)[0].max == 32);
+
+      std::vector<float> read(4 * 8192);
+      file.seek(4 * 8192);
+      file.read_samples(read.data(), read.size());
+      REQUIRE(std::all_of(read.begin(), read.end(), [] (float f) { return f == 0; }));
+    }
+  }
+
+  TEST_CASE("Spool data persistence", "[TapeFile] [util]") {
+    fs::path somePath = test::dir / "test4.tape";
+    fs::remove(somePath);
+
+    {
+      TapeFile file;
+      file.open(somePath);
+      file.reserve_audio(4 * 8192);
+      file.create_overview(8192);
+      file.create_spool(8192);
+      file.write_file();
+      file.spool.frames()[10] = {{1, 2, 3, 4}};
+      file.store_spool(10, 11);
+      file.close();
+    }
+
+    TapeFile file;
+    file.open(somePath);
+    REQUIRE(file.has_spool());
+    REQUIRE_FALSE(file.spool_loaded());
+    REQUIRE(file.spool.length() == 8192);
+    file.load_spool();
+    REQUIRE((file.spool.frames()[10] == std::array<std::int16_t, TapeFile::tracks>{{1, 2, 3, 4}}));
+    REQUIRE(file.spool.frames()[11][0] == 0);
+    REQUIRE(file.has_overview());
+  }
+
+  TEST_CASE("Written map persistence", "[TapeFile] [util]") {
+    fs::path somePath = test::dir / "test5.tape";
+    fs::remove(somePath);
+    constexpr int block = TapeFile::written_block_size;
+
+    {
+      TapeFile file;
+      file.open(somePath);
+      file.reserve_audio(TapeFile::tracks * 8 * block);
+      std::vector<float> audio(TapeFile::tracks * 16, 0.5f);
+      file.seek(TapeFile::tracks * (3 * block + 100));
+      file.write_samples(audio.data(), audio.size());
+
+      REQUIRE_FALSE(file.has_written_map());
+      file.create_written_map(8 * block);
+      REQUIRE(file.has_written_map());
+      REQUIRE(file.written_map.size() == 8 * TapeFile::tracks / 8);
+      // Whatever else the filesystem reports, the block with data is marked,
+      // for all tracks
+      for (int t = 0; t < TapeFile::tracks; t++) {
+        REQUIRE(file.written(t, 3));
+      }
+      REQUIRE_FALSE(file.written(2, 6));
+      file.mark_written(2, 6);
+      file.write_file();
+      REQUIRE(file.written_map_offset() != 0);
+      file.close();
+    }
+
+    TapeFile file;
+    file.open(somePath);
+    REQUIRE(file.has_written_map());
+    REQUIRE(file.written_map.size() == 8 * TapeFile::tracks / 8);
+    REQUIRE(file.written(0, 3));
+    REQUIRE(file.written(2, 6));
+    REQUIRE_FALSE(file.written(1, 6));
+    REQUIRE(file.length() == TapeFile::tracks * 8 * block);
+  }
+
+  TEST_CASE("Planar layout", "[TapeFile] [util]") {
+    fs::path somePath = test::dir / "test6.tape";
+    fs::remove(somePath);
+    constexpr int block = TapeFile::block_size;
+    constexpr int frames = 2 * block + 100;
+
+    // Interleaved, with silence on track 2
+    std::vector<float> audio;
+    for (int i = 0; i < frames; i++) {
+      for (int t = 0; t < TapeFile::tracks; t++) {
+        audio.push_back(t == 2 ? 0.f : Random::get<float>(-1.0, 1.0));
+      }
+    }
+
+    {
+      TapeFile file;
+      file.planar = false;
+      file.open(somePath);
+      file.slices[1].count = 1;
+      file.slices[1].array[0] = {10, 20};
+      file.write_samples(audio.data(), audio.size());
+      file.close();
+    }
+
+    TapeFile file;
+    file.open(somePath);
+    REQUIRE_FALSE(file.has_current_layout());
+    file.convert_layout();
+    REQUIRE(file.has_current_layout());
+
+    auto check = [&] (TapeFile& file) {
+      REQUIRE(file.slices[1].count == 1);
+      REQUIRE(file.slices[1].array[0].out == 20);
+      REQUIRE(file.length() == TapeFile::samples_for(frames));
+      std::vector<float> track(frames);
+      for (int t = 0; t < TapeFile::tracks; t++) {
+        for (int b = 0; b * block < frames; b++) {
+          int n = std::min(block, frames - b * block);
+          file.seek(TapeFile::sample_index(t, b * block));
+          file.read_samples(track.data() + b * block, n);
+        }
+        for (int i = 0; i < frames; i++) {
+          REQUIRE(track[i] == audio[i * TapeFile::tracks + t]);
+        }
+        REQUIRE(file.written(t, 1) == (t != 2));
+      }
+    };
+    check(file);
+    file.close();
+
+    SECTION("The layout survives reopening") {
+      TapeFile file;
+      file.open(somePath);
+      REQUIRE(file.planar);
+      check(file);
+    }
+  }
+
+  TEST_CASE("Tapes with another number of tracks", "[TapeFile] [util]") {
+    fs::path somePath = test::dir / "test7.tape";
+    fs::remove(somePath);
+    constexpr int block = TapeFile::block_size;
+    constexpr int frames = block + 10;
+    // Fewer tracks than the build, as if from a smaller build
+    constexpr int channels = 2;
+
+    std::array<std::vector<float>, channels> audio;
+    for (auto&& track : audio) {
+      std::generate_n(std::back_inserter(track), frames,
+        [] { return Random::get<float>(-1.0, 1.0); });
+    }
+
+    {
+      TapeFile file;
+      file.info.channels = channels;
+      file.open(somePath);
+      file.slices[1].count = 1;
+      for (int t = 0; t < channels; t++) {
+        for (int b = 0; b * block < frames; b++) {
+          int n = std::min(block, frames - b * block);
+          file.seek(TapeFile::sample_index(t, b * block, channels));
+          file.write_samples(audio[t].data() + b * block, n);
+        }
+      }
+      file.close();
+    }
+
+    TapeFile file;
+    file.open(somePath);
+    REQUIRE(file.info.channels == channels);
+    REQUIRE_FALSE(file.has_current_layout());
+    file.convert_layout();
+    REQUIRE(file.has_current_layout());
+    REQUIRE(file.info.channels == TapeFile::tracks);
+    REQUIRE(file.slices[1].count == 1);
+
+    std::vector<float> track(frames);
+    for (int t = 0; t < TapeFile::tracks; t++) {
+      for (int b = 0; b * block < frames; b++) {
+        int n = std::min(block, frames - b * block);
+        file.seek(TapeFile::sample_index(t, b * block));
+        file.read_samples(track.data() + b * block, n);
+      }
+      if (t < channels) {
+        REQUIRE(track == audio[t]);
+      } else {
+        REQUIRE(std::all_of(track.begin(), track.end(), [] (float f) { return f == 0; }));
+        REQUIRE_FALSE(file.written(t, 0));
+      }
+    }
+  }
 }
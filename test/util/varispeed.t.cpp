@@ -0,0 +1,170 @@
+#include "../testing.t.hpp"
+
+#include <vector>
+
+#include "util/varispeed.hpp"
+
+namespace otto::util::audio {
+
+  using Frame = std::array<float, 4>;
+  constexpr std::size_t size = 1 << 10;
+
+  /// A ring where every channel of frame `i` holds `i`
+  static std::vector<Frame> ramp()
+  {
+    std::vector<Frame> ring(size);
+    for (std::size_t i = 0; i < size; i++) {
+      ring[i].fill(float(i));
+    }
+    return ring;
+  }
+
+  TEST_CASE("Varispeed read", "[varispeed] [util]") {
+    auto ring = ramp();
+    std::vector<Frame> out(256);
+
+    SECTION("Unity speed wraps around the end of the ring") {
+      varispeed_read(ring.data(), size, Phase(size - 100) << phase_bits,
+        phase_one, out.data(), out.size());
+      for (int i = 0; i < 256; i++) {
+        REQUIRE(out[i][0] == float((size - 100 + i) % size));
+      }
+    }
+
+    SECTION("Reverse unity speed wraps around the start of the ring") {
+      varispeed_read(ring.data(), size, Phase(100) << phase_bits,
+        -phase_one, out.data(), out.size());
+      for (int i = 0; i < 256; i++) {
+        REQUIRE(out[i][3] == float((size + 100 - i) % size));
+      }
+    }
+
+    SECTION("Half speed interpolates linearly") {
+      varispeed_read(ring.data(), size, Phase(10) << phase_bits,
+        phase_step(0.5), out.data(), out.size(), Interpolation::Linear);
+      for (int i = 0; i < 256; i++) {
+        REQUIRE(out[i][1] == Approx(10 + i * 0.5));
+      }
+    }
+
+    SECTION("Cubic interpolation is exact on a line") {
+      varispeed_read(ring.data(), size, Phase(10) << phase_bits,
+        phase_step(-0.25), out.data(), out.size(), Interpolation::Cubic);
+      for (int i = 0; i < 36; i++) {
+        REQUIRE(out[i][2] == Approx(10 - i * 0.25));
+      }
+    }
+
+    SECTION("Block kernel agrees with per frame wrapping") {
+      std::vector<Frame> noise(size);
+      for (auto&& f : noise) {
+        f.fill(Random::get<float>(-1.f, 1.f));
+      }
+      for (float speed : {1.37f, -2.5f, 0.3f, 5.f}) {
+        Phase start = (Phase(size - 50) << phase_bits) + 12345;
+        Phase step = phase_step(speed);
+        varispeed_read(noise.data(), size, start, step, out.data(), out.size(),
+          Interpolation::Linear);
+        for (int i = 0; i < 256; i++) {
+          Phase p = start + i * step;
+          auto idx = phase_frames(p);
+          float t = phase_fract(p);
+          float a = noise[idx & (size - 1)][0];
+          float b = noise[(idx + 1) & (size - 1)][0];
+          REQUIRE(out[i][0] == Approx(a + (b - a) * t).margin(1e-5));
+        }
+      }
+    }
+  }
+
+  TEST_CASE("Varispeed mix", "[varispeed] [util]") {
+    std::vector<Frame> ring(size, Frame{{0, 0, 0, 0}});
+    std::vector<float> src(128);
+    for (int i = 0; i < 128; i++) src[i] = i;
+
+    SECTION("Unity speed adds into one channel across the wrap point") {
+      varispeed_mix(ring.data(), size, size - 64, 128, src.data(), 128,
+        phase_one, 2, 0.5f);
+      for (int i = 0; i < 128; i++) {
+        auto& f = ring[(size - 64 + i) % size];
+        REQUIRE(f[2] == Approx(i * 0.5f));
+        REQUIRE(f[0] == 0);
+      }
+    }
+
+    SECTION("Double speed writes half as many frames") {
+      varispeed_mix(ring.data(), size, 0, 64, src.data(), 128,
+        phase_step(2), 0, 1.f);
+      for (int i = 0; i < 64; i++) {
+        REQUIRE(ring[i][0] == Approx(2 * i));
+      }
+      REQUIRE(ring[64][0] == 0);
+    }
+  }
+
+  TEST_CASE("Varispeed on a single track", "[varispeed] [util]") {
+    std::vector<float> ring(size);
+    for (std::size_t i = 0; i < size; i++) ring[i] = float(i);
+
+    SECTION("Reads interpolate and wrap like whole frames") {
+      std::vector<float> out(256);
+      varispeed_read(ring.data(), size, Phase(size - 50) << phase_bits,
+        phase_step(0.5), out.data(), out.size(), Interpolation::Linear);
+      for (int i = 0; i < 98; i++) {
+        REQUIRE(out[i] == Approx(size - 50 + i * 0.5));
+      }
+      REQUIRE(out[100] == Approx(0));
+    }
+
+    SECTION("Mixing adds to the track") {
+      std::vector<float> src(64, 1.f);
+      varispeed_mix(ring.data(), size, size - 32, 64, src.data(), 64,
+        phase_one, 2.f);
+      for (int i = 0; i < 64; i++) {
+        auto p = (size - 32 + i) % size;
+        REQUIRE(ring[p] == float(p) + 2.f);
+      }
+      REQUIRE(ring[32] == 32.f);
+    }
+  }
+
+  TEST_CASE("Varispeed from planar rings", "[varispeed] [util]") {
+    using Wide = std::array<float, 8>;
+    std::vector<Wide> frames(size);
+    std::array<std::vector<float>, 8> planes;
+    for (auto&& p : planes) p.resize(size);
+    for (std::size_t i = 0; i < size; i++) {
+      for (int c = 0; c < 8; c++) {
+        frames[i][c] = planes[c][i] = Random::get<float>(-1.0, 1.0);
+      }
+    }
+    std::array<const float*, 8> rings;
+    for (int c = 0; c < 8; c++) rings[c] = planes[c].data();
+
+    /// Reads from the planes must match reads from the interleaved frames
+    auto check = [&] (Phase start, float speed, Interpolation interp) {
+      std::vector<Wide> expected(300), out(300);
+      varispeed_read(frames.data(), size, start, phase_step(speed),
+        expected.data(), expected.size(), interp);
+      varispeed_read(rings, size, start, phase_step(speed),
+        out.data(), out.size(), interp);
+      for (int i = 0; i < 300; i++) {
+        for (int c = 0; c < 8; c++) {
+          REQUIRE(out[i][c] == Approx(expected[i][c]).margin(1e-6));
+        }
+      }
+    };
+
+    SECTION("Unity speed") {
+      check(Phase(size - 100) << phase_bits, 1.f, Interpolation::Linear);
+      check(Phase(100) << phase_bits, -1.f, Interpolation::Linear);
+    }
+
+    SECTION("Interpolated, across the wrap point") {
+      for (auto interp : {Interpolation::None, Interpolation::Linear, Interpolation::Cubic}) {
+        check((Phase(size - 80) << phase_bits) + 12345, 0.7f, interp);
+        check((Phase(60) << phase_bits) + 98765, -1.3f, interp);
+      }
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#include "../testing.t.hpp"
+
+#include <thread>
+
+#include "util/worker-pool.hpp"
+
+namespace otto::util {
+
+  TEST_CASE("Worker pool", "[worker-pool] [util]") {
+
+    SECTION("Every task runs once per call") {
+      worker_pool pool {{3}};
+      REQUIRE(pool.workers() == 3);
+      std::array<std::atomic_int, 4> runs = {};
+      for (int round = 0; round < 1000; round++) {
+        pool.run(
+          [&] { runs[0]++; },
+          [&] { runs[1]++; },
+          [&] { runs[2]++; },
+          [&] { runs[3]++; });
+        REQUIRE(runs[3] == round + 1);
+      }
+      for (auto&& r : runs) REQUIRE(r == 1000);
+    }
+
+    SECTION("Tasks run at the same time") {
+      worker_pool pool {{1}};
+      std::atomic_int arrived {0};
+      auto meet = [&] {
+        arrived++;
+        while (arrived < 2) std::this_thread::yield();
+      };
+      pool.run(meet, meet);
+      REQUIRE(arrived == 2);
+    }
+
+    SECTION("Sleeping workers are woken") {
+      worker_pool pool {{2, 0, std::chrono::microseconds(0)}};
+      int a = 0, b = 0;
+      for (int round = 0; round < 100; round++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        pool.run([&] { a++; }, [&] { b++; });
+      }
+      REQUIRE(a == 100);
+      REQUIRE(b == 100);
+    }
+
+    SECTION("Without workers, tasks run in order on the calling thread") {
+      worker_pool pool {{0}};
+      REQUIRE(pool.workers() == 0);
+      auto self = std::this_thread::get_id();
+      std::vector<int> order;
+      pool.run(
+        [&] { order.push_back(1); REQUIRE(std::this_thread::get_id() == self); },
+        [&] { order.push_back(2); });
+      REQUIRE(order == (std::vector<int>{1, 2}));
+    }
+  }
+}